@@ -0,0 +1,201 @@
+/*
+ * socket.cpp
+ *
+ * This file provides TCP socket send()/recv() and connect() to other modules
+ * or layers.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <cerrno>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/time.h>
+#include "socket.h"
+
+/************ BaseSocket *************/
+BaseSocket::BaseSocket(int socketId)
+  : _socketId(socketId)
+{
+}
+
+BaseSocket::BaseSocket(BaseSocket &&move) noexcept
+  : _socketId(move._socketId)
+{
+  move._socketId = INVALID_SOCKET_ID;
+}
+
+BaseSocket& BaseSocket::operator=(BaseSocket &&move) noexcept
+{
+  if (this != &move) {
+    Close();
+    _socketId = move._socketId;
+    move._socketId = INVALID_SOCKET_ID;
+  }
+  return *this;
+}
+
+BaseSocket::~BaseSocket()
+{
+  Close();
+}
+
+RC BaseSocket::Close ()
+{
+  if (_socketId == INVALID_SOCKET_ID)
+    return SUCCESS;
+
+  ::close(_socketId);
+  _socketId = INVALID_SOCKET_ID;
+  return SUCCESS;
+}
+
+void BaseSocket::Reset (int socketId)
+{
+  Close();
+  _socketId = socketId;
+}
+
+/************ DataSocket *************/
+DataSocket::DataSocket(int socketId)
+  : BaseSocket(socketId)
+{
+}
+
+RC DataSocket::GetMessage (std::string &message)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  if (!_buffer.empty()) {
+    message += _buffer;
+    _buffer.clear();
+    return SUCCESS;
+  }
+  return Receive(message);
+}
+
+RC DataSocket::Receive (std::string &message)
+{
+  char chunk[RECV_CHUNK_SIZE];
+  while (true) {
+    ssize_t got = recv(GetSocketId(), chunk, sizeof(chunk), 0);
+    if (got > 0) {
+      message.append(chunk, got);
+      return SUCCESS;
+    }
+    if (got == 0)
+      return SOCKET_CLOSED;
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return SOCKET_TIMEOUT;
+    return SOCKET_RECV_ERROR;
+  }
+}
+
+RC DataSocket::GetLine (std::string &line)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  size_t from = 0;
+  while (true) {
+    size_t found = _buffer.find("\r\n", from);
+    if (found != std::string::npos) {
+      line.assign(_buffer, 0, found);
+      _buffer.erase(0, found + 2);
+      return SUCCESS;
+    }
+    if (_buffer.size() >= LINE_MAX_LENGTH)
+      return SOCKET_LINE_TOO_LONG;
+
+    // A CRLF may start on the last byte already buffered
+    from = _buffer.empty() ? 0 : _buffer.size() - 1;
+    RC rc = Receive(_buffer);
+    if (rc)
+      return rc;
+  }
+}
+
+RC DataSocket::PutMessage (const std::string &message)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  size_t sent = 0;
+  while (sent < message.size()) {
+    ssize_t put = send(GetSocketId(), message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+    if (put == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return SOCKET_TIMEOUT;
+      return SOCKET_SEND_ERROR;
+    }
+    sent += put;
+  }
+  return SUCCESS;
+}
+
+bool DataSocket::IsAlive ()
+{
+  if (!IsValid() || !_buffer.empty())
+    return false;
+
+  // Readable on an idle session means EOF, an error or an unasked reply
+  struct pollfd poller = {};
+  poller.fd     = GetSocketId();
+  poller.events = POLLIN;
+  return poll(&poller, 1, 0) == 0;
+}
+
+/************ ConnectSocket *************/
+ConnectSocket::ConnectSocket()
+  : DataSocket(INVALID_SOCKET_ID)
+{
+}
+
+RC ConnectSocket::Connect (const std::string &host, int port)
+{
+  struct addrinfo hints = {};
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses = NULL;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses))
+    return SOCKET_RESOLVE_ERROR;
+
+  RC rc = SOCKET_CONNECT_ERROR;
+  struct timeval timeout = {};
+  timeout.tv_sec  = SOCKET_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (SOCKET_TIMEOUT_MS % 1000) * 1000;
+
+  for (struct addrinfo *address = addresses; address; address = address->ai_next) {
+    int socketId = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+    if (socketId == INVALID_SOCKET_ID) {
+      rc = SOCKET_CREATE_ERROR;
+      continue;
+    }
+    Reset(socketId);
+
+    // Linux applies SO_SNDTIMEO to connect() as well
+    if (setsockopt(socketId, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ||
+        setsockopt(socketId, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) {
+      rc = SOCKET_OPTION_ERROR;
+      continue;
+    }
+    if (connect(socketId, address->ai_addr, address->ai_addrlen) == 0) {
+      rc = SUCCESS;
+      break;
+    }
+    rc = SOCKET_CONNECT_ERROR;
+  }
+
+  freeaddrinfo(addresses);
+  if (rc)
+    Close();
+  _buffer.clear();
+  return rc;
+}
@@ -0,0 +1,173 @@
+#ifndef TCP_SOCKET
+#define TCP_SOCKET
+
+/* ----- Include libries or files ----- */
+#include <string>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+
+/* ----- Define macros ----- */
+enum {
+  SOCKET_CREATE_ERROR = 301,
+  SOCKET_OPTION_ERROR,
+  SOCKET_RESOLVE_ERROR,
+  SOCKET_CONNECT_ERROR,
+  SOCKET_SEND_ERROR,
+  SOCKET_RECV_ERROR,
+  SOCKET_CLOSED,
+  SOCKET_TIMEOUT,
+  SOCKET_INVALID,
+  SOCKET_LINE_TOO_LONG,
+};
+
+#define INVALID_SOCKET_ID -1
+#define RECV_CHUNK_SIZE   4096
+#define LINE_MAX_LENGTH   1000  // RFC 5321 4.5.3.1.6, including the CRLF
+#define SOCKET_TIMEOUT_MS 30000 // Connect, send and recv give up after it
+#define SMTP_PORT         25
+#define POP3_PORT         110
+
+/**
+ * BaseSocket
+ * This class owns a socket id and closes it when the object goes away. It can
+ * be moved but never copied, so one socket id always has exactly one owner.
+ *
+ * Contained Public Functions:
+ *   int  GetSocketId ()
+ *   bool IsValid     ()
+ *   RC   Close       ()
+ */
+class BaseSocket
+{
+public:
+  BaseSocket(BaseSocket &&move) noexcept;
+  BaseSocket& operator=(BaseSocket &&move) noexcept;
+  BaseSocket(const BaseSocket &) = delete;
+  BaseSocket& operator=(const BaseSocket &) = delete;
+  virtual ~BaseSocket();
+
+  /**
+   * This function will return the socket id held by this object.
+   * @return int as the socket id, INVALID_SOCKET_ID if not valid.
+   */
+  int  GetSocketId () const { return _socketId; };
+
+  /**
+   * This function will tell if this object holds an open socket.
+   * @return true if the socket id is valid.
+   */
+  bool IsValid     () const { return _socketId != INVALID_SOCKET_ID; };
+
+  /**
+   * This function will close the socket id and invalidate this object.
+   * @return SUCCESS if closed or already closed.
+   */
+  RC   Close       ();
+
+protected:
+  explicit BaseSocket(int socketId);
+
+  /**
+   * This function will close the current socket id and take over the new one.
+   * @param  int given as the new socket id.
+   */
+  void Reset (int socketId);
+
+private:
+  int _socketId;    // Socket id, INVALID_SOCKET_ID once closed or moved
+};
+
+/**
+ * DataSocket
+ * This class handles all the message data send() and recv() on a connected
+ * blocking socket. Received bytes are buffered, so GetLine() reads a whole
+ * reply with as few recv() calls as the server needs packets.
+ *
+ * Contained Public Functions:
+ *   RC GetMessage (std::string &message)
+ *   RC GetLine    (std::string &line)
+ *   RC PutMessage (const std::string &message)
+ *   bool IsAlive  ()
+ */
+class DataSocket : public BaseSocket
+{
+public:
+  explicit DataSocket(int socketId);
+
+  /**
+   * This function will receive the bytes available, waiting for at least one,
+   * and append them to the given string. Buffered bytes are returned first.
+   * @param  string stores the received message.
+   * @return SUCCESS if some bytes have been received.
+   *         SOCKET_CLOSED if the peer closed the connection.
+   *         SOCKET_TIMEOUT if nothing came within SOCKET_TIMEOUT_MS.
+   *         SOCKET_RECV_ERROR otherwise.
+   */
+  RC GetMessage (std::string &message);
+
+  /**
+   * This function will return the next line without its CRLF.
+   * @param  string stores the line.
+   * @return SUCCESS if a complete line has been received.
+   *         SOCKET_LINE_TOO_LONG if LINE_MAX_LENGTH bytes come without a CRLF.
+   *         pre-defined error number returned by GetMessage() otherwise.
+   */
+  RC GetLine    (std::string &line);
+
+  /**
+   * This function will send the whole message through the socket.
+   * @param  const string given as the message.
+   * @return SUCCESS if the whole message has been sent.
+   *         SOCKET_TIMEOUT or SOCKET_SEND_ERROR otherwise.
+   */
+  RC PutMessage (const std::string &message);
+
+  /**
+   * This function will check without blocking that the peer has not closed
+   * the connection and sent nothing unasked.
+   * @return true if the connection looks usable.
+   */
+  bool IsAlive  ();
+
+protected:
+  std::string _buffer;    // Received bytes not returned yet
+
+private:
+  /**
+   * This function will recv() once and append what came to the string.
+   * @param  string stores the received bytes.
+   * @return same as GetMessage().
+   */
+  RC Receive (std::string &message);
+};
+
+/**
+ * ConnectSocket
+ * This class connects to a server. Connect, send and recv time out after
+ * SOCKET_TIMEOUT_MS so a dead server cannot hang the client.
+ *
+ * Contained Public Functions:
+ *   RC Connect (const std::string &host, int port)
+ */
+class ConnectSocket : public DataSocket
+{
+public:
+  ConnectSocket();
+
+  /**
+   * This function will resolve the host and connect to the first address that
+   * accepts the connection.
+   * @param  const string given as the host name or address.
+   *         int given as the port.
+   * @return SUCCESS if connected.
+   *         SOCKET_RESOLVE_ERROR, SOCKET_CREATE_ERROR or SOCKET_CONNECT_ERROR
+   *         otherwise.
+   */
+  RC Connect (const std::string &host, int port);
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * unit_test_socket.cpp
+ *
+ * This file provides unit test for socket.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <iostream>
+#include <thread>
+#include "unit_test_socket.h"
+using namespace std;
+
+static int ListenLocal (int port)
+{
+  int socketId = socket(AF_INET, SOCK_STREAM, 0);
+  int enable = 1;
+  setsockopt(socketId, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  struct sockaddr_in address = {};
+  address.sin_family      = AF_INET;
+  address.sin_port        = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(socketId, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) || listen(socketId, 4)) {
+    close(socketId);
+    return INVALID_SOCKET_ID;
+  }
+  return socketId;
+}
+
+static RC TestConnectLine ()
+{
+  int listenId = ListenLocal(TEST_PORT);
+  if (listenId == INVALID_SOCKET_ID)
+    return STANDARD_ERROR;
+
+  // The server sends a reply in two pieces, waits for one line, then closes
+  thread server([listenId] {
+    int peer = accept(listenId, NULL, NULL);
+    send(peer, "220 ready\r\n250-first", 20, 0);
+    usleep(10000);
+    send(peer, "\r\n250 last\r\n", 12, 0);
+    char buffer[64];
+    recv(peer, buffer, sizeof(buffer), 0);
+    close(peer);
+  });
+
+  ConnectSocket client;
+  RC rc = client.Connect("localhost", TEST_PORT);
+  string line, lines;
+  for (int i = 0; rc == SUCCESS && i < 3; ++i) {
+    rc = client.GetLine(line);
+    lines += line + "|";
+  }
+  bool alive = client.IsAlive();
+  client.PutMessage("QUIT\r\n");
+  server.join();
+  close(listenId);
+  usleep(10000);
+
+  if (rc || lines != "220 ready|250-first|250 last|" || !alive)
+    return STANDARD_ERROR;
+  // Closed by the peer while idle
+  return client.IsAlive() ? STANDARD_ERROR : SUCCESS;
+}
+
+static RC TestConnectRefused ()
+{
+  ConnectSocket client;
+  return client.Connect("127.0.0.1", TEST_PORT) == SOCKET_CONNECT_ERROR ? SUCCESS : STANDARD_ERROR;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  result = TestConnectLine();
+  cout << "TestConnectLine: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestConnectRefused();
+  cout << "TestConnectRefused: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  return (rc);
+}
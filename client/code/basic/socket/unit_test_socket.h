@@ -0,0 +1,19 @@
+/*
+ * unit_test_socket.h
+ *
+ * This file provides unit test for socket.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include <arpa/inet.h>
+#include "socket.h"
+
+#define TEST_PORT 20030
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * pm.cpp
+ *
+ * This file provides the client side SMTP and POP3 sessions and the pool that
+ * keeps them open between uses.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <cstdio>
+#include "pm.h"
+
+namespace {
+
+// RFC 4648 base64, for AUTH PLAIN
+std::string Base64 (const std::string &input)
+{
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string output;
+  size_t i = 0;
+  for (; i + 2 < input.size(); i += 3) {
+    unsigned value = static_cast<unsigned char>(input[i]) << 16 |
+                     static_cast<unsigned char>(input[i + 1]) << 8 |
+                     static_cast<unsigned char>(input[i + 2]);
+    output += table[value >> 18];
+    output += table[(value >> 12) & 63];
+    output += table[(value >> 6) & 63];
+    output += table[value & 63];
+  }
+  if (i < input.size()) {
+    unsigned value = static_cast<unsigned char>(input[i]) << 16;
+    if (i + 1 < input.size())
+      value |= static_cast<unsigned char>(input[i + 1]) << 8;
+    output += table[value >> 18];
+    output += table[(value >> 12) & 63];
+    output += i + 1 < input.size() ? table[(value >> 6) & 63] : '=';
+    output += '=';
+  }
+  return output;
+}
+
+// Lines starting with '.' get one more '.', the message ends with a CRLF
+std::string DotStuff (const std::string &message)
+{
+  std::string stuffed;
+  stuffed.reserve(message.size() + message.size() / 64 + 2);
+  bool lineStart = true;
+  for (char c : message) {
+    if (lineStart && c == '.')
+      stuffed += '.';
+    stuffed += c;
+    lineStart = c == '\n';
+  }
+  if (!lineStart)
+    stuffed += "\r\n";
+  return stuffed;
+}
+
+} // namespace
+
+/************ ClientSession *************/
+RC ClientSession::PutMessage (const std::string &message)
+{
+  RC rc = _socket.PutMessage(message);
+  if (rc)
+    _broken = true;
+  return rc;
+}
+
+RC ClientSession::GetLine (std::string &line)
+{
+  RC rc = _socket.GetLine(line);
+  if (rc)
+    _broken = true;
+  return rc;
+}
+
+RC ClientSession::ReadReply (std::string &reply, bool multiLine)
+{
+  RC rc;
+  std::string line;
+  reply.clear();
+
+  // "250-first line" goes on, "250 last line" ends an SMTP reply
+  do {
+    if ((rc = GetLine(line)))
+      return rc;
+    if (!reply.empty())
+      reply += "\r\n";
+    reply += line;
+  } while (multiLine && line.size() > 3 && line[3] == '-');
+  return SUCCESS;
+}
+
+/************ SmtpClient *************/
+SmtpClient::SmtpClient()
+  : _pipelining(false),
+    _dirty(false)
+{
+}
+
+RC SmtpClient::Open (const ServerAccount &server)
+{
+  RC rc;
+  std::string reply;
+
+  if ((rc = _socket.Connect(server.host, server.port)))
+    return rc;
+  if ((rc = ReadReply(reply, true)))
+    return rc;
+  if (reply[0] != '2')
+    return PM_REPLY_ERROR;
+
+  if ((rc = PutMessage("EHLO localhost\r\n")) || (rc = ReadReply(reply, true)))
+    return rc;
+  if (reply[0] != '2')
+    return PM_REPLY_ERROR;
+  _pipelining = reply.find("PIPELINING") != std::string::npos;
+
+  if (!server.account.empty()) {
+    if (reply.find("AUTH") == std::string::npos)
+      return PM_AUTH_FAILED;
+    std::string token = Base64(std::string(1, '\0') + server.account + '\0' + server.password);
+    if ((rc = PutMessage("AUTH PLAIN " + token + "\r\n")) || (rc = ReadReply(reply, true)))
+      return rc;
+    if (reply[0] != '2')
+      return PM_AUTH_FAILED;
+  }
+  return SUCCESS;
+}
+
+RC SmtpClient::Check ()
+{
+  return Expect("NOOP\r\n", '2');
+}
+
+RC SmtpClient::Recycle ()
+{
+  if (_broken)
+    return PM_NOT_REUSABLE;
+  // A completed transaction leaves the server reset already
+  if (!_dirty)
+    return SUCCESS;
+  if (Expect("RSET\r\n", '2'))
+    return PM_NOT_REUSABLE;
+  _dirty = false;
+  return SUCCESS;
+}
+
+void SmtpClient::Quit ()
+{
+  std::string reply;
+  if (PutMessage("QUIT\r\n") == SUCCESS)
+    ReadReply(reply, true);
+  _socket.Close();
+}
+
+RC SmtpClient::Send (const Envelope &envelope, const std::string &message)
+{
+  RC rc;
+  std::string reply;
+
+  std::vector<std::string> commands;
+  if (_dirty)
+    commands.push_back("RSET\r\n");
+  commands.push_back("MAIL FROM:<" + envelope.from + ">\r\n");
+  for (const std::string &recipient : envelope.recipients)
+    commands.push_back("RCPT TO:<" + recipient + ">\r\n");
+  commands.push_back("DATA\r\n");
+  _dirty = true;
+
+  // With PIPELINING the whole envelope goes in one send, replies follow in order
+  if (_pipelining) {
+    std::string batch;
+    for (const std::string &command : commands)
+      batch += command;
+    if ((rc = PutMessage(batch)))
+      return rc;
+  }
+
+  bool refused  = false;   // Some command before DATA has been refused
+  bool dataReady = false;   // DATA got 354
+  for (const std::string &command : commands) {
+    if (!_pipelining && (rc = PutMessage(command)))
+      return rc;
+    if ((rc = ReadReply(reply, true)))
+      return rc;
+    if (command[0] == 'D') {
+      dataReady = reply[0] == '3';
+    } else if (reply[0] != '2') {
+      refused = true;
+      // Without pipelining there is no point sending the rest
+      if (!_pipelining)
+        return PM_REPLY_ERROR;
+    }
+  }
+  // The server refused DATA, no recipient was accepted: RSET before the next
+  if (!dataReady)
+    return PM_REPLY_ERROR;
+
+  if ((rc = PutMessage(DotStuff(message) + ".\r\n")) || (rc = ReadReply(reply, true)))
+    return rc;
+  _dirty = false;
+  return (reply[0] != '2' || refused) ? PM_REPLY_ERROR : SUCCESS;
+}
+
+RC SmtpClient::Expect (const std::string &command, char code)
+{
+  RC rc;
+  std::string reply;
+  if ((rc = PutMessage(command)) || (rc = ReadReply(reply, true)))
+    return rc;
+  return reply[0] == code ? SUCCESS : PM_REPLY_ERROR;
+}
+
+/************ Pop3Client *************/
+Pop3Client::Pop3Client()
+  : _deleted(false)
+{
+}
+
+RC Pop3Client::Open (const ServerAccount &server)
+{
+  RC rc;
+  std::string reply;
+
+  if ((rc = _socket.Connect(server.host, server.port)))
+    return rc;
+  if ((rc = ReadReply(reply, false)))
+    return rc;
+  if (reply.compare(0, 3, "+OK"))
+    return PM_REPLY_ERROR;
+
+  if ((rc = Expect("USER " + server.account + "\r\n", reply)))
+    return rc == PM_REPLY_ERROR ? PM_AUTH_FAILED : rc;
+  if ((rc = Expect("PASS " + server.password + "\r\n", reply)))
+    return rc == PM_REPLY_ERROR ? PM_AUTH_FAILED : rc;
+  _opened = std::chrono::steady_clock::now();
+  return SUCCESS;
+}
+
+RC Pop3Client::Check ()
+{
+  std::string reply;
+  return Expect("NOOP\r\n", reply);
+}
+
+RC Pop3Client::Recycle ()
+{
+  // Deletions only happen at QUIT, and the maildrop is a snapshot taken at login
+  if (_broken || _deleted || std::chrono::steady_clock::now() - _opened > std::chrono::seconds(POP3_MAX_AGE))
+    return PM_NOT_REUSABLE;
+  return SUCCESS;
+}
+
+void Pop3Client::Quit ()
+{
+  std::string reply;
+  if (PutMessage("QUIT\r\n") == SUCCESS)
+    ReadReply(reply, false);
+  _socket.Close();
+}
+
+RC Pop3Client::Stat (size_t &number, size_t &size)
+{
+  RC rc;
+  std::string reply;
+  if ((rc = Expect("STAT\r\n", reply)))
+    return rc;
+
+  unsigned long count, octets;
+  if (sscanf(reply.c_str(), "+OK %lu %lu", &count, &octets) != 2)
+    return PM_REPLY_ERROR;
+  number = count;
+  size   = octets;
+  return SUCCESS;
+}
+
+RC Pop3Client::Retrieve (size_t number, std::string &message)
+{
+  RC rc;
+  std::string reply;
+  if ((rc = Expect("RETR " + std::to_string(number) + "\r\n", reply)))
+    return rc == PM_REPLY_ERROR ? PM_NO_SUCH_MESSAGE : rc;
+
+  // Multi-line response up to a lone ".", dot-stuffing removed
+  message.clear();
+  std::string line;
+  while ((rc = GetLine(line)) == SUCCESS) {
+    if (line == ".")
+      return SUCCESS;
+    if (!line.empty() && line[0] == '.')
+      message.append(line, 1, std::string::npos);
+    else
+      message += line;
+    message += "\r\n";
+  }
+  return rc;
+}
+
+RC Pop3Client::Delete (size_t number)
+{
+  RC rc;
+  std::string reply;
+  if ((rc = Expect("DELE " + std::to_string(number) + "\r\n", reply)))
+    return rc == PM_REPLY_ERROR ? PM_NO_SUCH_MESSAGE : rc;
+  _deleted = true;
+  return SUCCESS;
+}
+
+RC Pop3Client::Expect (const std::string &command, std::string &reply)
+{
+  RC rc;
+  if ((rc = PutMessage(command)) || (rc = ReadReply(reply, false)))
+    return rc;
+  return reply.compare(0, 3, "+OK") ? PM_REPLY_ERROR : SUCCESS;
+}
+
+/************ SessionPool *************/
+SessionPool::SessionPool(size_t idleNumber, int idleTimeout, int checkAfter)
+  : _idleNumber(idleNumber),
+    _idleTimeout(std::chrono::seconds(idleTimeout)),
+    _checkAfter(std::chrono::seconds(checkAfter)),
+    _openNumber(0),
+    _reuseNumber(0)
+{
+}
+
+SessionPool::~SessionPool()
+{
+  for (auto &entry : _idle) {
+    for (IdleSession &idle : entry.second)
+      idle.session->Quit();
+  }
+}
+
+void SessionPool::Expire ()
+{
+  std::vector<std::unique_ptr<ClientSession>> expired;
+  Clock::time_point now = Clock::now();
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    for (auto &entry : _idle) {
+      std::vector<IdleSession> &sessions = entry.second;
+      // Oldest first, stop at the first one still fresh
+      size_t stale = 0;
+      while (stale < sessions.size() && now - sessions[stale].released > _idleTimeout)
+        ++stale;
+      for (size_t i = 0; i < stale; ++i)
+        expired.push_back(std::move(sessions[i].session));
+      sessions.erase(sessions.begin(), sessions.begin() + stale);
+    }
+  }
+
+  // Network round trips outside the lock
+  for (std::unique_ptr<ClientSession> &session : expired)
+    session->Quit();
+}
+
+size_t SessionPool::GetIdleNumber ()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  size_t number = 0;
+  for (auto &entry : _idle)
+    number += entry.second.size();
+  return number;
+}
+
+/************ Helper Functions *************/
+RC SessionPool::Take (const char *kind, const ServerAccount &server, std::unique_ptr<ClientSession> &session,
+                      ClientSession *(*create)())
+{
+  Expire();
+  std::string key = MakeKey(kind, server);
+
+  while (true) {
+    IdleSession idle;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      auto found = _idle.find(key);
+      if (found == _idle.end() || found->second.empty())
+        break;
+      idle = std::move(found->second.back());
+      found->second.pop_back();
+    }
+
+    // A closed connection shows at once, a silent one only to NOOP
+    bool usable = idle.session->IsAlive();
+    if (usable && Clock::now() - idle.released > _checkAfter)
+      usable = idle.session->Check() == SUCCESS;
+    if (usable) {
+      session = std::move(idle.session);
+      std::lock_guard<std::mutex> lock(_lock);
+      ++_reuseNumber;
+      return SUCCESS;
+    }
+  }
+
+  session.reset(create());
+  RC rc = session->Open(server);
+  if (rc) {
+    session.reset();
+    return rc;
+  }
+  std::lock_guard<std::mutex> lock(_lock);
+  ++_openNumber;
+  return SUCCESS;
+}
+
+void SessionPool::Give (const char *kind, const ServerAccount &server, std::unique_ptr<ClientSession> session)
+{
+  if (!session)
+    return;
+  if (!session->IsAlive() || session->Recycle()) {
+    session->Quit();
+    return;
+  }
+
+  std::unique_ptr<ClientSession> extra;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    std::vector<IdleSession> &sessions = _idle[MakeKey(kind, server)];
+    sessions.push_back(IdleSession{std::move(session), Clock::now()});
+    if (sessions.size() > _idleNumber) {
+      extra = std::move(sessions.front().session);
+      sessions.erase(sessions.begin());
+    }
+  }
+  if (extra)
+    extra->Quit();
+}
+
+std::string SessionPool::MakeKey (const char *kind, const ServerAccount &server)
+{
+  return std::string(kind) + "://" + server.account + "@" + server.host + ":" + std::to_string(server.port);
+}
@@ -0,0 +1,308 @@
+#ifndef PROTOCOL_MANAGER
+#define PROTOCOL_MANAGER
+
+/* ----- Include libries or files ----- */
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../../basic/socket/socket.h"
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+
+/* ----- Define macros ----- */
+enum {
+  PM_REPLY_ERROR = 501,
+  PM_AUTH_FAILED,
+  PM_NOT_REUSABLE,
+  PM_NO_SUCH_MESSAGE,
+};
+
+#define POOL_IDLE_NUMBER   4      // Idle sessions kept per server and account
+#define POOL_IDLE_TIMEOUT  60     // Seconds an idle session is kept
+#define POOL_CHECK_AFTER   10     // Seconds idle after which NOOP checks a session
+#define POP3_MAX_AGE       300    // Seconds a POP3 session is reused, its view is a snapshot
+
+/* ----- Define structs ----- */
+struct ServerAccount {
+  std::string host;
+  int         port;
+  std::string account;    // Empty for SMTP without AUTH
+  std::string password;
+};
+
+struct Envelope {
+  std::string from;                     // Reverse-path, without the brackets
+  std::vector<std::string> recipients;  // Forward-paths, without the brackets
+};
+
+/**
+ * ClientSession
+ * This class holds what the SMTP and POP3 client sessions share: the
+ * connection, reading the replies and the hooks the SessionPool needs to keep
+ * a session open between uses.
+ *
+ * Contained Public Functions:
+ *   RC   Open    (const ServerAccount &server)
+ *   RC   Check   ()
+ *   RC   Recycle ()
+ *   void Quit    ()
+ *   bool IsAlive ()
+ */
+class ClientSession
+{
+public:
+  ClientSession() : _broken(false) {};
+  virtual ~ClientSession() {};
+
+  /**
+   * This function will connect, read the greeting and log in.
+   * @param  const ServerAccount given as the server and the account.
+   * @return SUCCESS if the session is ready for commands.
+   *         PM_AUTH_FAILED if the server refused the account.
+   *         PM_REPLY_ERROR or pre-defined socket error number otherwise.
+   */
+  virtual RC Open    (const ServerAccount &server) = 0;
+
+  /**
+   * This function will make sure the server still answers (NOOP).
+   * @return SUCCESS if it does.
+   */
+  virtual RC Check   () = 0;
+
+  /**
+   * This function will bring the session back to a state in which the next
+   * user may start over. A broken session never is.
+   * @return SUCCESS if the session may be reused.
+   *         PM_NOT_REUSABLE if it has to be closed.
+   */
+  virtual RC Recycle () = 0;
+
+  /**
+   * This function will end the session politely and close the connection.
+   */
+  virtual void Quit  () = 0;
+
+  /**
+   * This function will check without blocking that the connection is usable.
+   * @return true if it is and no socket error broke the session.
+   */
+  bool IsAlive () { return !_broken && _socket.IsAlive(); };
+
+protected:
+  ConnectSocket _socket;
+  bool _broken;             // A socket error left a reply unread or a command half sent
+
+  /**
+   * This function will send through the socket, and mark the session broken
+   * if it fails.
+   * @return same as ConnectSocket::PutMessage().
+   */
+  RC PutMessage (const std::string &message);
+
+  /**
+   * This function will read one line from the socket, and mark the session
+   * broken if it fails: a reply that timed out may still come and would be
+   * taken for the reply of the next command.
+   * @return same as ConnectSocket::GetLine().
+   */
+  RC GetLine (std::string &line);
+
+  /**
+   * This function will read one reply, joining the lines of a multi-line
+   * SMTP reply.
+   * @param  string stores the reply, lines separated by CRLF.
+   * @return SUCCESS if a complete reply has been read.
+   *         pre-defined socket error number otherwise.
+   */
+  RC ReadReply (std::string &reply, bool multiLine);
+};
+
+/**
+ * SmtpClient
+ * This class runs the client side of an SMTP session (RFC 5321). It uses
+ * PIPELINING (RFC 2920) when the server offers it, so MAIL, RCPT and DATA cost
+ * one round trip, and AUTH PLAIN (RFC 4954) when an account is given.
+ *
+ * Contained Public Functions:
+ *   RC Send (const Envelope &envelope, const std::string &message)
+ */
+class SmtpClient : public ClientSession
+{
+public:
+  static constexpr const char *KIND = "smtp";
+
+  SmtpClient();
+
+  RC   Open    (const ServerAccount &server) override;
+  RC   Check   () override;
+  RC   Recycle () override;
+  void Quit    () override;
+
+  /**
+   * This function will send one message.
+   * @param  const Envelope given as the sender and the recipients.
+   *         const string given as the message, without dot-stuffing.
+   * @return SUCCESS if the server accepted the message for every recipient.
+   *         PM_REPLY_ERROR if it refused the message or some recipient.
+   *         pre-defined socket error number otherwise.
+   */
+  RC Send (const Envelope &envelope, const std::string &message);
+
+private:
+  bool _pipelining;   // Server offers PIPELINING
+  bool _dirty;        // A transaction did not end cleanly, RSET before the next
+
+  // Private helper functions
+  RC Expect (const std::string &command, char code);
+};
+
+/**
+ * Pop3Client
+ * This class runs the client side of a POP3 session (RFC 1939).
+ *
+ * Contained Public Functions:
+ *   RC Stat     (size_t &number, size_t &size)
+ *   RC Retrieve (size_t number, std::string &message)
+ *   RC Delete   (size_t number)
+ */
+class Pop3Client : public ClientSession
+{
+public:
+  static constexpr const char *KIND = "pop3";
+
+  Pop3Client();
+
+  RC   Open    (const ServerAccount &server) override;
+  RC   Check   () override;
+  RC   Recycle () override;
+  void Quit    () override;
+
+  /**
+   * This function will ask for the number and total size of the messages.
+   * @param  size_t stores the number of messages.
+   *         size_t stores the total size in octets.
+   * @return SUCCESS if the server answered.
+   */
+  RC Stat     (size_t &number, size_t &size);
+
+  /**
+   * This function will download one message.
+   * @param  size_t given as the POP3 message number, ONE based.
+   *         string stores the message, dot-stuffing removed.
+   * @return SUCCESS if the message has been received.
+   *         PM_NO_SUCH_MESSAGE if the server refused the number.
+   */
+  RC Retrieve (size_t number, std::string &message);
+
+  /**
+   * This function will mark one message for deletion. The server removes it
+   * when the session ends, so a session with deletions is not reused.
+   * @param  size_t given as the POP3 message number, ONE based.
+   * @return SUCCESS if the message has been marked.
+   *         PM_NO_SUCH_MESSAGE if the server refused the number.
+   */
+  RC Delete   (size_t number);
+
+private:
+  bool _deleted;                                      // DELE has been sent
+  std::chrono::steady_clock::time_point _opened;      // When PASS succeeded
+
+  // Private helper functions
+  RC Expect (const std::string &command, std::string &reply);
+};
+
+/**
+ * SessionPool
+ * This class keeps logged in SMTP and POP3 sessions open between uses, keyed
+ * by protocol, server and account, so bulk senders and pollers stop paying
+ * for connect, greeting and login on every message.
+ *
+ * Acquire() hands out the most recently used idle session. Sessions idle for
+ * longer than POOL_IDLE_TIMEOUT are closed, sessions idle for more than
+ * POOL_CHECK_AFTER are checked with NOOP first, and every session is checked
+ * for a closed connection before it is handed out. Release() recycles a
+ * session (RSET for SMTP after a failed transaction) and keeps up to
+ * POOL_IDLE_NUMBER of them per key. Safe to use from several threads.
+ *
+ * Contained Public Functions:
+ *   RC   Acquire (const ServerAccount &server, std::unique_ptr<Session> &session)
+ *   void Release (const ServerAccount &server, std::unique_ptr<Session> session)
+ *   void Expire  ()
+ *   size_t GetIdleNumber ()
+ */
+class SessionPool
+{
+public:
+  SessionPool(size_t idleNumber = POOL_IDLE_NUMBER, int idleTimeout = POOL_IDLE_TIMEOUT,
+              int checkAfter = POOL_CHECK_AFTER);
+  ~SessionPool();
+
+  /**
+   * This function will hand out an open session, opening a new one if no idle
+   * session passes the checks.
+   * @param  const ServerAccount given as the server and the account.
+   *         unique_ptr stores the session.
+   * @return SUCCESS if the session is ready.
+   *         pre-defined error number returned by Open() otherwise.
+   */
+  template <class Session>
+  RC Acquire (const ServerAccount &server, std::unique_ptr<Session> &session)
+  {
+    std::unique_ptr<ClientSession> taken;
+    RC rc = Take(Session::KIND, server, taken, []() -> ClientSession * { return new Session(); });
+    session.reset(static_cast<Session *>(taken.release()));
+    return rc;
+  }
+
+  /**
+   * This function will give a session back to the pool.
+   * @param  const ServerAccount given as what it has been acquired for.
+   *         unique_ptr given as the session.
+   */
+  template <class Session>
+  void Release (const ServerAccount &server, std::unique_ptr<Session> session)
+  {
+    Give(Session::KIND, server, std::unique_ptr<ClientSession>(session.release()));
+  }
+
+  /**
+   * This function will close every session idle for too long.
+   */
+  void Expire ();
+
+  /**
+   * This function will count the idle sessions.
+   * @return size_t as the number of idle sessions of all keys.
+   */
+  size_t GetIdleNumber ();
+
+  unsigned long GetOpenNumber  () const { return _openNumber; };
+  unsigned long GetReuseNumber () const { return _reuseNumber; };
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct IdleSession {
+    std::unique_ptr<ClientSession> session;
+    Clock::time_point released;
+  };
+
+  size_t _idleNumber;
+  Clock::duration _idleTimeout;
+  Clock::duration _checkAfter;
+  std::mutex _lock;                                     // Guards the members below
+  std::map<std::string, std::vector<IdleSession>> _idle; // By key, most recent last
+  unsigned long _openNumber;                            // Sessions opened
+  unsigned long _reuseNumber;                           // Acquires served by an idle session
+
+  // Private helper functions
+  RC   Take (const char *kind, const ServerAccount &server, std::unique_ptr<ClientSession> &session,
+             ClientSession *(*create)());
+  void Give (const char *kind, const ServerAccount &server, std::unique_ptr<ClientSession> session);
+  static std::string MakeKey (const char *kind, const ServerAccount &server);
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * unit_test_pm.cpp
+ *
+ * This file provides unit test for pm.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include "unit_test_pm.h"
+using namespace std;
+
+/**
+ * FakeServer
+ * Accepts connections on the loopback and answers the SMTP or POP3 commands
+ * the clients send, one thread per connection. Counts what it has seen.
+ */
+class FakeServer
+{
+public:
+  atomic<int> connections{0};
+  atomic<int> messages{0};
+  atomic<int> quits{0};
+  atomic<int> dataDelay{0};   // Milliseconds before the reply to a message
+
+  RC Start (int port, bool pop3)
+  {
+    _pop3     = pop3;
+    _listenId = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(_listenId, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    struct sockaddr_in address = {};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(_listenId, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) || listen(_listenId, 8))
+      return STANDARD_ERROR;
+    _acceptor = thread([this] { AcceptAll(); });
+    return SUCCESS;
+  }
+
+  void Stop ()
+  {
+    shutdown(_listenId, SHUT_RDWR);
+    _acceptor.join();
+    DropAll();
+    for (thread &peer : _peers)
+      peer.join();
+    close(_listenId);
+  }
+
+  // Closes every open connection from the server side
+  void DropAll ()
+  {
+    lock_guard<mutex> lock(_lock);
+    for (int peerId : _peerIds)
+      shutdown(peerId, SHUT_RDWR);
+  }
+
+private:
+  bool   _pop3;
+  int    _listenId;
+  thread _acceptor;
+  mutex  _lock;
+  vector<thread> _peers;
+  vector<int>    _peerIds;
+
+  void AcceptAll ()
+  {
+    int peerId;
+    while ((peerId = accept(_listenId, NULL, NULL)) != -1) {
+      ++connections;
+      lock_guard<mutex> lock(_lock);
+      _peerIds.push_back(peerId);
+      _peers.emplace_back([this, peerId] { _pop3 ? ServePop3(peerId) : ServeSmtp(peerId); });
+    }
+  }
+
+  void ServeSmtp (int peerId)
+  {
+    DataSocket peer(peerId);
+    string line;
+    peer.PutMessage("220 fake ESMTP\r\n");
+    while (peer.GetLine(line) == SUCCESS) {
+      string verb = line.substr(0, 4);
+      if (verb == "EHLO") {
+        peer.PutMessage("250-fake\r\n250-PIPELINING\r\n250 AUTH PLAIN\r\n");
+      } else if (verb == "AUTH") {
+        peer.PutMessage("235 2.7.0 Accepted\r\n");
+      } else if (verb == "RCPT") {
+        peer.PutMessage(line.find("bad@") == string::npos ? "250 OK\r\n" : "550 No such user\r\n");
+      } else if (verb == "DATA") {
+        peer.PutMessage("354 Go ahead\r\n");
+        while (peer.GetLine(line) == SUCCESS && line != ".") {}
+        ++messages;
+        this_thread::sleep_for(chrono::milliseconds(dataDelay));
+        peer.PutMessage("250 Queued\r\n");
+      } else if (verb == "QUIT") {
+        ++quits;
+        peer.PutMessage("221 Bye\r\n");
+        break;
+      } else {
+        peer.PutMessage("250 OK\r\n");
+      }
+    }
+  }
+
+  void ServePop3 (int peerId)
+  {
+    DataSocket peer(peerId);
+    string line;
+    peer.PutMessage("+OK fake POP3\r\n");
+    while (peer.GetLine(line) == SUCCESS) {
+      string verb = line.substr(0, 4);
+      if (verb == "PASS") {
+        peer.PutMessage(line == "PASS secret" ? "+OK Logged in\r\n" : "-ERR Wrong password\r\n");
+      } else if (verb == "STAT") {
+        peer.PutMessage("+OK 2 40\r\n");
+      } else if (verb == "RETR") {
+        peer.PutMessage("+OK 20 octets\r\nSubject: x\r\n\r\n..dot\r\n.\r\n");
+      } else if (verb == "QUIT") {
+        ++quits;
+        peer.PutMessage("+OK Bye\r\n");
+        break;
+      } else {
+        peer.PutMessage("+OK\r\n");
+      }
+    }
+  }
+};
+
+static RC TestSmtpReuse ()
+{
+  FakeServer server;
+  if (server.Start(SMTP_TEST_PORT, false))
+    return STANDARD_ERROR;
+
+  SessionPool pool;
+  ServerAccount account = {"127.0.0.1", SMTP_TEST_PORT, "user", "secret"};
+  Envelope envelope = {"user@fake", {"a@fake", "b@fake"}};
+  RC rc = SUCCESS;
+
+  // Three messages over one connection
+  for (int i = 0; rc == SUCCESS && i < 3; ++i) {
+    unique_ptr<SmtpClient> client;
+    if ((rc = pool.Acquire(account, client)) == SUCCESS)
+      rc = client->Send(envelope, "Subject: test\r\n\r\n.line\r\n");
+    pool.Release(account, std::move(client));
+  }
+  bool reused = pool.GetOpenNumber() == 1 && pool.GetReuseNumber() == 2 && pool.GetIdleNumber() == 1;
+
+  // A refused recipient still delivers to the others, the session stays usable
+  if (rc == SUCCESS) {
+    unique_ptr<SmtpClient> client;
+    Envelope partly = {"user@fake", {"bad@fake", "a@fake"}};
+    if ((rc = pool.Acquire(account, client)) == SUCCESS)
+      rc = client->Send(partly, "Subject: test\r\n\r\nbody\r\n") == PM_REPLY_ERROR ? SUCCESS : STANDARD_ERROR;
+    pool.Release(account, std::move(client));
+  }
+  reused = reused && pool.GetOpenNumber() == 1 && pool.GetIdleNumber() == 1;
+
+  // A session whose connection the server closed is not handed out
+  server.DropAll();
+  usleep(10000);
+  if (rc == SUCCESS) {
+    unique_ptr<SmtpClient> client;
+    if ((rc = pool.Acquire(account, client)) == SUCCESS)
+      rc = client->Send(envelope, "Subject: again\r\n\r\nbody\r\n");
+    pool.Release(account, std::move(client));
+  }
+  bool reopened = pool.GetOpenNumber() == 2;
+
+  // Leaving the pool says QUIT on the idle session
+  pool.Expire();
+  server.Stop();
+
+  if (rc || !reused || !reopened || server.connections != 2 || server.messages != 5)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// SmtpClient waiting a short time for the replies
+class HastyClient : public SmtpClient
+{
+public:
+  void Hurry (int milliseconds)
+  {
+    struct timeval timeout = { 0, milliseconds * 1000 };
+    setsockopt(_socket.GetSocketId(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+};
+
+// A session that timed out waiting for a reply is closed, not recycled
+static RC TestSmtpTimeout ()
+{
+  FakeServer server;
+  if (server.Start(SMTP_TEST_PORT, false))
+    return STANDARD_ERROR;
+  server.dataDelay = 150;
+
+  SessionPool pool;
+  ServerAccount account = {"127.0.0.1", SMTP_TEST_PORT, "user", "secret"};
+  Envelope envelope = {"user@fake", {"a@fake"}};
+
+  // The late reply to the message would come in time to pass for the reply to RSET
+  unique_ptr<HastyClient> client;
+  if (pool.Acquire(account, client))
+    return STANDARD_ERROR;
+  client->Hurry(100);
+  RC sent = client->Send(envelope, "Subject: slow\r\n\r\nbody\r\n");
+  pool.Release(account, std::move(client));
+  size_t idle = pool.GetIdleNumber();
+
+  server.dataDelay = 0;
+  RC rc = pool.Acquire(account, client);
+  if (rc == SUCCESS)
+    rc = client->Send(envelope, "Subject: fast\r\n\r\nbody\r\n");
+  pool.Release(account, std::move(client));
+  pool.Expire();
+  server.Stop();
+
+  if (sent != SOCKET_TIMEOUT || idle != 0 || rc || pool.GetOpenNumber() != 2)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+static RC TestPop3Reuse ()
+{
+  FakeServer server;
+  if (server.Start(POP3_TEST_PORT, true))
+    return STANDARD_ERROR;
+
+  SessionPool pool;
+  ServerAccount account = {"127.0.0.1", POP3_TEST_PORT, "user", "secret"};
+  RC rc;
+  size_t number = 0, size = 0;
+  string message;
+
+  unique_ptr<Pop3Client> client;
+  if ((rc = pool.Acquire(account, client)) == SUCCESS && (rc = client->Stat(number, size)) == SUCCESS)
+    rc = client->Retrieve(1, message);
+  pool.Release(account, std::move(client));
+  bool first = rc == SUCCESS && number == 2 && size == 40 && message == "Subject: x\r\n\r\n.dot\r\n";
+
+  // Reused while nothing has been deleted, not given back after DELE
+  if ((rc = pool.Acquire(account, client)) == SUCCESS)
+    rc = client->Delete(1);
+  bool reused = pool.GetReuseNumber() == 1;
+  pool.Release(account, std::move(client));
+  bool dropped = pool.GetIdleNumber() == 0;
+
+  // Wrong password fails to open
+  ServerAccount wrong = {"127.0.0.1", POP3_TEST_PORT, "user", "guess"};
+  bool refused = pool.Acquire(wrong, client) != SUCCESS && !client;
+
+  server.Stop();
+
+  if (rc || !first || !reused || !dropped || !refused || server.quits != 1)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  result = TestSmtpReuse();
+  cout << "TestSmtpReuse: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestSmtpTimeout();
+  cout << "TestSmtpTimeout: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestPop3Reuse();
+  cout << "TestPop3Reuse: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  return (rc);
+}
@@ -0,0 +1,20 @@
+/*
+ * unit_test_pm.h
+ *
+ * This file provides unit test for pm.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include <arpa/inet.h>
+#include "pm.h"
+
+#define SMTP_TEST_PORT 20031
+#define POP3_TEST_PORT 20032
+
+#endif
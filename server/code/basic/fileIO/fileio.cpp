@@ -39,7 +39,7 @@ RC FileIO::CreateFile  (const std::string &fileName)
 RC FileIO::CreateDir   (const std::string &dirName)
 {
   // Create the directory
-	RC rc = mkdir(dirName.c_str(), 777);
+	RC rc = mkdir(dirName.c_str(), 0777);
   if (rc == SUCCESS) {
     return SUCCESS;
   }
@@ -76,6 +76,7 @@ RC FileIO::OpenFile    (const std::string &fileName)
 
   // Open the file for reading/writing in binary mode
   FILE *pFile;
+  GetMetrics<FileMetrics>().openCalls.Add();
   pFile = fopen(fileName.c_str(), "rb+");
   // If we fail, error
   if (pFile == NULL)
@@ -132,10 +133,13 @@ RC FileIO::WriteFile   (size_t offset, size_t length, const void *data)
     return FH_SEEK_FAILED;
 
   // Write the data
+  LatencyTimer timer(&GetMetrics<FileMetrics>().writeTimes);
+  GetMetrics<FileMetrics>().writeCalls.Add();
   if (fwrite(data, ONE_BYTE, length, _fd) == length)
   {
     // Immediately commit changes to disk
     fflush(_fd);
+    GetMetrics<FileMetrics>().writeBytes.Add(length);
     return SUCCESS;
   }
 
@@ -152,8 +156,10 @@ RC FileIO::ReadFile    (size_t offset, size_t length, void *data)
     return FH_SEEK_FAILED;
 
   // Try to read the specified page
+  GetMetrics<FileMetrics>().readCalls.Add();
   if (fread(data, ONE_BYTE, length, _fd) != length)
     return READ_ERROR;
+  GetMetrics<FileMetrics>().readBytes.Add(length);
 
   return SUCCESS;
 }
@@ -168,10 +174,13 @@ RC FileIO::AppendFile  (size_t length, const void *data)
     return FH_SEEK_FAILED;
 
   // Write the data
+  LatencyTimer timer(&GetMetrics<FileMetrics>().writeTimes);
+  GetMetrics<FileMetrics>().writeCalls.Add();
   if (fwrite(data, ONE_BYTE, length, _fd) == length)
   {
     // Immediately commit changes to disk
     fflush(_fd);
+    GetMetrics<FileMetrics>().writeBytes.Add(length);
     return SUCCESS;
   }
 
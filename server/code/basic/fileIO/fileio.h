@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 // #include "../../util/systemLog.h"
 #include "../../util/emailError.h"
+#include "../../util/metrics.h"
 #include "../../util/util.h"
 
 /* ----- Define macros ----- */
@@ -34,6 +35,17 @@ enum {
 #define ZERO     0
 #define ONE_BYTE 1
 
+/* ----- Define structs ----- */
+// Reported by the System Info Manager as fileio.*
+struct FileMetrics {
+  Counter openCalls;
+  Counter readCalls;
+  Counter readBytes;
+  Counter writeCalls;
+  Counter writeBytes;
+  Histogram writeTimes;       // Microseconds
+};
+
 /**
  * FileIO
  * This class contains all interfaces that will be used to manage the file.
@@ -168,7 +180,7 @@ public:
   unsigned GetFileSize ();
 
 protected:
-  FileIO()  {};   // Constructor
+  FileIO() : _fd(NULL) {};   // Constructor
   ~FileIO() {};   // Destructor
 
 private:
@@ -0,0 +1,111 @@
+/*
+ * buffer.cpp
+ *
+ * This file provides the pool of I/O blocks and the memory budget shared by
+ * all connections.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include "buffer.h"
+
+// Free blocks of one thread, given back to the pool when the thread exits
+struct BufferCache {
+  std::vector<char *> blocks;
+  ~BufferCache()
+  {
+    if (!blocks.empty()) {
+      BufferPool *pool = BufferPool::instance();
+      std::lock_guard<std::mutex> lock(pool->_lock);
+      pool->_free.insert(pool->_free.end(), blocks.begin(), blocks.end());
+    }
+  }
+};
+
+static thread_local BufferCache threadCache;
+
+BufferPool* BufferPool::instance()
+{
+  // Created on first use and never destroyed, thread caches may outlive main()
+  static BufferPool *pool = new BufferPool();
+  return pool;
+}
+
+BufferPool::BufferPool()
+  : _used(0),
+    _budget(BUFFER_GLOBAL_BUDGET)
+{
+}
+
+char *BufferPool::Acquire ()
+{
+  std::vector<char *> &cache = threadCache.blocks;
+  if (cache.empty())
+    Exchange(cache, true);
+
+  char *block = cache.back();
+  cache.pop_back();
+  _used.fetch_add(BUFFER_BLOCK_SIZE, std::memory_order_relaxed);
+  return block;
+}
+
+void BufferPool::Release (char *block)
+{
+  if (!block)
+    return;
+
+  std::vector<char *> &cache = threadCache.blocks;
+  cache.push_back(block);
+  _used.fetch_sub(BUFFER_BLOCK_SIZE, std::memory_order_relaxed);
+  if (cache.size() > BUFFER_CACHE_BLOCKS)
+    Exchange(cache, false);
+}
+
+bool BufferPool::Charge (size_t bytes)
+{
+  size_t used = _used.load(std::memory_order_relaxed);
+  do {
+    if (used + bytes > _budget.load(std::memory_order_relaxed))
+      return false;
+  } while (!_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+  return true;
+}
+
+void BufferPool::Discharge (size_t bytes)
+{
+  _used.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+size_t BufferPool::GetSlabNumber ()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _slabs.size();
+}
+
+/************ Helper Functions *************/
+void BufferPool::Exchange (std::vector<char *> &cache, bool refill)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  if (!refill) {
+    size_t keep = BUFFER_CACHE_BLOCKS / 2;
+    _free.insert(_free.end(), cache.begin() + keep, cache.end());
+    cache.resize(keep);
+    return;
+  }
+
+  if (_free.empty()) {
+    _slabs.emplace_back(new char[BUFFER_BLOCK_SIZE * BUFFER_SLAB_BLOCKS]);
+    char *slab = _slabs.back().get();
+    for (size_t i = 0; i < BUFFER_SLAB_BLOCKS; ++i)
+      _free.push_back(slab + i * BUFFER_BLOCK_SIZE);
+  }
+
+  // Take half a cache at once so the next few calls need no lock
+  size_t take = std::min(_free.size(), static_cast<size_t>(BUFFER_CACHE_BLOCKS / 2));
+  cache.insert(cache.end(), _free.end() - take, _free.end());
+  _free.resize(_free.size() - take);
+}
@@ -0,0 +1,107 @@
+#ifndef SOCKET_BUFFER
+#define SOCKET_BUFFER
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+
+/* ----- Define macros ----- */
+#define BUFFER_BLOCK_SIZE    16384                  // Bytes of one I/O block
+#define BUFFER_SLAB_BLOCKS   64                     // Blocks carved from one allocation
+#define BUFFER_CACHE_BLOCKS  32                     // Free blocks kept by each thread
+#define BUFFER_GLOBAL_BUDGET (512 * 1024 * 1024)    // Default for all connections together
+
+/**
+ * BufferPool
+ * This class hands out the fixed-size I/O blocks used by every DataSocket and
+ * keeps the memory budget shared by all connections.
+ *
+ * Blocks are carved from slabs of BUFFER_SLAB_BLOCKS blocks and never go back
+ * to the heap, so thousands of connections reusing them cannot fragment it.
+ * Each thread keeps up to BUFFER_CACHE_BLOCKS free blocks of its own, the
+ * shared free list is only locked when that cache runs empty or full.
+ *
+ * The budget covers the blocks in use and the bytes charged by the sessions
+ * for what they keep beyond the blocks (a DATA block being received). A block
+ * is always given, a connection needs one to make any progress; Charge() is
+ * refused once the budget is used up.
+ *
+ * Contained Public Functions:
+ *   BufferPool* instance ()
+ *   char *Acquire ()
+ *   void Release (char *block)
+ *   bool Charge (size_t bytes)
+ *   void Discharge (size_t bytes)
+ *   void SetBudget (size_t bytes)
+ */
+class BufferPool
+{
+public:
+  /**
+   * This function will initialize an instance for BufferPool.
+   * @return pointer of BufferPool.
+   */
+  static BufferPool* instance();
+
+  /**
+   * This function will take a free block of BUFFER_BLOCK_SIZE bytes.
+   * @return pointer of the block.
+   */
+  char *Acquire ();
+
+  /**
+   * This function will give a block back to the pool.
+   * @param char given as a block from Acquire().
+   */
+  void Release (char *block);
+
+  /**
+   * This function will take bytes from the budget.
+   * @param size_t given as the number of bytes.
+   * @return true if the budget had room for them.
+   */
+  bool Charge (size_t bytes);
+
+  /**
+   * This function will give bytes taken by Charge() back to the budget.
+   * @param size_t given as the number of bytes.
+   */
+  void Discharge (size_t bytes);
+
+  /**
+   * This function will change the budget of all connections together.
+   * @param size_t given as the number of bytes.
+   */
+  void SetBudget (size_t bytes) { _budget.store(bytes, std::memory_order_relaxed); };
+
+  size_t GetBudget     () const { return _budget.load(std::memory_order_relaxed); };
+  size_t GetUsedSize   () const { return _used.load(std::memory_order_relaxed); };
+  size_t GetSlabNumber ();
+
+protected:
+  BufferPool();
+
+private:
+  friend struct BufferCache;
+
+  std::mutex _lock;                                  // Guards _slabs and _free
+  std::vector<std::unique_ptr<char[]>> _slabs;       // Every slab, never freed
+  std::vector<char *> _free;                         // Free blocks of all threads
+  std::atomic<size_t> _used;                         // Blocks in use and charged bytes
+  std::atomic<size_t> _budget;                       // Limit of _used for Charge()
+
+  // Private helper functions
+  /**
+   * This function will move free blocks between a thread cache and the pool,
+   * allocating a new slab when the pool has none.
+   * @param vector given as the cache of the calling thread.
+   *        bool given as true to refill the cache, false to drain half of it.
+   */
+  void Exchange (std::vector<char *> &cache, bool refill);
+};
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * scan.cpp
+ *
+ * This file provides the vectorized CRLF and DATA terminator scanning used by
+ * the socket line reader.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <cstring>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+typedef size_t (*ScanFunction)(const char *data, size_t length);
+
+/************ Scalar *************/
+size_t FindCRLFScalar (const char *data, size_t length)
+{
+  // memchr() for the '\n', then check the byte before it
+  size_t offset = 1;
+  while (offset < length) {
+    const void *found = memchr(data + offset, '\n', length - offset);
+    if (!found)
+      break;
+    offset = static_cast<const char *>(found) - data;
+    if (data[offset - 1] == '\r')
+      return offset - 1;
+    ++offset;
+  }
+  return length;
+}
+
+size_t FindDataEndScalar (const char *data, size_t length)
+{
+  size_t offset = 0;
+  while (offset + DATA_END_LENGTH <= length) {
+    size_t found = FindCRLFScalar(data + offset, length - offset);
+    if (found == length - offset)
+      break;
+    offset += found;
+    if (offset + DATA_END_LENGTH <= length && memcmp(data + offset, DATA_END, DATA_END_LENGTH) == 0)
+      return offset;
+    ++offset;
+  }
+  return length;
+}
+
+#ifdef SCAN_X86
+/************ SSE2 *************/
+__attribute__((target("sse2")))
+size_t FindCRLFSSE2 (const char *data, size_t length)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  size_t offset = 0;
+
+  // Compare bytes [i, i+16) with '\r' and [i+1, i+17) with '\n' at once
+  for (; offset + sizeof(__m128i) + 1 <= length; offset += sizeof(__m128i)) {
+    __m128i first  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset));
+    __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset + 1));
+    unsigned mask  = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, cr),
+                                                     _mm_cmpeq_epi8(second, lf)));
+    if (mask)
+      return offset + __builtin_ctz(mask);
+  }
+  return offset + FindCRLFScalar(data + offset, length - offset);
+}
+
+__attribute__((target("sse2")))
+size_t FindDataEndSSE2 (const char *data, size_t length)
+{
+  const __m128i cr  = _mm_set1_epi8('\r');
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i lf  = _mm_set1_epi8('\n');
+  size_t offset = 0;
+
+  // Filter on the first, middle and last byte, then verify the candidates
+  for (; offset + sizeof(__m128i) + DATA_END_LENGTH - 1 <= length; offset += sizeof(__m128i)) {
+    __m128i first  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset));
+    __m128i middle = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset + 2));
+    __m128i last   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset + 4));
+    unsigned mask  = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, cr),
+                      _mm_and_si128(_mm_cmpeq_epi8(middle, dot), _mm_cmpeq_epi8(last, lf))));
+    while (mask) {
+      size_t candidate = offset + __builtin_ctz(mask);
+      if (data[candidate + 1] == '\n' && data[candidate + 3] == '\r')
+        return candidate;
+      mask &= mask - 1;
+    }
+  }
+  return offset + FindDataEndScalar(data + offset, length - offset);
+}
+
+/************ AVX2 *************/
+__attribute__((target("avx2")))
+size_t FindCRLFAVX2 (const char *data, size_t length)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  size_t offset = 0;
+
+  for (; offset + sizeof(__m256i) + 1 <= length; offset += sizeof(__m256i)) {
+    __m256i first  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offset));
+    __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offset + 1));
+    unsigned mask  = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, cr),
+                                                           _mm256_cmpeq_epi8(second, lf)));
+    if (mask)
+      return offset + __builtin_ctz(mask);
+  }
+  return offset + FindCRLFSSE2(data + offset, length - offset);
+}
+
+__attribute__((target("avx2")))
+size_t FindDataEndAVX2 (const char *data, size_t length)
+{
+  const __m256i cr  = _mm256_set1_epi8('\r');
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i lf  = _mm256_set1_epi8('\n');
+  size_t offset = 0;
+
+  for (; offset + sizeof(__m256i) + DATA_END_LENGTH - 1 <= length; offset += sizeof(__m256i)) {
+    __m256i first  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offset));
+    __m256i middle = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offset + 2));
+    __m256i last   = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offset + 4));
+    unsigned mask  = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, cr),
+                      _mm256_and_si256(_mm256_cmpeq_epi8(middle, dot), _mm256_cmpeq_epi8(last, lf))));
+    while (mask) {
+      size_t candidate = offset + __builtin_ctz(mask);
+      if (data[candidate + 1] == '\n' && data[candidate + 3] == '\r')
+        return candidate;
+      mask &= mask - 1;
+    }
+  }
+  return offset + FindDataEndSSE2(data + offset, length - offset);
+}
+#endif
+
+/************ Dispatch *************/
+namespace {
+
+struct ScanTable {
+  ScanFunction crlf;
+  ScanFunction dataEnd;
+  const char  *level;
+};
+
+ScanTable ChooseScanTable ()
+{
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return { FindCRLFAVX2, FindDataEndAVX2, "avx2" };
+  if (__builtin_cpu_supports("sse2"))
+    return { FindCRLFSSE2, FindDataEndSSE2, "sse2" };
+#endif
+  return { FindCRLFScalar, FindDataEndScalar, "scalar" };
+}
+
+const ScanTable &GetScanTable ()
+{
+  static const ScanTable table = ChooseScanTable();
+  return table;
+}
+
+}
+
+size_t FindCRLF (const char *data, size_t length)
+{
+  return GetScanTable().crlf(data, length);
+}
+
+size_t FindDataEnd (const char *data, size_t length)
+{
+  return GetScanTable().dataEnd(data, length);
+}
+
+const char *GetScanLevel ()
+{
+  return GetScanTable().level;
+}
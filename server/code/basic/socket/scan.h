@@ -0,0 +1,57 @@
+#ifndef SOCKET_SCAN
+#define SOCKET_SCAN
+
+/* ----- Include libries or files ----- */
+#include <cstddef>
+
+/* ----- Define macros ----- */
+#define CRLF             "\r\n"
+#define CRLF_LENGTH      2
+#define DATA_END         "\r\n.\r\n"
+#define DATA_END_LENGTH  5
+
+/**
+ * Scan functions
+ * These functions look for the SMTP/POP3 line and DATA terminators. On x86 they
+ * use AVX2 or SSE2 compares chosen once at start up from the CPU features, and
+ * a scalar loop everywhere else. All versions return the same result.
+ *
+ * Contained Public Functions:
+ *   size_t FindCRLF    (const char *data, size_t length)
+ *   size_t FindDataEnd (const char *data, size_t length)
+ *   const char *GetScanLevel ()
+ */
+
+/**
+ * This function will find the first "\r\n" in the given bytes.
+ * @param  const char * given as the start of the bytes.
+ *         size_t given as the number of bytes.
+ * @return size_t as the offset of the '\r', length if not found.
+ */
+size_t FindCRLF    (const char *data, size_t length);
+
+/**
+ * This function will find the first "\r\n.\r\n" in the given bytes.
+ * @param  const char * given as the start of the bytes.
+ *         size_t given as the number of bytes.
+ * @return size_t as the offset of the first '\r', length if not found.
+ */
+size_t FindDataEnd (const char *data, size_t length);
+
+/**
+ * This function will tell which implementation the scan functions use.
+ * @return "avx2", "sse2" or "scalar".
+ */
+const char *GetScanLevel ();
+
+/* Fixed implementations, exposed so the unit test can compare them */
+size_t FindCRLFScalar    (const char *data, size_t length);
+size_t FindDataEndScalar (const char *data, size_t length);
+#if defined(__x86_64__) || defined(__i386__)
+size_t FindCRLFSSE2      (const char *data, size_t length);
+size_t FindDataEndSSE2   (const char *data, size_t length);
+size_t FindCRLFAVX2      (const char *data, size_t length);
+size_t FindDataEndAVX2   (const char *data, size_t length);
+#endif
+
+#endif
@@ -0,0 +1,474 @@
+/*
+ * socket.cpp
+ *
+ * This file provides TCP socket send()/recv() and listen()/accept() to other
+ * modules or layers.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include "scan.h"
+#include "socket.h"
+
+/************ BaseSocket *************/
+BaseSocket::BaseSocket(int socketId)
+  : _socketId(socketId)
+{
+}
+
+BaseSocket::BaseSocket(BaseSocket &&move) noexcept
+  : _socketId(move._socketId)
+{
+  move._socketId = INVALID_SOCKET_ID;
+}
+
+BaseSocket& BaseSocket::operator=(BaseSocket &&move) noexcept
+{
+  if (this != &move) {
+    Close();
+    _socketId = move._socketId;
+    move._socketId = INVALID_SOCKET_ID;
+  }
+  return *this;
+}
+
+BaseSocket::~BaseSocket()
+{
+  Close();
+}
+
+RC BaseSocket::SetNonBlocking ()
+{
+  int flags = fcntl(_socketId, F_GETFL, 0);
+  if (flags == -1 || fcntl(_socketId, F_SETFL, flags | O_NONBLOCK) == -1)
+    return SOCKET_OPTION_ERROR;
+  return SUCCESS;
+}
+
+RC BaseSocket::Close ()
+{
+  if (_socketId == INVALID_SOCKET_ID)
+    return SUCCESS;
+
+  ::close(_socketId);
+  _socketId = INVALID_SOCKET_ID;
+  return SUCCESS;
+}
+
+void BaseSocket::Reset (int socketId)
+{
+  Close();
+  _socketId = socketId;
+}
+
+/************ DataSocket *************/
+DataSocket::DataSocket(int socketId)
+  : BaseSocket(socketId),
+    _buffer(NULL),
+    _begin(0),
+    _end(0),
+    _scanned(0),
+    _scanKind(SCAN_NONE),
+    _inData(false),
+    _charged(0),
+    _budget(CONNECTION_BUDGET),
+    _sendOffset(0)
+{
+}
+
+DataSocket::DataSocket(DataSocket &&move) noexcept
+  : BaseSocket(std::move(move)),
+    _buffer(move._buffer),
+    _begin(move._begin),
+    _end(move._end),
+    _scanned(move._scanned),
+    _scanKind(move._scanKind),
+    _inData(move._inData),
+    _charged(move._charged),
+    _budget(move._budget),
+    _sendQueue(std::move(move._sendQueue)),
+    _sendOffset(move._sendOffset)
+{
+  move._buffer  = NULL;
+  move._begin   = move._end = move._scanned = 0;
+  move._charged = 0;
+}
+
+DataSocket& DataSocket::operator=(DataSocket &&move) noexcept
+{
+  if (this != &move) {
+    BufferPool::instance()->Release(_buffer);
+    Discharge(_charged);
+    BaseSocket::operator=(std::move(move));
+    _buffer     = move._buffer;
+    _begin      = move._begin;
+    _end        = move._end;
+    _scanned    = move._scanned;
+    _scanKind   = move._scanKind;
+    _inData     = move._inData;
+    _charged    = move._charged;
+    _budget     = move._budget;
+    _sendQueue  = std::move(move._sendQueue);
+    _sendOffset = move._sendOffset;
+    move._buffer  = NULL;
+    move._begin   = move._end = move._scanned = 0;
+    move._charged = 0;
+  }
+  return *this;
+}
+
+DataSocket::~DataSocket()
+{
+  BufferPool::instance()->Release(_buffer);
+  Discharge(_charged);
+}
+
+RC DataSocket::GetMessage (std::string &message)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  RC rc;
+  if (_begin == _end && (rc = Fill()))
+    return rc;
+
+  message.append(_buffer + _begin, _end - _begin);
+  Consume(_end - _begin);
+  return SUCCESS;
+}
+
+RC DataSocket::GetLine (std::string_view &line)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  // Resume where the last call stopped, a CRLF may start on its last byte
+  size_t from = _scanKind == SCAN_LINE && _scanned > _begin ? _scanned - 1 : _begin;
+  _scanKind = SCAN_LINE;
+
+  while (true) {
+    size_t found = from + FindCRLF(_buffer + from, _end - from);
+    if (found < _end) {
+      line = std::string_view(_buffer + _begin, found - _begin);
+      Consume(found + CRLF_LENGTH - _begin);
+      return SUCCESS;
+    }
+    _scanned = _end;
+    if (_end - _begin >= LINE_MAX_LENGTH)
+      return SOCKET_LINE_TOO_LONG;
+
+    RC rc = Fill();
+    if (rc)
+      return rc;
+    from = _scanned > _begin ? _scanned - 1 : _begin;
+  }
+}
+
+RC DataSocket::GetData (std::string_view &data, bool &complete)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  // Resume where the last call stopped, the terminator may straddle it
+  size_t back = DATA_END_LENGTH - 1;
+  size_t from = _scanKind == SCAN_DATA && _scanned > _begin + back ? _scanned - back : _begin;
+  _scanKind = SCAN_DATA;
+
+  while (true) {
+    // An empty block: the CRLF before the dot was the one ending "DATA"
+    size_t dotLength = DATA_END_LENGTH - CRLF_LENGTH;
+    if (!_inData && _end - _begin >= dotLength &&
+        memcmp(_buffer + _begin, DATA_END + CRLF_LENGTH, dotLength) == 0) {
+      data = std::string_view(_buffer + _begin, 0);
+      complete = true;
+      Consume(dotLength);
+      return SUCCESS;
+    }
+
+    size_t found = from + FindDataEnd(_buffer + from, _end - from);
+    if (found < _end) {
+      data = std::string_view(_buffer + _begin, found + CRLF_LENGTH - _begin);
+      complete = true;
+      _inData  = false;
+      Consume(found + DATA_END_LENGTH - _begin);
+      return SUCCESS;
+    }
+    _scanned = _end;
+
+    RC rc = Fill();
+    if (rc == SUCCESS) {
+      from = _scanned > _begin + back ? _scanned - back : _begin;
+      continue;
+    }
+    if (rc != SOCKET_BUFFER_FULL && rc != SOCKET_WOULD_BLOCK)
+      return rc;
+
+    // Hand out what cannot belong to the terminator, the CRLF starting a
+    // terminator that is still arriving stays in the block
+    if (_end - _begin <= back)
+      return rc == SOCKET_BUFFER_FULL ? SOCKET_WOULD_BLOCK : rc;
+    size_t length = _end - back - _begin;
+    data = std::string_view(_buffer + _begin, length);
+    complete = false;
+    _inData  = true;
+    Consume(length);
+    return SUCCESS;
+  }
+}
+
+RC DataSocket::PutMessage (const std::string &message)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  // Keep the order with the messages queued before
+  if (!_sendQueue.empty()) {
+    QueueMessage(message);
+    return Flush();
+  }
+
+  size_t sent = 0;
+  while (sent < message.size()) {
+    ssize_t put = send(GetSocketId(), message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+    GetMetrics<SocketMetrics>().sendCalls.Add();
+    if (put == -1) {
+      if (errno == EINTR)
+        continue;
+      return SOCKET_SEND_ERROR;
+    }
+    GetMetrics<SocketMetrics>().sendBytes.Add(put);
+    sent += put;
+  }
+  return SUCCESS;
+}
+
+RC DataSocket::Charge (size_t bytes)
+{
+  if (_charged + bytes > _budget || !BufferPool::instance()->Charge(bytes))
+    return SOCKET_OVER_BUDGET;
+  _charged += bytes;
+  return SUCCESS;
+}
+
+void DataSocket::Discharge (size_t bytes)
+{
+  if (bytes > _charged)
+    bytes = _charged;
+  if (bytes == 0)
+    return;
+  BufferPool::instance()->Discharge(bytes);
+  _charged -= bytes;
+}
+
+void DataSocket::QueueMessage (std::string message)
+{
+  if (!message.empty())
+    _sendQueue.emplace_back(std::move(message));
+}
+
+RC DataSocket::QueueFile (int fileId, off_t offset, size_t length)
+{
+  if (length == 0)
+    return SUCCESS;
+
+  int copy = dup(fileId);
+  if (copy == -1)
+    return SOCKET_SEND_ERROR;
+  _sendQueue.emplace_back(copy, offset, length);
+  return SUCCESS;
+}
+
+RC DataSocket::Flush ()
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  while (!_sendQueue.empty()) {
+    // A file range goes straight from the page cache to the socket
+    SendItem &front = _sendQueue.front();
+    if (front.fileId != -1) {
+      off_t offset = front.offset + _sendOffset;
+      ssize_t put = sendfile(GetSocketId(), front.fileId, &offset, front.length - _sendOffset);
+      GetMetrics<SocketMetrics>().sendCalls.Add();
+      if (put == -1) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return SOCKET_WOULD_BLOCK;
+        return SOCKET_SEND_ERROR;
+      }
+      if (put == 0)   // The file is shorter than the queued range
+        return SOCKET_SEND_ERROR;
+      GetMetrics<SocketMetrics>().sendBytes.Add(put);
+      _sendOffset += put;
+      if (_sendOffset == front.length) {
+        _sendQueue.pop_front();
+        _sendOffset = 0;
+      }
+      continue;
+    }
+
+    // Gather the messages in memory up to the next file range
+    struct iovec vector[SEND_IOV_MAX];
+    size_t count = 0;
+    for (auto it = _sendQueue.begin(); it != _sendQueue.end() && it->fileId == -1 && count < SEND_IOV_MAX;
+         ++it, ++count) {
+      size_t skip = count == 0 ? _sendOffset : 0;
+      vector[count].iov_base = const_cast<char *>(it->data.data()) + skip;
+      vector[count].iov_len  = it->data.size() - skip;
+    }
+
+    // sendmsg() is writev() with flags, MSG_NOSIGNAL keeps SIGPIPE away
+    struct msghdr header = {};
+    header.msg_iov    = vector;
+    header.msg_iovlen = count;
+    ssize_t put = sendmsg(GetSocketId(), &header, MSG_NOSIGNAL);
+    GetMetrics<SocketMetrics>().sendCalls.Add();
+    if (put == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return SOCKET_WOULD_BLOCK;
+      return SOCKET_SEND_ERROR;
+    }
+    GetMetrics<SocketMetrics>().sendBytes.Add(put);
+
+    // Drop what has been sent, remember where the front message stopped
+    size_t sent = put;
+    while (sent > 0) {
+      size_t left = _sendQueue.front().length - _sendOffset;
+      if (sent < left) {
+        _sendOffset += sent;
+        break;
+      }
+      sent -= left;
+      _sendQueue.pop_front();
+      _sendOffset = 0;
+    }
+  }
+
+  return SUCCESS;
+}
+
+DataSocket::SendItem& DataSocket::SendItem::operator=(SendItem &&move) noexcept
+{
+  if (this != &move) {
+    if (fileId != -1)
+      ::close(fileId);
+    data   = std::move(move.data);
+    fileId = move.fileId;
+    offset = move.offset;
+    length = move.length;
+    move.fileId = -1;
+  }
+  return *this;
+}
+
+RC DataSocket::Fill ()
+{
+  if (!_buffer) {
+    _buffer = BufferPool::instance()->Acquire();
+  } else if (_end == BUFFER_BLOCK_SIZE) {
+    if (_begin == 0)
+      return SOCKET_BUFFER_FULL;
+    // Move the unconsumed bytes to the front, the block never grows
+    memmove(_buffer, _buffer + _begin, _end - _begin);
+    _scanned -= _begin;
+    _end     -= _begin;
+    _begin    = 0;
+  }
+
+  while (true) {
+    ssize_t got = recv(GetSocketId(), _buffer + _end, BUFFER_BLOCK_SIZE - _end, 0);
+    GetMetrics<SocketMetrics>().recvCalls.Add();
+    if (got > 0) {
+      GetMetrics<SocketMetrics>().recvBytes.Add(got);
+      _end += got;
+      return SUCCESS;
+    }
+    if (got == -1 && errno == EINTR)
+      continue;
+
+    // Nothing left to parse: keep an idle connection free of receive memory
+    if (_end == 0) {
+      BufferPool::instance()->Release(_buffer);
+      _buffer = NULL;
+    }
+    if (got == 0)
+      return SOCKET_CLOSED;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return SOCKET_WOULD_BLOCK;
+    return SOCKET_RECV_ERROR;
+  }
+}
+
+void DataSocket::Consume (size_t length)
+{
+  _begin   += length;
+  _scanned  = _begin;
+  _scanKind = SCAN_NONE;
+  // The block is kept, the views handed out stay valid until the next Get*()
+  if (_begin == _end)
+    _begin = _end = _scanned = 0;
+}
+
+/************ ServerSocket *************/
+ServerSocket::ServerSocket()
+  : BaseSocket(INVALID_SOCKET_ID),
+    _port(0)
+{
+}
+
+RC ServerSocket::Listen (int port, bool reusePort, int backlog)
+{
+  int socketId = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (socketId == INVALID_SOCKET_ID)
+    return SOCKET_CREATE_ERROR;
+  // Hand the id over to this object so every error path below closes it
+  Reset(socketId);
+
+  int enable = 1;
+  if (setsockopt(socketId, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)))
+    return SOCKET_OPTION_ERROR;
+  if (reusePort && setsockopt(socketId, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)))
+    return SOCKET_OPTION_ERROR;
+
+  struct sockaddr_in address = {};
+  address.sin_family      = AF_INET;
+  address.sin_port        = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(socketId, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)))
+    return SOCKET_BIND_ERROR;
+
+  if (listen(socketId, backlog))
+    return SOCKET_LISTEN_ERROR;
+
+  _port = port;
+  return SUCCESS;
+}
+
+RC ServerSocket::Accept (int &socketId)
+{
+  if (!IsValid())
+    return SOCKET_INVALID;
+
+  while (true) {
+    socketId = accept4(GetSocketId(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (socketId != INVALID_SOCKET_ID) {
+      GetMetrics<SocketMetrics>().accepts.Add();
+      return SUCCESS;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return SOCKET_WOULD_BLOCK;
+    return SOCKET_ACCEPT_ERROR;
+  }
+}
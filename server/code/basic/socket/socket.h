@@ -0,0 +1,356 @@
+#ifndef TCP_SOCKET
+#define TCP_SOCKET
+
+/* ----- Include libries or files ----- */
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "buffer.h"
+#include "../../util/emailError.h"
+#include "../../util/metrics.h"
+#include "../../util/util.h"
+
+/* ----- Define macros ----- */
+enum {
+  SOCKET_CREATE_ERROR = 301,
+  SOCKET_OPTION_ERROR,
+  SOCKET_BIND_ERROR,
+  SOCKET_LISTEN_ERROR,
+  SOCKET_ACCEPT_ERROR,
+  SOCKET_SEND_ERROR,
+  SOCKET_RECV_ERROR,
+  SOCKET_CLOSED,
+  SOCKET_WOULD_BLOCK,
+  SOCKET_INVALID,
+  SOCKET_LINE_TOO_LONG,
+  SOCKET_BUFFER_FULL,
+  SOCKET_OVER_BUDGET,
+};
+
+#define INVALID_SOCKET_ID -1
+#define DEFAULT_BACKLOG   1024
+#define CONNECTION_BUDGET (64 * 1024 * 1024)   // Default bytes one connection may charge
+#define LINE_MAX_LENGTH   1000  // RFC 5321 4.5.3.1.6, including the CRLF
+#define SEND_IOV_MAX      64    // Queued messages gathered into one send
+#define SMTP_PORT         25
+#define POP3_PORT         110
+
+/* ----- Define structs ----- */
+// Reported by the System Info Manager as socket.*
+struct SocketMetrics {
+  Counter accepts;
+  Counter recvCalls;
+  Counter recvBytes;
+  Counter sendCalls;
+  Counter sendBytes;
+};
+
+/**
+ * BaseSocket
+ * This class owns a socket id and closes it when the object goes away. It can
+ * be moved but never copied, so one socket id always has exactly one owner.
+ *
+ * Contained Public Functions:
+ *   int  GetSocketId ()
+ *   bool IsValid     ()
+ *   RC   SetNonBlocking ()
+ *   RC   Close       ()
+ */
+class BaseSocket
+{
+public:
+  BaseSocket(BaseSocket &&move) noexcept;
+  BaseSocket& operator=(BaseSocket &&move) noexcept;
+  BaseSocket(const BaseSocket &) = delete;
+  BaseSocket& operator=(const BaseSocket &) = delete;
+  virtual ~BaseSocket();
+
+  /**
+   * This function will return the socket id held by this object.
+   * @return int as the socket id, INVALID_SOCKET_ID if not valid.
+   */
+  int  GetSocketId () const { return _socketId; };
+
+  /**
+   * This function will tell if this object holds an open socket.
+   * @return true if the socket id is valid.
+   */
+  bool IsValid     () const { return _socketId != INVALID_SOCKET_ID; };
+
+  /**
+   * This function will put the socket into non-blocking mode.
+   * @return SUCCESS if the flag has been set.
+   *         SOCKET_OPTION_ERROR otherwise.
+   */
+  RC   SetNonBlocking ();
+
+  /**
+   * This function will close the socket id and invalidate this object.
+   * @return SUCCESS if closed or already closed.
+   */
+  RC   Close       ();
+
+protected:
+  explicit BaseSocket(int socketId);
+
+  /**
+   * This function will close the current socket id and take over the new one.
+   * @param  int given as the new socket id.
+   */
+  void Reset (int socketId);
+
+private:
+  int _socketId;    // Socket id, INVALID_SOCKET_ID once closed or moved
+};
+
+/**
+ * DataSocket
+ * This class handles all the message data send() and recv() on a connected
+ * socket.
+ *
+ * Received bytes go into one BUFFER_BLOCK_SIZE block of the BufferPool, taken
+ * when the first byte arrives and given back as soon as everything has been
+ * consumed, so an idle connection holds no receive memory. GetLine() and
+ * GetData() return string_views into that block, so parsing copies nothing. A
+ * view stays valid until the next Get*() call on the same socket.
+ *
+ * The block never grows. A DATA block larger than what is buffered comes in
+ * pieces, and while nobody consumes a full block the socket is not read, which
+ * leaves the sender to TCP flow control. What a session keeps beyond the block
+ * is charged with Charge() against the budget of the connection and the global
+ * budget of the BufferPool.
+ *
+ * Replies can be queued with QueueMessage() and written together by Flush(),
+ * which hands up to SEND_IOV_MAX of them to the kernel in one gathered send.
+ * QueueFile() queues a range of a file instead, which Flush() passes to
+ * sendfile() so the bytes never get copied into user space.
+ *
+ * Contained Public Functions:
+ *   RC GetMessage (std::string &message)
+ *   RC GetLine    (std::string_view &line)
+ *   RC GetData    (std::string_view &data, bool &complete)
+ *   RC PutMessage (const std::string &message)
+ *   void QueueMessage (std::string message)
+ *   RC QueueFile  (int fileId, off_t offset, size_t length)
+ *   RC Flush      ()
+ *   size_t GetBufferedSize ()
+ *   bool HasQueuedMessage ()
+ *   RC Charge     (size_t bytes)
+ *   void Discharge (size_t bytes)
+ *   void SetBudget (size_t bytes)
+ */
+class DataSocket : public BaseSocket
+{
+public:
+  explicit DataSocket(int socketId);
+  DataSocket(DataSocket &&move) noexcept;
+  DataSocket& operator=(DataSocket &&move) noexcept;
+  ~DataSocket();
+
+  /**
+   * This function will return the next line without its CRLF. It receives from
+   * the socket only when no complete line is buffered.
+   * @param  string_view stores the line.
+   * @return SUCCESS if a complete line has been found.
+   *         SOCKET_LINE_TOO_LONG if LINE_MAX_LENGTH bytes come without a CRLF.
+   *         pre-defined error number returned by GetMessage() otherwise.
+   */
+  RC GetLine    (std::string_view &line);
+
+  /**
+   * This function will return the next piece of the SMTP DATA block. Pieces
+   * are returned as they arrive, up to the "\r\n.\r\n" terminator; the last
+   * piece keeps the CRLF of the last line and the terminating ".\r\n" is
+   * consumed. Dot-stuffing is left in place.
+   * @param  string_view stores the piece, may be empty for an empty block.
+   *         bool stores true if the piece ends the DATA block.
+   * @return SUCCESS if a piece has been returned.
+   *         pre-defined error number returned by GetMessage() otherwise.
+   */
+  RC GetData    (std::string_view &data, bool &complete);
+
+  /**
+   * This function will return the number of received bytes not consumed yet.
+   * @return size_t as the buffered bytes.
+   */
+  size_t GetBufferedSize () const { return _end - _begin; };
+
+  /**
+   * This function will receive the bytes currently available on the socket and
+   * append them to the given string. Bytes already buffered are returned first.
+   * @param  string stores the received message.
+   * @return SUCCESS if some bytes have been received.
+   *         SOCKET_WOULD_BLOCK if nothing is available on a non-blocking socket.
+   *         SOCKET_CLOSED if the peer closed the connection.
+   *         SOCKET_RECV_ERROR otherwise.
+   */
+  RC GetMessage (std::string &message);
+
+  /**
+   * This function will send the whole message through the socket.
+   * @param  const string given as the message.
+   * @return SUCCESS if the whole message has been sent.
+   *         SOCKET_SEND_ERROR otherwise.
+   */
+  RC PutMessage (const std::string &message);
+
+  /**
+   * This function will queue a message to be sent by the next Flush().
+   * @param  string given as the message, moved into the queue.
+   */
+  void QueueMessage (std::string message);
+
+  /**
+   * This function will queue a range of a file to be sent by the next Flush().
+   * The socket keeps its own duplicate of the file descriptor, so the caller
+   * may close its one at once.
+   * @param  int given as the file descriptor.
+   *         off_t given as the start of the range in the file.
+   *         size_t given as the length of the range.
+   * @return SUCCESS if the range has been queued.
+   *         SOCKET_SEND_ERROR if the file descriptor cannot be duplicated.
+   */
+  RC QueueFile (int fileId, off_t offset, size_t length);
+
+  /**
+   * This function will send the queued messages, gathering several of them
+   * into each send. On a non-blocking socket it stops when the socket is full
+   * and keeps the rest for the next call.
+   * @return SUCCESS if the queue is empty.
+   *         SOCKET_WOULD_BLOCK if some messages are still queued.
+   *         SOCKET_SEND_ERROR otherwise.
+   */
+  RC Flush ();
+
+  /**
+   * This function will tell if some queued messages are not sent yet.
+   * @return true if the send queue is not empty.
+   */
+  bool HasQueuedMessage () const { return !_sendQueue.empty(); };
+
+  /**
+   * This function will take bytes from the budget of this connection and from
+   * the global budget, for memory a session keeps on behalf of the connection.
+   * @param  size_t given as the number of bytes.
+   * @return SUCCESS if both budgets had room.
+   *         SOCKET_OVER_BUDGET otherwise, nothing is taken then.
+   */
+  RC Charge (size_t bytes);
+
+  /**
+   * This function will give charged bytes back to both budgets.
+   * @param  size_t given as the number of bytes.
+   */
+  void Discharge (size_t bytes);
+
+  /**
+   * This function will change the budget of this connection.
+   * @param  size_t given as the number of bytes.
+   */
+  void SetBudget (size_t bytes) { _budget = bytes; };
+
+private:
+  enum ScanKind { SCAN_NONE, SCAN_LINE, SCAN_DATA };
+
+  // One queued message, either bytes in memory or a range of a file
+  struct SendItem {
+    explicit SendItem(std::string message)
+      : data(std::move(message)), fileId(-1), offset(0), length(data.size()) {};
+    SendItem(int file, off_t start, size_t size)
+      : fileId(file), offset(start), length(size) {};
+    SendItem(SendItem &&move) noexcept
+      : data(std::move(move.data)), fileId(move.fileId), offset(move.offset), length(move.length)
+      { move.fileId = -1; };
+    SendItem& operator=(SendItem &&move) noexcept;
+    ~SendItem() { if (fileId != -1) ::close(fileId); };
+
+    std::string data;   // Bytes to send, empty for a file range
+    int    fileId;      // Owned duplicate of the file descriptor, -1 for bytes
+    off_t  offset;      // Start of the file range
+    size_t length;      // Bytes to send
+  };
+
+  char  *_buffer;              // Receive block of the BufferPool, NULL when empty
+  size_t _begin;               // First byte not consumed yet
+  size_t _end;                 // One past the last received byte
+  size_t _scanned;             // No terminator of _scanKind starts before it
+  ScanKind _scanKind;          // Terminator _scanned refers to
+  bool   _inData;              // Part of a DATA block has been returned
+  size_t _charged;             // Bytes taken by Charge()
+  size_t _budget;              // Limit of _charged
+  std::deque<SendItem> _sendQueue;      // Messages waiting for Flush()
+  size_t _sendOffset;                   // Bytes of the front message sent
+
+  // Private helper functions
+  /**
+   * This function will recv() once into the free tail of the block, taking a
+   * block first or moving the unconsumed bytes to its front when needed.
+   * @return SUCCESS if some bytes have been received.
+   *         SOCKET_BUFFER_FULL if the block is full of unconsumed bytes.
+   *         SOCKET_WOULD_BLOCK, SOCKET_CLOSED or SOCKET_RECV_ERROR otherwise.
+   */
+  RC Fill ();
+
+  /**
+   * This function will drop the given number of bytes from the buffer front.
+   * @param size_t given as the number of bytes.
+   */
+  void Consume (size_t length);
+};
+
+/**
+ * ServerSocket
+ * This class sets up a new listening socket on the given port and accepts the
+ * incoming connections.
+ *
+ * With reusePort set, the socket is bound with SO_REUSEPORT so that several
+ * ServerSockets (one per reactor thread) can listen on the same port and the
+ * kernel spreads incoming connections between them.
+ *
+ * Contained Public Functions:
+ *   RC Listen (int port, bool reusePort, int backlog)
+ *   RC Accept (int &socketId)
+ *   int GetPort ()
+ */
+class ServerSocket : public BaseSocket
+{
+public:
+  ServerSocket();
+
+  /**
+   * This function will create, bind and listen a non-blocking socket.
+   * @param  int port to bind to.
+   *         bool reusePort to set SO_REUSEPORT on the socket.
+   *         int backlog for listen().
+   * @return SUCCESS if the socket is listening.
+   *         SOCKET_CREATE_ERROR, SOCKET_OPTION_ERROR, SOCKET_BIND_ERROR or
+   *         SOCKET_LISTEN_ERROR otherwise.
+   */
+  RC Listen (int port, bool reusePort = false, int backlog = DEFAULT_BACKLOG);
+
+  /**
+   * This function will accept one pending connection. The accepted socket is
+   * already in non-blocking mode.
+   * @param  int stores the accepted socket id.
+   * @return SUCCESS if a connection has been accepted.
+   *         SOCKET_WOULD_BLOCK if there is no pending connection.
+   *         SOCKET_ACCEPT_ERROR otherwise.
+   */
+  RC Accept (int &socketId);
+
+  /**
+   * This function will return the port this socket listens on.
+   * @return int as the port, ZERO if not listening.
+   */
+  int GetPort () const { return _port; };
+
+private:
+  int _port;    // Listening port
+};
+
+#endif
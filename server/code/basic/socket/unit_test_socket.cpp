@@ -0,0 +1,224 @@
+/*
+ * unit_test_socket.cpp
+ *
+ * This file provides unit test for socket.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <cstdlib>
+#include <iostream>
+#include "unit_test_socket.h"
+using namespace std;
+
+// Open a blocking client connection to the local port
+static int ConnectLocal (int port)
+{
+  int socketId = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {};
+  address.sin_family      = AF_INET;
+  address.sin_port        = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(socketId, reinterpret_cast<struct sockaddr *>(&address), sizeof(address))) {
+    close(socketId);
+    return INVALID_SOCKET_ID;
+  }
+  return socketId;
+}
+
+static RC TestListenAccept ()
+{
+  ServerSocket server;
+  if (server.Listen(TEST_PORT, true))
+    return STANDARD_ERROR;
+
+  // A second SO_REUSEPORT socket can share the port
+  ServerSocket shared;
+  if (shared.Listen(TEST_PORT, true))
+    return STANDARD_ERROR;
+
+  int socketId;
+  if (server.Accept(socketId) != SOCKET_WOULD_BLOCK)
+    return STANDARD_ERROR;
+
+  DataSocket client(ConnectLocal(TEST_PORT));
+  if (!client.IsValid())
+    return STANDARD_ERROR;
+
+  // The kernel hands the connection to one of the two listeners
+  while (server.Accept(socketId) != SUCCESS && shared.Accept(socketId) != SUCCESS) {}
+  DataSocket accepted(socketId);
+
+  if (client.PutMessage("HELO example.com\r\n"))
+    return STANDARD_ERROR;
+
+  string message;
+  RC rc;
+  while ((rc = accepted.GetMessage(message)) == SOCKET_WOULD_BLOCK) {}
+  if (rc || message != "HELO example.com\r\n")
+    return STANDARD_ERROR;
+
+  client.Close();
+  while ((rc = accepted.GetMessage(message)) == SOCKET_WOULD_BLOCK) {}
+  return rc == SOCKET_CLOSED ? SUCCESS : STANDARD_ERROR;
+}
+
+// Every scan implementation must agree with the scalar one
+static RC TestScanLevels ()
+{
+  srand(2019);
+  for (int round = 0; round < 2000; ++round) {
+    string data(rand() % 300, 'a');
+    for (char &c : data) {
+      int pick = rand() % 8;
+      c = pick == 0 ? '\r' : pick == 1 ? '\n' : pick == 2 ? '.' : 'a';
+    }
+    size_t crlf = FindCRLFScalar(data.data(), data.size());
+    size_t end  = FindDataEndScalar(data.data(), data.size());
+    if (crlf != data.find(CRLF) && !(crlf == data.size() && data.find(CRLF) == string::npos))
+      return STANDARD_ERROR;
+    if (FindCRLF(data.data(), data.size()) != crlf || FindDataEnd(data.data(), data.size()) != end)
+      return STANDARD_ERROR;
+#if defined(__x86_64__) || defined(__i386__)
+    if (FindCRLFSSE2(data.data(), data.size()) != crlf || FindDataEndSSE2(data.data(), data.size()) != end)
+      return STANDARD_ERROR;
+    if (__builtin_cpu_supports("avx2") &&
+        (FindCRLFAVX2(data.data(), data.size()) != crlf || FindDataEndAVX2(data.data(), data.size()) != end))
+      return STANDARD_ERROR;
+#endif
+  }
+  return SUCCESS;
+}
+
+static RC TestLineReader ()
+{
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket reader(pair[0]);
+  DataSocket writer(pair[1]);
+  reader.SetNonBlocking();
+
+  string_view line;
+  if (reader.GetLine(line) != SOCKET_WOULD_BLOCK)
+    return STANDARD_ERROR;
+
+  // Two commands in one packet, then a line split across two sends
+  writer.PutMessage("MAIL FROM:<a@b.com>\r\nRCPT TO:<c@d.com>\r\nDA");
+  if (reader.GetLine(line) || line != "MAIL FROM:<a@b.com>")
+    return STANDARD_ERROR;
+  if (reader.GetLine(line) || line != "RCPT TO:<c@d.com>")
+    return STANDARD_ERROR;
+  if (reader.GetLine(line) != SOCKET_WOULD_BLOCK)
+    return STANDARD_ERROR;
+  writer.PutMessage("TA\r");
+  if (reader.GetLine(line) != SOCKET_WOULD_BLOCK)
+    return STANDARD_ERROR;
+  writer.PutMessage("\n");
+  if (reader.GetLine(line) || line != "DATA")
+    return STANDARD_ERROR;
+
+  // A DATA block larger than the receive block, terminator split in two
+  string body;
+  while (body.size() < 3 * BUFFER_BLOCK_SIZE)
+    body += "Subject: test\r\n..stuffed line\r\n";
+  writer.PutMessage(body + "\r\n.");
+  string collected;
+  string_view data;
+  bool complete = false;
+  RC rc;
+  while (collected.size() < body.size() - 1) {
+    rc = reader.GetData(data, complete);
+    if (rc == SOCKET_WOULD_BLOCK)
+      continue;
+    if (rc || complete || reader.GetBufferedSize() > BUFFER_BLOCK_SIZE)
+      return STANDARD_ERROR;
+    collected.append(data);
+  }
+  writer.PutMessage("\r\nQUIT\r\n");
+  while (!complete) {
+    rc = reader.GetData(data, complete);
+    if (rc == SOCKET_WOULD_BLOCK)
+      continue;
+    if (rc)
+      return STANDARD_ERROR;
+    collected.append(data);
+  }
+  if (collected != body + "\r\n")
+    return STANDARD_ERROR;
+  if (reader.GetLine(line) || line != "QUIT")
+    return STANDARD_ERROR;
+
+  // An empty DATA block
+  writer.PutMessage(".\r\n");
+  if (reader.GetData(data, complete) || !data.empty() || !complete)
+    return STANDARD_ERROR;
+
+  // A line without CRLF must not grow the buffer forever
+  writer.PutMessage(string(LINE_MAX_LENGTH, 'x'));
+  while ((rc = reader.GetLine(line)) == SOCKET_WOULD_BLOCK) {}
+  return rc == SOCKET_LINE_TOO_LONG ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestBufferPool ()
+{
+  BufferPool *pool = BufferPool::instance();
+  size_t used = pool->GetUsedSize();
+
+  // Blocks go back to the thread cache and are handed out again
+  vector<char *> blocks;
+  for (int i = 0; i < 3 * BUFFER_SLAB_BLOCKS; ++i)
+    blocks.push_back(pool->Acquire());
+  size_t slabs = pool->GetSlabNumber();
+  for (char *block : blocks)
+    pool->Release(block);
+  for (int i = 0; i < 3 * BUFFER_SLAB_BLOCKS; ++i)
+    blocks[i] = pool->Acquire();
+  for (char *block : blocks)
+    pool->Release(block);
+  if (pool->GetSlabNumber() != slabs || pool->GetUsedSize() != used)
+    return STANDARD_ERROR;
+
+  // The connection budget, then the global budget refuse a charge
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket first(pair[0]);
+  DataSocket second(pair[1]);
+  first.SetBudget(1000);
+  if (first.Charge(600) || first.Charge(600) != SOCKET_OVER_BUDGET)
+    return STANDARD_ERROR;
+
+  size_t budget = pool->GetBudget();
+  pool->SetBudget(pool->GetUsedSize() + 1000);
+  RC rc = second.Charge(600) || second.Charge(600) != SOCKET_OVER_BUDGET ? STANDARD_ERROR : SUCCESS;
+  pool->SetBudget(budget);
+  first.Discharge(600);
+  if (rc || pool->GetUsedSize() != used + 600)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  result = TestListenAccept();
+  cout << "TestListenAccept: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestScanLevels();
+  cout << "TestScanLevels (" << GetScanLevel() << "): " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestLineReader();
+  cout << "TestLineReader: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestBufferPool();
+  cout << "TestBufferPool: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  return (rc);
+}
@@ -0,0 +1,247 @@
+/*
+ * unit_test_wal.cpp
+ *
+ * This file provides unit test for wal.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+#include "unit_test_wal.h"
+using namespace std;
+
+static void RemoveLog ()
+{
+  if (system((string("rm -rf ") + TEST_LOG + " " + TEST_FILE).c_str())) {}
+}
+
+static size_t CountLogFiles ()
+{
+  size_t number = 0;
+  DIR *directory = opendir(TEST_LOG);
+  struct dirent *entry;
+  while (directory && (entry = readdir(directory))) {
+    if (string(entry->d_name).find(WAL_EXTENSION) != string::npos)
+      ++number;
+  }
+  if (directory)
+    closedir(directory);
+  return number;
+}
+
+// A record puts its bytes at the offset in front of them
+static RC WriteBytes (const string &path, string_view payload)
+{
+  uint64_t offset;
+  memcpy(&offset, payload.data(), sizeof(offset));
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  ssize_t length = payload.size() - sizeof(offset);
+  bool written = pwrite(fd, payload.data() + sizeof(offset), length, offset) == length;
+  close(fd);
+  return written ? SUCCESS : STANDARD_ERROR;
+}
+
+static string Payload (uint64_t offset, const string &bytes)
+{
+  return string(reinterpret_cast<const char *>(&offset), sizeof(offset)) + bytes;
+}
+
+static string ReadBack ()
+{
+  char buffer[256];
+  int fd = open(TEST_FILE, O_RDONLY);
+  ssize_t length = fd == -1 ? 0 : pread(fd, buffer, sizeof(buffer), 0);
+  if (fd != -1)
+    close(fd);
+  return string(buffer, length > 0 ? length : 0);
+}
+
+// Open as after a restart and replay what the log holds
+static RC Restart (size_t &replayed)
+{
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  wal->Close();
+  replayed = 0;
+  wal->SetHandler(TEST_OWNER, [&replayed](const string &path, string_view payload) {
+    ++replayed;
+    return WriteBytes(path, payload);
+  });
+  RC rc = wal->Open(TEST_LOG);
+  return rc ? rc : wal->Recover();
+}
+
+// Changes logged but never applied are there after the restart
+static RC TestRecover ()
+{
+  RemoveLog();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  size_t replayed;
+  if (Restart(replayed) || replayed != 0)
+    return STANDARD_ERROR;
+
+  RC rc = SUCCESS;
+  for (size_t i = 0; i < 8 && !rc; ++i) {
+    string payload = Payload(i, string(1, 'a' + i));
+    rc = wal->Write(TEST_OWNER, TEST_FILE, payload, [&] { return i < 4 ? WriteBytes(TEST_FILE, payload) : SUCCESS; });
+  }
+  // The later change to the same byte wins
+  if (rc || wal->Write(TEST_OWNER, TEST_FILE, Payload(0, "z"), [] { return SUCCESS; }) || ReadBack() != "abcd")
+    return STANDARD_ERROR;
+
+  if (Restart(replayed) || replayed != 9 || ReadBack() != "zbcdefgh" || CountLogFiles() != 1)
+    return STANDARD_ERROR;
+
+  // Replayed once, then gone with the checkpoint of Recover()
+  return Restart(replayed) || replayed != 0 ? STANDARD_ERROR : SUCCESS;
+}
+
+// A record torn by the crash ends the log
+static RC TestTornRecord ()
+{
+  RemoveLog();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  size_t replayed;
+  if (Restart(replayed))
+    return STANDARD_ERROR;
+  for (size_t i = 0; i < 3; ++i) {
+    if (wal->Write(TEST_OWNER, TEST_FILE, Payload(i, "x"), [] { return SUCCESS; }))
+      return STANDARD_ERROR;
+  }
+
+  // Half a record at the end of the log file
+  DIR *directory = opendir(TEST_LOG);
+  struct dirent *entry;
+  string name;
+  while ((entry = readdir(directory))) {
+    if (string(entry->d_name).find(WAL_EXTENSION) != string::npos)
+      name = string(TEST_LOG) + entry->d_name;
+  }
+  closedir(directory);
+  int fd = open(name.c_str(), O_WRONLY | O_APPEND);
+  WalRecordHeader header = {};
+  header.magic  = WAL_MAGIC;
+  header.lsn    = 4;
+  header.length = 100;
+  bool written = write(fd, &header, sizeof(header)) == sizeof(header);
+  close(fd);
+
+  return written && Restart(replayed) == SUCCESS && replayed == 3 && ReadBack() == "xxx" ? SUCCESS : STANDARD_ERROR;
+}
+
+// A change whose apply failed is not made by the restart, the others are
+static RC TestFailedApply ()
+{
+  RemoveLog();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  size_t replayed;
+  if (Restart(replayed))
+    return STANDARD_ERROR;
+  if (wal->Write(TEST_OWNER, TEST_FILE, Payload(0, "a"), [] { return SUCCESS; }) ||
+      wal->Write(TEST_OWNER, TEST_FILE, Payload(1, "x"), [] { return STANDARD_ERROR; }) != STANDARD_ERROR ||
+      wal->Write(TEST_OWNER, TEST_FILE, Payload(2, "c"), [] { return SUCCESS; }))
+    return STANDARD_ERROR;
+  return Restart(replayed) == SUCCESS && replayed == 2 && ReadBack() == string("a\0c", 3) ? SUCCESS : STANDARD_ERROR;
+}
+
+// A checkpoint leaves nothing to replay
+static RC TestCheckpoint ()
+{
+  RemoveLog();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  size_t replayed;
+  if (Restart(replayed))
+    return STANDARD_ERROR;
+  string payload = Payload(0, "checkpointed");
+  if (wal->Write(TEST_OWNER, TEST_FILE, payload, [&] { return WriteBytes(TEST_FILE, payload); }) ||
+      wal->GetSize() == 0 || wal->Checkpoint() || wal->GetSize() != 0 || CountLogFiles() != 1)
+    return STANDARD_ERROR;
+
+  payload = Payload(0, "after");
+  if (wal->Write(TEST_OWNER, TEST_FILE, payload, [] { return SUCCESS; }))
+    return STANDARD_ERROR;
+  return Restart(replayed) == SUCCESS && replayed == 1 && ReadBack() == "afterpointed" ? SUCCESS : STANDARD_ERROR;
+}
+
+// Writers in several threads share the syncs, every change survives in order
+static RC TestConcurrentWrites ()
+{
+  RemoveLog();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  size_t replayed;
+  if (Restart(replayed))
+    return STANDARD_ERROR;
+
+  std::atomic<int> failed(0);
+  vector<thread> writers;
+  for (size_t t = 0; t < 4; ++t) {
+    writers.emplace_back([&, t] {
+      string path = string(TEST_FILE) + to_string(t);
+      for (uint64_t i = 0; i < 200; ++i) {
+        string payload = Payload(0, to_string(i));
+        if (wal->Write(TEST_OWNER, path, payload, [&] { return WriteBytes(path, payload); }))
+          ++failed;
+      }
+    });
+  }
+  // Checkpoints taken while the writers go on
+  std::atomic<bool> done(false);
+  thread checkpointer([&] {
+    while (!done) {
+      if (wal->Checkpoint())
+        ++failed;
+    }
+  });
+  for (thread &writer : writers)
+    writer.join();
+  done = true;
+  checkpointer.join();
+
+  RC rc = failed ? STANDARD_ERROR : Restart(replayed);
+  for (size_t t = 0; t < 4 && !rc; ++t) {
+    string path = string(TEST_FILE) + to_string(t);
+    char buffer[4] = {};
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1 || pread(fd, buffer, 3, 0) != 3 || string(buffer) != "199")
+      rc = STANDARD_ERROR;
+    if (fd != -1)
+      close(fd);
+    unlink(path.c_str());
+  }
+  return rc;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  result = TestRecover();
+  cout << "TestRecover: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestTornRecord();
+  cout << "TestTornRecord: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestFailedApply();
+  cout << "TestFailedApply: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestCheckpoint();
+  cout << "TestCheckpoint: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestConcurrentWrites();
+  cout << "TestConcurrentWrites: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  WriteAheadLog::instance()->Close();
+  RemoveLog();
+  return (rc);
+}
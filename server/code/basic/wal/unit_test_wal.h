@@ -0,0 +1,21 @@
+/*
+ * unit_test_wal.h
+ *
+ * This file provides unit test for wal.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "wal.h"
+
+const char TEST_LOG[]  = "unit_test_wal.data/";
+const char TEST_FILE[] = "unit_test_wal.file";
+
+#define TEST_OWNER 1
+
+#endif
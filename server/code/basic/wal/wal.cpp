@@ -0,0 +1,476 @@
+/*
+ * wal.cpp
+ *
+ * This file provides the write-ahead log shared by the managers and the
+ * checksum of its records.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "wal.h"
+
+/************ Checksum *************/
+namespace {
+
+struct Crc32cTable {
+  uint32_t entries[256];
+
+  Crc32cTable ()
+  {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit)
+        crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+      entries[i] = crc;
+    }
+  }
+};
+
+uint32_t Crc32cScalar (const unsigned char *bytes, size_t length, uint32_t crc)
+{
+  static const Crc32cTable table;
+  while (length--)
+    crc = table.entries[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t Crc32cSSE42 (const unsigned char *bytes, size_t length, uint32_t crc)
+{
+  uint64_t crc64 = crc;
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    bytes  += 8;
+    length -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+  while (length--)
+    crc = __builtin_ia32_crc32qi(crc, *bytes++);
+  return crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cFunction)(const unsigned char *bytes, size_t length, uint32_t crc);
+
+Crc32cFunction ChooseCrc32c ()
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+    return Crc32cSSE42;
+#endif
+  return Crc32cScalar;
+}
+
+}
+
+uint32_t Crc32c (const void *data, size_t length, uint32_t crc)
+{
+  static const Crc32cFunction function = ChooseCrc32c();
+  return ~function(static_cast<const unsigned char *>(data), length, ~crc);
+}
+
+/************ Helper Functions *************/
+static uint32_t RecordChecksum (const WalRecordHeader &header, const char *rest)
+{
+  // Everything after the checksum field, then the path and the payload
+  const char *fields = reinterpret_cast<const char *>(&header.lsn);
+  uint32_t crc = Crc32c(fields, reinterpret_cast<const char *>(&header + 1) - fields);
+  return Crc32c(rest, header.pathLength + header.length, crc);
+}
+
+/************ WriteAheadLog *************/
+WriteAheadLog::WriteAheadLog()
+  : _open(false),
+    _fd(-1),
+    _size(0),
+    _nextLsn(1),
+    _written(0),
+    _synced(0),
+    _stopping(false)
+{
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+  StopCheckpoints();
+  Close();
+}
+
+WriteAheadLog* WriteAheadLog::instance ()
+{
+  static WriteAheadLog *wal = new WriteAheadLog();
+  return wal;
+}
+
+RC WriteAheadLog::Open (const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _path = path;
+  if (_path.empty() || _path.back() != '/')
+    _path += '/';
+  if (mkdir(_path.c_str(), 0700) && errno != EEXIST)
+    return WAL_OPEN_ERROR;
+  return SUCCESS;
+}
+
+void WriteAheadLog::SetHandler (uint16_t owner, Handler handler)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  if (owner < WAL_OWNER_MAX)
+    _handlers[owner] = std::move(handler);
+}
+
+RC WriteAheadLog::Recover (unsigned threads)
+{
+  std::lock_guard<std::mutex> checkpointing(_checkpointLock);
+
+  // Log files are named after their first LSN, the name order is the log order
+  std::vector<std::string> names;
+  std::string extension = WAL_EXTENSION;
+  DIR *directory = opendir(_path.c_str());
+  if (!directory)
+    return WAL_OPEN_ERROR;
+  struct dirent *entry;
+  while ((entry = readdir(directory))) {
+    std::string name = entry->d_name;
+    if (name.size() > extension.size() && !name.compare(name.size() - extension.size(), extension.size(), extension))
+      names.push_back(_path + name);
+  }
+  closedir(directory);
+  std::sort(names.begin(), names.end());
+
+  std::vector<std::string> records;
+  for (const std::string &name : names) {
+    RC rc = ReadFile(name, records);
+    if (rc)
+      return rc;
+  }
+
+  // The records of one file go to one thread, so they are replayed in order
+  threads = std::max(threads, 1u);
+  std::vector<std::vector<const std::string *>> parts(threads);
+  std::set<std::string> dirty;
+  uint64_t lastLsn = 0;
+  for (const std::string &record : records) {
+    const WalRecordHeader *header = reinterpret_cast<const WalRecordHeader *>(record.data());
+    std::string path = record.substr(sizeof(WalRecordHeader), header->pathLength);
+    parts[std::hash<std::string>()(path) % threads].push_back(&record);
+    dirty.insert(path);
+    lastLsn = header->lsn;
+  }
+
+  // Nothing is replayed of a change that failed to apply, nor its cancel
+  std::set<uint64_t> cancelled;
+  for (const std::string &record : records) {
+    const WalRecordHeader *header = reinterpret_cast<const WalRecordHeader *>(record.data());
+    uint64_t lsn;
+    if (header->owner == WAL_OWNER_CANCEL && header->length == sizeof(lsn)) {
+      memcpy(&lsn, record.data() + sizeof(WalRecordHeader) + header->pathLength, sizeof(lsn));
+      cancelled.insert(lsn);
+    }
+  }
+
+  std::vector<RC> results(threads, SUCCESS);
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([this, &parts, &results, &cancelled, i] {
+      for (const std::string *record : parts[i]) {
+        const WalRecordHeader *header = reinterpret_cast<const WalRecordHeader *>(record->data());
+        if (header->owner == WAL_OWNER_CANCEL || cancelled.count(header->lsn))
+          continue;
+        std::string path = record->substr(sizeof(WalRecordHeader), header->pathLength);
+        std::string_view payload(record->data() + sizeof(WalRecordHeader) + header->pathLength, header->length);
+        RC rc = header->owner < WAL_OWNER_MAX && _handlers[header->owner] ?
+                _handlers[header->owner](path, payload) : WAL_CORRUPTED;
+        if (rc) {
+          results[i] = rc;
+          return;
+        }
+      }
+    });
+  }
+  for (std::thread &worker : workers)
+    worker.join();
+  for (RC rc : results) {
+    if (rc)
+      return rc;
+  }
+
+  // A new log file, and the replayed files on the disk before the old ones go
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _nextLsn = lastLsn + 1;
+    _written = _synced = lastLsn;
+    _files.clear();
+    RC rc = StartFile();
+    if (rc)
+      return rc;
+  }
+  RC rc = SyncFiles(dirty);
+  if (rc)
+    return rc;
+  for (const std::string &name : names)
+    unlink(name.c_str());
+  SyncDirectory();
+  return SUCCESS;
+}
+
+RC WriteAheadLog::Write (uint16_t owner, const std::string &path, std::string_view payload,
+                         const std::function<RC()> &apply)
+{
+  if (!IsOpen())
+    return apply();
+
+  std::shared_lock<std::shared_mutex> operation(_operationLock);
+  uint64_t lsn;
+  RC rc = Append(owner, path, payload, lsn);
+  if (rc)
+    return rc;
+  rc = apply();
+
+  // The caller is told it failed, so the next start must not make the change;
+  // if the cancel is lost too the change is replayed, as before it was added
+  if (rc) {
+    uint64_t cancel;
+    Append(WAL_OWNER_CANCEL, path, std::string_view(reinterpret_cast<const char *>(&lsn), sizeof(lsn)), cancel);
+  }
+  return rc;
+}
+
+RC WriteAheadLog::Checkpoint ()
+{
+  std::lock_guard<std::mutex> checkpointing(_checkpointLock);
+
+  // Every change logged before the new file has been applied once the lock is ours
+  std::vector<std::string> old;
+  std::set<std::string> dirty;
+  {
+    std::unique_lock<std::shared_mutex> operation(_operationLock);
+    std::lock_guard<std::mutex> lock(_lock);
+    if (_fd == -1)
+      return WAL_NOT_OPEN;
+    old = _files;
+    RC rc = StartFile();
+    if (rc)
+      return rc;
+    dirty.swap(_dirty);
+  }
+
+  RC rc = SyncFiles(dirty);
+  if (rc) {
+    std::lock_guard<std::mutex> lock(_lock);
+    _dirty.insert(dirty.begin(), dirty.end());
+    return rc;
+  }
+
+  for (const std::string &name : old)
+    unlink(name.c_str());
+  SyncDirectory();
+  std::lock_guard<std::mutex> lock(_lock);
+  _files.erase(_files.begin(), _files.begin() + old.size());
+  return SUCCESS;
+}
+
+void WriteAheadLog::StartCheckpoints (unsigned interval)
+{
+  StopCheckpoints();
+  _stopping = false;
+  _checkpointer = std::thread([this, interval] {
+    std::unique_lock<std::mutex> lock(_checkpointerLock);
+    while (!_stopping) {
+      _wake.wait_for(lock, std::chrono::seconds(interval),
+                     [this] { return _stopping || GetSize() >= WAL_CHECKPOINT_SIZE; });
+      if (_stopping)
+        break;
+      lock.unlock();
+      Checkpoint();
+      lock.lock();
+    }
+  });
+}
+
+void WriteAheadLog::StopCheckpoints ()
+{
+  {
+    std::lock_guard<std::mutex> lock(_checkpointerLock);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  if (_checkpointer.joinable())
+    _checkpointer.join();
+}
+
+void WriteAheadLog::Close ()
+{
+  std::unique_lock<std::shared_mutex> operation(_operationLock);
+  std::lock_guard<std::mutex> lock(_lock);
+  if (_fd != -1)
+    close(_fd);
+  _fd      = -1;
+  _open    = false;
+  _size    = 0;
+  _nextLsn = 1;
+  _written = _synced = 0;
+  _files.clear();
+  _dirty.clear();
+}
+
+uint64_t WriteAheadLog::GetSize ()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _size;
+}
+
+// Private helper functions
+RC WriteAheadLog::Append (uint16_t owner, const std::string &path, std::string_view payload, uint64_t &lsn)
+{
+  std::string record(sizeof(WalRecordHeader) + path.size() + payload.size(), '\0');
+  WalRecordHeader header = {};
+  header.magic      = WAL_MAGIC;
+  header.owner      = owner;
+  header.pathLength = path.size();
+  header.length     = payload.size();
+  memcpy(&record[sizeof(header)], path.data(), path.size());
+  memcpy(&record[sizeof(header) + path.size()], payload.data(), payload.size());
+
+  int fd;
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (_fd == -1)
+      return WAL_NOT_OPEN;
+    lsn = header.lsn = _nextLsn;
+    header.checksum  = RecordChecksum(header, record.data() + sizeof(header));
+    memcpy(&record[0], &header, sizeof(header));
+
+    size_t written = 0;
+    while (written < record.size()) {
+      ssize_t bytes = pwrite(_fd, record.data() + written, record.size() - written, _size + written);
+      if (bytes == -1 && errno == EINTR)
+        continue;
+      if (bytes <= 0)
+        return WAL_WRITE_ERROR;
+      written += bytes;
+    }
+    ++_nextLsn;
+    _size   += record.size();
+    _written = lsn;
+    _dirty.insert(path);
+    fd   = _fd;
+    full = _size >= WAL_CHECKPOINT_SIZE;
+  }
+
+  // One sync covers every record written before it started
+  {
+    std::lock_guard<std::mutex> syncing(_syncLock);
+    if (_synced < lsn) {
+      uint64_t written;
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        written = _written;
+      }
+      if (fdatasync(fd))
+        return WAL_WRITE_ERROR;
+      _synced = written;
+    }
+  }
+  if (full)
+    _wake.notify_one();
+  return SUCCESS;
+}
+
+
+
+RC WriteAheadLog::ReadFile (const std::string &name, std::vector<std::string> &records)
+{
+  int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return WAL_OPEN_ERROR;
+
+  uint64_t expected = records.empty() ? 0 :
+                      reinterpret_cast<const WalRecordHeader *>(records.back().data())->lsn + 1;
+  uint64_t offset = 0;
+  while (true) {
+    WalRecordHeader header;
+    if (pread(fd, &header, sizeof(header), offset) != sizeof(header) || header.magic != WAL_MAGIC ||
+        (expected && header.lsn != expected))
+      break;
+
+    std::string record(sizeof(header) + header.pathLength + header.length, '\0');
+    size_t rest = record.size() - sizeof(header);
+    if (pread(fd, &record[sizeof(header)], rest, offset + sizeof(header)) != static_cast<ssize_t>(rest) ||
+        header.checksum != RecordChecksum(header, record.data() + sizeof(header)))
+      break;
+    memcpy(&record[0], &header, sizeof(header));
+    records.push_back(std::move(record));
+    expected = header.lsn + 1;
+    offset  += sizeof(header) + rest;
+  }
+  close(fd);
+  return SUCCESS;
+}
+
+RC WriteAheadLog::StartFile ()
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%020" PRIu64, _nextLsn);
+  std::string file = _path + name + WAL_EXTENSION;
+  int fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return WAL_OPEN_ERROR;
+  SyncDirectory();
+
+  // The records in the old file are synced, Write() waits for that
+  if (_fd != -1)
+    close(_fd);
+  _fd   = fd;
+  _size = 0;
+  _open = true;
+  _files.push_back(file);
+  return SUCCESS;
+}
+
+RC WriteAheadLog::SyncFiles (std::set<std::string> &paths)
+{
+  RC rc = SUCCESS;
+  for (auto path = paths.begin(); path != paths.end();) {
+    int fd = open(path->c_str(), O_RDONLY | O_CLOEXEC);
+    // A file removed since has nothing left to sync
+    if ((fd == -1 && errno == ENOENT) || (fd != -1 && fsync(fd) == 0)) {
+      if (fd != -1)
+        close(fd);
+      path = paths.erase(path);
+      continue;
+    }
+    if (fd != -1)
+      close(fd);
+    rc = WAL_WRITE_ERROR;
+    ++path;
+  }
+  return rc;
+}
+
+void WriteAheadLog::SyncDirectory ()
+{
+  int fd = open(_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+}
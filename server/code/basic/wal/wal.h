@@ -0,0 +1,244 @@
+#ifndef WRITE_AHEAD_LOG
+#define WRITE_AHEAD_LOG
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+
+/* ----- Define macros ----- */
+enum {
+  WAL_OPEN_ERROR = 351,
+  WAL_WRITE_ERROR,
+  WAL_READ_ERROR,
+  WAL_CORRUPTED,
+  WAL_NOT_OPEN,
+};
+
+#define WAL_MAGIC               0x4C415745          // "EWAL" at the start of every record
+#define WAL_CHECKPOINT_SIZE     (64 * 1024 * 1024)  // Log size at which a checkpoint is due
+#define WAL_CHECKPOINT_INTERVAL 30                  // Seconds between checkpoints at most
+#define WAL_RECOVERY_THREADS    4                   // Threads replaying the log after a crash
+#define WAL_OWNER_CANCEL        0                   // Cancels the record whose LSN is its payload
+#define WAL_OWNER_UIM           1                   // Records of the UserInfoManager
+#define WAL_OWNER_EDM           2                   // Records of the Email Data Manager
+#define WAL_OWNER_MAX           8
+const char WAL_EXTENSION[] = ".wal";
+
+/* ----- Define structs ----- */
+/**
+ * WalRecordHeader
+ * Written in front of every record, followed by the path of the file the
+ * record changes and the payload of its owner. The checksum covers the rest of
+ * the header, the path and the payload, so a record torn by a crash ends the
+ * log there.
+ */
+struct WalRecordHeader {
+  uint32_t magic;         // WAL_MAGIC
+  uint32_t checksum;      // CRC-32C of the fields below, the path and the payload
+  uint64_t lsn;           // Sequence number, one more than the record before
+  uint16_t owner;         // WAL_OWNER_CANCEL, WAL_OWNER_UIM, WAL_OWNER_EDM
+  uint16_t pathLength;
+  uint32_t length;        // Bytes of the payload
+  uint64_t reserved;
+};
+static_assert(sizeof(WalRecordHeader) == 32, "WalRecordHeader is stored as it is in the log");
+
+/**
+ * This function will compute the CRC-32C (Castagnoli) of the given bytes, with
+ * the SSE4.2 instruction when the CPU has it and a table otherwise.
+ * @param  const void * given as the start of the bytes.
+ *         size_t given as the number of bytes.
+ *         uint32_t given as the CRC of the bytes before, 0 to start.
+ * @return uint32_t as the CRC.
+ */
+uint32_t Crc32c (const void *data, size_t length, uint32_t crc = 0);
+
+/**
+ * WriteAheadLog
+ * This class is the redo log shared by the managers that keep files of their
+ * own. A change is written as a record and synced before it is applied to its
+ * file, so a crash in the middle of a change is repaired by applying it again.
+ * Records must therefore say what the file will hold, not what to add to it.
+ * Threads writing at the same time share one fdatasync() (group commit).
+ *
+ * A checkpoint starts a new log file, syncs every file changed by the records
+ * before it and removes the old log files. Only the records after the last
+ * checkpoint are ever replayed, so a restart takes as long as the log is,
+ * however much data there is. Recover() gives the records of different files
+ * to several threads; the records of one file are replayed in order.
+ *
+ * A change whose apply fails is cancelled: a WAL_OWNER_CANCEL record naming
+ * it is synced after it, and Recover() replays neither. So a change the
+ * caller was told failed never takes effect at the next start; what the
+ * failed apply left in the file is up to its owner, as without the log.
+ *
+ * Every owner sets its handler before Recover(), which must come before the
+ * first Write(). Until Open() the log is off and Write() only applies.
+ *
+ * Contained Public Functions:
+ *   WriteAheadLog* instance ()
+ *   RC   Open       (const std::string &path)
+ *   void SetHandler (uint16_t owner, Handler handler)
+ *   RC   Recover    (unsigned threads)
+ *   RC   Write      (uint16_t owner, const std::string &path, std::string_view payload,
+ *                    const std::function<RC()> &apply)
+ *   RC   Checkpoint ()
+ *   void StartCheckpoints (unsigned interval)
+ *   void StopCheckpoints  ()
+ *   void Close      ()
+ *   bool IsOpen     ()
+ *   uint64_t GetSize ()
+ */
+class WriteAheadLog
+{
+public:
+  typedef std::function<RC(const std::string &path, std::string_view payload)> Handler;
+
+  /**
+   * This function will initialize an instance for WriteAheadLog.
+   * @return pointer of WriteAheadLog.
+   */
+  static WriteAheadLog* instance();
+
+  /**
+   * This function will choose the directory of the log files, creating it if
+   * needed. Nothing is read before Recover().
+   * @param  const string given as the directory.
+   * @return SUCCESS if the directory is there.
+   *         WAL_OPEN_ERROR otherwise.
+   */
+  RC Open (const std::string &path);
+
+  /**
+   * This function will set what replays the records of one owner.
+   * @param uint16_t given as the owner.
+   *        Handler given as the function, given the path and the payload.
+   */
+  void SetHandler (uint16_t owner, Handler handler);
+
+  /**
+   * This function will replay the records after the last checkpoint, then
+   * take a checkpoint. A torn record ends the log, the ones after it have
+   * never been acknowledged.
+   * @param  unsigned given as the number of threads replaying.
+   * @return SUCCESS if every record has been replayed and the log is ready.
+   *         pre-defined error number of a handler or the files otherwise.
+   */
+  RC Recover (unsigned threads = WAL_RECOVERY_THREADS);
+
+  /**
+   * This function will log a change, wait until the record is on the disk and
+   * then apply the change. No checkpoint is taken in between. If apply fails
+   * the record is cancelled, so Recover() does not make the change later.
+   * @param  uint16_t given as the owner of the record.
+   *         const string given as the file the change is made to.
+   *         string_view given as the payload the handler of the owner replays.
+   *         function given as what makes the change.
+   * @return what apply returned if the record is on the disk.
+   *         WAL_WRITE_ERROR otherwise, nothing is applied then.
+   */
+  RC Write (uint16_t owner, const std::string &path, std::string_view payload, const std::function<RC()> &apply);
+
+  /**
+   * This function will start a new log file, sync the files changed so far and
+   * remove the log files before. If a file cannot be synced the old log files
+   * are kept and the next checkpoint tries again.
+   * @return SUCCESS if the old log files are gone.
+   *         pre-defined error number of the files otherwise.
+   */
+  RC Checkpoint ();
+
+  /**
+   * This function will take checkpoints in a background thread: after every
+   * interval, or sooner once the log reaches WAL_CHECKPOINT_SIZE.
+   * @param unsigned given as the interval in seconds.
+   */
+  void StartCheckpoints (unsigned interval = WAL_CHECKPOINT_INTERVAL);
+
+  /**
+   * This function will stop the checkpoint thread and wait for it.
+   */
+  void StopCheckpoints ();
+
+  /**
+   * This function will close the log file. The log is off until the next
+   * Open() and Recover().
+   */
+  void Close ();
+
+  bool IsOpen () const { return _open; };
+
+  /**
+   * This function will give the bytes written to the log since the last
+   * checkpoint.
+   * @return uint64_t as the number of bytes.
+   */
+  uint64_t GetSize ();
+
+protected:
+  WriteAheadLog();          // Constructor
+  ~WriteAheadLog();         // Destructor
+
+private:
+  std::string _path;                      // Directory of the log files, ends with '/'
+  Handler _handlers[WAL_OWNER_MAX];
+  std::atomic<bool> _open;                // A log file takes records
+  std::shared_mutex _operationLock;       // Held shared from logging to applying, alone to roll over
+  std::mutex _checkpointLock;             // One Checkpoint() at a time
+  std::mutex _lock;                       // Guards the members below
+  int _fd;                                // Log file taking the records
+  uint64_t _size;                         // Where the next record goes
+  uint64_t _nextLsn;
+  uint64_t _written;                      // Last LSN written
+  std::vector<std::string> _files;        // Log files, oldest first, the last one taking records
+  std::set<std::string> _dirty;           // Files changed since the last checkpoint
+  std::mutex _syncLock;                   // One fdatasync() at a time
+  uint64_t _synced;                       // Last LSN on the disk
+  std::thread _checkpointer;
+  std::mutex _checkpointerLock;
+  std::condition_variable _wake;
+  bool _stopping;
+
+  // Private helper functions
+  /**
+   * This function will write a record and wait until it is on the disk, with
+   * _operationLock held shared.
+   * @param  uint64_t stores the LSN of the record.
+   * @return SUCCESS if it is on the disk, WAL_WRITE_ERROR or WAL_NOT_OPEN otherwise.
+   */
+  RC Append (uint16_t owner, const std::string &path, std::string_view payload, uint64_t &lsn);
+
+  /**
+   * This function will read the valid records of one log file.
+   * @return SUCCESS if read, a torn end is cut off and not an error.
+   */
+  RC ReadFile (const std::string &name, std::vector<std::string> &records);
+
+  /**
+   * This function will create the log file that the next record goes into.
+   * @return SUCCESS if created, WAL_OPEN_ERROR otherwise.
+   */
+  RC StartFile ();
+
+  /**
+   * This function will sync a list of files.
+   * @return SUCCESS if all are on the disk, the ones that are not are kept.
+   */
+  RC SyncFiles (std::set<std::string> &paths);
+
+  void SyncDirectory ();
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * coroutine.cpp
+ *
+ * This file provides the coroutine task and the awaiters that let a session
+ * wait for the events of its connection.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include "coroutine.h"
+
+/************ SessionTask *************/
+SessionTask& SessionTask::operator=(SessionTask &&move) noexcept
+{
+  if (this != &move) {
+    if (_handle)
+      _handle.destroy();
+    _handle = move._handle;
+    move._handle = {};
+  }
+  return *this;
+}
+
+SessionTask::~SessionTask()
+{
+  if (_handle)
+    _handle.destroy();
+}
+
+void SessionTask::Resume ()
+{
+  if (!IsDone())
+    _handle.resume();
+}
+
+/************ ConnectionAwaiter *************/
+bool ConnectionAwaiter::await_suspend (std::coroutine_handle<>)
+{
+  int socketId = _connection.socket.GetSocketId();
+  switch (_kind) {
+    case WAIT_READABLE:
+      _rc = _reactor.SetInterest(socketId, true, false);
+      break;
+    case WAIT_WRITABLE:
+      // Stop reading while the replies drain
+      _rc = _reactor.SetInterest(socketId, false, true);
+      break;
+    case WAIT_TURN:
+      _reactor.Schedule(_connection);
+      break;
+    case WAIT_WORK:
+      // Neither read nor write until the completion comes back
+      _rc = _reactor.SetInterest(socketId, false, false);
+      break;
+  }
+  // Do not suspend if nothing is going to resume the session
+  return _rc == SUCCESS;
+}
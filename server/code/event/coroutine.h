@@ -0,0 +1,111 @@
+#ifndef EVENT_COROUTINE
+#define EVENT_COROUTINE
+
+/* ----- Include libries or files ----- */
+#include <coroutine>
+#include <exception>
+#include "reactor.h"
+
+/**
+ * SessionTask
+ * This class owns the coroutine that runs one session. The coroutine starts
+ * suspended, is resumed by the EventHandler whenever the event it waits for
+ * arrives, and stays suspended at its end until the task is destroyed, so the
+ * handler can see that it is done before freeing the connection.
+ *
+ * The frame only keeps the locals of the session loop, the session state itself
+ * lives in the ProtocolSession, so a suspended session costs a few hundred bytes.
+ *
+ * Contained Public Functions:
+ *   void Resume ()
+ *   bool IsDone ()
+ */
+class SessionTask
+{
+public:
+  struct promise_type {
+    SessionTask get_return_object () { return SessionTask(std::coroutine_handle<promise_type>::from_promise(*this)); };
+    std::suspend_always initial_suspend () noexcept { return {}; };
+    std::suspend_always final_suspend   () noexcept { return {}; };
+    void return_void () {};
+    void unhandled_exception () { std::terminate(); };
+  };
+
+  SessionTask() : _handle() {};
+  SessionTask(SessionTask &&move) noexcept : _handle(move._handle) { move._handle = {}; };
+  SessionTask& operator=(SessionTask &&move) noexcept;
+  SessionTask(const SessionTask &) = delete;
+  SessionTask& operator=(const SessionTask &) = delete;
+  ~SessionTask();
+
+  /**
+   * This function will run the coroutine until it waits again or returns.
+   */
+  void Resume ();
+
+  /**
+   * This function will tell if the coroutine has returned.
+   * @return true if there is nothing left to resume.
+   */
+  bool IsDone () const { return !_handle || _handle.done(); };
+
+private:
+  explicit SessionTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {};
+
+  std::coroutine_handle<promise_type> _handle;
+};
+
+/**
+ * ConnectionAwaiter
+ * These awaiters suspend a session until its connection has something to do.
+ * They only tell the Reactor what to wait for, the EventHandler resumes the
+ * SessionTask of the connection when the event arrives.
+ *
+ *   co_await WaitReadable(reactor, connection)  input arrived
+ *   co_await WaitWritable(reactor, connection)  the send buffer has room again
+ *   co_await Yield(reactor, connection)         the other sessions had their turn
+ *   co_await WaitWork(reactor, connection)      work handed to a WorkerPool is done
+ *
+ * Each one gives SUCCESS once resumed, or the error of the Reactor without
+ * suspending if the wait could not be set up.
+ */
+class ConnectionAwaiter
+{
+public:
+  enum WaitKind { WAIT_READABLE, WAIT_WRITABLE, WAIT_TURN, WAIT_WORK };
+
+  ConnectionAwaiter(Reactor &reactor, Connection &connection, WaitKind kind)
+    : _reactor(reactor), _connection(connection), _kind(kind), _rc(SUCCESS) {};
+
+  bool await_ready () const noexcept { return false; };
+  bool await_suspend (std::coroutine_handle<>);
+  RC   await_resume () const noexcept { return _rc; };
+
+private:
+  Reactor    &_reactor;
+  Connection &_connection;
+  WaitKind    _kind;
+  RC          _rc;
+};
+
+inline ConnectionAwaiter WaitReadable (Reactor &reactor, Connection &connection)
+{
+  return ConnectionAwaiter(reactor, connection, ConnectionAwaiter::WAIT_READABLE);
+}
+
+inline ConnectionAwaiter WaitWritable (Reactor &reactor, Connection &connection)
+{
+  return ConnectionAwaiter(reactor, connection, ConnectionAwaiter::WAIT_WRITABLE);
+}
+
+inline ConnectionAwaiter Yield (Reactor &reactor, Connection &connection)
+{
+  return ConnectionAwaiter(reactor, connection, ConnectionAwaiter::WAIT_TURN);
+}
+
+inline ConnectionAwaiter WaitWork (Reactor &reactor, Connection &connection)
+{
+  return ConnectionAwaiter(reactor, connection, ConnectionAwaiter::WAIT_WORK);
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * handler.cpp
+ *
+ * This file provides the Event Handler that runs the protocol sessions on top
+ * of the reactors.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include "handler.h"
+
+MailEventHandler::MailEventHandler(MailStore &store, const std::string &hostname,
+                                   int smtpPort, int pop3Port, WorkerPool *pool)
+  : _store(store),
+    _hostname(hostname),
+    _smtpPort(smtpPort),
+    _pop3Port(pop3Port),
+    _pool(pool)
+{
+}
+
+void MailEventHandler::OnAccept (Reactor &reactor, Connection &connection)
+{
+  SessionState *state = new SessionState();
+  if (connection.port == _pop3Port)
+    state->session.reset(new Pop3Session(connection.socket, _store, _hostname));
+  else
+    state->session.reset(new SmtpSession(connection.socket, _store, _hostname));
+  state->session->SetDeferWork(_pool != NULL);
+  state->task = RunSession(reactor, connection, *state);
+  connection.session = state;
+
+  Resume(reactor, connection);
+}
+
+void MailEventHandler::OnReadable (Reactor &reactor, Connection &connection)
+{
+  Resume(reactor, connection);
+}
+
+void MailEventHandler::OnWritable (Reactor &reactor, Connection &connection)
+{
+  Resume(reactor, connection);
+}
+
+void MailEventHandler::OnClose (Reactor &, Connection &connection)
+{
+  // Destroys the suspended coroutine frame with the session, unless a worker
+  // still uses the session
+  SessionState *state = static_cast<SessionState *>(connection.session);
+  if (state && state->working)
+    state->orphaned = true;
+  else
+    delete state;
+  connection.session = NULL;
+}
+
+/************ Helper Functions *************/
+SessionTask MailEventHandler::RunSession (Reactor &reactor, Connection &connection, SessionState &state)
+{
+  ProtocolSession &session = *state.session;
+  RC rc = session.Greet();
+
+  while (true) {
+    if (rc == PM_WORK_PENDING) {
+      if (SubmitWork(reactor, connection, state))
+        co_return;
+      if ((rc = co_await WaitWork(reactor, connection)))
+        co_return;
+      session.CompleteWork(state.workRc);
+      rc = session.Process();
+      continue;
+    }
+
+    // Process() never blocks, so a wake up without work only costs one call
+    if (rc == SUCCESS)
+      rc = co_await WaitReadable(reactor, connection);
+    else if (rc == PM_OUTPUT_PENDING)
+      rc = co_await WaitWritable(reactor, connection);
+    else if (rc == PM_INPUT_PENDING)
+      rc = co_await Yield(reactor, connection);
+    else
+      co_return;
+
+    if (rc)
+      co_return;
+    rc = session.Process();
+  }
+}
+
+RC MailEventHandler::SubmitWork (Reactor &reactor, Connection &connection, SessionState &state)
+{
+  int socketId    = connection.socket.GetSocketId();
+  uint64_t serial = connection.serial;
+  SessionState *owner = &state;
+
+  state.working = true;
+  RC rc = _pool->Submit(reactor,
+                        [owner, work = state.session->TakeWork()] { owner->workRc = work(); },
+                        [this, &reactor, owner, socketId, serial] {
+                          owner->working = false;
+                          if (owner->orphaned) {
+                            delete owner;
+                            return;
+                          }
+                          Connection *current = reactor.GetConnection(socketId);
+                          if (current && current->serial == serial)
+                            Resume(reactor, *current);
+                        });
+  if (rc)
+    state.working = false;
+  return rc;
+}
+
+void MailEventHandler::Resume (Reactor &reactor, Connection &connection)
+{
+  // Events that arrive while the work is out, such as an earlier Schedule(),
+  // must not resume the session
+  SessionState *state = static_cast<SessionState *>(connection.session);
+  if (state->working)
+    return;
+  state->task.Resume();
+  if (state->task.IsDone())
+    reactor.CloseConnection(connection.socket.GetSocketId());
+}
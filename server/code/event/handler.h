@@ -0,0 +1,80 @@
+#ifndef EVENT_HANDLER
+#define EVENT_HANDLER
+
+/* ----- Include libries or files ----- */
+#include <memory>
+#include <string>
+#include "coroutine.h"
+#include "reactor.h"
+#include "worker.h"
+#include "../manager/pm/pm.h"
+
+/**
+ * MailEventHandler
+ * This class connects the reactors to the Protocol Manager. It starts an SMTP
+ * or a POP3 session for each accepted connection, depending on the port, and
+ * runs it as a coroutine that waits for the socket events of its connection.
+ *
+ * While a session has replies that did not fit into the socket, the connection
+ * only waits for the socket to become writable and stops reading. A session
+ * with a full batch of pipelined commands yields to the other connections of
+ * its reactor before handling the rest.
+ *
+ * Given a WorkerPool, the storage calls of the sessions run on the pool: the
+ * session waits with its connection idle, and the completion brings it back to
+ * its reactor. A slow mailbox then only delays its own session.
+ */
+class MailEventHandler : public EventHandler
+{
+public:
+  MailEventHandler(MailStore &store, const std::string &hostname,
+                   int smtpPort = SMTP_PORT, int pop3Port = POP3_PORT, WorkerPool *pool = NULL);
+
+  void OnAccept   (Reactor &reactor, Connection &connection) override;
+  void OnReadable (Reactor &reactor, Connection &connection) override;
+  void OnWritable (Reactor &reactor, Connection &connection) override;
+  void OnClose    (Reactor &reactor, Connection &connection) override;
+
+private:
+  // Kept in Connection::session
+  struct SessionState {
+    std::unique_ptr<ProtocolSession> session;
+    SessionTask task;
+    bool working = false;    // Work of the session is on the pool
+    bool orphaned = false;   // Connection closed while working, freed by the completion
+    RC   workRc = SUCCESS;   // Result of the work
+  };
+
+  MailStore  &_store;
+  std::string _hostname;
+  int _smtpPort;
+  int _pop3Port;
+  WorkerPool *_pool;
+
+  /**
+   * This function will be the coroutine of one session: greet, then handle
+   * commands whenever the connection is ready, until the session ends.
+   * @param Reactor and Connection indicate where the session runs.
+   *        SessionState given as the session.
+   */
+  SessionTask RunSession (Reactor &reactor, Connection &connection, SessionState &state);
+
+  /**
+   * This function will submit the work of a session to the pool. The
+   * completion resumes the session on its reactor.
+   * @param Reactor and Connection indicate the session.
+   *        SessionState given as the session.
+   * @return SUCCESS if the work has been submitted.
+   *         pre-defined error number of WorkerPool::Submit() otherwise.
+   */
+  RC SubmitWork (Reactor &reactor, Connection &connection, SessionState &state);
+
+  /**
+   * This function will resume the coroutine of a connection and close the
+   * connection once the coroutine has returned.
+   * @param Reactor and Connection indicate the session.
+   */
+  void Resume (Reactor &reactor, Connection &connection);
+};
+
+#endif
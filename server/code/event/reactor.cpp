@@ -0,0 +1,327 @@
+/*
+ * reactor.cpp
+ *
+ * This file provides the event loops that accept connections and dispatch
+ * socket events to the Event Handler.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <cerrno>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+
+/************ EventHandler *************/
+void EventHandler::OnWritable (Reactor &reactor, Connection &connection)
+{
+  RC rc = connection.socket.Flush();
+  if (rc == SUCCESS)
+    reactor.SetInterest(connection.socket.GetSocketId(), true, false);
+  else if (rc != SOCKET_WOULD_BLOCK)
+    reactor.CloseConnection(connection.socket.GetSocketId());
+}
+
+/************ Reactor *************/
+Reactor::Reactor(unsigned id, EventHandler *handler)
+  : _id(id),
+    _handler(handler),
+    _epollId(-1),
+    _wakeId(-1),
+    _running(false),
+    _connectionNumber(0),
+    _acceptNumber(0),
+    _serialNumber(0)
+{
+}
+
+Reactor::~Reactor()
+{
+  // Close the remaining connections so the handler can free its sessions
+  for (size_t socketId = 0; socketId < _connections.size(); ++socketId) {
+    if (_connections[socketId])
+      CloseConnection(socketId);
+  }
+  if (_wakeId != -1)
+    close(_wakeId);
+  if (_epollId != -1)
+    close(_epollId);
+}
+
+RC Reactor::Init (const std::vector<int> &ports)
+{
+  _epollId = epoll_create1(EPOLL_CLOEXEC);
+  if (_epollId == -1)
+    return REACTOR_EPOLL_ERROR;
+
+  _wakeId = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_wakeId == -1)
+    return REACTOR_EPOLL_ERROR;
+
+  struct epoll_event event = {};
+  event.events  = EPOLLIN;
+  event.data.fd = _wakeId;
+  if (epoll_ctl(_epollId, EPOLL_CTL_ADD, _wakeId, &event))
+    return REACTOR_EPOLL_ERROR;
+
+  // Every reactor binds its own socket to each port with SO_REUSEPORT
+  _listeners.reserve(ports.size());
+  for (int port : ports) {
+    _listeners.emplace_back();
+    ServerSocket &listener = _listeners.back();
+    if (listener.Listen(port, true))
+      return REACTOR_LISTEN_ERROR;
+
+    event.events  = EPOLLIN;
+    event.data.fd = listener.GetSocketId();
+    if (epoll_ctl(_epollId, EPOLL_CTL_ADD, listener.GetSocketId(), &event))
+      return REACTOR_EPOLL_ERROR;
+  }
+
+  _running = true;
+  return SUCCESS;
+}
+
+RC Reactor::Run ()
+{
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+
+  bool posted = false;
+
+  while (_running.load(std::memory_order_acquire)) {
+    // Only poll while posted callbacks are waiting to run
+    int ready = epoll_wait(_epollId, events, REACTOR_MAX_EVENTS, posted ? 0 : -1);
+    if (ready == -1) {
+      if (errno == EINTR)
+        continue;
+      return REACTOR_EPOLL_ERROR;
+    }
+
+    for (int i = 0; i < ready; ++i) {
+      int socketId = events[i].data.fd;
+
+      if (socketId == _wakeId) {
+        uint64_t count;
+        while (read(_wakeId, &count, sizeof(count)) > 0) {}
+        continue;
+      }
+
+      ServerSocket *listener = FindListener(socketId);
+      if (listener) {
+        AcceptAll(*listener);
+        continue;
+      }
+
+      // The connection may have been closed by an earlier event in this batch
+      if (!GetConnection(socketId))
+        continue;
+
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        CloseConnection(socketId);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+        _handler->OnReadable(*this, *_connections[socketId]);
+      if ((events[i].events & EPOLLOUT) && GetConnection(socketId))
+        _handler->OnWritable(*this, *_connections[socketId]);
+    }
+
+    posted = RunPosted();
+  }
+
+  return SUCCESS;
+}
+
+void Reactor::Stop ()
+{
+  _running.store(false, std::memory_order_release);
+  if (_wakeId != -1) {
+    uint64_t one = 1;
+    if (write(_wakeId, &one, sizeof(one)) == -1) {
+      // The counter is already non-zero, the loop will wake up anyway
+    }
+  }
+}
+
+RC Reactor::CloseConnection (int socketId)
+{
+  Connection *connection = GetConnection(socketId);
+  if (!connection)
+    return SOCKET_INVALID;
+
+  _handler->OnClose(*this, *connection);
+  epoll_ctl(_epollId, EPOLL_CTL_DEL, socketId, NULL);
+  _connections[socketId].reset();
+  --_connectionNumber;
+  return SUCCESS;
+}
+
+RC Reactor::SetInterest (int socketId, bool readable, bool writable)
+{
+  Connection *connection = GetConnection(socketId);
+  if (!connection)
+    return SOCKET_INVALID;
+
+  // Most calls keep the interest as it is, skip the system call then
+  uint32_t events = (readable ? EPOLLIN | EPOLLRDHUP : 0u) | (writable ? EPOLLOUT : 0u);
+  if (events == connection->events)
+    return SUCCESS;
+
+  struct epoll_event event = {};
+  event.events  = events;
+  event.data.fd = socketId;
+  if (epoll_ctl(_epollId, EPOLL_CTL_MOD, socketId, &event))
+    return REACTOR_EPOLL_ERROR;
+  connection->events = events;
+  return SUCCESS;
+}
+
+void Reactor::Post (std::function<void()> callback)
+{
+  bool first;
+  {
+    std::lock_guard<std::mutex> lock(_postLock);
+    first = _posted.empty();
+    _posted.push_back(std::move(callback));
+  }
+
+  // One wake up is enough for every callback posted before the loop runs them
+  if (first && _wakeId != -1) {
+    uint64_t one = 1;
+    if (write(_wakeId, &one, sizeof(one)) == -1) {
+      // The counter is already non-zero, the loop will wake up anyway
+    }
+  }
+}
+
+void Reactor::Schedule (Connection &connection)
+{
+  int socketId    = connection.socket.GetSocketId();
+  uint64_t serial = connection.serial;
+  Post([this, socketId, serial] {
+    Connection *current = GetConnection(socketId);
+    if (current && current->serial == serial)
+      _handler->OnReadable(*this, *current);
+  });
+}
+
+Connection *Reactor::GetConnection (int socketId)
+{
+  if (socketId < 0 || static_cast<size_t>(socketId) >= _connections.size())
+    return NULL;
+  return _connections[socketId].get();
+}
+
+/************ Helper Functions *************/
+void Reactor::AcceptAll (ServerSocket &listener)
+{
+  int socketId;
+  while (listener.Accept(socketId) == SUCCESS) {
+    if (static_cast<size_t>(socketId) >= _connections.size())
+      _connections.resize(socketId * 2 + 1);
+    _connections[socketId].reset(new Connection(socketId, listener.GetPort(), _serialNumber++));
+    ++_connectionNumber;
+    _acceptNumber.fetch_add(1, std::memory_order_relaxed);
+
+    struct epoll_event event = {};
+    event.events  = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = socketId;
+    if (epoll_ctl(_epollId, EPOLL_CTL_ADD, socketId, &event)) {
+      _connections[socketId].reset();
+      --_connectionNumber;
+      continue;
+    }
+    _connections[socketId]->events = event.events;
+
+    _handler->OnAccept(*this, *_connections[socketId]);
+  }
+}
+
+ServerSocket *Reactor::FindListener (int socketId)
+{
+  for (ServerSocket &listener : _listeners) {
+    if (listener.GetSocketId() == socketId)
+      return &listener;
+  }
+  return NULL;
+}
+
+bool Reactor::RunPosted ()
+{
+  std::vector<std::function<void()>> posted;
+  {
+    std::lock_guard<std::mutex> lock(_postLock);
+    posted.swap(_posted);
+  }
+  for (std::function<void()> &callback : posted)
+    callback();
+
+  std::lock_guard<std::mutex> lock(_postLock);
+  return !_posted.empty();
+}
+
+/************ ReactorGroup *************/
+ReactorGroup::ReactorGroup(const ReactorConfig &config, EventHandler *handler)
+  : _config(config),
+    _handler(handler)
+{
+  unsigned cores = std::thread::hardware_concurrency();
+  if (cores == 0)
+    cores = 1;
+  if (_config.reactorNumber == 0)
+    _config.reactorNumber = cores;
+}
+
+ReactorGroup::~ReactorGroup()
+{
+  Stop();
+  Join();
+}
+
+RC ReactorGroup::Start ()
+{
+  RC rc;
+
+  // Bind every listener before starting any thread so a bad port fails early
+  for (unsigned i = 0; i < _config.reactorNumber; ++i) {
+    _reactors.emplace_back(new Reactor(i, _handler));
+    rc = _reactors.back()->Init(_config.ports);
+    if (rc) {
+      _reactors.clear();
+      return rc;
+    }
+  }
+
+  unsigned cores = std::thread::hardware_concurrency();
+  for (unsigned i = 0; i < _reactors.size(); ++i) {
+    Reactor *reactor = _reactors[i].get();
+    _threads.emplace_back([reactor] { reactor->Run(); });
+
+    if (_config.pinCpu && cores) {
+      cpu_set_t cpuSet;
+      CPU_ZERO(&cpuSet);
+      CPU_SET(i % cores, &cpuSet);
+      pthread_setaffinity_np(_threads.back().native_handle(), sizeof(cpuSet), &cpuSet);
+    }
+  }
+
+  return SUCCESS;
+}
+
+void ReactorGroup::Stop ()
+{
+  for (std::unique_ptr<Reactor> &reactor : _reactors)
+    reactor->Stop();
+}
+
+void ReactorGroup::Join ()
+{
+  for (std::thread &thread : _threads) {
+    if (thread.joinable())
+      thread.join();
+  }
+  _threads.clear();
+}
@@ -0,0 +1,238 @@
+#ifndef EVENT_REACTOR
+#define EVENT_REACTOR
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../basic/socket/socket.h"
+#include "../util/emailError.h"
+#include "../util/util.h"
+
+/* ----- Define macros ----- */
+enum {
+  REACTOR_EPOLL_ERROR = 401,
+  REACTOR_LISTEN_ERROR,
+  REACTOR_THREAD_ERROR,
+  REACTOR_NOT_RUNNING,
+};
+
+#define REACTOR_MAX_EVENTS 128
+
+class Reactor;
+
+/* ----- Define structs ----- */
+struct Connection {
+  explicit Connection(int socketId, int listenPort, uint64_t connectionSerial)
+    : socket(socketId), port(listenPort), session(NULL), events(0), serial(connectionSerial) {};
+
+  DataSocket socket;    // Accepted data socket, owned by the connection
+  int        port;      // Port the connection came in on (SMTP_PORT, POP3_PORT)
+  void      *session;   // Protocol state, owned and freed by the EventHandler
+  uint32_t   events;    // epoll events currently watched, kept by the Reactor
+  uint64_t   serial;    // Unique in the reactor, socket ids are reused
+};
+
+struct ReactorConfig {
+  std::vector<int> ports;   // Ports every reactor listens on
+  unsigned reactorNumber;   // Number of reactor threads, ZERO for one per core
+  bool     pinCpu;          // Pin reactor i to core (i % cores)
+};
+
+/**
+ * EventHandler
+ * This interface receives the connection events of a Reactor. All calls for one
+ * connection come from the reactor thread that accepted it, so per-connection
+ * state needs no locking. One handler may be shared by several reactors.
+ *
+ * OnWritable() is only called after the handler asked for it with
+ * Reactor::SetInterest(). By default it flushes the queued messages of the
+ * socket and goes back to reading.
+ */
+class EventHandler
+{
+public:
+  virtual ~EventHandler() {};
+  virtual void OnAccept   (Reactor &reactor, Connection &connection) = 0;
+  virtual void OnReadable (Reactor &reactor, Connection &connection) = 0;
+  virtual void OnWritable (Reactor &reactor, Connection &connection);
+  virtual void OnClose    (Reactor &reactor, Connection &connection) = 0;
+};
+
+/**
+ * Reactor
+ * This class runs one event loop. It owns its own SO_REUSEPORT listening
+ * sockets, its own epoll instance and its own connection table, so reactors
+ * never share an accept lock or hand connections to each other.
+ *
+ * Contained Public Functions:
+ *   RC Init  (const std::vector<int> &ports)
+ *   RC Run   ()
+ *   void Stop ()
+ *   RC CloseConnection (int socketId)
+ *   RC SetInterest (int socketId, bool readable, bool writable)
+ *   void Post (std::function<void()> callback)
+ *   void Schedule (Connection &connection)
+ *   Connection *GetConnection (int socketId)
+ */
+class Reactor
+{
+public:
+  Reactor(unsigned id, EventHandler *handler);
+  ~Reactor();
+  Reactor(const Reactor &) = delete;
+  Reactor& operator=(const Reactor &) = delete;
+
+  /**
+   * This function will create the epoll instance and one listening socket for
+   * each port, all bound with SO_REUSEPORT.
+   * @param  const vector<int> given as the ports to listen on.
+   * @return SUCCESS if the reactor is ready to run.
+   *         REACTOR_EPOLL_ERROR or REACTOR_LISTEN_ERROR otherwise.
+   */
+  RC Init (const std::vector<int> &ports);
+
+  /**
+   * This function will run the event loop in the calling thread until Stop().
+   * @return SUCCESS if stopped by Stop().
+   *         REACTOR_EPOLL_ERROR if epoll_wait() failed.
+   */
+  RC Run  ();
+
+  /**
+   * This function will ask the event loop to return. Safe to call from any
+   * thread.
+   */
+  void Stop ();
+
+  /**
+   * This function will notify the handler, remove the connection from epoll and
+   * close it. Must be called on the reactor thread.
+   * @param  int given as the socket id of the connection.
+   * @return SUCCESS if the connection has been closed.
+   *         SOCKET_INVALID if there is no such connection.
+   */
+  RC CloseConnection (int socketId);
+
+  /**
+   * This function will choose which events of a connection are watched. A
+   * connection that waits for its output to drain should stop reading, so a
+   * pipelining client cannot grow the reply queue without bound.
+   * @param  int given as the socket id of the connection.
+   *         bool readable to watch for input.
+   *         bool writable to watch for free space in the send buffer.
+   * @return SUCCESS if the interest has been changed.
+   *         REACTOR_EPOLL_ERROR otherwise.
+   */
+  RC SetInterest (int socketId, bool readable, bool writable);
+
+  /**
+   * This function will run a callback on the reactor thread after the events
+   * of the current round. Safe to call from any thread.
+   * @param function given as the callback.
+   */
+  void Post (std::function<void()> callback);
+
+  /**
+   * This function will call OnReadable() for a connection again after the
+   * events of the current round, unless it has been closed by then. Lets a
+   * session give up the thread while it still has input to handle.
+   * @param Connection indicates the connection to resume.
+   */
+  void Schedule (Connection &connection);
+
+  /**
+   * This function will look up a connection of this reactor.
+   * @param  int given as the socket id.
+   * @return pointer of Connection, NULL if not found.
+   */
+  Connection *GetConnection (int socketId);
+
+  unsigned GetId               () const { return _id; };
+  size_t   GetConnectionNumber () const { return _connectionNumber; };
+  unsigned long GetAcceptNumber() const { return _acceptNumber.load(std::memory_order_relaxed); };
+
+private:
+  unsigned _id;                  // Index of this reactor in its group
+  EventHandler *_handler;        // Receiver of connection events
+  int _epollId;                  // epoll instance
+  int _wakeId;                   // eventfd used by Stop() to wake epoll_wait()
+  std::atomic<bool> _running;    // Cleared by Stop()
+  std::vector<ServerSocket> _listeners;                  // One per port
+  std::vector<std::unique_ptr<Connection>> _connections; // Indexed by socket id
+  size_t _connectionNumber;                              // Live connections
+  std::atomic<unsigned long> _acceptNumber;              // Accepted so far
+  uint64_t _serialNumber;                                // Serial of the next connection
+  std::mutex _postLock;                                  // Guards _posted
+  std::vector<std::function<void()>> _posted;            // Callbacks given to Post()
+
+  // Private helper functions
+  /**
+   * This function will accept every pending connection on a listener.
+   * @param ServerSocket indicates the listener that became readable.
+   */
+  void AcceptAll (ServerSocket &listener);
+
+  /**
+   * This function will find the listener of the given socket id.
+   * @param int given as the socket id.
+   * @return pointer of ServerSocket, NULL if it is not a listener.
+   */
+  ServerSocket *FindListener (int socketId);
+
+  /**
+   * This function will run the callbacks posted so far.
+   * @return true if more callbacks have been posted meanwhile.
+   */
+  bool RunPosted ();
+};
+
+/**
+ * ReactorGroup
+ * This class starts N independent reactors on N threads, optionally pinned to
+ * cores. The kernel distributes connections between the reactors' listening
+ * sockets, so connection setup scales with the number of cores.
+ *
+ * Contained Public Functions:
+ *   RC Start ()
+ *   void Stop ()
+ *   void Join ()
+ *   Reactor &GetReactor (unsigned index)
+ */
+class ReactorGroup
+{
+public:
+  ReactorGroup(const ReactorConfig &config, EventHandler *handler);
+  ~ReactorGroup();
+
+  /**
+   * This function will initialize every reactor and start its thread.
+   * @return SUCCESS if all reactors are running.
+   *         pre-defined error number returned by Reactor::Init() otherwise.
+   */
+  RC   Start ();
+
+  /**
+   * This function will stop all reactors. Use Join() to wait for them.
+   */
+  void Stop  ();
+
+  /**
+   * This function will wait for every reactor thread to return.
+   */
+  void Join  ();
+
+  size_t   GetReactorNumber () const { return _reactors.size(); };
+  Reactor &GetReactor (unsigned index) { return *_reactors[index]; };
+
+private:
+  ReactorConfig _config;
+  EventHandler *_handler;
+  std::vector<std::unique_ptr<Reactor>> _reactors;
+  std::vector<std::thread> _threads;
+};
+
+#endif
@@ -0,0 +1,346 @@
+/*
+ * unit_test_reactor.cpp
+ *
+ * This file provides unit test for reactor.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <iostream>
+#include "unit_test_reactor.h"
+using namespace std;
+
+// Reply to every message with "+OK" and count the events
+class EchoHandler : public EventHandler
+{
+public:
+  std::atomic<int> accepted{0};
+  std::atomic<int> closed{0};
+
+  void OnAccept (Reactor &, Connection &) override { ++accepted; }
+  void OnClose  (Reactor &, Connection &) override { ++closed; }
+  void OnReadable (Reactor &reactor, Connection &connection) override
+  {
+    string message;
+    RC rc = connection.socket.GetMessage(message);
+    if (rc == SOCKET_WOULD_BLOCK)
+      return;
+    if (rc) {
+      reactor.CloseConnection(connection.socket.GetSocketId());
+      return;
+    }
+    connection.socket.PutMessage("+OK\r\n");
+  }
+};
+
+static int ConnectLocal (int port)
+{
+  int socketId = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {};
+  address.sin_family      = AF_INET;
+  address.sin_port        = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(socketId, reinterpret_cast<struct sockaddr *>(&address), sizeof(address))) {
+    close(socketId);
+    return INVALID_SOCKET_ID;
+  }
+  return socketId;
+}
+
+static RC TestReactorGroup ()
+{
+  EchoHandler handler;
+  ReactorConfig config;
+  config.ports         = { TEST_PORT };
+  config.reactorNumber = 2;
+  config.pinCpu        = true;
+
+  ReactorGroup group(config, &handler);
+  if (group.Start())
+    return STANDARD_ERROR;
+
+  for (int i = 0; i < TEST_CONNECTIONS; ++i) {
+    int socketId = ConnectLocal(TEST_PORT);
+    if (socketId == INVALID_SOCKET_ID)
+      return STANDARD_ERROR;
+    char reply[8] = {};
+    if (send(socketId, "NOOP\r\n", 6, 0) != 6 || recv(socketId, reply, 5, MSG_WAITALL) != 5)
+      return STANDARD_ERROR;
+    close(socketId);
+    if (string(reply) != "+OK\r\n")
+      return STANDARD_ERROR;
+  }
+
+  group.Stop();
+  group.Join();
+
+  unsigned long total = 0;
+  for (size_t i = 0; i < group.GetReactorNumber(); ++i)
+    total += group.GetReactor(i).GetAcceptNumber();
+
+  return (total == TEST_CONNECTIONS && handler.accepted == TEST_CONNECTIONS) ? SUCCESS : STANDARD_ERROR;
+}
+
+// Read from a blocking socket until the reply ends with the given text
+static string ReadUntil (int socketId, const string &last)
+{
+  string reply;
+  char buffer[512];
+  while (reply.size() < last.size() || reply.compare(reply.size() - last.size(), last.size(), last) != 0) {
+    ssize_t got = recv(socketId, buffer, sizeof(buffer), 0);
+    if (got <= 0)
+      break;
+    reply.append(buffer, got);
+  }
+  return reply;
+}
+
+static RC TestMailEventHandler ()
+{
+  CountingStore store;
+  MailEventHandler handler(store, "mail.example.com", TEST_SMTP_PORT, POP3_PORT);
+  ReactorConfig config;
+  config.ports         = { TEST_SMTP_PORT };
+  config.reactorNumber = 1;
+  config.pinCpu        = false;
+
+  ReactorGroup group(config, &handler);
+  if (group.Start())
+    return STANDARD_ERROR;
+
+  int socketId = ConnectLocal(TEST_SMTP_PORT);
+  if (socketId == INVALID_SOCKET_ID)
+    return STANDARD_ERROR;
+  ReadUntil(socketId, "ready\r\n");
+
+  string batch = "EHLO client\r\nMAIL FROM:<a@b.com>\r\nRCPT TO:<c@d.com>\r\nDATA\r\n";
+  send(socketId, batch.data(), batch.size(), 0);
+  string reply = ReadUntil(socketId, "354 End data with <CR><LF>.<CR><LF>\r\n");
+  string body = "Subject: test\r\n\r\nbody\r\n.\r\nQUIT\r\n";
+  send(socketId, body.data(), body.size(), 0);
+  reply += ReadUntil(socketId, "closing connection\r\n");
+  close(socketId);
+
+  group.Stop();
+  group.Join();
+
+  if (reply.find("250-PIPELINING") == string::npos || reply.find("221 ") == string::npos)
+    return STANDARD_ERROR;
+  return store.delivered == 1 ? SUCCESS : STANDARD_ERROR;
+}
+
+// More pipelined commands than one batch: the session yields and resumes
+static RC TestSessionYield ()
+{
+  CountingStore store;
+  MailEventHandler handler(store, "mail.example.com", TEST_SMTP_PORT, POP3_PORT);
+  ReactorConfig config;
+  config.ports         = { TEST_SMTP_PORT };
+  config.reactorNumber = 1;
+  config.pinCpu        = false;
+
+  ReactorGroup group(config, &handler);
+  if (group.Start())
+    return STANDARD_ERROR;
+
+  int first  = ConnectLocal(TEST_SMTP_PORT);
+  int second = ConnectLocal(TEST_SMTP_PORT);
+  if (first == INVALID_SOCKET_ID || second == INVALID_SOCKET_ID)
+    return STANDARD_ERROR;
+  ReadUntil(first, "ready\r\n");
+  ReadUntil(second, "ready\r\n");
+
+  string batch;
+  for (int i = 0; i < PROCESS_BATCH_SIZE * 3; ++i)
+    batch += "NOOP\r\n";
+  batch += "QUIT\r\n";
+  send(first, batch.data(), batch.size(), 0);
+  send(second, "NOOP\r\nQUIT\r\n", 12, 0);
+
+  string replies = ReadUntil(first, "closing connection\r\n");
+  string other   = ReadUntil(second, "closing connection\r\n");
+  close(first);
+  close(second);
+
+  group.Stop();
+  group.Join();
+
+  size_t count = 0;
+  for (size_t at = replies.find("250 OK"); at != string::npos; at = replies.find("250 OK", at + 1))
+    ++count;
+  return (count == PROCESS_BATCH_SIZE * 3 && other == "250 OK\r\n221 mail.example.com closing connection\r\n")
+         ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestWorkerPool ()
+{
+  WorkerPool pool(4);
+  if (pool.Start())
+    return STANDARD_ERROR;
+
+  // Half of the items come from outside, each of them spawns one from inside
+  std::atomic<int> done{0};
+  for (int i = 0; i < TEST_WORK_ITEMS / 2; ++i) {
+    pool.Submit([&pool, &done] {
+      ++done;
+      pool.Submit([&done] { ++done; }, PRIORITY_BACKGROUND);
+    });
+  }
+  pool.Stop();
+  return done == TEST_WORK_ITEMS ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestWorkPriority ()
+{
+  WorkerPool pool(1);
+  if (pool.Start())
+    return STANDARD_ERROR;
+
+  // Hold the only worker, then queue background work before interactive work
+  std::atomic<bool> hold{true};
+  pool.Submit([&hold] { while (hold) std::this_thread::yield(); });
+  vector<int> order;
+  pool.Submit([&order] { order.push_back(PRIORITY_BACKGROUND); }, PRIORITY_BACKGROUND);
+  pool.Submit([&order] { order.push_back(PRIORITY_INTERACTIVE); }, PRIORITY_INTERACTIVE);
+  hold = false;
+  pool.Stop();
+
+  return (order.size() == 2 && order[0] == PRIORITY_INTERACTIVE) ? SUCCESS : STANDARD_ERROR;
+}
+
+// A delivery stuck on the pool does not hold the other session of the reactor
+static RC TestPooledHandler ()
+{
+  CountingStore store;
+  store.slow = true;
+  WorkerPool pool(2);
+  if (pool.Start())
+    return STANDARD_ERROR;
+  MailEventHandler handler(store, "mail.example.com", TEST_SMTP_PORT, POP3_PORT, &pool);
+  ReactorConfig config;
+  config.ports         = { TEST_SMTP_PORT };
+  config.reactorNumber = 1;
+  config.pinCpu        = false;
+
+  ReactorGroup group(config, &handler);
+  if (group.Start())
+    return STANDARD_ERROR;
+
+  int first  = ConnectLocal(TEST_SMTP_PORT);
+  int second = ConnectLocal(TEST_SMTP_PORT);
+  if (first == INVALID_SOCKET_ID || second == INVALID_SOCKET_ID)
+    return STANDARD_ERROR;
+  ReadUntil(first, "ready\r\n");
+  ReadUntil(second, "ready\r\n");
+
+  string batch = "EHLO client\r\nMAIL FROM:<a@b.com>\r\nRCPT TO:<c@d.com>\r\nDATA\r\nbody\r\n.\r\nNOOP\r\n";
+  send(first, batch.data(), batch.size(), 0);
+  ReadUntil(first, "<CR><LF>.<CR><LF>\r\n");
+  send(second, "NOOP\r\n", 6, 0);
+  string other = ReadUntil(second, "250 OK\r\n");
+  int deliveredBefore = store.delivered;
+
+  store.slow = false;
+  string replies = ReadUntil(first, "250 OK\r\n250 OK\r\n");
+  close(first);
+  close(second);
+
+  group.Stop();
+  group.Join();
+  pool.Stop();
+
+  return (deliveredBefore == 0 && store.delivered == 1 && replies == "250 OK\r\n250 OK\r\n")
+         ? SUCCESS : STANDARD_ERROR;
+}
+
+// A delivery on the pool reads its own copy of the message, not the receive
+// block that goes back to the pool when the peer resets the connection
+static RC TestClosedDuringDelivery ()
+{
+  CountingStore store;
+  store.slow = true;
+  WorkerPool pool(1);
+  if (pool.Start())
+    return STANDARD_ERROR;
+  MailEventHandler handler(store, "mail.example.com", TEST_SMTP_PORT, POP3_PORT, &pool);
+  ReactorConfig config;
+  config.ports         = { TEST_SMTP_PORT };
+  config.reactorNumber = 1;
+  config.pinCpu        = false;
+
+  ReactorGroup group(config, &handler);
+  if (group.Start())
+    return STANDARD_ERROR;
+
+  int first = ConnectLocal(TEST_SMTP_PORT);
+  if (first == INVALID_SOCKET_ID)
+    return STANDARD_ERROR;
+  ReadUntil(first, "ready\r\n");
+  string batch = "EHLO client\r\nMAIL FROM:<a@b.com>\r\nRCPT TO:<c@d.com>\r\nDATA\r\n"
+                 "Subject: kept\r\n\r\n" + string(1000, 'k') + "\r\n.\r\n";
+  send(first, batch.data(), batch.size(), 0);
+  ReadUntil(first, "<CR><LF>.<CR><LF>\r\n");
+
+  // A reset gives EPOLLHUP and EPOLLERR while the delivery waits
+  struct linger reset = { 1, 0 };
+  setsockopt(first, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+  close(first);
+  while (group.GetReactor(0).GetConnectionNumber() != 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // The next connection of the reactor takes the block the first one had
+  int second = ConnectLocal(TEST_SMTP_PORT);
+  if (second == INVALID_SOCKET_ID)
+    return STANDARD_ERROR;
+  ReadUntil(second, "ready\r\n");
+  string noise = string(1200, 'z') + "\r\n";
+  send(second, noise.data(), noise.size(), 0);
+  ReadUntil(second, "not implemented\r\n");
+
+  store.slow = false;
+  while (store.delivered == 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  close(second);
+
+  group.Stop();
+  group.Join();
+  pool.Stop();
+
+  return store.lastBody == "Subject: kept\r\n\r\n" + string(1000, 'k') + "\r\n" ? SUCCESS : STANDARD_ERROR;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  result = TestReactorGroup();
+  cout << "TestReactorGroup: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestMailEventHandler();
+  cout << "TestMailEventHandler: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestSessionYield();
+  cout << "TestSessionYield: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestWorkerPool();
+  cout << "TestWorkerPool: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestWorkPriority();
+  cout << "TestWorkPriority: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestPooledHandler();
+  cout << "TestPooledHandler: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestClosedDuringDelivery();
+  cout << "TestClosedDuringDelivery: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  return (rc);
+}
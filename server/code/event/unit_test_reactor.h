@@ -0,0 +1,48 @@
+/*
+ * unit_test_reactor.h
+ *
+ * This file provides unit test for reactor.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <string>
+#include "handler.h"
+#include "reactor.h"
+#include "worker.h"
+
+#define TEST_PORT        20026
+#define TEST_SMTP_PORT   20027
+#define TEST_CONNECTIONS 16
+#define TEST_WORK_ITEMS  10000
+
+/* ----- MailStore that only counts deliveries ----- */
+class CountingStore : public MailStore
+{
+public:
+  std::atomic<int> delivered{0};
+  std::atomic<bool> slow{false};   // Deliver() waits until cleared
+  std::string lastBody;            // Read once delivered is seen
+
+  RC Deliver (const Envelope &, std::string_view data) override
+  {
+    while (slow)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    lastBody = std::string(data);
+    ++delivered;
+    return SUCCESS;
+  };
+  RC OpenMaildrop (const std::string &, const std::string &, std::unique_ptr<Maildrop> &) override
+  {
+    return PM_AUTH_FAILED;
+  };
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * worker.cpp
+ *
+ * This file provides the work-stealing worker pool that runs blocking and
+ * long work away from the reactor threads.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <system_error>
+#include "worker.h"
+
+// The pool and worker index of the calling thread, if it is a worker
+static thread_local WorkerPool *currentPool  = NULL;
+static thread_local unsigned    currentIndex = 0;
+
+/************ WorkDeque *************/
+WorkDeque::WorkDeque()
+  : _top(0),
+    _bottom(0)
+{
+  _arrays.emplace_back(new SlotArray(WORK_DEQUE_CAPACITY));
+  _array.store(_arrays.back().get(), std::memory_order_relaxed);
+}
+
+WorkDeque::~WorkDeque()
+{
+  // Items left behind are dropped with the pool
+  WorkItem *item;
+  while ((item = Pop()) != NULL)
+    delete item;
+}
+
+void WorkDeque::Push (WorkItem *item)
+{
+  int64_t bottom = _bottom.load(std::memory_order_relaxed);
+  int64_t top    = _top.load(std::memory_order_acquire);
+  SlotArray *array = _array.load(std::memory_order_relaxed);
+
+  if (bottom - top > array->capacity - 1) {
+    // Full: copy the live items to an array twice as large
+    SlotArray *grown = new SlotArray(array->capacity * 2);
+    for (int64_t i = top; i < bottom; ++i)
+      grown->Put(i, array->Get(i));
+    _arrays.emplace_back(grown);
+    _array.store(grown, std::memory_order_release);
+    array = grown;
+  }
+
+  array->Put(bottom, item);
+  std::atomic_thread_fence(std::memory_order_release);
+  _bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+WorkItem *WorkDeque::Pop ()
+{
+  int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+  SlotArray *array = _array.load(std::memory_order_relaxed);
+  _bottom.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t top = _top.load(std::memory_order_relaxed);
+
+  if (top > bottom) {
+    // Empty
+    _bottom.store(bottom + 1, std::memory_order_relaxed);
+    return NULL;
+  }
+
+  WorkItem *item = array->Get(bottom);
+  if (top == bottom) {
+    // The last item: race the thieves for it
+    if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      item = NULL;
+    _bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return item;
+}
+
+WorkItem *WorkDeque::Steal ()
+{
+  int64_t top = _top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t bottom = _bottom.load(std::memory_order_acquire);
+  if (top >= bottom)
+    return NULL;
+
+  SlotArray *array = _array.load(std::memory_order_acquire);
+  WorkItem *item = array->Get(top);
+  if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    return NULL;
+  return item;
+}
+
+/************ WorkerPool *************/
+WorkerPool::WorkerPool(unsigned workerNumber)
+  : _workerNumber(workerNumber),
+    _running(false),
+    _pending(0),
+    _sleeping(0),
+    _sharedNumber(0),
+    _stealNumber(0)
+{
+  if (_workerNumber == 0)
+    _workerNumber = std::thread::hardware_concurrency();
+  if (_workerNumber == 0)
+    _workerNumber = 1;
+}
+
+WorkerPool::~WorkerPool()
+{
+  Stop();
+  for (int priority = 0; priority < PRIORITY_LEVELS; ++priority) {
+    for (WorkItem *item : _shared[priority])
+      delete item;
+  }
+}
+
+RC WorkerPool::Start ()
+{
+  // Every deque exists before any thread may steal from it
+  for (unsigned i = 0; i < _workerNumber; ++i)
+    _workers.emplace_back(new Worker());
+  _running = true;
+
+  try {
+    for (unsigned i = 0; i < _workerNumber; ++i)
+      _threads.emplace_back([this, i] { Run(i); });
+  } catch (const std::system_error &) {
+    Stop();
+    return WORKER_THREAD_ERROR;
+  }
+  return SUCCESS;
+}
+
+void WorkerPool::Stop ()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _running = false;
+  }
+  _wake.notify_all();
+
+  for (std::thread &thread : _threads) {
+    if (thread.joinable())
+      thread.join();
+  }
+  _threads.clear();
+}
+
+RC WorkerPool::Submit (std::function<void()> work, WorkPriority priority)
+{
+  // Work spawned by running work is still taken while Stop() drains the pool
+  if (!_running.load(std::memory_order_acquire) && currentPool != this)
+    return WORKER_NOT_RUNNING;
+
+  WorkItem *item = new WorkItem{std::move(work)};
+  if (currentPool == this) {
+    // From a worker: its own deque without a lock, idle workers steal from it
+    _workers[currentIndex]->deques[priority].Push(item);
+    _pending.fetch_add(1, std::memory_order_seq_cst);
+  } else {
+    std::lock_guard<std::mutex> lock(_lock);
+    _shared[priority].push_back(item);
+    _sharedNumber.fetch_add(1, std::memory_order_relaxed);
+    _pending.fetch_add(1, std::memory_order_seq_cst);
+  }
+
+  // A worker counts itself as sleeping before it checks _pending, so either
+  // it sees the new item or we see it and wake it up
+  if (_sleeping.load(std::memory_order_seq_cst) > 0) {
+    std::lock_guard<std::mutex> lock(_lock);
+    _wake.notify_one();
+  }
+  return SUCCESS;
+}
+
+RC WorkerPool::Submit (Reactor &reactor, std::function<void()> work, std::function<void()> done,
+                       WorkPriority priority)
+{
+  return Submit([&reactor, work = std::move(work), done = std::move(done)] () mutable {
+                  work();
+                  reactor.Post(std::move(done));
+                }, priority);
+}
+
+/************ Helper Functions *************/
+void WorkerPool::Run (unsigned index)
+{
+  currentPool  = this;
+  currentIndex = index;
+
+  while (true) {
+    WorkItem *item = Find(index);
+    if (item) {
+      _pending.fetch_sub(1, std::memory_order_relaxed);
+      item->work();
+      delete item;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(_lock);
+    if (!_running && _pending.load(std::memory_order_seq_cst) == 0)
+      break;
+    _sleeping.fetch_add(1, std::memory_order_seq_cst);
+    _wake.wait(lock, [this] { return _pending.load(std::memory_order_seq_cst) > 0 || !_running; });
+    _sleeping.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  currentPool = NULL;
+}
+
+WorkItem *WorkerPool::Find (unsigned index)
+{
+  WorkItem *item;
+
+  for (int priority = 0; priority < PRIORITY_LEVELS; ++priority) {
+    if ((item = _workers[index]->deques[priority].Pop()) != NULL)
+      return item;
+
+    // Most of the time there is nothing shared, skip the lock then
+    if (_sharedNumber.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(_lock);
+      if (!_shared[priority].empty()) {
+        item = _shared[priority].front();
+        _shared[priority].pop_front();
+        _sharedNumber.fetch_sub(1, std::memory_order_relaxed);
+        return item;
+      }
+    }
+
+    // Start with the next worker so thieves spread over the victims
+    for (unsigned i = 1; i < _workerNumber; ++i) {
+      unsigned victim = (index + i) % _workerNumber;
+      if ((item = _workers[victim]->deques[priority].Steal()) != NULL) {
+        _stealNumber.fetch_add(1, std::memory_order_relaxed);
+        return item;
+      }
+    }
+  }
+  return NULL;
+}
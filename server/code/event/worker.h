@@ -0,0 +1,188 @@
+#ifndef EVENT_WORKER
+#define EVENT_WORKER
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "reactor.h"
+#include "../util/emailError.h"
+#include "../util/util.h"
+
+/* ----- Define macros ----- */
+enum {
+  WORKER_THREAD_ERROR = 451,
+  WORKER_NOT_RUNNING,
+};
+
+#define WORK_DEQUE_CAPACITY 256   // Initial slots of a WorkDeque, doubled when full
+
+enum WorkPriority {
+  PRIORITY_INTERACTIVE,   // Work a client is waiting for: replies, delivery, login
+  PRIORITY_BACKGROUND,    // Work nobody waits for: compaction, indexing
+  PRIORITY_LEVELS,
+};
+
+/* ----- Define structs ----- */
+struct WorkItem {
+  std::function<void()> work;
+};
+
+/**
+ * WorkDeque
+ * This class is the Chase-Lev work-stealing deque. Its owner pushes and pops
+ * at the bottom without a lock, other threads steal from the top with one
+ * compare-and-swap. The slot array grows when full, replaced arrays are kept
+ * until the deque is destroyed since a thief may still be reading them.
+ *
+ * Contained Public Functions:
+ *   void Push (WorkItem *item)
+ *   WorkItem *Pop ()
+ *   WorkItem *Steal ()
+ */
+class WorkDeque
+{
+public:
+  WorkDeque();
+  ~WorkDeque();
+  WorkDeque(const WorkDeque &) = delete;
+  WorkDeque& operator=(const WorkDeque &) = delete;
+
+  /**
+   * This function will add an item at the bottom. Owner thread only.
+   * @param WorkItem given as the item.
+   */
+  void Push (WorkItem *item);
+
+  /**
+   * This function will take the item added last. Owner thread only.
+   * @return pointer of WorkItem, NULL if the deque is empty.
+   */
+  WorkItem *Pop ();
+
+  /**
+   * This function will take the item added first. Safe from any thread.
+   * @return pointer of WorkItem, NULL if empty or lost to another thread.
+   */
+  WorkItem *Steal ();
+
+private:
+  struct SlotArray {
+    explicit SlotArray(int64_t slotNumber)
+      : capacity(slotNumber), slots(new std::atomic<WorkItem *>[slotNumber]) {};
+    WorkItem *Get (int64_t index) { return slots[index & (capacity - 1)].load(std::memory_order_relaxed); };
+    void Put (int64_t index, WorkItem *item) { slots[index & (capacity - 1)].store(item, std::memory_order_relaxed); };
+
+    int64_t capacity;                                // Power of two
+    std::unique_ptr<std::atomic<WorkItem *>[]> slots;
+  };
+
+  alignas(64) std::atomic<int64_t> _top;             // Next item to steal
+  alignas(64) std::atomic<int64_t> _bottom;          // Next free slot of the owner
+  std::atomic<SlotArray *> _array;
+  std::vector<std::unique_ptr<SlotArray>> _arrays;   // Current and replaced arrays
+};
+
+/**
+ * WorkerPool
+ * This class runs work that may block or take long (delivery, opening a
+ * maildrop, search, compaction) away from the reactor threads. Every worker
+ * owns one WorkDeque per priority; work submitted by a worker goes to its own
+ * deque, work submitted from other threads goes to a shared queue. An idle
+ * worker looks for interactive work first in its own deque, then in the shared
+ * queue, then in the deques of the other workers, and only then for
+ * background work the same way.
+ *
+ * Submit() with a Reactor hands the completion back to that reactor, so the
+ * session that asked for the work continues on its own thread.
+ *
+ * Contained Public Functions:
+ *   RC Start ()
+ *   void Stop ()
+ *   RC Submit (std::function<void()> work, WorkPriority priority)
+ *   RC Submit (Reactor &reactor, std::function<void()> work,
+ *              std::function<void()> done, WorkPriority priority)
+ */
+class WorkerPool
+{
+public:
+  explicit WorkerPool(unsigned workerNumber = 0);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool& operator=(const WorkerPool &) = delete;
+
+  /**
+   * This function will start the worker threads.
+   * @return SUCCESS if all workers are running.
+   *         WORKER_THREAD_ERROR otherwise.
+   */
+  RC Start ();
+
+  /**
+   * This function will run the work already submitted, then stop and join
+   * every worker.
+   */
+  void Stop ();
+
+  /**
+   * This function will queue work for the workers. Safe from any thread.
+   * @param function given as the work.
+   *        WorkPriority given as its priority.
+   * @return SUCCESS if the work has been queued.
+   *         WORKER_NOT_RUNNING if the pool is stopped.
+   */
+  RC Submit (std::function<void()> work, WorkPriority priority = PRIORITY_INTERACTIVE);
+
+  /**
+   * This function will queue work and post its completion to a reactor.
+   * @param Reactor given as where done() runs.
+   *        function given as the work, run on a worker.
+   *        function given as the completion, run on the reactor thread.
+   *        WorkPriority given as its priority.
+   * @return same as Submit() above.
+   */
+  RC Submit (Reactor &reactor, std::function<void()> work, std::function<void()> done,
+             WorkPriority priority = PRIORITY_INTERACTIVE);
+
+  size_t GetWorkerNumber () const { return _workerNumber; };
+  unsigned long GetStealNumber () const { return _stealNumber.load(std::memory_order_relaxed); };
+
+private:
+  struct Worker {
+    WorkDeque deques[PRIORITY_LEVELS];
+  };
+
+  unsigned _workerNumber;
+  std::vector<std::unique_ptr<Worker>> _workers;
+  std::vector<std::thread> _threads;
+  std::atomic<bool> _running;
+
+  std::mutex _lock;                                  // Guards _shared and _wake
+  std::condition_variable _wake;                     // Signalled for new work
+  std::deque<WorkItem *> _shared[PRIORITY_LEVELS];   // Work from outside the pool
+  std::atomic<long> _pending;                        // Submitted, not taken yet
+  std::atomic<int>  _sleeping;                       // Workers waiting on _wake
+  std::atomic<long> _sharedNumber;                   // Items in _shared
+  std::atomic<unsigned long> _stealNumber;           // Items taken from other workers
+
+  // Private helper functions
+  /**
+   * This function will be the loop of one worker thread.
+   * @param unsigned given as the index of the worker.
+   */
+  void Run (unsigned index);
+
+  /**
+   * This function will find the next item for a worker, by priority.
+   * @param unsigned given as the index of the worker.
+   * @return pointer of WorkItem, NULL if there is no work.
+   */
+  WorkItem *Find (unsigned index);
+};
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * delete.cpp
+ *
+ * This file provides the Delete function: the bulk deletion of messages.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include "delete.h"
+
+/************ Expunge *************/
+RC Expunge (const std::shared_ptr<Mailbox> &mailbox, const std::vector<uint64_t> &keys, size_t &deleted)
+{
+  return mailbox->Delete(keys, deleted);
+}
@@ -0,0 +1,27 @@
+#ifndef DELETE_FUNCTION
+#define DELETE_FUNCTION
+
+/* ----- Include libries or files ----- */
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+#include "../../manager/edm/edm.h"
+
+/**
+ * This function will delete a set of messages of a mailbox as one batch, as
+ * for POP3 QUIT or emptying a folder: one write of their directory entries,
+ * one update of the summary and one sync, whatever their number. Their
+ * records are left to the compactor.
+ * @param  shared_ptr given as the mailbox.
+ *         const vector given as the keys, in any order, those of no message
+ *         skipped.
+ *         size_t stores the number of messages deleted.
+ * @return SUCCESS if deleted.
+ *         pre-defined error number of Mailbox::Delete() otherwise, none is
+ *         deleted then.
+ */
+RC Expunge (const std::shared_ptr<Mailbox> &mailbox, const std::vector<uint64_t> &keys, size_t &deleted);
+
+#endif
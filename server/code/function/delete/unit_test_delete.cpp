@@ -0,0 +1,106 @@
+/*
+ * unit_test_delete.cpp
+ *
+ * This file provides unit test for delete.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "unit_test_delete.h"
+using namespace std;
+
+static void RemoveMailbox ()
+{
+  if (system((string("rm -rf ") + TEST_MAILBOX + " " + TEST_OTHER + " " + TEST_SHARED + " " + TEST_LOG).c_str())) {}
+}
+
+static RC FillMailbox (shared_ptr<Mailbox> &mailbox, size_t messages, vector<uint64_t> &keys)
+{
+  RemoveMailbox();
+  RC rc = EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox);
+  keys.resize(messages);
+  for (size_t i = 0; i < messages && rc == SUCCESS; ++i)
+    rc = mailbox->Append("message " + to_string(i), keys[i]);
+  return rc;
+}
+
+// Every other message of a large mailbox goes with one record of the log
+static RC TestExpunge ()
+{
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys;
+  if (FillMailbox(mailbox, TEST_MESSAGES, keys))
+    return STANDARD_ERROR;
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  if (wal->Open(TEST_LOG) || wal->Recover())
+    return STANDARD_ERROR;
+
+  vector<uint64_t> marked;
+  for (size_t i = 0; i < TEST_MESSAGES; i += 2)
+    marked.push_back(keys[i]);
+  uint64_t size = wal->GetSize();
+  size_t deleted;
+  RC rc = Expunge(mailbox, marked, deleted);
+  if (rc || deleted != TEST_MESSAGES / 2 || wal->GetSize() - size !=
+      sizeof(WalRecordHeader) + strlen(TEST_MAILBOX) + strlen(DIRECTORY_FILE_NAME) + strlen(DF_EXTENSION) +
+      deleted * sizeof(DirectoryRedo))
+    rc = STANDARD_ERROR;
+  wal->Close();
+
+  string message;
+  if (rc || mailbox->GetMessageNumber() != TEST_MESSAGES / 2 ||
+      mailbox->Read(keys[0], message) != EDM_NO_SUCH_MESSAGE || mailbox->Read(keys[1], message) ||
+      message != "message 1")
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Messages stored once for several mailboxes lose one reference a mailbox
+static RC TestShared ()
+{
+  RemoveMailbox();
+  EmailDataManager *edm = EmailDataManager::instance();
+  vector<uint64_t> first, second;
+  shared_ptr<Mailbox> mailbox, other, shared;
+  if (edm->Deliver("first", {TEST_MAILBOX, TEST_OTHER}, first) ||
+      edm->Deliver("second", {TEST_MAILBOX, TEST_OTHER}, second) ||
+      edm->OpenMailbox(TEST_MAILBOX, mailbox) || edm->OpenMailbox(TEST_OTHER, other) ||
+      edm->OpenMailbox(TEST_SHARED, shared))
+    return STANDARD_ERROR;
+
+  size_t deleted;
+  vector<Index> indexes;
+  if (Expunge(mailbox, {first[0], second[0], first[0]}, deleted) || deleted != 2 ||
+      mailbox->GetMessageNumber())
+    return STANDARD_ERROR;
+  shared->ListMessages(indexes);
+  if (indexes.size() != 2 || indexes[0].refs != 1 || indexes[1].refs != 1)
+    return STANDARD_ERROR;
+
+  // The last references go, the records are left to the compactor
+  if (Expunge(other, {first[1], second[1]}, deleted) || deleted != 2 || shared->GetMessageNumber())
+    return STANDARD_ERROR;
+  shared->ListMessages(indexes);
+  return indexes.empty() ? SUCCESS : STANDARD_ERROR;
+}
+
+int main ()
+{
+  RC rc = SUCCESS, result;
+  EmailDataManager::instance()->SetSharedPath(TEST_SHARED);
+
+  result = TestExpunge();
+  cout << "TestExpunge: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestShared();
+  cout << "TestShared: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  RemoveMailbox();
+  return (rc);
+}
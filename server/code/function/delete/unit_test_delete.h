@@ -0,0 +1,24 @@
+/*
+ * unit_test_delete.h
+ *
+ * This file provides unit test for delete.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "../../basic/wal/wal.h"
+#include "delete.h"
+
+const char TEST_MAILBOX[] = "unit_test_delete.data/";
+const char TEST_OTHER[]   = "unit_test_delete.other/";
+const char TEST_SHARED[]  = "unit_test_delete.shared/";
+const char TEST_LOG[]     = "unit_test_delete.wal/";
+
+#define TEST_MESSAGES 10000
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * read.cpp
+ *
+ * This file provides the Read function: the mail store the SMTP and POP3
+ * sessions deliver to and read from, on top of the EDM and the UIM.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include "read.h"
+
+/************ Helper Functions *************/
+// The user of an address, false if it cannot name a user of the UIM
+static bool GetUser (const std::string &address, UserInfo &userInfo)
+{
+  size_t at = address.rfind('@');
+  if (at == std::string::npos)
+    return false;
+  std::string name = address.substr(0, at), domain = address.substr(at + 1);
+  for (char &character : domain)
+    character = tolower(static_cast<unsigned char>(character));
+  // A local part is a directory of the domain
+  if (name.empty() || name.size() >= USERNAME_MAX_LANGTH || name.find('/') != std::string::npos ||
+      name.find("..") != std::string::npos || domain.empty() || domain.size() >= DOMAIN_NAME_MAX_LENGTH ||
+      domain.find('/') != std::string::npos || domain.find("..") != std::string::npos)
+    return false;
+  userInfo = {};
+  memcpy(userInfo.username, name.data(), name.size());
+  memcpy(userInfo.domainName, domain.data(), domain.size());
+  return true;
+}
+
+// The domain of an address, in lower case
+static std::string GetDomain (const std::string &address)
+{
+  size_t at = address.rfind('@');
+  std::string domain = at == std::string::npos ? "" : address.substr(at + 1);
+  for (char &character : domain)
+    character = tolower(static_cast<unsigned char>(character));
+  return domain;
+}
+
+/************ EdmMaildrop *************/
+EdmMaildrop::EdmMaildrop(std::shared_ptr<Mailbox> mailbox)
+  : _mailbox(std::move(mailbox)),
+    _octets(0)
+{
+  _mailbox->ListSummary(_entries);
+  for (const SummaryEntry &entry : _entries)
+    _octets += entry.length;
+}
+
+std::string EdmMaildrop::GetUid (size_t index)
+{
+  char uid[17];
+  snprintf(uid, sizeof(uid), "%016" PRIx64, _entries[index].uid);
+  return uid;
+}
+
+RC EdmMaildrop::ReadMessage (size_t index, std::string &message)
+{
+  std::shared_ptr<const std::string> cached;
+  RC rc = EmailDataCache::instance()->Read(_mailbox, _entries[index].key, cached);
+  if (rc)
+    return rc;
+  message = *cached;
+  return SUCCESS;
+}
+
+RC EdmMaildrop::DeleteMessages (const std::vector<size_t> &indexes)
+{
+  std::vector<uint64_t> keys;
+  keys.reserve(indexes.size());
+  for (size_t index : indexes)
+    keys.push_back(_entries[index].key);
+  size_t deleted;
+  return Expunge(_mailbox, keys, deleted);
+}
+
+RC EdmMaildrop::LocateMessage (size_t index, int &file, off_t &offset, size_t &length)
+{
+  std::shared_ptr<Segment> segment;
+  RC rc = _mailbox->Locate(_entries[index].key, segment, offset, length);
+  if (rc)
+    return rc;
+  file = segment->GetFd();
+  _segments.insert(std::move(segment));
+  return SUCCESS;
+}
+
+/************ EdmStream *************/
+EdmStream::EdmStream(EdmStore &store, const std::vector<std::string> &recipients)
+  : _store(store),
+    _recipients(recipients)
+{
+}
+
+RC EdmStream::Write (std::string_view data)
+{
+  if (_stream)
+    return _stream->Write(data);
+  _head.append(data);
+  return SUCCESS;
+}
+
+bool EdmStream::IsFull () const
+{
+  return _stream ? _stream->IsFull() : _head.size() >= STREAM_CHUNK_SIZE;
+}
+
+RC EdmStream::Flush ()
+{
+  RC rc = Open();
+  if (rc)
+    return rc;
+  return _stream->Flush();
+}
+
+RC EdmStream::Commit ()
+{
+  RC rc = Open();
+  if (rc)
+    return rc;
+  std::vector<uint64_t> keys;
+  return _stream->Commit(keys);
+}
+
+RC EdmStream::Open ()
+{
+  if (_stream)
+    return SUCCESS;
+  std::vector<std::string> paths;
+  RC rc = _store.FindMailboxes(_recipients, paths);
+  if (rc)
+    return rc;
+  EmailDataManager::instance()->OpenStream(paths, _stream);
+  rc = _stream->Write(_head);
+  std::string().swap(_head);
+  return rc;
+}
+
+/************ EdmStore *************/
+RC EdmStore::Deliver (const Envelope &envelope, std::string_view data)
+{
+  std::vector<std::string> local, remote;
+  for (const std::string &recipient : envelope.recipients)
+    (IsLocal(recipient) ? local : remote).push_back(recipient);
+
+  // Spooled first: a failure after it sends the remote copies twice at worst
+  if (!remote.empty()) {
+    uint64_t id;
+    RC rc = _outbound->Enqueue(envelope.from, remote, data, id);
+    if (rc)
+      return rc == SEND_BAD_ADDRESS ? PM_RECIPIENT_REFUSED : PM_DELIVERY_FAILED;
+  }
+  if (local.empty())
+    return SUCCESS;
+  std::vector<std::string> paths;
+  RC rc = FindMailboxes(local, paths);
+  if (rc)
+    return rc;
+  std::vector<uint64_t> keys;
+  return EmailDataCache::instance()->Deliver(data, paths, keys);
+}
+
+RC EdmStore::OpenMaildrop (const std::string &account, const std::string &password,
+                           std::unique_ptr<Maildrop> &maildrop)
+{
+  UserInfo userInfo;
+  if (!GetUser(account, userInfo) || password.size() >= PASSWORD_MAX_LENGTH)
+    return PM_AUTH_FAILED;
+  memcpy(userInfo.password, password.data(), password.size());
+  {
+    std::lock_guard<std::mutex> lock(_usersLock);
+    if (UserInfoManager::instance()->Login(userInfo))
+      return PM_AUTH_FAILED;
+  }
+
+  std::shared_ptr<Mailbox> mailbox;
+  RC rc = EmailDataManager::instance()->OpenMailbox(UserInfoManager::GetMailboxPath(userInfo), mailbox);
+  if (rc)
+    return rc;
+  maildrop.reset(new EdmMaildrop(std::move(mailbox)));
+  return SUCCESS;
+}
+
+RC EdmStore::OpenStream (const Envelope &envelope, std::unique_ptr<DeliveryStream> &stream)
+{
+  // The OutboundQueue spools a message whole
+  for (const std::string &recipient : envelope.recipients) {
+    if (!IsLocal(recipient))
+      return SUCCESS;
+  }
+  stream.reset(new EdmStream(*this, envelope.recipients));
+  return SUCCESS;
+}
+
+RC EdmStore::CheckRecipient (const std::string &recipient)
+{
+  if (GetDomain(recipient).empty())
+    return PM_RECIPIENT_REFUSED;
+  if (!IsLocal(recipient))
+    return SUCCESS;
+  std::vector<std::string> paths;
+  return FindMailboxes({ recipient }, paths);
+}
+
+RC EdmStore::FindMailboxes (const std::vector<std::string> &recipients, std::vector<std::string> &paths)
+{
+  paths.clear();
+  std::lock_guard<std::mutex> lock(_usersLock);
+  for (const std::string &recipient : recipients) {
+    UserInfo userInfo;
+    if (!GetUser(recipient, userInfo))
+      return PM_RECIPIENT_REFUSED;
+    RC rc = UserInfoManager::instance()->ReadUser(userInfo);
+    if (rc == USER_NOT_EXISTS)
+      return PM_RECIPIENT_REFUSED;
+    if (rc)
+      return PM_DELIVERY_FAILED;
+    std::string path = UserInfoManager::GetMailboxPath(userInfo);
+    if (std::find(paths.begin(), paths.end(), path) == paths.end())
+      paths.push_back(path);
+  }
+  return SUCCESS;
+}
+
+void EdmStore::AddLocalDomain (const std::string &domain)
+{
+  _localDomains.insert(GetDomain("@" + domain));
+}
+
+// Private helper functions
+bool EdmStore::IsLocal (const std::string &address) const
+{
+  return !_outbound || _localDomains.count(GetDomain(address));
+}
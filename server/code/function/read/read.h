@@ -0,0 +1,202 @@
+#ifndef READ_FUNCTION
+#define READ_FUNCTION
+
+/* ----- Include libries or files ----- */
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+#include "../../manager/edc/edc.h"
+#include "../../manager/edm/edm.h"
+#include "../../manager/pm/pm.h"
+#include "../../manager/uim/uim.h"
+#include "../delete/delete.h"
+#include "../send/send.h"
+
+/**
+ * EdmMaildrop
+ * This class gives a POP3 session the messages of one EDM mailbox, as the
+ * summary listed them when the session logged in: STAT, LIST and UIDL never
+ * read the directory file, RETR and TOP send the records from their segment
+ * with sendfile(). A compressed record cannot be sent that way; ReadMessage()
+ * gets it through the EmailDataCache, so it is decompressed once as long as
+ * it stays cached, and new mail is read from the copy kept by Deliver().
+ * The segments located stay open as long as the maildrop,
+ * so a reply queued before a compaction is still sent whole. The messages
+ * marked by DELE are expunged at QUIT as one batch.
+ *
+ * Contained Public Functions:
+ *   size_t GetMessageNumber ()
+ *   size_t GetMessageSize   (size_t index)
+ *   uint64_t GetTotalSize   ()
+ *   std::string GetUid      (size_t index)
+ *   RC ReadMessage    (size_t index, std::string &message)
+ *   RC DeleteMessages (const std::vector<size_t> &indexes)
+ *   RC LocateMessage  (size_t index, int &file, off_t &offset, size_t &length)
+ */
+class EdmMaildrop : public Maildrop
+{
+public:
+  explicit EdmMaildrop(std::shared_ptr<Mailbox> mailbox);
+
+  size_t GetMessageNumber () override { return _entries.size(); };
+  size_t GetMessageSize (size_t index) override { return _entries[index].length; };
+  uint64_t GetTotalSize () override { return _octets; };
+  std::string GetUid (size_t index) override;
+  RC ReadMessage (size_t index, std::string &message) override;
+  RC DeleteMessages (const std::vector<size_t> &indexes) override;
+  RC LocateMessage (size_t index, int &file, off_t &offset, size_t &length) override;
+
+private:
+  std::shared_ptr<Mailbox> _mailbox;
+  std::vector<SummaryEntry> _entries;           // Message index i is _entries[i]
+  uint64_t _octets;                             // Of all the messages listed
+  std::set<std::shared_ptr<Segment>> _segments; // Located, kept open for sendfile()
+};
+
+class EdmStore;
+
+/**
+ * EdmStream
+ * This class is the DeliveryStream of an EdmStore: a MessageStream made at
+ * the first Flush() or Commit(), once the recipients are looked up. What is
+ * written before, at most a chunk and a piece, waits in the stream.
+ *
+ * Contained Public Functions:
+ *   RC   Write  (std::string_view data)
+ *   bool IsFull ()
+ *   RC   Flush  ()
+ *   RC   Commit ()
+ */
+class EdmStream : public DeliveryStream
+{
+public:
+  EdmStream(EdmStore &store, const std::vector<std::string> &recipients);
+
+  RC   Write  (std::string_view data) override;
+  bool IsFull () const override;
+  RC   Flush  () override;
+  RC   Commit () override;
+
+private:
+  EdmStore &_store;
+  std::vector<std::string> _recipients;
+  std::unique_ptr<MessageStream> _stream;       // NULL until the mailboxes are found
+  std::string _head;                            // Written before that
+
+  // Private helper functions
+  RC Open ();
+};
+
+/**
+ * EdmStore
+ * This class connects the SMTP and POP3 sessions to the EDM. Accounts and
+ * recipients are "user@domain" and are looked up in the UIM: OpenMaildrop()
+ * logs the user in and opens the mailbox at UserInfoManager::GetMailboxPath().
+ * Deliver() and the streams store a message once for all the local
+ * recipients, with EmailDataCache::Deliver() or a MessageStream.
+ *
+ * Every domain is local unless an OutboundQueue is set; then only those
+ * given to AddLocalDomain() are, and the recipients of the others are handed
+ * to OutboundQueue::Enqueue(). CheckRecipient() refuses a local recipient
+ * the UIM does not know at RCPT, and one gone by the end of DATA fails the
+ * delivery with PM_RECIPIENT_REFUSED, so no recipient is ever dropped. A
+ * message for a remote recipient is never streamed, the session collects it.
+ *
+ * OpenStream() must not block, so it looks nobody up: the stream collects
+ * the first chunk and finds the mailboxes at its first Flush() or Commit(),
+ * which the session runs where blocking is fine. The UIM is not thread safe,
+ * the store takes its own lock around it.
+ *
+ * Contained Public Functions:
+ *   RC Deliver      (const Envelope &envelope, std::string_view data)
+ *   RC OpenMaildrop (const std::string &account, const std::string &password,
+ *                    std::unique_ptr<Maildrop> &maildrop)
+ *   RC OpenStream   (const Envelope &envelope, std::unique_ptr<DeliveryStream> &stream)
+ *   RC CheckRecipient (const std::string &recipient)
+ *   RC FindMailboxes (const std::vector<std::string> &recipients, std::vector<std::string> &paths)
+ *   void SetOutboundQueue (OutboundQueue *outbound)
+ *   void AddLocalDomain   (const std::string &domain)
+ */
+class EdmStore : public MailStore
+{
+public:
+  EdmStore() : _outbound(NULL) {};
+
+  EdmStore(const EdmStore &) = delete;
+  EdmStore &operator=(const EdmStore &) = delete;
+
+  /**
+   * This function will store a DATA block for every local recipient and
+   * spool it for the remote ones.
+   * @param  Envelope given as the sender and the recipients.
+   *         string_view given as the block, dot-stuffed and ending with CRLF.
+   * @return SUCCESS if every recipient has the message or it is spooled.
+   *         PM_RECIPIENT_REFUSED if a local recipient is not known.
+   *         PM_DELIVERY_FAILED if the UIM or the OutboundQueue fails.
+   *         pre-defined error number of EmailDataCache::Deliver() otherwise.
+   */
+  RC Deliver (const Envelope &envelope, std::string_view data) override;
+
+  /**
+   * This function will log a user in and list the mailbox.
+   * @param  string given as the account, "user@domain".
+   *         string given as the password.
+   *         unique_ptr stores the maildrop.
+   * @return SUCCESS if logged in.
+   *         PM_AUTH_FAILED if the account or the password is wrong.
+   *         pre-defined error number of EmailDataManager::OpenMailbox() otherwise.
+   */
+  RC OpenMaildrop (const std::string &account, const std::string &password,
+                   std::unique_ptr<Maildrop> &maildrop) override;
+
+  /**
+   * This function will start a DATA block to be stored in pieces. Looks
+   * nobody up and opens nothing, so it never blocks.
+   * @param  Envelope given as the sender and the recipients.
+   *         unique_ptr stores the stream, left empty if a recipient is remote.
+   * @return SUCCESS always.
+   */
+  RC OpenStream (const Envelope &envelope, std::unique_ptr<DeliveryStream> &stream) override;
+
+  bool ChecksRecipients () const override { return true; };
+
+  /**
+   * This function will tell if a recipient can be given a message: a remote
+   * one always, a local one if the UIM knows it.
+   * @param  string given as the recipient, "user@domain".
+   * @return SUCCESS if it can.
+   *         PM_RECIPIENT_REFUSED if it is not an address or not known.
+   *         PM_DELIVERY_FAILED if the UIM fails.
+   */
+  RC CheckRecipient (const std::string &recipient) override;
+
+  /**
+   * This function will give the mailboxes of local recipients.
+   * @param  const vector given as the recipients, "user@domain".
+   *         vector stores the directories of their mailboxes.
+   * @return SUCCESS if every one is known.
+   *         PM_RECIPIENT_REFUSED if one is not.
+   *         PM_DELIVERY_FAILED if the UIM fails.
+   */
+  RC FindMailboxes (const std::vector<std::string> &recipients, std::vector<std::string> &paths);
+
+  // Both are set before the sessions start
+  void SetOutboundQueue (OutboundQueue *outbound) { _outbound = outbound; };
+  void AddLocalDomain (const std::string &domain);
+
+private:
+  std::mutex _usersLock;              // Taken around every call into the UIM
+  OutboundQueue *_outbound;           // Takes the remote recipients, NULL if every domain is local
+  std::set<std::string> _localDomains;
+
+  // Private helper functions
+  bool IsLocal (const std::string &address) const;
+};
+
+#endif
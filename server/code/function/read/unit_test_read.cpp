@@ -0,0 +1,257 @@
+/*
+ * unit_test_read.cpp
+ *
+ * This file provides unit test for read.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <cstdlib>
+#include <iostream>
+#include <sys/socket.h>
+#include "unit_test_read.h"
+using namespace std;
+
+static UserInfo GetUser (const string &name)
+{
+  UserInfo userInfo = {};
+  strncpy(userInfo.username, name.c_str(), USERNAME_MAX_LANGTH - 1);
+  strncpy(userInfo.domainName, TEST_DOMAIN, DOMAIN_NAME_MAX_LENGTH - 1);
+  strncpy(userInfo.password, TEST_PASSWORD, PASSWORD_MAX_LENGTH - 1);
+  return userInfo;
+}
+
+static void RemoveUsers ()
+{
+  if (system((string("rm -rf ") + TEST_SHARED + " " + TEST_SPOOL + " " + DATAPATH + TEST_DOMAIN).c_str())) {}
+}
+
+static RC OpenAlice (shared_ptr<Mailbox> &mailbox)
+{
+  return EmailDataManager::instance()->OpenMailbox(UserInfoManager::GetMailboxPath(GetUser("alice")), mailbox);
+}
+
+// Read everything the session has sent so far
+static string Drain (DataSocket &client)
+{
+  string reply;
+  while (client.GetMessage(reply) == SUCCESS) {}
+  return reply;
+}
+
+// Run a session until a reply shows up, the storage calls done in between,
+// each one after the check given
+static RC RunUntil (ProtocolSession &session, DataSocket &client, const string &reply, string &replies,
+                    const function<bool()> &check = NULL)
+{
+  while (replies.find(reply) == string::npos) {
+    RC rc = session.Process();
+    if (rc == PM_WORK_PENDING) {
+      if (check && !check())
+        return STANDARD_ERROR;
+      function<RC()> work = session.TakeWork();
+      session.CompleteWork(work());
+      rc = SUCCESS;
+    }
+    replies += Drain(client);
+    if (rc)
+      return STANDARD_ERROR;
+  }
+  return SUCCESS;
+}
+
+// A DATA block from the socket is streamed in chunks and only listed once the terminator is in
+static RC TestStreamToIndex ()
+{
+  EdmStore store;
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+  session.SetDeferWork(true);
+  session.Greet();
+  Drain(client);
+
+  string body;
+  while (body.size() < 3 * STREAM_CHUNK_SIZE)
+    body += "Subject: stream\r\n..line " + to_string(body.size()) + "\r\n";
+  client.PutMessage(string("EHLO client\r\nMAIL FROM:<a@b.com>\r\nRCPT TO:<") + TEST_ACCOUNT + ">\r\n"
+                    "RCPT TO:<nobody@read.test>\r\nDATA\r\n" + body + ".\r\n");
+
+  // Nothing in the mailbox before the commit
+  shared_ptr<Mailbox> mailbox;
+  string replies;
+  size_t works = 0;
+  function<bool()> check = [&] { return ++works && !mailbox->GetMessageNumber(); };
+  if (OpenAlice(mailbox) || RunUntil(session, client, "354", replies, check))
+    return STANDARD_ERROR;
+  replies.clear();
+  if (RunUntil(session, client, "\r\n", replies, check) || replies != "250 OK\r\n")
+    return STANDARD_ERROR;
+
+  vector<Index> indexes;
+  string message;
+  mailbox->ListMessages(indexes);
+  if (works < 5 || indexes.size() != 1 || mailbox->Read(indexes[0].key, message) || message != body)
+    return STANDARD_ERROR;
+
+  // A recipient nobody knows is refused at RCPT, a message for none of them never starts
+  replies.clear();
+  client.PutMessage("MAIL FROM:<a@b.com>\r\nRCPT TO:<nobody@read.test>\r\nRCPT TO:<no-domain>\r\nDATA\r\n"
+                    "RSET\r\n");
+  if (RunUntil(session, client, "554", replies) || RunUntil(session, client, "\r\n250", replies) ||
+      replies != "250 OK\r\n550 No such user here\r\n550 No such user here\r\n554 No valid recipients\r\n"
+                 "250 OK\r\n")
+    return STANDARD_ERROR;
+
+  // One gone by the end of DATA fails the message for all of them
+  Envelope envelope;
+  envelope.from = "a@b.com";
+  envelope.recipients = { TEST_ACCOUNT, "nobody@read.test" };
+  return store.Deliver(envelope, "short\r\n") == PM_RECIPIENT_REFUSED && mailbox->GetMessageNumber() == 1
+         ? SUCCESS : STANDARD_ERROR;
+}
+
+// Recipients of other domains go to the OutboundQueue, with the message whole
+static RC TestOutbound ()
+{
+  OutboundQueue outbound(TEST_SPOOL);
+  EdmStore store;
+  if (outbound.Open())
+    return STANDARD_ERROR;
+  store.SetOutboundQueue(&outbound);
+  store.AddLocalDomain(TEST_DOMAIN);
+
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+  session.SetDeferWork(true);
+  session.Greet();
+  Drain(client);
+
+  shared_ptr<Mailbox> mailbox;
+  if (OpenAlice(mailbox))
+    return STANDARD_ERROR;
+  size_t number = mailbox->GetMessageNumber();
+  string body;
+  while (body.size() < 2 * STREAM_CHUNK_SIZE)
+    body += "Subject: outbound\r\n..line " + to_string(body.size()) + "\r\n";
+  client.PutMessage(string("EHLO client\r\nMAIL FROM:<a@b.com>\r\nRCPT TO:<") + TEST_ACCOUNT + ">\r\n"
+                    "RCPT TO:<carol@Remote.Test>\r\nRCPT TO:<nobody@READ.test>\r\nDATA\r\n" + body + ".\r\n"
+                    "MAIL FROM:<a@b.com>\r\nRCPT TO:<dave@remote.test>\r\nDATA\r\nshort\r\n.\r\n");
+  string replies;
+  if (RunUntil(session, client, "354", replies) || RunUntil(session, client, "\r\n250", replies) ||
+      replies.find("550 No such user here\r\n") == string::npos)
+    return STANDARD_ERROR;
+  replies.erase(0, replies.find("354"));
+  replies.erase(0, replies.find("\r\n250") + 6);
+  if (RunUntil(session, client, "354", replies) || RunUntil(session, client, "\r\n250", replies))
+    return STANDARD_ERROR;
+
+  SendStats stats;
+  outbound.GetStats(stats);
+  vector<Index> indexes;
+  string message;
+  mailbox->ListMessages(indexes);
+  return (stats.enqueued == 2 && stats.queuedRecipients == 2 && indexes.size() == number + 1 &&
+          !mailbox->Read(indexes.back().key, message) && message == body) ? SUCCESS : STANDARD_ERROR;
+}
+
+// POP3 logs in through the UIM, lists the summary and deletes at QUIT
+static RC TestMaildrop ()
+{
+  EdmStore store;
+  Envelope envelope;
+  envelope.from = "a@b.com";
+  envelope.recipients = { TEST_ACCOUNT };
+  string first = "Subject: first\r\n\r\n..dot\r\n", second = "Subject: second\r\n\r\nbody\r\n";
+  string third = "Subject: third\r\n\r\n";
+  while (third.size() < 4 * COMPRESS_MIN_SIZE)
+    third += "the same line, stored compressed\r\n";
+  shared_ptr<Mailbox> mailbox;
+  if (OpenAlice(mailbox))
+    return STANDARD_ERROR;
+  size_t number = mailbox->GetMessageNumber();
+  if (store.Deliver(envelope, first) || store.Deliver(envelope, second) || store.Deliver(envelope, third))
+    return STANDARD_ERROR;
+
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  Pop3Session session(server, store, TEST_HOSTNAME);
+  session.Greet();
+  Drain(client);
+
+  string replies;
+  client.PutMessage(string("USER ") + TEST_ACCOUNT + "\r\nPASS wrong\r\n");
+  if (RunUntil(session, client, "-ERR", replies) || replies != "+OK\r\n-ERR invalid user or password\r\n")
+    return STANDARD_ERROR;
+
+  string total = to_string(number + 3) + " ";
+  client.PutMessage(string("USER ") + TEST_ACCOUNT + "\r\nPASS " + TEST_PASSWORD + "\r\nSTAT\r\n");
+  replies.clear();
+  if (RunUntil(session, client, "+OK " + total, replies))
+    return STANDARD_ERROR;
+
+  string index = to_string(number + 1);
+  client.PutMessage("RETR " + index + "\r\nDELE " + index + "\r\n");
+  replies.clear();
+  if (RunUntil(session, client, "deleted\r\n", replies) ||
+      replies != "+OK " + to_string(first.size()) + " octets\r\n" + first + ".\r\n+OK message deleted\r\n")
+    return STANDARD_ERROR;
+
+  // A compressed message cannot go out with sendfile(), it comes from the copy Deliver() cached
+  CacheStats before, after;
+  EmailDataCache::instance()->GetCache().GetStats(before);
+  string last = to_string(number + 3);
+  client.PutMessage("RETR " + last + "\r\n");
+  replies.clear();
+  if (RunUntil(session, client, third + ".\r\n", replies) ||
+      replies != "+OK " + to_string(third.size()) + " octets\r\n" + third + ".\r\n")
+    return STANDARD_ERROR;
+  EmailDataCache::instance()->GetCache().GetStats(after);
+  if (after.hits != before.hits + 1 || after.misses != before.misses)
+    return STANDARD_ERROR;
+
+  client.PutMessage("QUIT\r\n");
+  replies.clear();
+  RC rc;
+  while ((rc = session.Process()) == SUCCESS) {}
+  vector<Index> indexes;
+  string message;
+  mailbox->ListMessages(indexes);
+  return (rc == PM_SESSION_CLOSED && indexes.size() == number + 2 && !mailbox->Read(indexes.back().key, message) &&
+          message == third) ? SUCCESS : STANDARD_ERROR;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  RemoveUsers();
+  EmailDataManager::instance()->SetSharedPath(TEST_SHARED);
+  UserInfoManager::instance()->CreateUser(GetUser("alice"));
+
+  result = TestStreamToIndex();
+  cout << "TestStreamToIndex: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestMaildrop();
+  cout << "TestMaildrop: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestOutbound();
+  cout << "TestOutbound: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  RemoveUsers();
+  return (rc);
+}
@@ -0,0 +1,23 @@
+/*
+ * unit_test_read.h
+ *
+ * This file provides unit test for read.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "read.h"
+
+#define TEST_HOSTNAME "mail.example.com"
+const char TEST_SHARED[]  = "unit_test_read.shared/";
+const char TEST_SPOOL[]   = "unit_test_read.spool/";
+const char TEST_DOMAIN[]  = "read.test";                 // Its users are under DATAPATH, made again by every test
+const char TEST_ACCOUNT[] = "alice@read.test";
+const char TEST_PASSWORD[] = "secret";
+
+#endif
@@ -0,0 +1,461 @@
+/*
+ * headers.cpp
+ *
+ * This file provides the Header Store: the date, sender, recipients and
+ * subject of the messages of a mailbox, kept in columns.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "headers.h"
+#include "scan.h"
+
+/************ Helper Functions *************/
+static const char *const COLUMN_FILES[COLUMN_NUMBER] = {
+  "names.dict", "to.col", "subject.dat", "to_end.col", "subject_end.col", "from.col", "time.col", "deleted.col",
+  "key.col",
+};
+
+static std::string Lowercase (std::string_view text)
+{
+  std::string lower(text);
+  for (char &character : lower)
+    character = tolower(static_cast<unsigned char>(character));
+  return lower;
+}
+
+static std::string_view Trim (std::string_view text)
+{
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+    text.remove_prefix(1);
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+    text.remove_suffix(1);
+  return text;
+}
+
+// Every field of the header with its folded lines joined
+static void ForEachField (std::string_view message,
+                          const std::function<void (std::string_view name, std::string_view value)> &visit)
+{
+  std::string_view name;
+  std::string value;
+  size_t position = 0;
+  while (position < message.size()) {
+    size_t end  = message.find('\n', position);
+    size_t next = end == std::string_view::npos ? message.size() : end + 1;
+    std::string_view line = message.substr(position, next - position);
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+      line.remove_suffix(1);
+    position = next;
+
+    if (!line.empty() && (line[0] == ' ' || line[0] == '\t')) {
+      value.append(line);
+      continue;
+    }
+    if (!name.empty())
+      visit(name, Trim(value));
+    if (line.empty())
+      return;
+    size_t colon = line.find(':');
+    name = colon == std::string_view::npos ? std::string_view() : line.substr(0, colon);
+    value.assign(colon == std::string_view::npos ? std::string_view() : line.substr(colon + 1));
+  }
+  if (!name.empty())
+    visit(name, Trim(value));
+}
+
+static bool IsField (std::string_view name, const char *field)
+{
+  return name.size() == strlen(field) && !strncasecmp(name.data(), field, name.size());
+}
+
+void ParseAddresses (std::string_view value, std::vector<std::string> &addresses)
+{
+  size_t position = 0;
+  while (position < value.size()) {
+    size_t end = value.find(',', position);
+    if (end == std::string_view::npos)
+      end = value.size();
+    std::string_view mailbox = value.substr(position, end - position);
+    position = end + 1;
+
+    size_t open = mailbox.find('<'), close = mailbox.rfind('>');
+    if (open != std::string_view::npos && close != std::string_view::npos && open < close) {
+      mailbox = Trim(mailbox.substr(open + 1, close - open - 1));
+    } else {
+      // The word holding the '@', without a display name around it
+      size_t at = mailbox.find('@');
+      if (at == std::string_view::npos)
+        continue;
+      size_t first = mailbox.find_last_of(" \t\"", at), last = mailbox.find_first_of(" \t\"", at);
+      first = first == std::string_view::npos ? 0 : first + 1;
+      mailbox = mailbox.substr(first, last == std::string_view::npos ? std::string_view::npos : last - first);
+    }
+    if (!mailbox.empty())
+      addresses.push_back(Lowercase(mailbox));
+  }
+}
+
+static bool ReadFile (int fd, std::string &bytes)
+{
+  struct stat status;
+  if (fstat(fd, &status))
+    return false;
+  bytes.resize(status.st_size);
+  size_t done = 0;
+  while (done < bytes.size()) {
+    ssize_t got = pread(fd, &bytes[done], bytes.size() - done, done);
+    if (got <= 0) {
+      if (got == -1 && errno == EINTR)
+        continue;
+      return false;
+    }
+    done += got;
+  }
+  return true;
+}
+
+template <typename T>
+static void Decode (const std::string &bytes, size_t rows, std::vector<T> &column)
+{
+  column.resize(rows);
+  if (rows)
+    memcpy(column.data(), bytes.data(), rows * sizeof(T));
+}
+
+/************ HeaderStore *************/
+HeaderStore::HeaderStore(const std::string &path)
+  : _path(path),
+    _lastKey(0)
+{
+  if (_path.empty() || _path.back() != '/')
+    _path += '/';
+  _path += HEADER_DIRECTORY_NAME;
+  std::fill(_fds, _fds + COLUMN_NUMBER, -1);
+  std::fill(_sizes, _sizes + COLUMN_NUMBER, 0);
+}
+
+HeaderStore::~HeaderStore()
+{
+  for (int fd : _fds) {
+    if (fd != -1)
+      close(fd);
+  }
+}
+
+RC HeaderStore::Open ()
+{
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  if (mkdir(_path.c_str(), 0700) && errno != EEXIST)
+    return SEARCH_OPEN_ERROR;
+  RC rc = Load();
+  if (rc != SEARCH_CORRUPTED)
+    return rc;
+
+  // Made again from the mailbox by CatchUp()
+  Reset();
+  for (const char *name : COLUMN_FILES)
+    unlink((_path + name).c_str());
+  return Load();
+}
+
+RC HeaderStore::Add (uint64_t key, time_t arrival, std::string_view message)
+{
+  std::vector<std::string> from, to;
+  std::string subject;
+  ForEachField(message, [&](std::string_view name, std::string_view value) {
+    if (IsField(name, "from") && from.empty())
+      ParseAddresses(value, from);
+    else if (IsField(name, "to") || IsField(name, "cc"))
+      ParseAddresses(value, to);
+    else if (IsField(name, "subject") && subject.empty())
+      subject = value.substr(0, HEADER_MAX_SUBJECT);
+  });
+  from.resize(1);
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  if (key <= _lastKey)
+    return SUCCESS;
+
+  // The bytes of every column, then written in order, the key last
+  std::string pending[COLUMN_NUMBER];
+  size_t names = _names.size();
+  uint32_t fromId = GetNameId(from[0], pending[COLUMN_NAMES]);
+  std::vector<uint32_t> toIds;
+  for (const std::string &address : to)
+    toIds.push_back(GetNameId(address, pending[COLUMN_NAMES]));
+  uint64_t toEnd = _to.size() + toIds.size();
+  uint64_t subjectEnd = _subjects.size() + subject.size();
+  int64_t time = std::max<int64_t>(arrival, _times.empty() ? INT64_MIN : _times.back());
+  uint8_t deleted = 0;
+  pending[COLUMN_TO].assign(reinterpret_cast<const char *>(toIds.data()), toIds.size() * sizeof(uint32_t));
+  pending[COLUMN_SUBJECT] = subject;
+  pending[COLUMN_TO_END].assign(reinterpret_cast<const char *>(&toEnd), sizeof(toEnd));
+  pending[COLUMN_SUBJECT_END].assign(reinterpret_cast<const char *>(&subjectEnd), sizeof(subjectEnd));
+  pending[COLUMN_FROM].assign(reinterpret_cast<const char *>(&fromId), sizeof(fromId));
+  pending[COLUMN_TIME].assign(reinterpret_cast<const char *>(&time), sizeof(time));
+  pending[COLUMN_DELETED].assign(reinterpret_cast<const char *>(&deleted), sizeof(deleted));
+  pending[COLUMN_KEY].assign(reinterpret_cast<const char *>(&key), sizeof(key));
+
+  for (int column = 0; column < COLUMN_NUMBER; ++column) {
+    if (Append(static_cast<HeaderColumn>(column), pending[column].data(), pending[column].size()) == SUCCESS)
+      continue;
+    // Columns written so far are cut back, the names given out taken back
+    for (int written = 0; written <= column; ++written) {
+      if (ftruncate(_fds[written], _sizes[written])) {}
+    }
+    while (_names.size() > names) {
+      _nameIds.erase(_names.back());
+      _names.pop_back();
+    }
+    return SEARCH_WRITE_ERROR;
+  }
+
+  for (int column = 0; column < COLUMN_NUMBER; ++column)
+    _sizes[column] += pending[column].size();
+  _to.insert(_to.end(), toIds.begin(), toIds.end());
+  _subjects += subject;
+  _toEnd.push_back(toEnd);
+  _subjectEnd.push_back(subjectEnd);
+  _from.push_back(fromId);
+  _times.push_back(time);
+  _deleted.push_back(deleted);
+  _keys.push_back(key);
+  _lastKey = key;
+  return SUCCESS;
+}
+
+RC HeaderStore::Remove (uint64_t key)
+{
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  auto found = std::lower_bound(_keys.begin(), _keys.end(), key);
+  if (found == _keys.end() || *found != key)
+    return SUCCESS;
+  size_t row = found - _keys.begin();
+  uint8_t deleted = 1;
+  if (pwrite(_fds[COLUMN_DELETED], &deleted, sizeof(deleted), row) != sizeof(deleted))
+    return SEARCH_WRITE_ERROR;
+  _deleted[row] = deleted;
+  return SUCCESS;
+}
+
+RC HeaderStore::CatchUp (const std::shared_ptr<Mailbox> &mailbox, uint64_t last)
+{
+  uint64_t nextKey = std::min(mailbox->GetNextKey(), last + 1);
+  uint64_t lastKey;
+  {
+    std::shared_lock<std::shared_mutex> lock(_lock);
+    lastKey = _lastKey;
+  }
+  if (nextKey <= lastKey + 1)
+    return SUCCESS;
+
+  // In key order, with the time each was stored at
+  std::vector<Index> indexes;
+  mailbox->ListMessages(indexes);
+  std::string message;
+  for (const Index &index : indexes) {
+    if (index.key <= lastKey || index.key >= nextKey)
+      continue;
+    RC rc = mailbox->Read(index.key, message);
+    if (rc == EDM_NO_SUCH_MESSAGE)
+      continue;
+    if (rc || (rc = Add(index.key, index.arrival, message)))
+      return rc;
+  }
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  _lastKey = std::max(_lastKey, nextKey - 1);
+  return SUCCESS;
+}
+
+RC HeaderStore::Query (const HeaderQuery &query, std::vector<uint64_t> &keys)
+{
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  keys.clear();
+
+  // The time range, then one pass a column over the rows in it
+  size_t first = std::lower_bound(_times.begin(), _times.end(), static_cast<int64_t>(query.since)) - _times.begin();
+  size_t last  = std::lower_bound(_times.begin(), _times.end(), static_cast<int64_t>(query.before)) - _times.begin();
+  if (first >= last)
+    return SUCCESS;
+  size_t rows = last - first;
+  std::vector<uint8_t> selected(rows);
+  const uint8_t *deleted = _deleted.data() + first;
+  for (size_t i = 0; i < rows; ++i)
+    selected[i] = !deleted[i];
+
+  if (!query.from.empty()) {
+    auto found = _nameIds.find(Lowercase(query.from));
+    if (found == _nameIds.end())
+      return SUCCESS;
+    uint32_t id = found->second;
+    const uint32_t *from = _from.data() + first;
+    for (size_t i = 0; i < rows; ++i)
+      selected[i] &= from[i] == id;
+  }
+
+  if (!query.to.empty()) {
+    auto found = _nameIds.find(Lowercase(query.to));
+    if (found == _nameIds.end())
+      return SUCCESS;
+    for (size_t i = 0; i < rows; ++i) {
+      if (!selected[i])
+        continue;
+      size_t row = first + i;
+      auto begin = _to.begin() + (row ? _toEnd[row - 1] : 0), end = _to.begin() + _toEnd[row];
+      selected[i] = std::find(begin, end, found->second) != end;
+    }
+  }
+
+  if (!query.subject.empty()) {
+    for (size_t i = 0; i < rows; ++i) {
+      if (!selected[i])
+        continue;
+      size_t row = first + i, begin = row ? _subjectEnd[row - 1] : 0;
+      selected[i] = FindNeedle(std::string_view(_subjects).substr(begin, _subjectEnd[row] - begin), query.subject, true);
+    }
+  }
+
+  for (size_t i = 0; i < rows; ++i) {
+    if (selected[i])
+      keys.push_back(_keys[first + i]);
+  }
+  return SUCCESS;
+}
+
+size_t HeaderStore::GetRows ()
+{
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  return _keys.size();
+}
+
+// Private helper functions
+RC HeaderStore::Load ()
+{
+  std::string bytes[COLUMN_NUMBER];
+  for (int column = 0; column < COLUMN_NUMBER; ++column) {
+    _fds[column] = open((_path + COLUMN_FILES[column]).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (_fds[column] == -1 || !ReadFile(_fds[column], bytes[column]))
+      return SEARCH_OPEN_ERROR;
+  }
+
+  // Names past a torn one, and rows past the last key, were never used
+  const std::string &names = bytes[COLUMN_NAMES];
+  size_t position = 0;
+  uint32_t length;
+  while (position + sizeof(length) <= names.size()) {
+    memcpy(&length, names.data() + position, sizeof(length));
+    if (length > names.size() - position - sizeof(length))
+      break;
+    _names.emplace_back(names, position + sizeof(length), length);
+    _nameIds[_names.back()] = _names.size() - 1;
+    position += sizeof(length) + length;
+  }
+  _sizes[COLUMN_NAMES] = position;
+
+  size_t rows = bytes[COLUMN_KEY].size() / sizeof(uint64_t);
+  rows = std::min(rows, bytes[COLUMN_TO_END].size() / sizeof(uint64_t));
+  rows = std::min(rows, bytes[COLUMN_SUBJECT_END].size() / sizeof(uint64_t));
+  rows = std::min(rows, bytes[COLUMN_FROM].size() / sizeof(uint32_t));
+  rows = std::min(rows, bytes[COLUMN_TIME].size() / sizeof(int64_t));
+  rows = std::min(rows, bytes[COLUMN_DELETED].size());
+  Decode(bytes[COLUMN_TO_END], rows, _toEnd);
+  Decode(bytes[COLUMN_SUBJECT_END], rows, _subjectEnd);
+  Decode(bytes[COLUMN_FROM], rows, _from);
+  Decode(bytes[COLUMN_TIME], rows, _times);
+  Decode(bytes[COLUMN_DELETED], rows, _deleted);
+  Decode(bytes[COLUMN_KEY], rows, _keys);
+  uint64_t toEnd = rows ? _toEnd.back() : 0, subjectEnd = rows ? _subjectEnd.back() : 0;
+  if (toEnd > bytes[COLUMN_TO].size() / sizeof(uint32_t) || subjectEnd > bytes[COLUMN_SUBJECT].size())
+    return SEARCH_CORRUPTED;
+  Decode(bytes[COLUMN_TO], toEnd, _to);
+  _subjects.assign(bytes[COLUMN_SUBJECT], 0, subjectEnd);
+
+  for (size_t row = 0; row < rows; ++row) {
+    if ((row && (_keys[row] <= _keys[row - 1] || _times[row] < _times[row - 1] || _toEnd[row] < _toEnd[row - 1] ||
+                 _subjectEnd[row] < _subjectEnd[row - 1])) || _from[row] >= _names.size())
+      return SEARCH_CORRUPTED;
+  }
+  for (uint32_t id : _to) {
+    if (id >= _names.size())
+      return SEARCH_CORRUPTED;
+  }
+
+  _sizes[COLUMN_TO]          = toEnd * sizeof(uint32_t);
+  _sizes[COLUMN_SUBJECT]     = subjectEnd;
+  _sizes[COLUMN_TO_END]      = rows * sizeof(uint64_t);
+  _sizes[COLUMN_SUBJECT_END] = rows * sizeof(uint64_t);
+  _sizes[COLUMN_FROM]        = rows * sizeof(uint32_t);
+  _sizes[COLUMN_TIME]        = rows * sizeof(int64_t);
+  _sizes[COLUMN_DELETED]     = rows;
+  _sizes[COLUMN_KEY]         = rows * sizeof(uint64_t);
+  for (int column = 0; column < COLUMN_NUMBER; ++column) {
+    if (_sizes[column] != bytes[column].size() && ftruncate(_fds[column], _sizes[column]))
+      return SEARCH_OPEN_ERROR;
+  }
+  _lastKey = rows ? _keys.back() : 0;
+  return SUCCESS;
+}
+
+void HeaderStore::Reset ()
+{
+  for (int &fd : _fds) {
+    if (fd != -1)
+      close(fd);
+    fd = -1;
+  }
+  std::fill(_sizes, _sizes + COLUMN_NUMBER, 0);
+  _names.clear();
+  _nameIds.clear();
+  _to.clear();
+  _subjects.clear();
+  _toEnd.clear();
+  _subjectEnd.clear();
+  _from.clear();
+  _times.clear();
+  _deleted.clear();
+  _keys.clear();
+  _lastKey = 0;
+}
+
+uint32_t HeaderStore::GetNameId (const std::string &name, std::string &names)
+{
+  auto found = _nameIds.find(name);
+  if (found != _nameIds.end())
+    return found->second;
+  uint32_t length = name.size();
+  names.append(reinterpret_cast<const char *>(&length), sizeof(length));
+  names += name;
+  _names.push_back(name);
+  return _nameIds[name] = _names.size() - 1;
+}
+
+RC HeaderStore::Append (HeaderColumn column, const void *data, size_t length)
+{
+  const char *bytes = static_cast<const char *>(data);
+  uint64_t offset = _sizes[column];
+  while (length) {
+    ssize_t written = pwrite(_fds[column], bytes, length, offset);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return SEARCH_WRITE_ERROR;
+    }
+    bytes  += written;
+    length -= written;
+    offset += written;
+  }
+  return SUCCESS;
+}
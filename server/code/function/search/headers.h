@@ -0,0 +1,163 @@
+#ifndef SEARCH_HEADERS
+#define SEARCH_HEADERS
+
+/* ----- Include libries or files ----- */
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "search.h"
+
+/* ----- Define macros ----- */
+#define HEADER_MAX_SUBJECT 998              // Longest subject kept, the line limit of RFC 5322
+const char HEADER_DIRECTORY_NAME[] = "headers/";  // Under the directory of the mailbox
+
+/**
+ * The columns of a HeaderStore, one file each in its directory. Row i of a
+ * fixed-size column is its i-th value; the recipients and the subjects of
+ * row i are the bytes of to.col and subject.dat between the ends of rows
+ * i - 1 and i.
+ */
+enum HeaderColumn {
+  COLUMN_NAMES,           // names.dict: every address, as a uint32 length and its bytes
+  COLUMN_TO,              // to.col: uint32 name ids of the recipients
+  COLUMN_SUBJECT,         // subject.dat: the subjects, one after the other
+  COLUMN_TO_END,          // to_end.col: uint64 end of the recipients of each row, in ids
+  COLUMN_SUBJECT_END,     // subject_end.col: uint64 end of the subject of each row
+  COLUMN_FROM,            // from.col: uint32 name id of the sender
+  COLUMN_TIME,            // time.col: int64 time of arrival, never decreasing
+  COLUMN_DELETED,         // deleted.col: uint8, 1 once the message is deleted
+  COLUMN_KEY,             // key.col: uint64 key of the message, written last
+  COLUMN_NUMBER,
+};
+
+/**
+ * HeaderQuery
+ * What a message must match, every field given. Addresses are compared
+ * whole and in lowercase, the subject is looked for anywhere in any case.
+ */
+struct HeaderQuery {
+  time_t since  = 0;                    // Arrived at or after
+  time_t before = INT64_MAX;            // Arrived before
+  std::string from;                     // Address of the sender
+  std::string to;                       // Address of one of the recipients, To or Cc
+  std::string subject;                  // Part of the subject
+};
+
+/**
+ * This function will give the addresses of a header field, in lowercase:
+ * what is between angle brackets, or else every word holding an '@'.
+ * @param  string_view given as the value of the field.
+ *         vector stores the addresses, appended.
+ */
+void ParseAddresses (std::string_view value, std::vector<std::string> &addresses);
+
+/**
+ * HeaderStore
+ * This class keeps the time of arrival, the sender, the recipients and the
+ * subject of every message of a mailbox in columns, so listings and searches
+ * by date, sender and recipient never read a message. Times never decrease
+ * from one row to the next, so a time range is two binary searches; the
+ * addresses are ids into a dictionary, so a sender is matched by comparing
+ * integers over the rows in range, a loop the compiler vectorizes.
+ *
+ * Rows are only appended, each column file is written at its end and the key
+ * column last: a row is there once its key is, and what a crash left past
+ * the last key is cut off by Open(). Like the indexes, the store is made
+ * again from the mailbox by CatchUp() after a loss, with the times of
+ * arrival the EDM keeps in the Index of every message.
+ *
+ * Contained Public Functions:
+ *   RC Open    ()
+ *   RC Add     (uint64_t key, time_t arrival, std::string_view message)
+ *   RC Remove  (uint64_t key)
+ *   RC CatchUp (const std::shared_ptr<Mailbox> &mailbox, uint64_t last = UINT64_MAX)
+ *   RC Query   (const HeaderQuery &query, std::vector<uint64_t> &keys)
+ *   size_t GetRows ()
+ */
+class HeaderStore
+{
+public:
+  explicit HeaderStore(const std::string &path);
+  ~HeaderStore();
+
+  HeaderStore(const HeaderStore &) = delete;
+  HeaderStore &operator=(const HeaderStore &) = delete;
+
+  /**
+   * This function will read the columns into memory, cutting off a row a
+   * crash left unfinished. Damaged columns are dropped, to be made again by
+   * CatchUp().
+   * @return SUCCESS if the store is ready.
+   *         SEARCH_OPEN_ERROR otherwise.
+   */
+  RC Open ();
+
+  /**
+   * This function will add the row of a message. Keys must come in
+   * increasing order, a key already there is left alone.
+   * @param  uint64_t given as the key of the message.
+   *         time_t given as its time of arrival.
+   *         string_view given as the message, only its header is read.
+   * @return SUCCESS if added.
+   *         SEARCH_WRITE_ERROR otherwise.
+   */
+  RC Add (uint64_t key, time_t arrival, std::string_view message);
+
+  /**
+   * This function will mark the row of a message deleted.
+   * @param  uint64_t given as the key.
+   * @return SUCCESS if marked or not there.
+   *         SEARCH_WRITE_ERROR otherwise.
+   */
+  RC Remove (uint64_t key);
+
+  /**
+   * This function will add the rows of the messages of the mailbox the store
+   * has not seen.
+   * @param  shared_ptr given as the mailbox.
+   *         uint64_t given as the last key to look at.
+   * @return SUCCESS if up to date.
+   *         pre-defined error number of the mailbox or the store otherwise.
+   */
+  RC CatchUp (const std::shared_ptr<Mailbox> &mailbox, uint64_t last = UINT64_MAX);
+
+  /**
+   * This function will find the messages matching a query.
+   * @param  HeaderQuery given as the query.
+   *         vector stores the keys, in increasing order.
+   * @return SUCCESS if queried.
+   */
+  RC Query (const HeaderQuery &query, std::vector<uint64_t> &keys);
+
+  size_t GetRows ();
+
+private:
+  std::string _path;                            // Directory of the store, in the mailbox
+  std::shared_mutex _lock;                      // Guards the members below
+  int _fds[COLUMN_NUMBER];
+  uint64_t _sizes[COLUMN_NUMBER];               // Bytes of each column file holding whole rows
+  std::vector<std::string> _names;
+  std::unordered_map<std::string, uint32_t> _nameIds;
+  std::vector<uint32_t> _to;
+  std::string _subjects;
+  std::vector<uint64_t> _toEnd;
+  std::vector<uint64_t> _subjectEnd;
+  std::vector<uint32_t> _from;
+  std::vector<int64_t> _times;
+  std::vector<uint8_t> _deleted;
+  std::vector<uint64_t> _keys;
+  uint64_t _lastKey;                            // Highest key seen, deleted since or not
+
+  // Private helper functions
+  RC Load ();
+  void Reset ();
+  uint32_t GetNameId (const std::string &name, std::string &names);
+  RC Append (HeaderColumn column, const void *data, size_t length);
+};
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * scan.cpp
+ *
+ * This file provides the Content Scanner: a parallel search of the stored
+ * messages of a mailbox, for what the indexes cannot answer.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sys/mman.h>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "scan.h"
+
+/************ Helper Functions *************/
+struct Needle {
+  std::string_view bytes;
+  bool ignoreCase;
+  char first[2];          // The first byte, both cases if they are ignored
+  char last[2];
+};
+
+static Needle MakeNeedle (std::string_view bytes, bool ignoreCase)
+{
+  unsigned char first = bytes.front(), last = bytes.back();
+  Needle needle{bytes, ignoreCase, {bytes.front(), bytes.front()}, {bytes.back(), bytes.back()}};
+  if (ignoreCase) {
+    needle.first[0] = tolower(first);
+    needle.first[1] = toupper(first);
+    needle.last[0]  = tolower(last);
+    needle.last[1]  = toupper(last);
+  }
+  return needle;
+}
+
+static bool Matches (const char *at, const Needle &needle)
+{
+  if (!needle.ignoreCase)
+    return !memcmp(at, needle.bytes.data(), needle.bytes.size());
+  for (size_t i = 0; i < needle.bytes.size(); ++i) {
+    if (tolower(static_cast<unsigned char>(at[i])) != tolower(static_cast<unsigned char>(needle.bytes[i])))
+      return false;
+  }
+  return true;
+}
+
+static bool FindScalar (const char *data, size_t length, const Needle &needle, size_t start)
+{
+  size_t last = needle.bytes.size() - 1;
+  for (size_t i = start; i + last < length; ++i) {
+    if ((data[i] == needle.first[0] || data[i] == needle.first[1]) &&
+        (data[i + last] == needle.last[0] || data[i + last] == needle.last[1]) && Matches(data + i, needle))
+      return true;
+  }
+  return false;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Bit i of a mask is set where the first byte is at i and the last at i + size - 1
+__attribute__((target("sse2")))
+static bool FindSse2 (const char *data, size_t length, const Needle &needle)
+{
+  size_t last = needle.bytes.size() - 1, i = 0;
+  const __m128i first0 = _mm_set1_epi8(needle.first[0]), first1 = _mm_set1_epi8(needle.first[1]);
+  const __m128i last0  = _mm_set1_epi8(needle.last[0]),  last1  = _mm_set1_epi8(needle.last[1]);
+  for (; i + last + 16 <= length; i += 16) {
+    __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + last));
+    __m128i both = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(head, first0), _mm_cmpeq_epi8(head, first1)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(tail, last0), _mm_cmpeq_epi8(tail, last1)));
+    for (unsigned mask = _mm_movemask_epi8(both); mask; mask &= mask - 1) {
+      if (Matches(data + i + __builtin_ctz(mask), needle))
+        return true;
+    }
+  }
+  return FindScalar(data, length, needle, i);
+}
+
+__attribute__((target("avx2")))
+static bool FindAvx2 (const char *data, size_t length, const Needle &needle)
+{
+  size_t last = needle.bytes.size() - 1, i = 0;
+  const __m256i first0 = _mm256_set1_epi8(needle.first[0]), first1 = _mm256_set1_epi8(needle.first[1]);
+  const __m256i last0  = _mm256_set1_epi8(needle.last[0]),  last1  = _mm256_set1_epi8(needle.last[1]);
+  for (; i + last + 32 <= length; i += 32) {
+    __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + last));
+    __m256i both = _mm256_and_si256(_mm256_or_si256(_mm256_cmpeq_epi8(head, first0), _mm256_cmpeq_epi8(head, first1)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(tail, last0), _mm256_cmpeq_epi8(tail, last1)));
+    for (unsigned mask = _mm256_movemask_epi8(both); mask; mask &= mask - 1) {
+      if (Matches(data + i + __builtin_ctz(mask), needle))
+        return true;
+    }
+  }
+  return FindScalar(data, length, needle, i);
+}
+#endif
+
+static bool FindAny (const char *data, size_t length, const Needle &needle)
+{
+  return FindScalar(data, length, needle, 0);
+}
+
+typedef bool (*Finder) (const char *data, size_t length, const Needle &needle);
+
+// Chosen once, for the processor the server runs on
+static Finder GetFinder ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return FindAvx2;
+  if (__builtin_cpu_supports("sse2"))
+    return FindSse2;
+#endif
+  return FindAny;
+}
+
+bool FindNeedle (std::string_view haystack, std::string_view needle, bool ignoreCase)
+{
+  static const Finder finder = GetFinder();
+  if (needle.empty() || haystack.size() < needle.size())
+    return false;
+  return finder(haystack.data(), haystack.size(), MakeNeedle(needle, ignoreCase));
+}
+
+/************ ContentScanner *************/
+ContentScanner::ContentScanner(size_t threads)
+  : _threads(threads),
+    _stats()
+{
+  if (!_threads)
+    _threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+RC ContentScanner::Scan (const std::shared_ptr<Mailbox> &mailbox, std::string_view needle, bool ignoreCase,
+                         const std::function<void (uint64_t key)> &found)
+{
+  _stats = {};
+  if (needle.empty())
+    return SEARCH_BAD_QUERY;
+
+  // Where every message is: a range of a segment, or to be read back if compressed
+  struct Located {
+    uint64_t key;
+    std::shared_ptr<Segment> segment;
+    off_t offset;
+    size_t length;
+  };
+  std::vector<SummaryEntry> entries;
+  std::vector<Located> located;
+  mailbox->ListSummary(entries);
+  located.reserve(entries.size());
+  for (const SummaryEntry &entry : entries) {
+    Located message{entry.key, NULL, 0, 0};
+    RC rc = mailbox->Locate(entry.key, message.segment, message.offset, message.length);
+    if (rc == EDM_NO_SUCH_MESSAGE)
+      continue;
+    if (rc && rc != EDM_COMPRESSED)
+      return rc;
+    located.push_back(std::move(message));
+  }
+
+  // One mapping a segment, as far as its last message here
+  std::map<Segment *, std::pair<const char *, size_t>> mappings;
+  for (const Located &message : located) {
+    if (message.segment) {
+      size_t &size = mappings[message.segment.get()].second;
+      size = std::max(size, static_cast<size_t>(message.offset + message.length));
+    }
+  }
+  RC rc = SUCCESS;
+  for (auto &mapping : mappings) {
+    void *data = mmap(NULL, mapping.second.second, PROT_READ, MAP_SHARED, mapping.first->GetFd(), 0);
+    if (data == MAP_FAILED) {
+      mapping.second.second = 0;
+      rc = SEARCH_READ_ERROR;
+      continue;
+    }
+    madvise(data, mapping.second.second, MADV_SEQUENTIAL);
+    mapping.second.first = static_cast<const char *>(data);
+  }
+
+  // Pieces overlap by the needle less one byte, so nothing is missed at a cut
+  struct Piece {
+    size_t message;
+    const char *data;       // NULL for a compressed message
+    size_t length;
+  };
+  std::vector<Piece> pieces;
+  for (size_t i = 0; i < located.size() && rc == SUCCESS; ++i) {
+    if (!located[i].segment) {
+      pieces.push_back(Piece{i, NULL, 0});
+      continue;
+    }
+    const char *data = mappings[located[i].segment.get()].first + located[i].offset;
+    size_t length = located[i].length;
+    _stats.bytes += length;
+    for (size_t start = 0; start == 0 || start + needle.size() - 1 < length; start += SCAN_CHUNK_SIZE)
+      pieces.push_back(Piece{i, data + start, std::min(length - start, SCAN_CHUNK_SIZE + needle.size() - 1)});
+  }
+
+  std::unique_ptr<std::atomic<bool>[]> done(new std::atomic<bool>[located.size()]());
+  std::atomic<size_t> next(0);
+  std::atomic<uint64_t> readBytes(0);
+  std::atomic<RC> failed(SUCCESS);
+  std::mutex reporting;
+  auto work = [&] {
+    std::string message;
+    for (size_t i = next++; i < pieces.size() && rc == SUCCESS; i = next++) {
+      const Piece &piece = pieces[i];
+      if (done[piece.message])
+        continue;
+      std::string_view haystack(piece.data, piece.length);
+      if (!piece.data) {
+        RC read = mailbox->Read(located[piece.message].key, message);
+        if (read == EDM_NO_SUCH_MESSAGE)
+          continue;
+        if (read) {
+          RC none = SUCCESS;
+          failed.compare_exchange_strong(none, read);
+          continue;
+        }
+        readBytes += message.size();
+        haystack = message;
+      }
+      if (FindNeedle(haystack, needle, ignoreCase) && !done[piece.message].exchange(true)) {
+        std::lock_guard<std::mutex> lock(reporting);
+        ++_stats.matches;
+        found(located[piece.message].key);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(_threads, pieces.size()); ++i)
+    workers.emplace_back(work);
+  work();
+  for (std::thread &worker : workers)
+    worker.join();
+
+  for (const auto &mapping : mappings) {
+    if (mapping.second.first)
+      munmap(const_cast<char *>(mapping.second.first), mapping.second.second);
+  }
+  _stats.messages = located.size();
+  _stats.bytes   += readBytes;
+  return rc ? rc : failed.load();
+}
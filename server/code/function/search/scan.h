@@ -0,0 +1,82 @@
+#ifndef SEARCH_SCAN
+#define SEARCH_SCAN
+
+/* ----- Include libries or files ----- */
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "search.h"
+
+/* ----- Define macros ----- */
+#define SCAN_CHUNK_SIZE  (1024 * 1024)      // Larger messages are cut for the workers to share
+
+struct ScanStats {
+  uint64_t messages;      // Looked at
+  uint64_t bytes;         // Of the messages, as stored or read back
+  uint64_t matches;       // Messages holding the needle
+};
+
+/**
+ * This function will tell whether a buffer holds a needle. Candidates are
+ * the positions where both the first and the last byte of the needle are,
+ * found 32 bytes at a time with AVX2, 16 with SSE2 or one by one otherwise,
+ * as the processor allows; only those are compared in full.
+ * @param  string_view given as the buffer.
+ *         string_view given as the needle, not empty.
+ *         bool given as true to ignore the case of ASCII letters.
+ * @return true if the needle is found.
+ */
+bool FindNeedle (std::string_view haystack, std::string_view needle, bool ignoreCase);
+
+/**
+ * ContentScanner
+ * This class searches the stored messages of a mailbox themselves, for
+ * mailboxes without an index or queries an index cannot answer. The
+ * segments holding the messages are mapped into memory and the messages are
+ * shared out among worker threads in pieces of up to SCAN_CHUNK_SIZE, so a
+ * scan runs on all cores at about the speed memory is read. Compressed
+ * messages are read back and decompressed by the worker that takes them.
+ *
+ * A message is given to the callback as soon as it is found, from the
+ * worker that found it, one call at a time.
+ *
+ * Contained Public Functions:
+ *   RC Scan (const std::shared_ptr<Mailbox> &mailbox, std::string_view needle, bool ignoreCase,
+ *            const std::function<void (uint64_t key)> &found)
+ *   void GetStats (ScanStats &stats)
+ */
+class ContentScanner
+{
+public:
+  explicit ContentScanner(size_t threads = 0);
+
+  /**
+   * This function will find the messages of a mailbox holding a needle.
+   * @param  shared_ptr given as the mailbox.
+   *         string_view given as the needle.
+   *         bool given as true to ignore the case of ASCII letters.
+   *         function given to call with the key of every message found.
+   * @return SUCCESS if every message has been looked at.
+   *         SEARCH_BAD_QUERY if the needle is empty.
+   *         SEARCH_READ_ERROR if a segment cannot be mapped.
+   *         pre-defined error number of the mailbox otherwise.
+   */
+  RC Scan (const std::shared_ptr<Mailbox> &mailbox, std::string_view needle, bool ignoreCase,
+           const std::function<void (uint64_t key)> &found);
+
+  /**
+   * This function will give the counters of the last scan.
+   * @param ScanStats stores the counters.
+   */
+  void GetStats (ScanStats &stats) const { stats = _stats; }
+
+private:
+  size_t _threads;        // Workers of a scan, one a core by default
+  ScanStats _stats;
+};
+
+#endif
@@ -0,0 +1,934 @@
+/*
+ * search.cpp
+ *
+ * This file provides the Search Engine: an inverted index of the messages of
+ * every mailbox, kept in immutable segments merged in the background.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../basic/wal/wal.h"
+#include "headers.h"
+#include "scan.h"
+#include "search.h"
+
+/************ Helper Functions *************/
+static bool WriteAll (int fd, const void *data, size_t length, uint64_t offset)
+{
+  const char *bytes = static_cast<const char *>(data);
+  while (length) {
+    ssize_t written = pwrite(fd, bytes, length, offset);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes  += written;
+    length -= written;
+    offset += written;
+  }
+  return true;
+}
+
+static void SyncDirectory (const std::string &path)
+{
+  int directoryId = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directoryId != -1) {
+    fsync(directoryId);
+    close(directoryId);
+  }
+}
+
+static void PutVarint (std::string &out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out += static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+static bool GetVarint (const char *&data, const char *end, uint64_t &value)
+{
+  value = 0;
+  for (int shift = 0; data < end && shift < 64; shift += 7) {
+    uint8_t byte = *data++;
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static bool IsWordCharacter (unsigned char character)
+{
+  // Bytes of UTF-8 sequences are kept, the words of other scripts stay whole
+  return isalnum(character) || character >= 0x80;
+}
+
+static void AddWords (std::string_view text, char field, std::set<std::string> &terms)
+{
+  std::string word;
+  for (size_t i = 0; i <= text.size(); ++i) {
+    unsigned char character = i < text.size() ? text[i] : ' ';
+    if (IsWordCharacter(character)) {
+      word += static_cast<char>(tolower(character));
+      continue;
+    }
+    if (word.size() >= SEARCH_MIN_TOKEN && word.size() <= SEARCH_MAX_TOKEN)
+      terms.insert(field + word);
+    word.clear();
+  }
+}
+
+static char GetField (std::string_view name)
+{
+  static const struct {
+    const char *name;
+    char field;
+  } FIELDS[] = {
+    {"subject", SEARCH_SUBJECT}, {"from", SEARCH_FROM}, {"to", SEARCH_TO}, {"cc", SEARCH_TO},
+    {"bcc", SEARCH_TO}, {"body", SEARCH_BODY},
+  };
+  for (const auto &known : FIELDS) {
+    if (name.size() == strlen(known.name) && !strncasecmp(name.data(), known.name, name.size()))
+      return known.field;
+  }
+  return 0;
+}
+
+void Tokenize (std::string_view message, std::set<std::string> &terms)
+{
+  // Header fields up to the empty line, folded lines belong to the field before
+  size_t position = 0;
+  char field = 0;
+  while (position < message.size()) {
+    size_t end  = message.find('\n', position);
+    size_t next = end == std::string_view::npos ? message.size() : end + 1;
+    std::string_view line = message.substr(position, next - position);
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+      line.remove_suffix(1);
+    position = next;
+
+    if (line.empty())
+      break;
+    if (line[0] == ' ' || line[0] == '\t') {
+      if (field && field != SEARCH_BODY)
+        AddWords(line, field, terms);
+      continue;
+    }
+    size_t colon = line.find(':');
+    field = colon == std::string_view::npos ? 0 : GetField(line.substr(0, colon));
+    if (field && field != SEARCH_BODY)
+      AddWords(line.substr(colon + 1), field, terms);
+  }
+  AddWords(message.substr(position), SEARCH_BODY, terms);
+}
+
+void Trigrams (std::string_view message, std::set<std::string> &terms)
+{
+  char trigram[3];
+  for (size_t i = 0; i < message.size(); ++i) {
+    trigram[i % 3] = tolower(static_cast<unsigned char>(message[i]));
+    if (i >= 2)
+      terms.emplace(std::string{trigram[(i - 2) % 3], trigram[(i - 1) % 3], trigram[i % 3]});
+  }
+}
+
+/************ IndexSegment *************/
+IndexSegment::IndexSegment(const std::string &name, uint64_t number)
+  : _name(name),
+    _number(number),
+    _header(),
+    _data(NULL),
+    _size(0)
+{
+}
+
+IndexSegment::~IndexSegment()
+{
+  if (_data)
+    munmap(const_cast<char *>(_data), _size);
+}
+
+RC IndexSegment::Open ()
+{
+  int fd = open(_name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return SEARCH_OPEN_ERROR;
+  struct stat status;
+  if (fstat(fd, &status) || static_cast<size_t>(status.st_size) < sizeof(IndexSegmentHeader)) {
+    close(fd);
+    return SEARCH_CORRUPTED;
+  }
+  _size = status.st_size;
+  void *mapping = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return SEARCH_OPEN_ERROR;
+  _data = static_cast<const char *>(mapping);
+
+  memcpy(&_header, _data, sizeof(_header));
+  if (_header.magic != SEARCH_MAGIC || _header.version != SEARCH_VERSION ||
+      _header.dictionary < sizeof(_header) || _header.dictionary > _size ||
+      Crc32c(_data + sizeof(_header), _size - sizeof(_header)) != _header.checksum)
+    return SEARCH_CORRUPTED;
+
+  const char *entry = _data + _header.dictionary;
+  const char *end   = _data + _size;
+  _terms.reserve(_header.terms);
+  for (uint64_t i = 0; i < _header.terms; ++i) {
+    uint64_t length;
+    Term term;
+    if (!GetVarint(entry, end, length) || length > static_cast<uint64_t>(end - entry))
+      return SEARCH_CORRUPTED;
+    term.term = std::string_view(entry, length);
+    entry += length;
+    if (!GetVarint(entry, end, term.count) || !GetVarint(entry, end, term.offset) ||
+        !GetVarint(entry, end, term.length) || term.offset < sizeof(_header) ||
+        term.offset + term.length > _header.dictionary)
+      return SEARCH_CORRUPTED;
+    _terms.push_back(term);
+  }
+  return SUCCESS;
+}
+
+bool IndexSegment::Find (std::string_view term, std::vector<uint64_t> &keys) const
+{
+  auto found = std::lower_bound(_terms.begin(), _terms.end(), term,
+                                [](const Term &entry, std::string_view wanted) { return entry.term < wanted; });
+  if (found == _terms.end() || found->term != term)
+    return false;
+  Decode(*found, keys);
+  return true;
+}
+
+void IndexSegment::Decode (const Term &term, std::vector<uint64_t> &keys) const
+{
+  const char *postings = _data + term.offset;
+  const char *end      = postings + term.length;
+  uint64_t key = 0, delta;
+  keys.reserve(keys.size() + term.count);
+  for (uint64_t i = 0; i < term.count && GetVarint(postings, end, delta); ++i) {
+    key += delta;
+    keys.push_back(key);
+  }
+}
+
+/************ SegmentWriter *************/
+SegmentWriter::SegmentWriter()
+  : _fd(-1),
+    _offset(sizeof(IndexSegmentHeader)),
+    _crc(0),
+    _terms(0)
+{
+}
+
+SegmentWriter::~SegmentWriter()
+{
+  // Given up before Finish()
+  if (_fd != -1) {
+    close(_fd);
+    unlink((_name + ".tmp").c_str());
+  }
+}
+
+RC SegmentWriter::Open (const std::string &name)
+{
+  _name = name;
+  _fd = open((_name + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  return _fd == -1 ? SEARCH_OPEN_ERROR : SUCCESS;
+}
+
+RC SegmentWriter::Add (std::string_view term, const std::vector<uint64_t> &keys)
+{
+  uint64_t offset = _offset + _postings.size();
+  uint64_t previous = 0;
+  for (uint64_t key : keys) {
+    PutVarint(_postings, key - previous);
+    previous = key;
+  }
+
+  PutVarint(_dictionary, term.size());
+  _dictionary.append(term);
+  PutVarint(_dictionary, keys.size());
+  PutVarint(_dictionary, offset);
+  PutVarint(_dictionary, _offset + _postings.size() - offset);
+  ++_terms;
+
+  if (_postings.size() < SEARCH_FLUSH_SIZE)
+    return SUCCESS;
+  RC rc = WriteOut(_postings);
+  _postings.clear();
+  return rc;
+}
+
+RC SegmentWriter::Finish (IndexSegmentHeader &header)
+{
+  RC rc = WriteOut(_postings);
+  _postings.clear();
+  header.dictionary = _offset;
+  if (rc || (rc = WriteOut(_dictionary)))
+    return rc;
+
+  header.magic    = SEARCH_MAGIC;
+  header.version  = SEARCH_VERSION;
+  header.terms    = _terms;
+  header.checksum = _crc;
+  header.reserved = 0;
+  std::string temporary = _name + ".tmp";
+  if (!WriteAll(_fd, &header, sizeof(header), 0) || fdatasync(_fd) ||
+      rename(temporary.c_str(), _name.c_str()))
+    return SEARCH_WRITE_ERROR;
+  close(_fd);
+  _fd = -1;
+  SyncDirectory(_name.substr(0, _name.rfind('/') + 1));
+  return SUCCESS;
+}
+
+// Private helper functions
+RC SegmentWriter::WriteOut (const std::string &bytes)
+{
+  if (!WriteAll(_fd, bytes.data(), bytes.size(), _offset))
+    return SEARCH_WRITE_ERROR;
+  _crc = Crc32c(bytes.data(), bytes.size(), _crc);
+  _offset += bytes.size();
+  return SUCCESS;
+}
+
+/************ SearchIndex *************/
+SearchIndex::SearchIndex(const std::string &path, const char *directory, Tokenizer tokenizer)
+  : _mailbox(path),
+    _tokenizer(tokenizer),
+    _nextSegment(1),
+    _bufferedMessages(0),
+    _bufferedSize(0),
+    _lastKey(0),
+    _deletedId(-1)
+{
+  if (_mailbox.empty() || _mailbox.back() != '/')
+    _mailbox += '/';
+  _path = _mailbox + directory;
+}
+
+SearchIndex::~SearchIndex()
+{
+  if (_deletedId != -1)
+    close(_deletedId);
+}
+
+RC SearchIndex::Open ()
+{
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  if (mkdir(_path.c_str(), 0700) && errno != EEXIST)
+    return SEARCH_OPEN_ERROR;
+
+  DIR *directory = opendir(_path.c_str());
+  if (!directory)
+    return SEARCH_OPEN_ERROR;
+  std::string extension = SEARCH_EXTENSION;
+  std::vector<std::shared_ptr<IndexSegment>> segments;
+  bool damaged = false;
+  struct dirent *entry;
+  while ((entry = readdir(directory))) {
+    std::string name = entry->d_name;
+    // Segments a crash left unfinished
+    if (name.size() > 4 && !name.compare(name.size() - 4, 4, ".tmp")) {
+      unlink((_path + name).c_str());
+      continue;
+    }
+    if (name.size() <= extension.size() || name.compare(name.size() - extension.size(), extension.size(), extension))
+      continue;
+    char *end;
+    uint64_t number = strtoull(name.c_str(), &end, 10);
+    if (end != name.c_str() + name.size() - extension.size())
+      continue;
+    std::shared_ptr<IndexSegment> segment(new IndexSegment(_path + name, number));
+    damaged |= segment->Open() != SUCCESS;
+    segments.push_back(std::move(segment));
+  }
+  closedir(directory);
+
+  // A damaged segment leaves a hole no catching up would fill: start again
+  if (damaged) {
+    for (const std::shared_ptr<IndexSegment> &segment : segments)
+      unlink(segment->GetName().c_str());
+    segments.clear();
+    unlink((_path + SEARCH_DELETED_NAME).c_str());
+  }
+
+  // Segments a merge replaced, left by a crash before they were unlinked
+  for (const std::shared_ptr<IndexSegment> &segment : segments) {
+    bool replaced = false;
+    for (const std::shared_ptr<IndexSegment> &other : segments) {
+      replaced |= other != segment && other->GetHeader().first <= segment->GetNumber() &&
+                  segment->GetNumber() <= other->GetHeader().last;
+    }
+    if (replaced) {
+      unlink(segment->GetName().c_str());
+      continue;
+    }
+    _segments.push_back(segment);
+    _nextSegment = std::max(_nextSegment, segment->GetNumber() + 1);
+    _lastKey     = std::max(_lastKey, segment->GetHeader().maxKey);
+  }
+  std::sort(_segments.begin(), _segments.end(),
+            [](const std::shared_ptr<IndexSegment> &a, const std::shared_ptr<IndexSegment> &b) {
+              return a->GetNumber() < b->GetNumber();
+            });
+
+  // A torn tombstone at the end is dropped
+  std::string name = _path + SEARCH_DELETED_NAME;
+  _deletedId = open(name.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (_deletedId == -1)
+    return SEARCH_OPEN_ERROR;
+  uint64_t key;
+  for (off_t offset = 0; pread(_deletedId, &key, sizeof(key), offset) == sizeof(key); offset += sizeof(key))
+    _deleted.insert(key);
+  return SUCCESS;
+}
+
+RC SearchIndex::Add (uint64_t key, std::string_view message)
+{
+  std::set<std::string> terms;
+  _tokenizer(message, terms);
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  // Indexed already, by CatchUp()
+  if (key <= _lastKey)
+    return SUCCESS;
+  for (const std::string &term : terms) {
+    _buffer[term].push_back(key);
+    _bufferedSize += term.size() + sizeof(key);
+  }
+  ++_bufferedMessages;
+  _lastKey = key;
+
+  if (_bufferedMessages < SEARCH_FLUSH_MESSAGES && _bufferedSize < SEARCH_FLUSH_SIZE)
+    return SUCCESS;
+  return FlushLocked();
+}
+
+RC SearchIndex::Remove (uint64_t key)
+{
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  if (!_deleted.insert(key).second)
+    return SUCCESS;
+  // Not synced: a tombstone lost only leaves a key a search filters out
+  if (write(_deletedId, &key, sizeof(key)) != sizeof(key))
+    return SEARCH_WRITE_ERROR;
+  return SUCCESS;
+}
+
+RC SearchIndex::CatchUp (const std::shared_ptr<Mailbox> &mailbox, uint64_t last)
+{
+  uint64_t nextKey = std::min(mailbox->GetNextKey(), last + 1);
+  uint64_t lastKey;
+  {
+    std::shared_lock<std::shared_mutex> lock(_lock);
+    lastKey = _lastKey;
+  }
+  if (nextKey <= lastKey + 1)
+    return SUCCESS;
+
+  std::vector<SummaryEntry> entries;
+  mailbox->ListSummary(entries);
+  std::sort(entries.begin(), entries.end(),
+            [](const SummaryEntry &a, const SummaryEntry &b) { return a.key < b.key; });
+  std::string message;
+  for (const SummaryEntry &entry : entries) {
+    if (entry.key <= lastKey || entry.key >= nextKey)
+      continue;
+    RC rc = mailbox->Read(entry.key, message);
+    if (rc == EDM_NO_SUCH_MESSAGE)
+      continue;
+    if (rc || (rc = Add(entry.key, message)))
+      return rc;
+  }
+
+  // Keys given to messages deleted since are seen as well
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  _lastKey = std::max(_lastKey, nextKey - 1);
+  return SUCCESS;
+}
+
+RC SearchIndex::Search (const std::vector<std::vector<std::string>> &query, std::vector<uint64_t> &keys)
+{
+  std::shared_lock<std::shared_mutex> lock(_lock);
+
+  keys.clear();
+  std::vector<uint64_t> matches, kept;
+  for (size_t group = 0; group < query.size(); ++group) {
+    // Keys holding any term of the group, from the segments and the buffer
+    matches.clear();
+    for (const std::string &term : query[group]) {
+      for (const std::shared_ptr<IndexSegment> &segment : _segments)
+        segment->Find(term, matches);
+      auto buffered = _buffer.find(term);
+      if (buffered != _buffer.end())
+        matches.insert(matches.end(), buffered->second.begin(), buffered->second.end());
+    }
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+
+    if (group == 0) {
+      keys.swap(matches);
+    } else {
+      kept.clear();
+      std::set_intersection(keys.begin(), keys.end(), matches.begin(), matches.end(), std::back_inserter(kept));
+      keys.swap(kept);
+    }
+    if (keys.empty())
+      return SUCCESS;
+  }
+
+  keys.erase(std::remove_if(keys.begin(), keys.end(), [this](uint64_t key) { return _deleted.count(key); }),
+             keys.end());
+  return SUCCESS;
+}
+
+RC SearchIndex::Flush ()
+{
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  return FlushLocked();
+}
+
+RC SearchIndex::Merge ()
+{
+  std::lock_guard<std::mutex> merging(_mergeLock);
+
+  // The segments never change, they are read without the lock
+  std::vector<std::shared_ptr<IndexSegment>> inputs;
+  std::unordered_set<uint64_t> deleted;
+  uint64_t number;
+  {
+    std::unique_lock<std::shared_mutex> lock(_lock);
+    if (_segments.size() < 2)
+      return SUCCESS;
+    inputs  = _segments;
+    deleted = _deleted;
+    number  = _nextSegment++;
+  }
+
+  IndexSegmentHeader header = {};
+  header.first  = UINT64_MAX;
+  header.minKey = UINT64_MAX;
+  for (const std::shared_ptr<IndexSegment> &input : inputs) {
+    header.first  = std::min(header.first, input->GetHeader().first);
+    header.last   = std::max(header.last, input->GetNumber());
+    header.minKey = std::min(header.minKey, input->GetHeader().minKey);
+    header.maxKey = std::max(header.maxKey, input->GetHeader().maxKey);
+  }
+
+  // A k-way merge of the dictionaries, one term at a time
+  SegmentWriter writer;
+  RC rc = writer.Open(GetFileName(number));
+  if (rc)
+    return rc;
+  std::vector<size_t> cursors(inputs.size(), 0);
+  std::vector<uint64_t> keys;
+  while (true) {
+    std::string_view term;
+    bool found = false;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      const std::vector<IndexSegment::Term> &terms = inputs[i]->GetTerms();
+      if (cursors[i] < terms.size() && (!found || terms[cursors[i]].term < term)) {
+        term  = terms[cursors[i]].term;
+        found = true;
+      }
+    }
+    if (!found)
+      break;
+
+    keys.clear();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      const std::vector<IndexSegment::Term> &terms = inputs[i]->GetTerms();
+      if (cursors[i] < terms.size() && terms[cursors[i]].term == term)
+        inputs[i]->Decode(terms[cursors[i]++], keys);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::remove_if(keys.begin(), keys.end(), [&deleted](uint64_t key) { return deleted.count(key); }),
+               keys.end());
+    if (!keys.empty() && (rc = writer.Add(term, keys)))
+      return rc;
+  }
+  std::shared_ptr<IndexSegment> merged(new IndexSegment(GetFileName(number), number));
+  if ((rc = writer.Finish(header)) || (rc = merged->Open()))
+    return rc;
+
+  // Segments written meanwhile stay, tombstones applied go
+  {
+    std::unique_lock<std::shared_mutex> lock(_lock);
+    for (const std::shared_ptr<IndexSegment> &input : inputs)
+      _segments.erase(std::find(_segments.begin(), _segments.end(), input));
+    _segments.insert(_segments.begin(), merged);
+    for (uint64_t key : deleted) {
+      if (key <= header.maxKey)
+        _deleted.erase(key);
+    }
+    RewriteDeleted();
+  }
+  for (const std::shared_ptr<IndexSegment> &input : inputs)
+    unlink(input->GetName().c_str());
+  return SUCCESS;
+}
+
+size_t SearchIndex::GetSegmentNumber ()
+{
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  return _segments.size();
+}
+
+// Private helper functions
+RC SearchIndex::FlushLocked ()
+{
+  if (_buffer.empty())
+    return SUCCESS;
+
+  std::vector<std::pair<const std::string, std::vector<uint64_t>> *> terms;
+  terms.reserve(_buffer.size());
+  IndexSegmentHeader header = {};
+  header.minKey = UINT64_MAX;
+  for (auto &term : _buffer) {
+    terms.push_back(&term);
+    header.minKey = std::min(header.minKey, term.second.front());
+    header.maxKey = std::max(header.maxKey, term.second.back());
+  }
+  std::sort(terms.begin(), terms.end(), [](const auto *a, const auto *b) { return a->first < b->first; });
+
+  uint64_t number = _nextSegment;
+  header.first = header.last = number;
+  SegmentWriter writer;
+  RC rc = writer.Open(GetFileName(number));
+  for (size_t i = 0; i < terms.size() && rc == SUCCESS; ++i)
+    rc = writer.Add(terms[i]->first, terms[i]->second);
+  std::shared_ptr<IndexSegment> segment(new IndexSegment(GetFileName(number), number));
+  if (rc || (rc = writer.Finish(header)) || (rc = segment->Open()))
+    return rc;
+
+  ++_nextSegment;
+  _segments.push_back(segment);
+  _buffer.clear();
+  _bufferedMessages = 0;
+  _bufferedSize     = 0;
+  if (_segments.size() >= SEARCH_MERGE_SEGMENTS)
+    SearchEngine::instance()->ReportMergeable(_path);
+  return SUCCESS;
+}
+
+RC SearchIndex::RewriteDeleted ()
+{
+  std::string name      = _path + SEARCH_DELETED_NAME;
+  std::string temporary = name + ".tmp";
+  int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return SEARCH_WRITE_ERROR;
+  std::vector<uint64_t> keys(_deleted.begin(), _deleted.end());
+  if ((!keys.empty() && write(fd, keys.data(), keys.size() * sizeof(uint64_t)) !=
+                        static_cast<ssize_t>(keys.size() * sizeof(uint64_t))) ||
+      rename(temporary.c_str(), name.c_str())) {
+    close(fd);
+    unlink(temporary.c_str());
+    return SEARCH_WRITE_ERROR;
+  }
+  close(_deletedId);
+  _deletedId = fd;
+  return SUCCESS;
+}
+
+std::string SearchIndex::GetFileName (uint64_t number) const
+{
+  return _path + std::to_string(number) + SEARCH_EXTENSION;
+}
+
+/************ SearchEngine *************/
+SearchEngine* SearchEngine::instance ()
+{
+  static SearchEngine *engine = new SearchEngine();
+  return engine;
+}
+
+RC SearchEngine::Add (const std::shared_ptr<Mailbox> &mailbox, uint64_t key, std::string_view message)
+{
+  std::shared_ptr<SearchIndex> index, trigrams;
+  std::shared_ptr<HeaderStore> headers;
+  Index stored;
+  RC rc = mailbox->Lookup(key, stored);
+  if (rc || (rc = OpenIndex(mailbox->GetPath(), index)) || (rc = index->CatchUp(mailbox, key - 1)) ||
+      (rc = index->Add(key, message)) ||
+      (rc = OpenHeaderStore(mailbox->GetPath(), headers)) || (rc = headers->CatchUp(mailbox, key - 1)) ||
+      (rc = headers->Add(key, stored.arrival, message)) ||
+      (rc = OpenTrigramIndex(mailbox->GetPath(), false, trigrams)) || !trigrams ||
+      (rc = trigrams->CatchUp(mailbox, key - 1)))
+    return rc;
+  return trigrams->Add(key, message);
+}
+
+RC SearchEngine::Remove (const std::shared_ptr<Mailbox> &mailbox, uint64_t key)
+{
+  std::shared_ptr<SearchIndex> index, trigrams;
+  std::shared_ptr<HeaderStore> headers;
+  RC rc = OpenIndex(mailbox->GetPath(), index);
+  if (rc || (rc = index->Remove(key)) || (rc = OpenHeaderStore(mailbox->GetPath(), headers)) ||
+      (rc = headers->Remove(key)) || (rc = OpenTrigramIndex(mailbox->GetPath(), false, trigrams)) || !trigrams)
+    return rc;
+  return trigrams->Remove(key);
+}
+
+RC SearchEngine::Search (const std::shared_ptr<Mailbox> &mailbox, const std::string &query, std::vector<uint64_t> &keys)
+{
+  keys.clear();
+
+  // Every word is a group: its terms in the field given, or in all of them
+  std::vector<std::vector<std::string>> groups;
+  size_t position = 0;
+  while (position < query.size()) {
+    size_t end = query.find_first_of(" \t", position);
+    if (end == std::string::npos)
+      end = query.size();
+    std::string_view word(query.data() + position, end - position);
+    position = end + 1;
+
+    char field = 0;
+    size_t colon = word.find(':');
+    if (colon != std::string_view::npos && (field = GetField(word.substr(0, colon))))
+      word.remove_prefix(colon + 1);
+    std::set<std::string> tokens;
+    AddWords(word, ' ', tokens);
+    for (const std::string &token : tokens) {
+      std::string text = token.substr(1);
+      if (field) {
+        groups.push_back({field + text});
+      } else {
+        groups.emplace_back();
+        for (char any : {SEARCH_SUBJECT, SEARCH_FROM, SEARCH_TO, SEARCH_BODY})
+          groups.back().push_back(any + text);
+      }
+    }
+  }
+  if (groups.empty())
+    return SEARCH_BAD_QUERY;
+
+  std::shared_ptr<SearchIndex> index;
+  RC rc = OpenIndex(mailbox->GetPath(), index);
+  if (rc || (rc = index->CatchUp(mailbox)) || (rc = index->Search(groups, keys)))
+    return rc;
+
+  // The mailbox has the last word, a deletion the index missed is not found
+  Index entry;
+  keys.erase(std::remove_if(keys.begin(), keys.end(),
+                            [&mailbox, &entry](uint64_t key) { return mailbox->Lookup(key, entry) != SUCCESS; }),
+             keys.end());
+  return SUCCESS;
+}
+
+RC SearchEngine::SearchSubstring (const std::shared_ptr<Mailbox> &mailbox, std::string_view fragment,
+                                  std::vector<uint64_t> &keys)
+{
+  keys.clear();
+  if (fragment.empty())
+    return SEARCH_BAD_QUERY;
+  std::shared_ptr<SearchIndex> index;
+  RC rc = OpenTrigramIndex(mailbox->GetPath(), false, index);
+  if (rc)
+    return rc;
+
+  // Without the index, or a trigram in the fragment, every message is looked at
+  if (!index || fragment.size() < 3) {
+    ContentScanner scanner;
+    rc = scanner.Scan(mailbox, fragment, true, [&keys](uint64_t key) { keys.push_back(key); });
+    std::sort(keys.begin(), keys.end());
+    return rc;
+  }
+
+  // Candidates hold every trigram of the fragment
+  std::set<std::string> trigrams;
+  std::vector<std::vector<std::string>> groups;
+  std::vector<uint64_t> candidates;
+  Trigrams(fragment, trigrams);
+  for (const std::string &trigram : trigrams)
+    groups.push_back({trigram});
+  if ((rc = index->CatchUp(mailbox)) || (rc = index->Search(groups, candidates)))
+    return rc;
+
+  // The trigrams may be apart in a candidate: only its content tells
+  std::string message;
+  for (uint64_t key : candidates) {
+    rc = mailbox->Read(key, message);
+    if (rc == EDM_NO_SUCH_MESSAGE)
+      continue;
+    if (rc)
+      return rc;
+    if (FindNeedle(message, fragment, true))
+      keys.push_back(key);
+  }
+  return SUCCESS;
+}
+
+RC SearchEngine::EnableTrigrams (const std::shared_ptr<Mailbox> &mailbox)
+{
+  std::shared_ptr<SearchIndex> index;
+  RC rc = OpenTrigramIndex(mailbox->GetPath(), true, index);
+  if (rc)
+    return rc;
+  return index->CatchUp(mailbox);
+}
+
+RC SearchEngine::SearchHeaders (const std::shared_ptr<Mailbox> &mailbox, const HeaderQuery &query,
+                                std::vector<uint64_t> &keys)
+{
+  std::shared_ptr<HeaderStore> headers;
+  RC rc = OpenHeaderStore(mailbox->GetPath(), headers);
+  if (rc || (rc = headers->CatchUp(mailbox)) || (rc = headers->Query(query, keys)))
+    return rc;
+
+  Index entry;
+  keys.erase(std::remove_if(keys.begin(), keys.end(),
+                            [&mailbox, &entry](uint64_t key) { return mailbox->Lookup(key, entry) != SUCCESS; }),
+             keys.end());
+  return SUCCESS;
+}
+
+RC SearchEngine::Flush (const std::shared_ptr<Mailbox> &mailbox)
+{
+  std::shared_ptr<SearchIndex> index, trigrams;
+  RC rc = OpenIndex(mailbox->GetPath(), index);
+  if (rc || (rc = index->Flush()) || (rc = OpenTrigramIndex(mailbox->GetPath(), false, trigrams)) || !trigrams)
+    return rc;
+  return trigrams->Flush();
+}
+
+RC SearchEngine::OpenIndex (const std::string &path, std::shared_ptr<SearchIndex> &index)
+{
+  return Open(path, SEARCH_DIRECTORY_NAME, Tokenize, true, index);
+}
+
+RC SearchEngine::OpenTrigramIndex (const std::string &path, bool create, std::shared_ptr<SearchIndex> &index)
+{
+  return Open(path, SEARCH_TRIGRAM_DIRECTORY_NAME, Trigrams, create, index);
+}
+
+RC SearchEngine::OpenHeaderStore (const std::string &path, std::shared_ptr<HeaderStore> &store)
+{
+  std::string mailbox = path;
+  if (mailbox.empty() || mailbox.back() != '/')
+    mailbox += '/';
+
+  std::lock_guard<std::mutex> lock(_lock);
+  auto found = _headers.find(mailbox);
+  if (found != _headers.end()) {
+    store = found->second;
+    return SUCCESS;
+  }
+  std::shared_ptr<HeaderStore> opened(new HeaderStore(mailbox));
+  RC rc = opened->Open();
+  if (rc)
+    return rc;
+  _headers[mailbox] = opened;
+  store = std::move(opened);
+  return SUCCESS;
+}
+
+bool SearchEngine::FindIndex (const std::string &directory, std::shared_ptr<SearchIndex> &index)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  auto found = _indexes.find(directory);
+  if (found == _indexes.end() || !found->second)
+    return false;
+  index = found->second;
+  return true;
+}
+
+void SearchEngine::TakeMergeable (std::vector<std::string> &paths)
+{
+  std::lock_guard<std::mutex> lock(_mergeLock);
+  paths.assign(_mergeable.begin(), _mergeable.end());
+  _mergeable.clear();
+}
+
+void SearchEngine::ReportMergeable (const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(_mergeLock);
+  _mergeable.insert(path);
+}
+
+// Private helper functions
+RC SearchEngine::Open (const std::string &path, const char *directory, SearchIndex::Tokenizer tokenizer, bool create,
+                       std::shared_ptr<SearchIndex> &index)
+{
+  std::string mailbox = path;
+  if (mailbox.empty() || mailbox.back() != '/')
+    mailbox += '/';
+  std::string name = mailbox + directory;
+
+  // A mailbox without an optional index is remembered as such
+  std::lock_guard<std::mutex> lock(_lock);
+  auto found = _indexes.find(name);
+  if (found != _indexes.end() && (found->second || !create)) {
+    index = found->second;
+    return SUCCESS;
+  }
+  struct stat status;
+  if (!create && stat(name.c_str(), &status)) {
+    _indexes[name] = index = NULL;
+    return SUCCESS;
+  }
+  std::shared_ptr<SearchIndex> opened(new SearchIndex(mailbox, directory, tokenizer));
+  RC rc = opened->Open();
+  if (rc)
+    return rc;
+  _indexes[name] = opened;
+  index = std::move(opened);
+  return SUCCESS;
+}
+
+/************ SearchMerger *************/
+SearchMerger::SearchMerger(int interval)
+  : _interval(interval)
+{
+}
+
+SearchMerger::~SearchMerger()
+{
+  Stop();
+}
+
+void SearchMerger::Start ()
+{
+  _thread.Start(_interval, [this] { RunOnce(); });
+}
+
+void SearchMerger::Stop ()
+{
+  _thread.Stop();
+}
+
+RC SearchMerger::RunOnce ()
+{
+  RC result = SUCCESS;
+  std::vector<std::string> paths;
+  SearchEngine::instance()->TakeMergeable(paths);
+
+  for (const std::string &path : paths) {
+    std::shared_ptr<SearchIndex> index;
+    RC rc = SUCCESS;
+    if (SearchEngine::instance()->FindIndex(path, index))
+      rc = index->Merge();
+    if (rc && result == SUCCESS)
+      result = rc;
+  }
+  return result;
+}
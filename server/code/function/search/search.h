@@ -0,0 +1,531 @@
+#ifndef SEARCH_ENGINE
+#define SEARCH_ENGINE
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/periodic.h"
+#include "../../util/util.h"
+#include "../../manager/edm/edm.h"
+
+/* ----- Define macros ----- */
+enum {
+  SEARCH_OPEN_ERROR = 701,
+  SEARCH_READ_ERROR,
+  SEARCH_WRITE_ERROR,
+  SEARCH_CORRUPTED,
+  SEARCH_BAD_QUERY,
+};
+
+#define SEARCH_MAGIC          0x58495345    // "ESIX" in the segment header
+#define SEARCH_VERSION        1
+#define SEARCH_MIN_TOKEN      2             // Shorter words are not indexed
+#define SEARCH_MAX_TOKEN      64            // Nor longer ones, mostly encoded data
+#define SEARCH_FLUSH_MESSAGES 1024          // Messages buffered before a segment is written
+#define SEARCH_FLUSH_SIZE     (4 * 1024 * 1024) // Or postings buffered, in bytes
+#define SEARCH_MERGE_SEGMENTS 8             // Segments of a mailbox that ask for a merge
+#define SEARCH_MERGE_INTERVAL 10            // Seconds between two looks for mailboxes to merge
+const char SEARCH_DIRECTORY_NAME[] = "search/";  // Under the directory of the mailbox
+const char SEARCH_TRIGRAM_DIRECTORY_NAME[] = "trigram/";  // Only if enabled for the mailbox
+const char SEARCH_EXTENSION[]      = ".seg";
+const char SEARCH_DELETED_NAME[]   = "deleted.del";
+
+/* ----- Define structs ----- */
+class HeaderStore;
+struct HeaderQuery;
+
+/**
+ * The fields a term comes from. A term is stored as the field letter
+ * followed by the lowercase word.
+ */
+enum SearchField {
+  SEARCH_SUBJECT = 's',
+  SEARCH_FROM    = 'f',
+  SEARCH_TO      = 't',     // To, Cc and Bcc
+  SEARCH_BODY    = 'b',
+};
+
+/**
+ * IndexSegmentHeader
+ * At the start of every segment file. A segment made by a merge replaces the
+ * segments numbered first to last; the merged ones a crash left behind are
+ * found by that and removed.
+ *
+ * After the header come the postings of every term, then the dictionary:
+ * for each term in order, varints of its length, its bytes, the number of
+ * keys, and the offset and length of its postings. Postings are the keys in
+ * increasing order, each as a varint of its difference to the one before.
+ */
+struct IndexSegmentHeader {
+  uint32_t magic;
+  uint32_t checksum;        // CRC-32C of everything after the header
+  uint64_t first;           // Segments this one replaces, by number
+  uint64_t last;
+  uint64_t minKey;          // Keys of the messages in it
+  uint64_t maxKey;
+  uint64_t terms;
+  uint64_t dictionary;      // Offset of the dictionary
+  uint32_t version;
+  uint32_t reserved;
+};
+static_assert(sizeof(IndexSegmentHeader) == 64, "IndexSegmentHeader is stored as it is in the .seg files");
+
+/**
+ * This function will cut a message into the terms to index: the words of
+ * the Subject, From, To, Cc and Bcc header fields and of the body, each
+ * with the letter of its field.
+ * @param  string_view given as the message.
+ *         set stores the terms.
+ */
+void Tokenize (std::string_view message, std::set<std::string> &terms);
+
+/**
+ * This function will cut a message into its trigrams: every three bytes in a
+ * row, ASCII letters in lowercase.
+ * @param  string_view given as the message.
+ *         set stores the trigrams.
+ */
+void Trigrams (std::string_view message, std::set<std::string> &terms);
+
+/**
+ * IndexSegment
+ * This class is one immutable segment file, mapped into memory. The
+ * dictionary is read when it is opened; a term is found with a binary
+ * search and its postings are decoded straight from the mapping.
+ *
+ * Contained Public Functions:
+ *   RC   Open   ()
+ *   bool Find   (std::string_view term, std::vector<uint64_t> &keys)
+ *   void Decode (const Term &term, std::vector<uint64_t> &keys)
+ */
+class IndexSegment
+{
+public:
+  struct Term {
+    std::string_view term;  // Points into the mapping
+    uint64_t offset;        // Of the postings
+    uint64_t length;
+    uint64_t count;
+  };
+
+  IndexSegment(const std::string &name, uint64_t number);
+  ~IndexSegment();
+
+  IndexSegment(const IndexSegment &) = delete;
+  IndexSegment &operator=(const IndexSegment &) = delete;
+
+  /**
+   * This function will map the file and read its dictionary.
+   * @return SUCCESS if the segment is ready.
+   *         SEARCH_OPEN_ERROR if it cannot be opened.
+   *         SEARCH_CORRUPTED if the checksum or the layout is wrong.
+   */
+  RC Open ();
+
+  /**
+   * This function will add the keys of a term to a list.
+   * @param  string_view given as the term.
+   *         vector stores the keys, appended in increasing order.
+   * @return true if the segment has the term.
+   */
+  bool Find (std::string_view term, std::vector<uint64_t> &keys) const;
+
+  /**
+   * This function will decode the postings of one dictionary entry.
+   */
+  void Decode (const Term &term, std::vector<uint64_t> &keys) const;
+
+  const std::vector<Term> &GetTerms () const { return _terms; }
+  const IndexSegmentHeader &GetHeader () const { return _header; }
+  const std::string &GetName () const { return _name; }
+  uint64_t GetNumber () const { return _number; }
+
+private:
+  std::string _name;
+  uint64_t _number;
+  IndexSegmentHeader _header;
+  const char *_data;        // The mapping, NULL before Open()
+  size_t _size;
+  std::vector<Term> _terms; // In order
+};
+
+/**
+ * SegmentWriter
+ * This class writes a new segment file: terms are given in order with their
+ * keys, Finish() adds the dictionary and the header and puts the file in
+ * place with rename(), so a segment is there whole or not at all.
+ *
+ * Contained Public Functions:
+ *   RC Open   (const std::string &name)
+ *   RC Add    (std::string_view term, const std::vector<uint64_t> &keys)
+ *   RC Finish (IndexSegmentHeader &header)
+ */
+class SegmentWriter
+{
+public:
+  SegmentWriter();
+  ~SegmentWriter();
+
+  /**
+   * This function will create the file, under a temporary name.
+   * @param  const string given as the name of the segment, with the path.
+   * @return SUCCESS if created, SEARCH_OPEN_ERROR otherwise.
+   */
+  RC Open   (const std::string &name);
+
+  /**
+   * This function will write the postings of the next term.
+   * @param  string_view given as the term, after the one before.
+   *         const vector given as the keys, in increasing order.
+   * @return SUCCESS if written, SEARCH_WRITE_ERROR otherwise.
+   */
+  RC Add    (std::string_view term, const std::vector<uint64_t> &keys);
+
+  /**
+   * This function will write the dictionary and the header and put the file
+   * in place.
+   * @param  IndexSegmentHeader given with first, last, minKey and maxKey set,
+   *         stores the rest.
+   * @return SUCCESS if the segment is in place, SEARCH_WRITE_ERROR otherwise.
+   */
+  RC Finish (IndexSegmentHeader &header);
+
+private:
+  std::string _name;
+  int _fd;
+  uint64_t _offset;         // End of what is written
+  uint32_t _crc;
+  uint64_t _terms;
+  std::string _dictionary;
+  std::string _postings;    // Postings not written yet, they start at _offset
+
+  RC WriteOut (const std::string &bytes);
+};
+
+/**
+ * SearchIndex
+ * This class is the inverted index of one mailbox: for every term, the keys
+ * of the messages holding it. New messages go into a buffer in memory,
+ * written out as a new segment every SEARCH_FLUSH_MESSAGES messages. Segments
+ * never change; Merge() writes one segment for all of them, in the
+ * background, and drops the deleted messages on the way. A deletion is only
+ * written down as a tombstone until then.
+ *
+ * The mailbox stays the record: what was in the buffer at a crash is
+ * indexed again from the mailbox by CatchUp(), and a search only gives keys
+ * the mailbox still has.
+ *
+ * The terms come from a tokenizer: Tokenize() for the word index in search/,
+ * Trigrams() for the optional trigram index in trigram/.
+ *
+ * Contained Public Functions:
+ *   RC Open    ()
+ *   RC Add     (uint64_t key, std::string_view message)
+ *   RC Remove  (uint64_t key)
+ *   RC CatchUp (const std::shared_ptr<Mailbox> &mailbox, uint64_t last = UINT64_MAX)
+ *   RC Search  (const std::vector<std::vector<std::string>> &query, std::vector<uint64_t> &keys)
+ *   RC Flush   ()
+ *   RC Merge   ()
+ *   size_t GetSegmentNumber ()
+ */
+class SearchIndex
+{
+public:
+  typedef void (*Tokenizer) (std::string_view message, std::set<std::string> &terms);
+
+  SearchIndex(const std::string &path, const char *directory = SEARCH_DIRECTORY_NAME, Tokenizer tokenizer = Tokenize);
+  ~SearchIndex();
+
+  SearchIndex(const SearchIndex &) = delete;
+  SearchIndex &operator=(const SearchIndex &) = delete;
+
+  /**
+   * This function will open the segments and the tombstones. Segments a merge
+   * replaced are removed, a damaged segment drops the whole index, which is
+   * then made again by CatchUp().
+   * @return SUCCESS if the index is ready.
+   *         SEARCH_OPEN_ERROR otherwise.
+   */
+  RC Open ();
+
+  /**
+   * This function will index a message. Keys must come in increasing order.
+   * @param  uint64_t given as the key of the message.
+   *         string_view given as the message.
+   * @return SUCCESS if indexed.
+   *         SEARCH_WRITE_ERROR if a segment had to be written and failed.
+   */
+  RC Add (uint64_t key, std::string_view message);
+
+  /**
+   * This function will take a message out of the index.
+   * @param  uint64_t given as the key.
+   * @return SUCCESS if its tombstone has been written.
+   *         SEARCH_WRITE_ERROR otherwise.
+   */
+  RC Remove (uint64_t key);
+
+  /**
+   * This function will index the messages of the mailbox the index has not
+   * seen, after a restart or a delivery that did not go through Add().
+   * @param  shared_ptr given as the mailbox.
+   *         uint64_t given as the last key to look at.
+   * @return SUCCESS if up to date.
+   *         pre-defined error number of the mailbox or the index otherwise.
+   */
+  RC CatchUp (const std::shared_ptr<Mailbox> &mailbox, uint64_t last = UINT64_MAX);
+
+  /**
+   * This function will find the messages holding every group of terms: a
+   * message matches a group if it holds one of its terms.
+   * @param  vector given as the groups of terms.
+   *         vector stores the keys, in increasing order.
+   * @return SUCCESS if searched.
+   */
+  RC Search (const std::vector<std::vector<std::string>> &query, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will write the buffered messages as a new segment.
+   * @return SUCCESS if written or nothing to write.
+   *         SEARCH_OPEN_ERROR or SEARCH_WRITE_ERROR otherwise.
+   */
+  RC Flush ();
+
+  /**
+   * This function will merge all segments into one. The segments are read
+   * without holding the lock; Add() and Search() go on meanwhile.
+   * @return SUCCESS if merged or nothing to merge.
+   *         pre-defined error number of the segments otherwise.
+   */
+  RC Merge ();
+
+  size_t GetSegmentNumber ();
+  const std::string &GetPath () const { return _path; }
+
+private:
+  std::string _mailbox;                         // Directory of the mailbox, ends with '/'
+  std::string _path;                            // Directory of the index, in the mailbox
+  Tokenizer _tokenizer;
+  std::mutex _mergeLock;                        // One Merge() at a time
+  std::shared_mutex _lock;                      // Guards the members below
+  std::vector<std::shared_ptr<IndexSegment>> _segments; // By number
+  uint64_t _nextSegment;
+  std::unordered_map<std::string, std::vector<uint64_t>> _buffer; // Postings not written yet
+  size_t _bufferedMessages;
+  size_t _bufferedSize;
+  uint64_t _lastKey;                            // Highest key indexed, in a segment or buffered
+  std::unordered_set<uint64_t> _deleted;        // Tombstones
+  int _deletedId;                               // Tombstone file
+
+  // Private helper functions
+  RC FlushLocked ();
+  RC RewriteDeleted ();
+  std::string GetFileName (uint64_t number) const;
+};
+
+/**
+ * SearchEngine
+ * This class hands out the index of every mailbox and answers searches. A
+ * query is a list of words, all of which a message must hold; a word may be
+ * given a field, as in "subject:report" or "from:alice". Words are cut as
+ * the messages are, "alice@example.com" looks for alice, example and com.
+ *
+ * A mailbox may also have a trigram index, for fragments of words: the
+ * messages holding every trigram of the fragment are read and kept if they
+ * hold the fragment itself. Without it the messages are scanned.
+ *
+ * Every mailbox also has a HeaderStore (headers.cpp), for queries by time of
+ * arrival, sender, recipient and subject.
+ *
+ * Contained Public Functions:
+ *   SearchEngine* instance ()
+ *   RC Add    (const std::shared_ptr<Mailbox> &mailbox, uint64_t key, std::string_view message)
+ *   RC Remove (const std::shared_ptr<Mailbox> &mailbox, uint64_t key)
+ *   RC Search (const std::shared_ptr<Mailbox> &mailbox, const std::string &query, std::vector<uint64_t> &keys)
+ *   RC SearchSubstring (const std::shared_ptr<Mailbox> &mailbox, std::string_view fragment, std::vector<uint64_t> &keys)
+ *   RC EnableTrigrams  (const std::shared_ptr<Mailbox> &mailbox)
+ *   RC SearchHeaders   (const std::shared_ptr<Mailbox> &mailbox, const HeaderQuery &query, std::vector<uint64_t> &keys)
+ *   RC Flush  (const std::shared_ptr<Mailbox> &mailbox)
+ *   RC OpenIndex (const std::string &path, std::shared_ptr<SearchIndex> &index)
+ *   RC OpenTrigramIndex (const std::string &path, bool create, std::shared_ptr<SearchIndex> &index)
+ *   RC OpenHeaderStore  (const std::string &path, std::shared_ptr<HeaderStore> &store)
+ *   bool FindIndex (const std::string &directory, std::shared_ptr<SearchIndex> &index)
+ *   void TakeMergeable (std::vector<std::string> &paths)
+ */
+class SearchEngine
+{
+public:
+  /**
+   * This function will initialize an instance for SearchEngine.
+   * @return pointer of SearchEngine.
+   */
+  static SearchEngine* instance();
+
+  /**
+   * This function will index a message just delivered, after the ones
+   * delivered before it without being indexed, and add its row to the
+   * HeaderStore, with the time the mailbox stored it at.
+   * @return same as SearchIndex::Add(), or EDM_NO_SUCH_MESSAGE.
+   */
+  RC Add    (const std::shared_ptr<Mailbox> &mailbox, uint64_t key, std::string_view message);
+
+  /**
+   * This function will take a deleted message out of the index.
+   * @return same as SearchIndex::Remove().
+   */
+  RC Remove (const std::shared_ptr<Mailbox> &mailbox, uint64_t key);
+
+  /**
+   * This function will search a mailbox.
+   * @param  shared_ptr given as the mailbox.
+   *         const string given as the query.
+   *         vector stores the keys of the messages found, in increasing order.
+   * @return SUCCESS if searched.
+   *         SEARCH_BAD_QUERY if the query has no word to look for.
+   *         pre-defined error number of the index otherwise.
+   */
+  RC Search (const std::shared_ptr<Mailbox> &mailbox, const std::string &query, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will find the messages holding a fragment, anywhere and
+   * in any case, with the trigram index. Without one, or for fragments of
+   * less than three bytes, the messages are scanned by a ContentScanner.
+   * @param  shared_ptr given as the mailbox.
+   *         string_view given as the fragment.
+   *         vector stores the keys of the messages found, in increasing order.
+   * @return SUCCESS if searched.
+   *         SEARCH_BAD_QUERY if the fragment is empty.
+   *         pre-defined error number of the index or the mailbox otherwise.
+   */
+  RC SearchSubstring (const std::shared_ptr<Mailbox> &mailbox, std::string_view fragment, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will give a mailbox a trigram index and fill it. It costs
+   * about as much space as the messages, so it is only made on request.
+   * @return same as SearchIndex::CatchUp().
+   */
+  RC EnableTrigrams (const std::shared_ptr<Mailbox> &mailbox);
+
+  /**
+   * This function will find the messages of a mailbox by their header, from
+   * the HeaderStore alone.
+   * @param  shared_ptr given as the mailbox.
+   *         HeaderQuery given as what the messages must match.
+   *         vector stores the keys of the messages found, in increasing order.
+   * @return SUCCESS if searched.
+   *         pre-defined error number of the store or the mailbox otherwise.
+   */
+  RC SearchHeaders (const std::shared_ptr<Mailbox> &mailbox, const HeaderQuery &query, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will write what the indexes of a mailbox buffer.
+   * @return same as SearchIndex::Flush().
+   */
+  RC Flush  (const std::shared_ptr<Mailbox> &mailbox);
+
+  /**
+   * This function will open the index of a mailbox.
+   * @param  const string given as the directory of the mailbox.
+   *         shared_ptr stores the index.
+   * @return same as SearchIndex::Open().
+   */
+  RC OpenIndex (const std::string &path, std::shared_ptr<SearchIndex> &index);
+
+  /**
+   * This function will open the trigram index of a mailbox.
+   * @param  const string given as the directory of the mailbox.
+   *         bool given as true to make the index if there is none.
+   *         shared_ptr stores the index, NULL if there is none.
+   * @return same as SearchIndex::Open().
+   */
+  RC OpenTrigramIndex (const std::string &path, bool create, std::shared_ptr<SearchIndex> &index);
+
+  /**
+   * This function will open the HeaderStore of a mailbox.
+   * @param  const string given as the directory of the mailbox.
+   *         shared_ptr stores the store.
+   * @return same as HeaderStore::Open().
+   */
+  RC OpenHeaderStore (const std::string &path, std::shared_ptr<HeaderStore> &store);
+
+  /**
+   * This function will give an index already open.
+   * @param  const string given as the directory of the index.
+   *         shared_ptr stores the index.
+   * @return true if it is open.
+   */
+  bool FindIndex (const std::string &directory, std::shared_ptr<SearchIndex> &index);
+
+  /**
+   * This function will give the indexes that asked for a merge since the
+   * last call, for the SearchMerger.
+   * @param vector stores the directories of the indexes.
+   */
+  void TakeMergeable (std::vector<std::string> &paths);
+
+  /**
+   * This function will note that an index has SEARCH_MERGE_SEGMENTS segments.
+   */
+  void ReportMergeable (const std::string &path);
+
+protected:
+  SearchEngine() {};        // Constructor
+  ~SearchEngine() {};       // Destructor
+
+private:
+  std::mutex _lock;                                       // Guards the members below
+  std::map<std::string, std::shared_ptr<SearchIndex>> _indexes; // By directory, kept open, NULL if none
+  std::map<std::string, std::shared_ptr<HeaderStore>> _headers; // By mailbox path, kept open
+  std::mutex _mergeLock;                                  // Guards _mergeable, taken under an index lock
+  std::set<std::string> _mergeable;
+
+  // Private helper functions
+  RC Open (const std::string &path, const char *directory, SearchIndex::Tokenizer tokenizer, bool create,
+           std::shared_ptr<SearchIndex> &index);
+};
+
+/**
+ * SearchMerger
+ * This class runs a background thread that merges the segments of the
+ * indexes reported by the SearchEngine, like the Compactor of the EDM.
+ *
+ * Contained Public Functions:
+ *   void Start ()
+ *   void Stop  ()
+ *   RC   RunOnce ()
+ */
+class SearchMerger
+{
+public:
+  explicit SearchMerger(int interval = SEARCH_MERGE_INTERVAL);
+  ~SearchMerger();
+
+  void Start ();
+  void Stop  ();
+
+  /**
+   * This function will merge every index reported since the last run, in the
+   * calling thread.
+   * @return SUCCESS if all of them have been merged.
+   *         pre-defined error number of the first index that failed.
+   */
+  RC RunOnce ();
+
+private:
+  std::chrono::seconds _interval;
+  PeriodicThread _thread;
+};
+
+#endif
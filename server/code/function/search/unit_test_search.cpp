@@ -0,0 +1,507 @@
+/*
+ * unit_test_search.cpp
+ *
+ * This file provides unit test for search.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sys/stat.h>
+#include <thread>
+#include "unit_test_search.h"
+using namespace std;
+
+static void RemoveMailbox ()
+{
+  if (system((string("rm -rf ") + TEST_MAILBOX + " " + TEST_TRIGRAM + " " + TEST_HEADERS + " " +
+             TEST_ARRIVAL + " " + TEST_SHARED).c_str())) {}
+}
+
+static string Message (uint64_t n)
+{
+  return "From: sender" + to_string(n % 7) + "@example.com\r\n"
+         "To: user@example.com,\r\n"
+         "\tcopy" + to_string(n % 3) + "@example.com\r\n"
+         "Subject: report r" + to_string(n) + "\r\n"
+         "X-Mailer: ignored\r\n"
+         "\r\n"
+         "Body word" + to_string(n % 10) + " common\r\n";
+}
+
+static RC Search (SearchIndex &index, const vector<vector<string>> &query, vector<uint64_t> expected)
+{
+  vector<uint64_t> keys;
+  if (index.Search(query, keys))
+    return STANDARD_ERROR;
+  return keys == expected ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestTokenize ()
+{
+  set<string> terms;
+  Tokenize("From: Alice <alice@example.com>\r\nTo: bob@example.com,\r\n carol@example.com\r\n"
+           "Subject: Quarterly REPORT a\r\nX-Other: hidden\r\n\r\nThe body, with words.\r\n", terms);
+  set<string> expected = {
+    "falice", "fexample", "fcom", "tbob", "texample", "tcom", "tcarol", "squarterly", "sreport",
+    "bthe", "bbody", "bwith", "bwords",
+  };
+  return terms == expected ? SUCCESS : STANDARD_ERROR;
+}
+
+// Searches see the buffer and the segments, by field and across fields
+static RC TestAddSearch ()
+{
+  RemoveMailbox();
+  if (mkdir(TEST_MAILBOX, 0700))
+    return STANDARD_ERROR;
+  SearchIndex index(TEST_MAILBOX);
+  RC rc = index.Open();
+  for (uint64_t key = 1; key <= 20 && rc == SUCCESS; ++key) {
+    rc = index.Add(key, Message(key));
+    if (key == 10 && rc == SUCCESS)
+      rc = index.Flush();
+  }
+  if (rc || index.GetSegmentNumber() != 1)
+    return STANDARD_ERROR;
+
+  if (Search(index, {{"sr12"}}, {12}) || Search(index, {{"bword3"}}, {3, 13}) ||
+      Search(index, {{"bword3"}, {"fsender6"}}, {13}) || Search(index, {{"tcopy1"}}, {1, 4, 7, 10, 13, 16, 19}) ||
+      Search(index, {{"sreport"}, {"bmissing"}}, {}) || Search(index, {{"xignored"}}, {}) ||
+      Search(index, {{"bnone", "sr5"}}, {5}))
+    return STANDARD_ERROR;
+
+  // Added twice, by a delivery and by CatchUp(), indexed once
+  if (index.Add(5, Message(5)) || Search(index, {{"sr5"}}, {5}))
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Deleted messages are not found, before and after a restart
+static RC TestDeleteReopen ()
+{
+  RemoveMailbox();
+  if (mkdir(TEST_MAILBOX, 0700))
+    return STANDARD_ERROR;
+  {
+    SearchIndex index(TEST_MAILBOX);
+    RC rc = index.Open();
+    for (uint64_t key = 1; key <= 10 && rc == SUCCESS; ++key)
+      rc = index.Add(key, Message(key));
+    if (rc || index.Flush() || index.Remove(4) || Search(index, {{"bword4"}}, {}))
+      return STANDARD_ERROR;
+    // Buffered only, lost by the restart
+    if (index.Add(11, Message(11)))
+      return STANDARD_ERROR;
+  }
+
+  SearchIndex index(TEST_MAILBOX);
+  if (index.Open() || index.GetSegmentNumber() != 1 || Search(index, {{"bword4"}}, {}) ||
+      Search(index, {{"bcommon"}}, {1, 2, 3, 5, 6, 7, 8, 9, 10}) || Search(index, {{"sr11"}}, {}))
+    return STANDARD_ERROR;
+
+  // A damaged segment drops the index
+  string name = string(TEST_MAILBOX) + SEARCH_DIRECTORY_NAME + "1" + SEARCH_EXTENSION;
+  if (system(("printf X | dd of=" + name + " bs=1 seek=70 conv=notrunc 2>/dev/null").c_str()))
+    return STANDARD_ERROR;
+  SearchIndex damaged(TEST_MAILBOX);
+  if (damaged.Open() || damaged.GetSegmentNumber() != 0 || Search(damaged, {{"bcommon"}}, {}))
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Segments merge into one, deleted messages are dropped on the way
+static RC TestMerge ()
+{
+  RemoveMailbox();
+  if (mkdir(TEST_MAILBOX, 0700))
+    return STANDARD_ERROR;
+  string stale = string(TEST_MAILBOX) + SEARCH_DIRECTORY_NAME + "stale";
+  {
+    SearchIndex index(TEST_MAILBOX);
+    RC rc = index.Open();
+    for (uint64_t key = 1; key <= 40 && rc == SUCCESS; ++key) {
+      rc = index.Add(key, Message(key));
+      if (key % 5 == 0 && rc == SUCCESS)
+        rc = index.Flush();
+    }
+    if (rc || index.GetSegmentNumber() != 8 || index.Remove(3) || index.Remove(33))
+      return STANDARD_ERROR;
+
+    // Kept aside to play a crash between the merge and the unlinks
+    string first = string(TEST_MAILBOX) + SEARCH_DIRECTORY_NAME + "2" + SEARCH_EXTENSION;
+    if (system(("cp " + first + " " + stale).c_str()) || index.Merge() || index.GetSegmentNumber() != 1 ||
+        Search(index, {{"bword3"}}, {13, 23}) || Search(index, {{"fsender1"}}, {1, 8, 15, 22, 29, 36}))
+      return STANDARD_ERROR;
+  }
+  if (system(("mv " + stale + " " + string(TEST_MAILBOX) + SEARCH_DIRECTORY_NAME + "2" + SEARCH_EXTENSION).c_str()))
+    return STANDARD_ERROR;
+
+  // Tombstones of merged messages are gone, the stale segment too
+  SearchIndex index(TEST_MAILBOX);
+  struct stat status;
+  string deleted = string(TEST_MAILBOX) + SEARCH_DIRECTORY_NAME + SEARCH_DELETED_NAME;
+  if (index.Open() || index.GetSegmentNumber() != 1 || stat(deleted.c_str(), &status) || status.st_size != 0 ||
+      Search(index, {{"bword3"}}, {13, 23}) || Search(index, {{"sr7"}}, {7}))
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// The engine indexes what the mailbox got without it, and never gives deleted keys
+static RC TestSearchEngine ()
+{
+  RemoveMailbox();
+  SearchEngine *engine = SearchEngine::instance();
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys(10), found;
+  RC rc = EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox);
+  for (uint64_t i = 0; i < keys.size() && rc == SUCCESS; ++i) {
+    rc = mailbox->Append(Message(i), keys[i]);
+    if (i % 2 && rc == SUCCESS)
+      rc = engine->Add(mailbox, keys[i], Message(i));
+  }
+  if (rc || mailbox->Delete(keys[6]) || engine->Remove(mailbox, keys[6]) || mailbox->Delete(keys[2]))
+    return STANDARD_ERROR;
+
+  if (engine->Search(mailbox, "Common", found) || found.size() != 8 ||
+      engine->Search(mailbox, "subject:report body:word1", found) || found != vector<uint64_t>{keys[1]} ||
+      engine->Search(mailbox, "from:sender0 example.com", found) || found != vector<uint64_t>{keys[0], keys[7]} ||
+      engine->Search(mailbox, "word2", found) || !found.empty() ||
+      engine->Search(mailbox, "to: ,", found) != SEARCH_BAD_QUERY)
+    return STANDARD_ERROR;
+
+  // Delivered after the catch up
+  uint64_t key;
+  if (mailbox->Append(Message(12), key) || engine->Add(mailbox, key, Message(12)) ||
+      engine->Search(mailbox, "subject:r12", found) || found != vector<uint64_t>{key})
+    return STANDARD_ERROR;
+
+  SearchMerger merger;
+  return merger.RunOnce();
+}
+
+// Fragments are found anywhere, in any case, and only where they really are
+static RC TestTrigram ()
+{
+  RemoveMailbox();
+  SearchEngine *engine = SearchEngine::instance();
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys(4), found;
+  const char *messages[] = {
+    "Subject: Order ORD-48213\r\n\r\nshipped\r\n",
+    "Subject: Order ORD-77310\r\n\r\nabc and xbcd\r\n",
+    "From: billing@Example.com\r\n\r\nabcd\r\n",
+  };
+  RC rc = EmailDataManager::instance()->OpenMailbox(TEST_TRIGRAM, mailbox);
+  if (rc || mailbox->Append(messages[0], keys[0]) ||
+      engine->SearchSubstring(mailbox, "8213", found) || found != vector<uint64_t>{keys[0]})
+    return STANDARD_ERROR;
+
+  // Scanned until then; filled from the mailbox, then kept up to date by deliveries
+  if (engine->EnableTrigrams(mailbox) || mailbox->Append(messages[1], keys[1]) ||
+      engine->Add(mailbox, keys[1], messages[1]) || mailbox->Append(messages[2], keys[2]) ||
+      engine->Add(mailbox, keys[2], messages[2]))
+    return STANDARD_ERROR;
+
+  if (engine->SearchSubstring(mailbox, "8213", found) || found != vector<uint64_t>{keys[0]} ||
+      engine->SearchSubstring(mailbox, "rd-", found) || found != vector<uint64_t>{keys[0], keys[1]} ||
+      engine->SearchSubstring(mailbox, "ling@exa", found) || found != vector<uint64_t>{keys[2]} ||
+      engine->SearchSubstring(mailbox, "abcd", found) || found != vector<uint64_t>{keys[2]} ||
+      engine->SearchSubstring(mailbox, "-7", found) || found != vector<uint64_t>{keys[1]} ||
+      engine->SearchSubstring(mailbox, "", found) != SEARCH_BAD_QUERY)
+    return STANDARD_ERROR;
+
+  if (mailbox->Delete(keys[0]) || engine->Remove(mailbox, keys[0]) || engine->Flush(mailbox) ||
+      engine->SearchSubstring(mailbox, "order", found) || found != vector<uint64_t>{keys[1]})
+    return STANDARD_ERROR;
+
+  // Reopened from its segments
+  SearchIndex index(TEST_TRIGRAM, SEARCH_TRIGRAM_DIRECTORY_NAME, Trigrams);
+  if (index.Open() || Search(index, {{"ord"}, {"773"}}, {keys[1]}))
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Every filter finds what a plain search finds, at any alignment
+static RC TestFindNeedle ()
+{
+  string haystack;
+  srand(7);
+  for (int i = 0; i < 4096; ++i)
+    haystack += "abAB"[rand() % 4];
+  for (size_t length = 1; length <= 40; ++length) {
+    for (size_t start = 0; start + length <= 300; start += 7) {
+      string needle = haystack.substr(1000 + start, length);
+      string_view window(haystack.data() + start, 100 + length);
+      bool expected = window.find(needle) != string_view::npos;
+      string folded(window), lowered(needle);
+      for (char &character : folded)
+        character = tolower(character);
+      for (char &character : lowered)
+        character = tolower(character);
+      if (FindNeedle(window, needle, false) != expected ||
+          FindNeedle(window, needle, true) != (folded.find(lowered) != string::npos))
+        return STANDARD_ERROR;
+    }
+  }
+  return FindNeedle("abc", "abcd", false) || !FindNeedle("xxABC", "abc", true) ? STANDARD_ERROR : SUCCESS;
+}
+
+// Without an index the stored messages are scanned, stored as they are or compressed
+static RC TestScan ()
+{
+  RemoveMailbox();
+  EmailDataManager *edm = EmailDataManager::instance();
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys(TEST_SCAN_MESSAGES), found;
+  RC rc = edm->OpenMailbox(TEST_MAILBOX, mailbox);
+  edm->SetCompression(false);
+  for (uint64_t i = 0; i < keys.size() && rc == SUCCESS; ++i)
+    rc = mailbox->Append(Message(i) + string(i * 97 % 4096, 'x'), keys[i]);
+  // The needle across the cut between two pieces of a large message
+  uint64_t large, compressed;
+  string content(SCAN_CHUNK_SIZE * 3, 'y');
+  content.replace(SCAN_CHUNK_SIZE * 2 - 3, 8, "NEEDLE42");
+  if (rc || mailbox->Append(content, large))
+    return STANDARD_ERROR;
+  edm->SetCompression(true);
+  if (mailbox->Append(string(8192, 'z') + "needle42", compressed) || mailbox->Delete(keys[5]))
+    return STANDARD_ERROR;
+
+  ContentScanner scanner(4);
+  ScanStats stats;
+  if (scanner.Scan(mailbox, "Needle42", true, [&found](uint64_t key) { found.push_back(key); }))
+    return STANDARD_ERROR;
+  sort(found.begin(), found.end());
+  scanner.GetStats(stats);
+  if (found != vector<uint64_t>{large, compressed} || stats.messages != TEST_SCAN_MESSAGES + 1 ||
+      stats.matches != 2)
+    return STANDARD_ERROR;
+
+  found.clear();
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  if (scanner.Scan(mailbox, "word5 common", false, [&found](uint64_t key) { found.push_back(key); }) ||
+      found.size() != TEST_SCAN_MESSAGES / 10 - 1)
+    return STANDARD_ERROR;
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  scanner.GetStats(stats);
+  cout << "  scan of " << stats.bytes / 1024 << " KiB: " << elapsed * 1000 << " ms" << endl;
+  return scanner.Scan(mailbox, "", false, [](uint64_t) {}) == SEARCH_BAD_QUERY ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestParseAddresses ()
+{
+  vector<string> addresses;
+  ParseAddresses("\"Doe, Jane\" <Jane@Example.com>, bob@example.com, Carol <carol@example.org>, undisclosed", addresses);
+  ParseAddresses("dave@example.net (Dave)", addresses);
+  return addresses == vector<string>{"jane@example.com", "bob@example.com", "carol@example.org", "dave@example.net"} ?
+         SUCCESS : STANDARD_ERROR;
+}
+
+// Queries by time, sender, recipient and subject come from the columns alone
+static RC TestHeaderStore ()
+{
+  RemoveMailbox();
+  if (mkdir(TEST_MAILBOX, 0700))
+    return STANDARD_ERROR;
+  {
+    HeaderStore store(TEST_MAILBOX);
+    RC rc = store.Open();
+    for (uint64_t key = 1; key <= 100 && rc == SUCCESS; ++key)
+      rc = store.Add(key, 1000 + key * 10, Message(key));
+    // Arrived out of order, kept in order
+    if (rc || store.Add(101, 1500, Message(101)) || store.Add(50, 0, Message(50)) || store.GetRows() != 101)
+      return STANDARD_ERROR;
+
+    vector<uint64_t> keys;
+    HeaderQuery query;
+    query.since  = 1100;
+    query.before = 1200;
+    if (store.Query(query, keys) || keys != vector<uint64_t>{10, 11, 12, 13, 14, 15, 16, 17, 18, 19})
+      return STANDARD_ERROR;
+    query.from = "Sender3@example.com";
+    if (store.Query(query, keys) || keys != vector<uint64_t>{10, 17})
+      return STANDARD_ERROR;
+    query = HeaderQuery();
+    query.since = 1990;
+    query.to = "copy2@example.com";
+    if (store.Query(query, keys) || keys != vector<uint64_t>{101})
+      return STANDARD_ERROR;
+    query = HeaderQuery();
+    query.subject = "REPORT R9";
+    if (store.Query(query, keys) || keys != vector<uint64_t>{9, 90, 91, 92, 93, 94, 95, 96, 97, 98, 99} ||
+        store.Remove(91) || store.Query(query, keys) || keys.size() != 10)
+      return STANDARD_ERROR;
+    query.from = "nobody@example.com";
+    if (store.Query(query, keys) || !keys.empty())
+      return STANDARD_ERROR;
+  }
+
+  // A torn row is cut off, the rest is read back
+  string key = string(TEST_MAILBOX) + HEADER_DIRECTORY_NAME + "key.col";
+  string to  = string(TEST_MAILBOX) + HEADER_DIRECTORY_NAME + "to.col";
+  if (system(("printf abc >> " + key + "; printf abcdefgh >> " + to).c_str()))
+    return STANDARD_ERROR;
+  {
+    HeaderStore store(TEST_MAILBOX);
+    vector<uint64_t> keys;
+    HeaderQuery query;
+    query.subject = "report r9";
+    if (store.Open() || store.GetRows() != 101 || store.Query(query, keys) || keys.size() != 10 ||
+        store.Add(102, 0, Message(102)) || store.GetRows() != 102)
+      return STANDARD_ERROR;
+  }
+
+  // A damaged column drops the store
+  string from = string(TEST_MAILBOX) + HEADER_DIRECTORY_NAME + "from.col";
+  if (system(("printf '\377\377\377\377' | dd of=" + from + " bs=1 seek=8 conv=notrunc 2>/dev/null").c_str()))
+    return STANDARD_ERROR;
+  HeaderStore store(TEST_MAILBOX);
+  return store.Open() || store.GetRows() != 0 ? STANDARD_ERROR : SUCCESS;
+}
+
+// The engine fills the store from the mailbox and gives only messages still there
+static RC TestSearchHeaders ()
+{
+  RemoveMailbox();
+  SearchEngine *engine = SearchEngine::instance();
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys(10), found;
+  RC rc = EmailDataManager::instance()->OpenMailbox(TEST_HEADERS, mailbox);
+  for (uint64_t i = 0; i < keys.size() && rc == SUCCESS; ++i) {
+    rc = mailbox->Append(Message(i), keys[i]);
+    if (i >= 5 && rc == SUCCESS)
+      rc = engine->Add(mailbox, keys[i], Message(i));
+  }
+  if (rc || mailbox->Delete(keys[7]) || engine->Remove(mailbox, keys[7]) || mailbox->Delete(keys[0]))
+    return STANDARD_ERROR;
+
+  HeaderQuery query;
+  query.from = "sender0@example.com";
+  if (engine->SearchHeaders(mailbox, query, found) || !found.empty())
+    return STANDARD_ERROR;
+  query.from = "";
+  query.to   = "copy1@example.com";
+  if (engine->SearchHeaders(mailbox, query, found) || found != vector<uint64_t>{keys[1], keys[4]})
+    return STANDARD_ERROR;
+  query.since = time(NULL) + 3600;
+  return engine->SearchHeaders(mailbox, query, found) || !found.empty() ? STANDARD_ERROR : SUCCESS;
+}
+
+// A message caught up later keeps the time it was stored at
+static RC TestArrival ()
+{
+  RemoveMailbox();
+  SearchEngine *engine = SearchEngine::instance();
+  shared_ptr<Mailbox> mailbox;
+  uint64_t early, late;
+  Index index;
+  time_t start = time(NULL);
+  if (EmailDataManager::instance()->OpenMailbox(TEST_ARRIVAL, mailbox) || mailbox->Append(Message(1), early) ||
+      mailbox->Lookup(early, index) || index.arrival < start || index.arrival > time(NULL))
+    return STANDARD_ERROR;
+  while (time(NULL) < start + 2)
+    this_thread::sleep_for(chrono::milliseconds(50));
+  if (mailbox->Append(Message(2), late) || engine->Add(mailbox, late, Message(2)))
+    return STANDARD_ERROR;
+
+  HeaderQuery query;
+  vector<uint64_t> found;
+  query.since = start + 2;
+  if (engine->SearchHeaders(mailbox, query, found) || found != vector<uint64_t>{late})
+    return STANDARD_ERROR;
+  query.since  = 0;
+  query.before = start + 2;
+  return engine->SearchHeaders(mailbox, query, found) || found != vector<uint64_t>{early} ? STANDARD_ERROR : SUCCESS;
+}
+
+// A search of a large mailbox reads a few postings, not the messages
+static RC TestLarge ()
+{
+  RemoveMailbox();
+  if (mkdir(TEST_MAILBOX, 0700))
+    return STANDARD_ERROR;
+  SearchIndex index(TEST_MAILBOX);
+  RC rc = index.Open();
+  for (uint64_t key = 1; key <= TEST_MESSAGES && rc == SUCCESS; ++key)
+    rc = index.Add(key, Message(key));
+  if (rc || index.Flush() || index.Merge())
+    return STANDARD_ERROR;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<uint64_t> keys;
+  for (int i = 0; i < 100; ++i) {
+    if (index.Search({{"sr4321"}}, keys) || keys != vector<uint64_t>{4321} ||
+        index.Search({{"bword7"}, {"fsender2"}}, keys) || keys.size() != (TEST_MESSAGES - 37) / 70 + 1)
+      return STANDARD_ERROR;
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "  200 searches of " << TEST_MESSAGES << " messages: " << elapsed * 1000 << " ms" << endl;
+  return SUCCESS;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  EmailDataManager::instance()->SetSharedPath(TEST_SHARED);
+
+  result = TestTokenize();
+  cout << "TestTokenize: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestAddSearch();
+  cout << "TestAddSearch: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestDeleteReopen();
+  cout << "TestDeleteReopen: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestMerge();
+  cout << "TestMerge: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestSearchEngine();
+  cout << "TestSearchEngine: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestTrigram();
+  cout << "TestTrigram: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestFindNeedle();
+  cout << "TestFindNeedle: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestScan();
+  cout << "TestScan: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestParseAddresses();
+  cout << "TestParseAddresses: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestHeaderStore();
+  cout << "TestHeaderStore: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestSearchHeaders();
+  cout << "TestSearchHeaders: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestArrival();
+  cout << "TestArrival: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestLarge();
+  cout << "TestLarge: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  RemoveMailbox();
+  return (rc);
+}
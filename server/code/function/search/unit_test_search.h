@@ -0,0 +1,27 @@
+/*
+ * unit_test_search.h
+ *
+ * This file provides unit test for search.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "headers.h"
+#include "scan.h"
+#include "search.h"
+
+const char TEST_MAILBOX[] = "unit_test_search.data/";
+const char TEST_TRIGRAM[] = "unit_test_search.trigram/";  // The engine keeps indexes open, one mailbox a test
+const char TEST_HEADERS[] = "unit_test_search.headers/";
+const char TEST_ARRIVAL[] = "unit_test_search.arrival/";
+const char TEST_SHARED[]  = "unit_test_search.shared/";
+
+#define TEST_MESSAGES      5000
+#define TEST_SCAN_MESSAGES 2000
+
+#endif
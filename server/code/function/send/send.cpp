@@ -0,0 +1,710 @@
+/*
+ * send.cpp
+ *
+ * This file provides the Outbound Queue: the spool of the messages taken by
+ * SMTP and the workers delivering them.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../basic/wal/wal.h"
+#include "send.h"
+
+/************ Helper Functions *************/
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t GetSeconds ()
+{
+  return std::chrono::duration_cast<std::chrono::seconds>(Clock::now().time_since_epoch()).count();
+}
+
+static bool WriteAll (int fd, const void *data, size_t length)
+{
+  const char *bytes = static_cast<const char *>(data);
+  while (length) {
+    ssize_t written = write(fd, bytes, length);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes  += written;
+    length -= written;
+  }
+  return true;
+}
+
+static void SyncDirectory (const std::string &path)
+{
+  int directoryId = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directoryId != -1) {
+    fsync(directoryId);
+    close(directoryId);
+  }
+}
+
+static bool ReadFile (const std::string &name, std::string &bytes)
+{
+  int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  struct stat status;
+  bool read = !fstat(fd, &status);
+  bytes.resize(read ? status.st_size : 0);
+  for (size_t done = 0; read && done < bytes.size();) {
+    ssize_t got = pread(fd, &bytes[done], bytes.size() - done, done);
+    if (got == -1 && errno == EINTR)
+      continue;
+    read = got > 0;
+    done += read ? got : 0;
+  }
+  close(fd);
+  return read;
+}
+
+static void PutString (std::string &out, std::string_view text)
+{
+  uint32_t length = text.size();
+  out.append(reinterpret_cast<const char *>(&length), sizeof(length));
+  out.append(text);
+}
+
+static bool GetString (std::string_view &in, std::string &text)
+{
+  uint32_t length;
+  if (in.size() < sizeof(length))
+    return false;
+  memcpy(&length, in.data(), sizeof(length));
+  in.remove_prefix(sizeof(length));
+  if (in.size() < length)
+    return false;
+  text.assign(in.substr(0, length));
+  in.remove_prefix(length);
+  return true;
+}
+
+static std::string GetDomain (const std::string &address)
+{
+  size_t at = address.rfind('@');
+  std::string domain = at == std::string::npos ? "" : address.substr(at + 1);
+  for (char &character : domain)
+    character = tolower(static_cast<unsigned char>(character));
+  return domain;
+}
+
+// Whether a local part can name a mailbox, a directory of the domain
+static bool IsMailboxName (const std::string &address)
+{
+  std::string name = address.substr(0, address.rfind('@'));
+  return !name.empty() && name.size() < USERNAME_MAX_LANGTH && name.find('/') == std::string::npos &&
+         name.find("..") == std::string::npos;
+}
+
+static uint32_t GetChecksum (const JournalRecord &record)
+{
+  return Crc32c(&record, offsetof(JournalRecord, checksum));
+}
+
+/************ TimerWheel *************/
+TimerWheel::TimerWheel(size_t slots)
+  : _slots(slots),
+    _now(0),
+    _size(0)
+{
+}
+
+void TimerWheel::Schedule (DeliveryJob job, uint64_t due)
+{
+  due = std::max(due, _now + 1);
+  _slots[due % _slots.size()].emplace_back(due, std::move(job));
+  ++_size;
+}
+
+void TimerWheel::Advance (uint64_t now, std::vector<DeliveryJob> &expired)
+{
+  if (now <= _now)
+    return;
+  // One turn looks at every slot, whatever the time passed
+  uint64_t passed = std::min<uint64_t>(now - _now, _slots.size());
+  for (uint64_t second = now - passed + 1; second <= now; ++second) {
+    std::vector<std::pair<uint64_t, DeliveryJob>> &slot = _slots[second % _slots.size()];
+    size_t kept = 0;
+    for (size_t i = 0; i < slot.size(); ++i) {
+      if (slot[i].first <= now) {
+        expired.push_back(std::move(slot[i].second));
+        --_size;
+      } else {
+        if (kept != i)
+          slot[kept] = std::move(slot[i]);
+        ++kept;
+      }
+    }
+    slot.resize(kept);
+  }
+  _now = now;
+}
+
+/************ OutboundQueue *************/
+OutboundQueue::OutboundQueue(const std::string &path, size_t threads)
+  : _path(path),
+    _threads(std::max<size_t>(threads, 1)),
+    _stopping(false),
+    _nextId(1),
+    _stats(),
+    _journal(-1),
+    _journalLimit(SEND_JOURNAL_MAX),
+    _journalKept(0)
+{
+  if (_path.empty() || _path.back() != '/')
+    _path += '/';
+}
+
+OutboundQueue::~OutboundQueue()
+{
+  Stop();
+  if (_journal != -1)
+    close(_journal);
+}
+
+RC OutboundQueue::Open ()
+{
+  if (mkdir(_path.c_str(), 0700) && errno != EEXIST)
+    return SEND_OPEN_ERROR;
+
+  // Recipients done with, up to a torn record
+  std::string journal;
+  std::set<std::pair<uint64_t, uint32_t>> done;
+  ReadFile(_path + SEND_JOURNAL_NAME, journal);
+  for (size_t offset = 0; offset + sizeof(JournalRecord) <= journal.size(); offset += sizeof(JournalRecord)) {
+    JournalRecord record;
+    memcpy(&record, journal.data() + offset, sizeof(record));
+    if (record.checksum != GetChecksum(record))
+      break;
+    done.emplace(record.id, record.recipient);
+  }
+
+  DIR *directory = opendir(_path.c_str());
+  if (!directory)
+    return SEND_OPEN_ERROR;
+  std::vector<std::string> names;
+  std::string extension = SEND_EXTENSION;
+  struct dirent *entry;
+  while ((entry = readdir(directory))) {
+    std::string name = entry->d_name;
+    if (name.size() > 4 && !name.compare(name.size() - 4, 4, ".tmp"))
+      unlink((_path + name).c_str());
+    else if (name.size() > extension.size() && !name.compare(name.size() - extension.size(), extension.size(), extension))
+      names.push_back(name);
+  }
+  closedir(directory);
+
+  // The journal starts again with the records of the messages still there
+  std::vector<JournalRecord> kept;
+  std::unique_lock<std::mutex> lock(_lock);
+  for (const std::string &name : names) {
+    std::shared_ptr<SpooledMessage> message;
+    if (LoadMessage(_path + name, message)) {
+      unlink((_path + name).c_str());
+      continue;
+    }
+    _nextId = std::max(_nextId, message->id + 1);
+
+    std::map<std::string, DeliveryJob> jobs;
+    for (uint32_t i = 0; i < message->recipients.size(); ++i) {
+      if (done.count({message->id, i})) {
+        kept.push_back(JournalRecord{message->id, i, 0});
+        continue;
+      }
+      std::string domain = GetDomain(message->recipients[i]);
+      DeliveryJob &job = jobs[domain];
+      job.message = message;
+      job.domain  = domain;
+      job.recipients.push_back(i);
+      job.attempts = 0;
+      ++message->pending;
+    }
+    if (!message->pending) {
+      unlink((_path + name).c_str());
+      continue;
+    }
+    _messages[message->id] = message;
+    for (auto &job : jobs)
+      Queue(std::move(job.second));
+  }
+  lock.unlock();
+
+  std::lock_guard<std::mutex> journalLock(_journalLock);
+  return RewriteJournal(kept) ? SEND_OPEN_ERROR : SUCCESS;
+}
+
+void OutboundQueue::Start ()
+{
+  _stopping = false;
+  for (size_t i = 0; i < _threads; ++i) {
+    _workers.emplace_back([this] {
+      std::unique_lock<std::mutex> lock(_lock);
+      while (true) {
+        std::string domain;
+        std::vector<DeliveryJob> batch;
+        _wake.wait(lock, [&] { return _stopping || TakeBatch(domain, batch); });
+        if (_stopping && batch.empty())
+          return;
+        lock.unlock();
+        DeliverBatch(domain, batch);
+        lock.lock();
+      }
+    });
+  }
+  _clock = std::thread([this] {
+    std::unique_lock<std::mutex> lock(_lock);
+    while (!_stopping) {
+      lock.unlock();
+      Advance(GetSeconds());
+      lock.lock();
+      _wake.wait_for(lock, std::chrono::seconds(1), [this] { return _stopping; });
+    }
+  });
+}
+
+void OutboundQueue::Stop ()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  for (std::thread &worker : _workers)
+    worker.join();
+  _workers.clear();
+  if (_clock.joinable())
+    _clock.join();
+}
+
+RC OutboundQueue::Enqueue (const std::string &sender, const std::vector<std::string> &recipients,
+                           std::string_view message, uint64_t &id)
+{
+  std::shared_ptr<SpooledMessage> spooled(new SpooledMessage{0, sender, recipients, std::string(message),
+                                                             Clock::now(), recipients.size()});
+  std::map<std::string, DeliveryJob> jobs;
+  for (uint32_t i = 0; i < recipients.size(); ++i) {
+    std::string domain = GetDomain(recipients[i]);
+    if (domain.empty())
+      return SEND_BAD_ADDRESS;
+    if (!IsMailboxName(recipients[i])) {
+      std::lock_guard<std::mutex> lock(_lock);
+      if (IsLocal(domain))
+        return SEND_BAD_ADDRESS;
+    }
+    DeliveryJob &job = jobs[domain];
+    job.message = spooled;
+    job.domain  = domain;
+    job.recipients.push_back(i);
+    job.attempts = 0;
+  }
+  if (jobs.empty())
+    return SEND_BAD_ADDRESS;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    spooled->id = id = _nextId++;
+  }
+
+  // The whole message and envelope, written and synced once
+  std::string body;
+  PutString(body, sender);
+  for (const std::string &recipient : recipients)
+    PutString(body, recipient);
+  body.append(message);
+  SpoolHeader header{SEND_MAGIC, Crc32c(body.data(), body.size()), id, message.size(),
+                     static_cast<uint32_t>(sender.size()), static_cast<uint32_t>(recipients.size())};
+  std::string name = GetFileName(id), temporary = name + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return SEND_WRITE_ERROR;
+  bool written = WriteAll(fd, &header, sizeof(header)) && WriteAll(fd, body.data(), body.size()) && !fdatasync(fd);
+  close(fd);
+  if (!written || rename(temporary.c_str(), name.c_str())) {
+    unlink(temporary.c_str());
+    return SEND_WRITE_ERROR;
+  }
+  SyncDirectory(_path);
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _messages[id] = spooled;
+    ++_stats.enqueued;
+    for (auto &job : jobs)
+      Queue(std::move(job.second));
+  }
+  _wake.notify_all();
+  return SUCCESS;
+}
+
+void OutboundQueue::RunOnce ()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+  std::string domain;
+  std::vector<DeliveryJob> batch;
+  while (TakeBatch(domain, batch)) {
+    lock.unlock();
+    DeliverBatch(domain, batch);
+    lock.lock();
+    batch.clear();
+  }
+}
+
+void OutboundQueue::Advance (uint64_t now)
+{
+  std::vector<DeliveryJob> expired;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _wheel.Advance(now, expired);
+    for (DeliveryJob &job : expired)
+      Queue(std::move(job));
+  }
+  if (!expired.empty())
+    _wake.notify_all();
+}
+
+void OutboundQueue::AddLocalDomain (const std::string &domain)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _localDomains.insert(GetDomain("@" + domain));
+}
+
+void OutboundQueue::SetTransport (Transport transport)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _transport = std::move(transport);
+}
+
+void OutboundQueue::SetJournalLimit (uint64_t bytes)
+{
+  std::lock_guard<std::mutex> journalLock(_journalLock);
+  _journalLimit = bytes;
+}
+
+void OutboundQueue::GetStats (SendStats &stats)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  stats = _stats;
+  stats.queuedMessages   = _messages.size();
+  stats.queuedRecipients = 0;
+  for (const auto &message : _messages)
+    stats.queuedRecipients += message.second->pending;
+  stats.waiting = _wheel.GetSize();
+}
+
+// Private helper functions
+bool OutboundQueue::TakeBatch (std::string &domain, std::vector<DeliveryJob> &batch)
+{
+  for (size_t turn = 0; turn < _readyDomains.size(); ++turn) {
+    domain = _readyDomains.front();
+    _readyDomains.pop_front();
+    bool local = IsLocal(domain);
+    if (!local && _busy.count(domain)) {
+      _readyDomains.push_back(domain);
+      continue;
+    }
+
+    std::deque<DeliveryJob> &jobs = _ready[domain];
+    while (!jobs.empty() && batch.size() < SEND_BATCH_MESSAGES) {
+      batch.push_back(std::move(jobs.front()));
+      jobs.pop_front();
+    }
+    if (jobs.empty())
+      _ready.erase(domain);
+    else
+      _readyDomains.push_back(domain);
+    if (!local)
+      _busy.insert(domain);
+    ++_stats.batches;
+    return true;
+  }
+  return false;
+}
+
+void OutboundQueue::DeliverBatch (const std::string &domain, std::vector<DeliveryJob> &batch)
+{
+  std::vector<RC> results(batch.size());
+  std::vector<size_t> unknown(batch.size(), 0);
+  bool local;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    local = IsLocal(domain);
+  }
+  if (local) {
+    DeliverLocal(batch, results, unknown);
+  } else {
+    for (size_t i = 0; i < batch.size(); ++i)
+      results[i] = DeliverRemote(batch[i]);
+  }
+
+  std::vector<JournalRecord> records;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    // Failing for the last time is failing for good
+    if (results[i] && results[i] != SEND_PERMANENT_FAILURE && batch[i].attempts + 1 >= SEND_MAX_ATTEMPTS)
+      results[i] = SEND_PERMANENT_FAILURE;
+    if (results[i] && results[i] != SEND_PERMANENT_FAILURE)
+      continue;
+    for (uint32_t recipient : batch[i].recipients)
+      records.push_back(JournalRecord{batch[i].message->id, recipient, 0});
+  }
+  // Not in the journal, they are delivered again after a restart
+  if (WriteJournal(records)) {
+    for (RC &result : results) {
+      if (!result || result == SEND_PERMANENT_FAILURE)
+        result = SEND_WRITE_ERROR;
+    }
+  }
+
+  bool finished = false;
+  Clock::time_point now = Clock::now();
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _busy.erase(domain);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      DeliveryJob &job = batch[i];
+      if (results[i] && results[i] != SEND_PERMANENT_FAILURE) {
+        ++_stats.deferred;
+        uint64_t delay = std::min<uint64_t>(static_cast<uint64_t>(SEND_RETRY_BASE) << std::min(job.attempts, 20u),
+                                            SEND_RETRY_MAX);
+        ++job.attempts;
+        _wheel.Schedule(std::move(job), std::max(_wheel.GetNow(), GetSeconds()) + delay);
+        continue;
+      }
+      if (results[i] == SEND_PERMANENT_FAILURE) {
+        _stats.bounced += job.recipients.size();
+      } else {
+        uint64_t latency = std::chrono::duration_cast<std::chrono::milliseconds>(now - job.message->queued).count();
+        _stats.bounced      += unknown[i];
+        _stats.delivered    += job.recipients.size() - unknown[i];
+        _stats.latencyTotal += latency * (job.recipients.size() - unknown[i]);
+        _stats.latencyMax    = std::max(_stats.latencyMax, latency);
+      }
+      job.message->pending -= job.recipients.size();
+      // Gone from the disk before the queue, so an empty queue is an empty spool
+      if (!job.message->pending) {
+        unlink(GetFileName(job.message->id).c_str());
+        _messages.erase(job.message->id);
+        finished = true;
+      }
+    }
+  }
+  _wake.notify_all();
+
+  // An empty spool needs none of the journal, a long one only the records of the messages still there
+  if (finished) {
+    std::lock_guard<std::mutex> journalLock(_journalLock);
+    std::unique_lock<std::mutex> lock(_lock);
+    if (_messages.empty() && _journal != -1) {
+      if (ftruncate(_journal, 0)) {}
+      _journalKept = 0;
+    } else {
+      lock.unlock();
+      TrimJournal();
+    }
+  }
+}
+
+void OutboundQueue::DeliverLocal (const std::vector<DeliveryJob> &batch, std::vector<RC> &results,
+                                  std::vector<size_t> &unknown)
+{
+  std::vector<std::vector<std::string>> paths(batch.size());
+  {
+    std::lock_guard<std::mutex> lock(_usersLock);
+    for (size_t i = 0; i < batch.size(); ++i)
+      results[i] = FindMailboxes(batch[i], paths[i], unknown[i]);
+  }
+
+  // All recipients of a message in one delivery, the message stored once;
+  // the messages for one mailbox alone in one delivery, its entries written once
+  std::map<std::string, std::vector<size_t>> alone;
+  std::vector<uint64_t> keys;
+  uint64_t stores = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (results[i])
+      continue;
+    if (paths[i].size() == 1) {
+      alone[paths[i][0]].push_back(i);
+      continue;
+    }
+    results[i] = EmailDataCache::instance()->Deliver(batch[i].message->data, paths[i], keys);
+    ++stores;
+  }
+  for (const auto &mailbox : alone) {
+    std::vector<std::string_view> messages;
+    for (size_t i : mailbox.second)
+      messages.push_back(batch[i].message->data);
+    RC rc = EmailDataCache::instance()->Deliver(messages, mailbox.first, keys);
+    for (size_t i : mailbox.second)
+      results[i] = rc;
+    ++stores;
+  }
+
+  std::lock_guard<std::mutex> lock(_lock);
+  _stats.stores += stores;
+}
+
+RC OutboundQueue::FindMailboxes (const DeliveryJob &job, std::vector<std::string> &paths, size_t &unknown)
+{
+  // Only the mailboxes of the users the UIM knows
+  paths.clear();
+  if (job.domain.size() < DOMAIN_NAME_MAX_LENGTH) {
+    for (uint32_t index : job.recipients) {
+      const std::string &recipient = job.message->recipients[index];
+      if (!IsMailboxName(recipient))
+        continue;
+      UserInfo userInfo = {};
+      std::string name = recipient.substr(0, recipient.rfind('@'));
+      memcpy(userInfo.username, name.data(), name.size());
+      memcpy(userInfo.domainName, job.domain.data(), job.domain.size());
+      RC rc = UserInfoManager::instance()->ReadUser(userInfo);
+      if (rc == USER_NOT_EXISTS)
+        continue;
+      if (rc)
+        return SEND_TEMPORARY_FAILURE;
+      paths.push_back(UserInfoManager::GetMailboxPath(userInfo));
+    }
+  }
+  if (paths.empty())
+    return SEND_PERMANENT_FAILURE;
+  unknown = job.recipients.size() - paths.size();
+  return SUCCESS;
+}
+
+RC OutboundQueue::DeliverRemote (const DeliveryJob &job)
+{
+  const SpooledMessage &message = *job.message;
+  std::vector<std::string> recipients;
+  for (uint32_t recipient : job.recipients)
+    recipients.push_back(message.recipients[recipient]);
+
+  Transport transport;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    transport = _transport;
+  }
+  return transport ? transport(job.domain, message.sender, recipients, message.data) : SEND_TEMPORARY_FAILURE;
+}
+
+void OutboundQueue::Queue (DeliveryJob job)
+{
+  std::deque<DeliveryJob> &jobs = _ready[job.domain];
+  if (jobs.empty())
+    _readyDomains.push_back(job.domain);
+  jobs.push_back(std::move(job));
+}
+
+RC OutboundQueue::WriteJournal (const std::vector<JournalRecord> &records)
+{
+  if (records.empty())
+    return SUCCESS;
+  std::vector<JournalRecord> sealed(records);
+  for (JournalRecord &record : sealed)
+    record.checksum = GetChecksum(record);
+
+  std::lock_guard<std::mutex> lock(_journalLock);
+  if (_journal == -1 || !WriteAll(_journal, sealed.data(), sealed.size() * sizeof(JournalRecord)) ||
+      fdatasync(_journal))
+    return SEND_WRITE_ERROR;
+  std::lock_guard<std::mutex> queueLock(_lock);
+  ++_stats.journalSyncs;
+  return SUCCESS;
+}
+
+RC OutboundQueue::RewriteJournal (std::vector<JournalRecord> &records)
+{
+  std::string temporary = _path + SEND_JOURNAL_NAME + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+  for (JournalRecord &record : records)
+    record.checksum = GetChecksum(record);
+  if (fd == -1 || !WriteAll(fd, records.data(), records.size() * sizeof(JournalRecord)) || fdatasync(fd) ||
+      rename(temporary.c_str(), (_path + SEND_JOURNAL_NAME).c_str())) {
+    if (fd != -1)
+      close(fd);
+    return SEND_WRITE_ERROR;
+  }
+  SyncDirectory(_path);
+  if (_journal != -1)
+    close(_journal);
+  _journal = fd;
+  _journalKept = records.size() * sizeof(JournalRecord);
+  return SUCCESS;
+}
+
+void OutboundQueue::TrimJournal ()
+{
+  // Twice what was kept at least, so a large spool is not rewritten at every message
+  struct stat status;
+  if (_journal == -1 || fstat(_journal, &status) ||
+      static_cast<uint64_t>(status.st_size) <= std::max(_journalLimit, 2 * _journalKept))
+    return;
+
+  std::string journal;
+  if (!ReadFile(_path + SEND_JOURNAL_NAME, journal))
+    return;
+  std::vector<JournalRecord> kept;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    for (size_t offset = 0; offset + sizeof(JournalRecord) <= journal.size(); offset += sizeof(JournalRecord)) {
+      JournalRecord record;
+      memcpy(&record, journal.data() + offset, sizeof(record));
+      if (record.checksum != GetChecksum(record))
+        break;
+      if (_messages.count(record.id))
+        kept.push_back(record);
+    }
+  }
+  // The old journal stays in place if this fails, it is only longer
+  if (RewriteJournal(kept))
+    return;
+  std::lock_guard<std::mutex> lock(_lock);
+  ++_stats.journalRewrites;
+}
+
+RC OutboundQueue::LoadMessage (const std::string &name, std::shared_ptr<SpooledMessage> &message)
+{
+  std::string bytes;
+  SpoolHeader header;
+  if (!ReadFile(name, bytes) || bytes.size() < sizeof(header))
+    return SEND_OPEN_ERROR;
+  memcpy(&header, bytes.data(), sizeof(header));
+  std::string_view body(bytes);
+  body.remove_prefix(sizeof(header));
+  if (header.magic != SEND_MAGIC || header.checksum != Crc32c(body.data(), body.size()))
+    return SEND_OPEN_ERROR;
+
+  message.reset(new SpooledMessage{header.id, "", {}, "", Clock::now(), 0});
+  if (!GetString(body, message->sender))
+    return SEND_OPEN_ERROR;
+  message->recipients.resize(header.recipients);
+  for (std::string &recipient : message->recipients) {
+    if (!GetString(body, recipient))
+      return SEND_OPEN_ERROR;
+  }
+  if (body.size() != header.length)
+    return SEND_OPEN_ERROR;
+  message->data.assign(body);
+  return SUCCESS;
+}
+
+std::string OutboundQueue::GetFileName (uint64_t id) const
+{
+  return _path + std::to_string(id) + SEND_EXTENSION;
+}
+
+bool OutboundQueue::IsLocal (const std::string &domain)
+{
+  return _localDomains.count(domain);
+}
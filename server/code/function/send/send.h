@@ -0,0 +1,349 @@
+#ifndef SEND_QUEUE
+#define SEND_QUEUE
+
+/* ----- Include libries or files ----- */
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+#include "../../manager/edc/edc.h"
+#include "../../manager/uim/uim.h"
+
+/* ----- Define macros ----- */
+enum {
+  SEND_OPEN_ERROR = 801,
+  SEND_WRITE_ERROR,
+  SEND_BAD_ADDRESS,
+  SEND_TEMPORARY_FAILURE,   // For a Transport: try again later
+  SEND_PERMANENT_FAILURE,   // For a Transport: never try again
+};
+
+#define SEND_MAGIC          0x444E5345      // "ESND" in the spool header
+#define SEND_THREADS        4               // Workers delivering
+#define SEND_BATCH_MESSAGES 64              // Messages of one domain a worker takes at once
+#define SEND_WHEEL_SLOTS    512             // Seconds one turn of the timer wheel covers
+#define SEND_RETRY_BASE     60              // Seconds before the first retry, doubled every time
+#define SEND_RETRY_MAX      (4 * 3600)      // Seconds between two retries at most
+#define SEND_MAX_ATTEMPTS   12              // Attempts before a recipient is given up
+#define SEND_JOURNAL_MAX    (1024 * 1024)   // Bytes of journal before it is rewritten with the spool left
+const char SEND_EXTENSION[]    = ".msg";
+const char SEND_JOURNAL_NAME[] = "done.log";
+
+/* ----- Define structs ----- */
+/**
+ * SpoolHeader
+ * At the start of every spool file, followed by the sender, every recipient
+ * as a uint32 length and its bytes, and the message. The checksum covers all
+ * of it after the header.
+ */
+struct SpoolHeader {
+  uint32_t magic;
+  uint32_t checksum;
+  uint64_t id;
+  uint64_t length;          // Of the message
+  uint32_t senderLength;
+  uint32_t recipients;
+};
+static_assert(sizeof(SpoolHeader) == 32, "SpoolHeader is stored as it is in the spool files");
+
+/**
+ * JournalRecord
+ * Written to the journal once a recipient is done with, delivered or given
+ * up, so a restart does not deliver to it again.
+ */
+struct JournalRecord {
+  uint64_t id;
+  uint32_t recipient;       // Its index in the spool file
+  uint32_t checksum;        // CRC-32C of the fields above
+};
+static_assert(sizeof(JournalRecord) == 16, "JournalRecord is stored as it is in the journal");
+
+struct SpooledMessage {
+  uint64_t id;
+  std::string sender;
+  std::vector<std::string> recipients;
+  std::string data;
+  std::chrono::steady_clock::time_point queued;
+  size_t pending;           // Recipients not done with
+};
+
+/**
+ * The recipients of one message in one domain, delivered together.
+ */
+struct DeliveryJob {
+  std::shared_ptr<SpooledMessage> message;
+  std::string domain;
+  std::vector<uint32_t> recipients;
+  uint32_t attempts;
+};
+
+struct SendStats {
+  uint64_t queuedMessages;  // In the spool now
+  uint64_t queuedRecipients;
+  uint64_t waiting;         // Jobs waiting for a retry, in the timer wheel
+  uint64_t enqueued;        // Messages taken by Enqueue()
+  uint64_t delivered;       // Recipients
+  uint64_t deferred;        // Attempts that failed for now
+  uint64_t bounced;         // Recipients given up
+  uint64_t batches;         // Taken by the workers
+  uint64_t journalSyncs;
+  uint64_t journalRewrites; // Down to the records of the messages still spooled
+  uint64_t stores;          // Calls storing local mail, one a mailbox of a batch
+  uint64_t latencyTotal;    // Milliseconds from Enqueue() to delivery, of all delivered
+  uint64_t latencyMax;
+};
+
+/**
+ * TimerWheel
+ * This class holds the jobs waiting for a retry: one slot a second over
+ * SEND_WHEEL_SLOTS seconds, a job due later than one turn staying in its slot
+ * until the turn it is due. Scheduling is constant time and advancing the
+ * clock only looks at the slots passed, however many jobs wait.
+ *
+ * Contained Public Functions:
+ *   void   Schedule (DeliveryJob job, uint64_t due)
+ *   void   Advance  (uint64_t now, std::vector<DeliveryJob> &expired)
+ *   size_t GetSize  ()
+ *   uint64_t GetNow ()
+ */
+class TimerWheel
+{
+public:
+  explicit TimerWheel(size_t slots = SEND_WHEEL_SLOTS);
+
+  /**
+   * This function will put a job in the wheel.
+   * @param DeliveryJob given as the job.
+   *        uint64_t given as the second it is due, the next one if passed.
+   */
+  void Schedule (DeliveryJob job, uint64_t due);
+
+  /**
+   * This function will move the clock and take out the jobs due.
+   * @param uint64_t given as the second now.
+   *        vector stores the jobs due, appended.
+   */
+  void Advance (uint64_t now, std::vector<DeliveryJob> &expired);
+
+  size_t   GetSize () const { return _size; }
+  uint64_t GetNow  () const { return _now; }
+
+private:
+  std::vector<std::vector<std::pair<uint64_t, DeliveryJob>>> _slots;
+  uint64_t _now;            // Last second advanced to
+  size_t _size;
+};
+
+/**
+ * OutboundQueue
+ * This class delivers the messages taken by SMTP. A message is written once
+ * to its own spool file, synced and renamed into place before Enqueue()
+ * returns, whatever the number of recipients. Its recipients are then
+ * grouped by domain: those of a local domain are looked up in the UIM and
+ * stored with one EmailDataCache::Deliver() call, so the message is written
+ * once to the shared store with one index entry a mailbox, or kept in the
+ * cache for the first RETR when it is for one mailbox; a local recipient
+ * the UIM does not know is bounced. The messages of a batch for the same
+ * single mailbox are stored together, with one update of its directory
+ * file. Those of other domains go to the Transport, one call a domain.
+ *
+ * A fixed set of workers takes the jobs of a domain SEND_BATCH_MESSAGES at a
+ * time. Local domains are worked on by every worker at once; a remote domain
+ * by one worker at a time, so it sees one connection. Recipients done with
+ * are written to the journal, one write and one fdatasync() a batch; a spool
+ * file goes once all its recipients are done. The journal is emptied with
+ * the spool, and once it passes SEND_JOURNAL_MAX it is rewritten with the
+ * records of the messages still spooled, as Open() does. Open() delivers
+ * what the journal does not have after a restart, so a message is delivered
+ * at least once.
+ *
+ * A failed attempt is tried again after SEND_RETRY_BASE seconds, doubled
+ * every time up to SEND_RETRY_MAX, by a timer wheel, with no thread waiting
+ * for it; after SEND_MAX_ATTEMPTS it is given up. Retries are counted in
+ * memory only and start again after a restart.
+ *
+ * Contained Public Functions:
+ *   RC   Open    ()
+ *   void Start   ()
+ *   void Stop    ()
+ *   RC   Enqueue (const std::string &sender, const std::vector<std::string> &recipients,
+ *                 std::string_view message, uint64_t &id)
+ *   void RunOnce ()
+ *   void Advance (uint64_t now)
+ *   void AddLocalDomain (const std::string &domain)
+ *   void SetTransport   (Transport transport)
+ *   void SetJournalLimit (uint64_t bytes)
+ *   void GetStats (SendStats &stats)
+ */
+class OutboundQueue
+{
+public:
+  /**
+   * Delivers to the recipients of one remote domain.
+   * @return SUCCESS if delivered, SEND_PERMANENT_FAILURE to give them up,
+   *         anything else to try again later.
+   */
+  typedef std::function<RC(const std::string &domain, const std::string &sender,
+                           const std::vector<std::string> &recipients, std::string_view message)> Transport;
+
+  explicit OutboundQueue(const std::string &path, size_t threads = SEND_THREADS);
+  ~OutboundQueue();
+
+  OutboundQueue(const OutboundQueue &) = delete;
+  OutboundQueue &operator=(const OutboundQueue &) = delete;
+
+  /**
+   * This function will read the spool and queue every recipient the journal
+   * does not have.
+   * @return SUCCESS if the queue is ready.
+   *         SEND_OPEN_ERROR otherwise.
+   */
+  RC Open ();
+
+  /**
+   * This function will start the workers and the thread moving the clock of
+   * the timer wheel.
+   */
+  void Start ();
+
+  /**
+   * This function will stop the threads and wait for them. What is queued
+   * stays in the spool.
+   */
+  void Stop  ();
+
+  /**
+   * This function will spool a message and queue its recipients.
+   * @param  const string given as the sender.
+   *         const vector given as the recipients, as user@domain.
+   *         string_view given as the message.
+   *         uint64_t stores the id of the message in the spool.
+   * @return SUCCESS if the message is on the disk.
+   *         SEND_BAD_ADDRESS if a recipient has no domain, or one of a local
+   *         domain has a name no mailbox can have.
+   *         SEND_WRITE_ERROR otherwise.
+   */
+  RC Enqueue (const std::string &sender, const std::vector<std::string> &recipients, std::string_view message,
+              uint64_t &id);
+
+  /**
+   * This function will deliver everything queued that is due, in the
+   * calling thread.
+   */
+  void RunOnce ();
+
+  /**
+   * This function will move the clock of the timer wheel and queue the
+   * retries due.
+   * @param uint64_t given as the second now, of the steady clock.
+   */
+  void Advance (uint64_t now);
+
+  void AddLocalDomain (const std::string &domain);
+
+  void SetTransport (Transport transport);
+
+  /**
+   * This function will set the size the journal is rewritten at.
+   * @param uint64_t given as the bytes, SEND_JOURNAL_MAX by default.
+   */
+  void SetJournalLimit (uint64_t bytes);
+
+  /**
+   * This function will give the counters and the depth of the queue.
+   * @param SendStats stores them.
+   */
+  void GetStats (SendStats &stats);
+
+private:
+  std::string _path;                            // Directory of the spool, ends with '/'
+  size_t _threads;
+  std::vector<std::thread> _workers;
+  std::thread _clock;
+  std::mutex _lock;                             // Guards the members below
+  std::condition_variable _wake;
+  bool _stopping;
+  std::map<uint64_t, std::shared_ptr<SpooledMessage>> _messages; // In the spool, by id
+  uint64_t _nextId;
+  std::map<std::string, std::deque<DeliveryJob>> _ready;  // Jobs to deliver now, by domain
+  std::deque<std::string> _readyDomains;        // Domains with jobs, in turn
+  std::set<std::string> _busy;                  // Remote domains a worker is on
+  TimerWheel _wheel;
+  std::set<std::string> _localDomains;
+  Transport _transport;
+  SendStats _stats;
+  std::mutex _journalLock;                      // Guards the journal members, taken before _lock
+  int _journal;
+  uint64_t _journalLimit;
+  uint64_t _journalKept;                        // Bytes of the journal after it was last rewritten
+  std::mutex _usersLock;                        // Taken around the UIM, which is not thread safe
+
+  // Private helper functions
+  /**
+   * This function will take a batch of jobs of one domain, with the lock
+   * held.
+   * @return true if there was one.
+   */
+  bool TakeBatch (std::string &domain, std::vector<DeliveryJob> &batch);
+
+  /**
+   * This function will deliver a batch, without the lock, and requeue or
+   * drop its jobs.
+   */
+  void DeliverBatch (const std::string &domain, std::vector<DeliveryJob> &batch);
+
+  /**
+   * This function will store the jobs of a batch for a local domain.
+   * @param vector given as the jobs.
+   *        vector stores the result of every job: SUCCESS if delivered,
+   *        SEND_PERMANENT_FAILURE to give it up, anything else to try again.
+   *        vector stores how many recipients of every job are bounced as
+   *        unknown, if the others are delivered.
+   */
+  void DeliverLocal (const std::vector<DeliveryJob> &batch, std::vector<RC> &results, std::vector<size_t> &unknown);
+
+  /**
+   * This function will give the mailboxes of the recipients of a local job,
+   * with _usersLock held.
+   * @return SUCCESS if at least one is known, SEND_PERMANENT_FAILURE if
+   *         none is, SEND_TEMPORARY_FAILURE if the UIM fails.
+   */
+  RC   FindMailboxes (const DeliveryJob &job, std::vector<std::string> &paths, size_t &unknown);
+
+  /**
+   * This function will hand a job for a remote domain to the Transport.
+   * @return same as the Transport, SEND_TEMPORARY_FAILURE if none is set.
+   */
+  RC   DeliverRemote (const DeliveryJob &job);
+  void Queue (DeliveryJob job);
+  RC   WriteJournal (const std::vector<JournalRecord> &records);
+
+  /**
+   * This function will put a new journal holding the records given in place
+   * of the old one, with _journalLock held.
+   * @return SUCCESS if it is in place, SEND_WRITE_ERROR otherwise.
+   */
+  RC   RewriteJournal (std::vector<JournalRecord> &records);
+
+  /**
+   * This function will rewrite the journal with the records of the messages
+   * still spooled once it is too long, with _journalLock held.
+   */
+  void TrimJournal ();
+  RC   LoadMessage (const std::string &name, std::shared_ptr<SpooledMessage> &message);
+  std::string GetFileName (uint64_t id) const;
+  bool IsLocal (const std::string &domain);
+};
+
+#endif
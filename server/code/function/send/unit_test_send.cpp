@@ -0,0 +1,363 @@
+/*
+ * unit_test_send.cpp
+ *
+ * This file provides unit test for send.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <atomic>
+#include <cstdlib>
+#include <dirent.h>
+#include <iostream>
+#include <sys/stat.h>
+#include "unit_test_send.h"
+using namespace std;
+
+static UserInfo GetUser (const string &name)
+{
+  UserInfo userInfo = {};
+  strncpy(userInfo.username, name.c_str(), USERNAME_MAX_LANGTH - 1);
+  strncpy(userInfo.domainName, TEST_DOMAIN, DOMAIN_NAME_MAX_LENGTH - 1);
+  return userInfo;
+}
+
+static void RemoveSpool ()
+{
+  if (system((string("rm -rf ") + TEST_SPOOL + " " + TEST_SHARED + " " + DATAPATH + TEST_DOMAIN).c_str())) {}
+  for (const char *name : {"bob", "carol", "dave", "u0", "u1", "u2", "u3"})
+    UserInfoManager::instance()->CreateUser(GetUser(name));
+}
+
+static size_t CountSpoolFiles ()
+{
+  size_t count = 0;
+  DIR *directory = opendir(TEST_SPOOL);
+  if (!directory)
+    return 0;
+  struct dirent *entry;
+  while ((entry = readdir(directory))) {
+    string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, SEND_EXTENSION) == 0)
+      ++count;
+  }
+  closedir(directory);
+  return count;
+}
+
+static size_t CountMessages (const string &user)
+{
+  shared_ptr<Mailbox> mailbox;
+  vector<SummaryEntry> entries;
+  if (EmailDataManager::instance()->OpenMailbox(UserInfoManager::GetMailboxPath(GetUser(user)), mailbox))
+    return 0;
+  mailbox->ListSummary(entries);
+  return entries.size();
+}
+
+static OutboundQueue *OpenQueue ()
+{
+  OutboundQueue *queue = new OutboundQueue(TEST_SPOOL, 2);
+  queue->AddLocalDomain(TEST_DOMAIN);
+  if (queue->Open()) {
+    delete queue;
+    return NULL;
+  }
+  return queue;
+}
+
+// Jobs come out on the second due, also those more than a turn away
+static RC TestTimerWheel ()
+{
+  TimerWheel wheel(8);
+  vector<DeliveryJob> expired;
+  wheel.Advance(100, expired);
+  for (uint64_t due : {101, 105, 120, 90}) {
+    DeliveryJob job;
+    job.attempts = due;
+    job.recipients.push_back(due);
+    wheel.Schedule(job, due);
+  }
+  if (wheel.GetSize() != 4)
+    return STANDARD_ERROR;
+  wheel.Advance(101, expired);
+  // A job due in the past is due on the next second
+  if (expired.size() != 2 || expired[0].attempts + expired[1].attempts != 191)
+    return STANDARD_ERROR;
+  wheel.Advance(108, expired);
+  if (expired.size() != 3 || expired[2].attempts != 105)
+    return STANDARD_ERROR;
+  wheel.Advance(119, expired);
+  if (expired.size() != 3 || wheel.GetSize() != 1)
+    return STANDARD_ERROR;
+  wheel.Advance(1000, expired);
+  return expired.size() == 4 && expired[3].recipients.size() == 1 && !wheel.GetSize() ? SUCCESS : STANDARD_ERROR;
+}
+
+// One spool file a message, one delivery to all the local recipients
+static RC TestLocalDelivery ()
+{
+  RemoveSpool();
+  unique_ptr<OutboundQueue> queue(OpenQueue());
+  uint64_t id;
+  if (!queue || queue->Enqueue("a@remote.test", {"bob@local.test", "carol@LOCAL.test", "dave@local.test"},
+                               "Subject: hi\r\n\r\nbody\r\n", id))
+    return STANDARD_ERROR;
+  SendStats stats;
+  queue->GetStats(stats);
+  if (CountSpoolFiles() != 1 || stats.queuedMessages != 1 || stats.queuedRecipients != 3)
+    return STANDARD_ERROR;
+
+  queue->RunOnce();
+  queue->GetStats(stats);
+  if (CountSpoolFiles() || stats.queuedMessages || stats.delivered != 3 || stats.batches != 1 ||
+      stats.journalSyncs != 1 || stats.stores != 1)
+    return STANDARD_ERROR;
+  if (CountMessages("bob") != 1 || CountMessages("carol") != 1 || CountMessages("dave") != 1)
+    return STANDARD_ERROR;
+
+  // The messages of a batch for bob alone stored together
+  for (int i = 0; i < 5; ++i) {
+    if (queue->Enqueue("a@remote.test", {"bob@local.test"}, "message " + to_string(i), id))
+      return STANDARD_ERROR;
+  }
+  if (queue->Enqueue("a@remote.test", {"carol@local.test", "dave@local.test"}, "both", id))
+    return STANDARD_ERROR;
+  queue->RunOnce();
+  queue->GetStats(stats);
+  if (CountSpoolFiles() || stats.delivered != 10 || stats.batches != 2 || stats.stores != 3 ||
+      CountMessages("bob") != 6 || CountMessages("carol") != 2 || CountMessages("dave") != 2)
+    return STANDARD_ERROR;
+
+  if (queue->Enqueue("a@remote.test", {"nodomain"}, "x", id) != SEND_BAD_ADDRESS ||
+      queue->Enqueue("a@remote.test", {}, "x", id) != SEND_BAD_ADDRESS)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Local users the UIM does not know are bounced, paths out of the domain refused
+static RC TestUnknownRecipients ()
+{
+  RemoveSpool();
+  unique_ptr<OutboundQueue> queue(OpenQueue());
+  uint64_t id;
+  if (queue->Enqueue("a@remote.test", {"../bob@local.test"}, "x", id) != SEND_BAD_ADDRESS ||
+      queue->Enqueue("a@remote.test", {"bob/x@local.test"}, "x", id) != SEND_BAD_ADDRESS ||
+      queue->Enqueue("a@remote.test", {"@local.test"}, "x", id) != SEND_BAD_ADDRESS)
+    return STANDARD_ERROR;
+  if (queue->Enqueue("a@remote.test", {"bob@local.test", "nobody@local.test"}, "first", id) ||
+      queue->Enqueue("a@remote.test", {"nobody@local.test"}, "second", id))
+    return STANDARD_ERROR;
+  CacheStats before, after;
+  EmailDataCache::instance()->GetCache().GetStats(before);
+  queue->RunOnce();
+  SendStats stats;
+  queue->GetStats(stats);
+  if (stats.delivered != 1 || stats.bounced != 2 || stats.queuedMessages || CountSpoolFiles())
+    return STANDARD_ERROR;
+  // Delivered through the cache, for one mailbox
+  EmailDataCache::instance()->GetCache().GetStats(after);
+  if (after.insertions != before.insertions + 1)
+    return STANDARD_ERROR;
+  // No mailbox was made for the unknown user
+  struct stat status;
+  return CountMessages("bob") == 1 && stat(UserInfoManager::GetMailboxPath(GetUser("nobody")).c_str(), &status) ?
+         SUCCESS : STANDARD_ERROR;
+}
+
+// A remote domain gets its recipients in one call, tried again once due
+static RC TestRetry ()
+{
+  RemoveSpool();
+  unique_ptr<OutboundQueue> queue(OpenQueue());
+  size_t calls = 0, recipients = 0;
+  RC answer = SEND_TEMPORARY_FAILURE;
+  queue->SetTransport([&] (const string &domain, const string &, const vector<string> &to, string_view) {
+    ++calls;
+    recipients += to.size();
+    return domain == "remote.test" ? answer : SEND_PERMANENT_FAILURE;
+  });
+  uint64_t id;
+  if (queue->Enqueue("bob@local.test", {"x@remote.test", "y@remote.test", "z@gone.test"}, "message", id))
+    return STANDARD_ERROR;
+  queue->RunOnce();
+  SendStats stats;
+  queue->GetStats(stats);
+  if (calls != 2 || recipients != 3 || stats.deferred != 1 || stats.bounced != 1 || stats.waiting != 1 ||
+      stats.queuedRecipients != 2 || CountSpoolFiles() != 1)
+    return STANDARD_ERROR;
+
+  // Not due yet, then due
+  uint64_t now = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now().time_since_epoch()).count();
+  queue->Advance(now + 1);
+  queue->RunOnce();
+  if (calls != 2)
+    return STANDARD_ERROR;
+  answer = SUCCESS;
+  queue->Advance(now + SEND_RETRY_BASE + 2);
+  queue->RunOnce();
+  queue->GetStats(stats);
+  return calls == 3 && stats.delivered == 2 && !stats.waiting && !stats.queuedMessages && !CountSpoolFiles() ?
+         SUCCESS : STANDARD_ERROR;
+}
+
+// What the journal does not have is delivered again after a restart
+static RC TestRecovery ()
+{
+  RemoveSpool();
+  unique_ptr<OutboundQueue> queue(OpenQueue());
+  uint64_t first, second;
+  size_t calls = 0;
+  queue->SetTransport([&] (const string &, const string &, const vector<string> &, string_view) {
+    ++calls;
+    return SUCCESS;
+  });
+  if (queue->Enqueue("a@remote.test", {"bob@local.test", "x@remote.test"}, "first", first))
+    return STANDARD_ERROR;
+  queue->RunOnce();
+  if (queue->Enqueue("a@remote.test", {"carol@local.test", "y@remote.test"}, "second", second))
+    return STANDARD_ERROR;
+  queue.reset();
+
+  // Half of the second message done before the crash
+  JournalRecord record{second, 1, 0};
+  record.checksum = Crc32c(&record, offsetof(JournalRecord, checksum));
+  FILE *journal = fopen((string(TEST_SPOOL) + SEND_JOURNAL_NAME).c_str(), "ab");
+  if (!journal || fwrite(&record, sizeof(record), 1, journal) != 1 || fclose(journal))
+    return STANDARD_ERROR;
+
+  queue.reset(OpenQueue());
+  queue->SetTransport([&] (const string &, const string &, const vector<string> &, string_view) {
+    ++calls;
+    return SUCCESS;
+  });
+  SendStats stats;
+  queue->GetStats(stats);
+  if (!queue || stats.queuedMessages != 1 || stats.queuedRecipients != 1)
+    return STANDARD_ERROR;
+  queue->RunOnce();
+  uint64_t third;
+  if (calls != 1 || CountMessages("carol") != 1 || CountSpoolFiles() ||
+      queue->Enqueue("a@remote.test", {"bob@local.test"}, "third", third) || third <= second)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// A long journal is rewritten with the records of the messages still spooled
+static RC TestJournalLimit ()
+{
+  RemoveSpool();
+  unique_ptr<OutboundQueue> queue(OpenQueue());
+  size_t calls = 0;
+  queue->SetTransport([&] (const string &, const string &, const vector<string> &, string_view) {
+    ++calls;
+    return SEND_TEMPORARY_FAILURE;
+  });
+  queue->SetJournalLimit(4 * sizeof(JournalRecord));
+  uint64_t id;
+  if (queue->Enqueue("a@remote.test", {"bob@local.test", "x@remote.test"}, "pending", id))
+    return STANDARD_ERROR;
+  queue->RunOnce();
+  for (int i = 0; i < 10; ++i) {
+    if (queue->Enqueue("a@remote.test", {"carol@local.test"}, "message " + to_string(i), id))
+      return STANDARD_ERROR;
+  }
+  queue->RunOnce();
+  SendStats stats;
+  queue->GetStats(stats);
+  // Only bob of the pending message is left, the spool never emptied
+  struct stat status;
+  if (stats.journalRewrites != 1 || stats.queuedMessages != 1 || CountSpoolFiles() != 1 ||
+      stat((string(TEST_SPOOL) + SEND_JOURNAL_NAME).c_str(), &status) || status.st_size != sizeof(JournalRecord))
+    return STANDARD_ERROR;
+
+  // Nothing done is delivered again after a restart
+  queue.reset(OpenQueue());
+  queue->GetStats(stats);
+  if (!queue || stats.queuedMessages != 1 || stats.queuedRecipients != 1)
+    return STANDARD_ERROR;
+  return CountMessages("bob") == 1 && CountMessages("carol") == 10 ? SUCCESS : STANDARD_ERROR;
+}
+
+// The workers deliver what is queued from several threads
+static RC TestWorkers ()
+{
+  RemoveSpool();
+  unique_ptr<OutboundQueue> queue(OpenQueue());
+  atomic<size_t> remote(0);
+  queue->SetTransport([&] (const string &, const string &, const vector<string> &to, string_view) {
+    remote += to.size();
+    return SUCCESS;
+  });
+  queue->Start();
+  vector<thread> senders;
+  atomic<RC> rc(SUCCESS);
+  for (int t = 0; t < 4; ++t) {
+    senders.emplace_back([&, t] {
+      for (int i = 0; i < TEST_MESSAGES / 4; ++i) {
+        uint64_t id;
+        if (queue->Enqueue("a@remote.test", {"u" + to_string(t) + "@local.test", "x@far" + to_string(i % 3) + ".test"},
+                           "message " + to_string(i), id))
+          rc = STANDARD_ERROR;
+      }
+    });
+  }
+  for (thread &sender : senders)
+    sender.join();
+
+  SendStats stats;
+  for (int wait = 0; wait < 500; ++wait) {
+    queue->GetStats(stats);
+    if (!stats.queuedMessages)
+      break;
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  queue->Stop();
+  if (rc || stats.queuedMessages || stats.delivered != 2 * TEST_MESSAGES || remote != TEST_MESSAGES ||
+      stats.enqueued != TEST_MESSAGES || stats.latencyMax * stats.delivered < stats.latencyTotal)
+    return STANDARD_ERROR;
+  for (int t = 0; t < 4; ++t) {
+    if (CountMessages("u" + to_string(t)) != TEST_MESSAGES / 4)
+      return STANDARD_ERROR;
+  }
+  return CountSpoolFiles() ? STANDARD_ERROR : SUCCESS;
+}
+
+int main ()
+{
+  RC rc = SUCCESS, result;
+  EmailDataManager::instance()->SetSharedPath(TEST_SHARED);
+
+  result = TestTimerWheel();
+  cout << "TestTimerWheel: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestLocalDelivery();
+  cout << "TestLocalDelivery: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestUnknownRecipients();
+  cout << "TestUnknownRecipients: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestRetry();
+  cout << "TestRetry: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestRecovery();
+  cout << "TestRecovery: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestJournalLimit();
+  cout << "TestJournalLimit: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestWorkers();
+  cout << "TestWorkers: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  RemoveSpool();
+  if (system((string("rm -rf ") + TEST_SPOOL + " " + TEST_SHARED + " " + DATAPATH + TEST_DOMAIN).c_str())) {}
+  return (rc);
+}
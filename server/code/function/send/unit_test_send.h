@@ -0,0 +1,22 @@
+/*
+ * unit_test_send.h
+ *
+ * This file provides unit test for send.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "send.h"
+
+const char TEST_SPOOL[]  = "unit_test_send.spool/";
+const char TEST_SHARED[] = "unit_test_send.shared/";
+const char TEST_DOMAIN[] = "local.test";                // Its users are under DATAPATH, made again by every test
+
+#define TEST_MESSAGES 100
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * system.cpp
+ *
+ * This file provides the System function: the metrics of the System Info
+ * Manager as text, for the admin connection and the stats file.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include "system.h"
+
+/************ Helper Functions *************/
+static bool HasPrefix (const std::string &name, const std::string &prefix)
+{
+  return !name.compare(0, prefix.size(), prefix);
+}
+
+static void AddLine (std::string &text, const std::string &name, const std::string &value)
+{
+  text.append(name).append(" ").append(value).append("\n");
+}
+
+static bool WriteAll (int fd, const std::string &text)
+{
+  for (size_t written = 0; written < text.size();) {
+    ssize_t bytes = write(fd, text.data() + written, text.size() - written);
+    if (bytes <= 0)
+      return false;
+    written += bytes;
+  }
+  return true;
+}
+
+void FormatMetrics (const MetricsSnapshot &snapshot, const std::string &prefix, std::string &text)
+{
+  // One sorted list of lines, whatever kind of metric they come from
+  std::map<std::string, std::string> lines;
+  char value[32];
+  for (const auto &counter : snapshot.counters) {
+    if (HasPrefix(counter.first, prefix))
+      lines[counter.first] = std::to_string(counter.second);
+  }
+  for (const auto &counter : snapshot.counters) {
+    const std::string &name = counter.first;
+    if (name.size() < 5 || name.compare(name.size() - 5, 5, ".hits") || !HasPrefix(name, prefix))
+      continue;
+    std::string base = name.substr(0, name.size() - 5);
+    auto misses = snapshot.counters.find(base + ".misses");
+    if (misses == snapshot.counters.end())
+      continue;
+    uint64_t lookups = counter.second + misses->second;
+    snprintf(value, sizeof(value), "%.4f", lookups ? static_cast<double>(counter.second) / lookups : 0.0);
+    lines[base + ".hit_rate"] = value;
+  }
+  for (const auto &gauge : snapshot.gauges) {
+    if (HasPrefix(gauge.first, prefix))
+      lines[gauge.first] = std::to_string(gauge.second);
+  }
+  for (const auto &histogram : snapshot.histograms) {
+    const std::string &name = histogram.first;
+    const HistogramSnapshot &values = histogram.second;
+    if (!HasPrefix(name, prefix))
+      continue;
+    lines[name + ".count"] = std::to_string(values.count);
+    lines[name + ".mean"]  = std::to_string(values.count ? values.sum / values.count : 0);
+    lines[name + ".p50"]   = std::to_string(values.GetPercentile(0.5));
+    lines[name + ".p90"]   = std::to_string(values.GetPercentile(0.9));
+    lines[name + ".p99"]   = std::to_string(values.GetPercentile(0.99));
+    lines[name + ".p999"]  = std::to_string(values.GetPercentile(0.999));
+    lines[name + ".max"]   = std::to_string(values.max);
+  }
+
+  text.clear();
+  for (const auto &line : lines)
+    AddLine(text, line.first, line.second);
+}
+
+RC HandleAdminCommand (const std::string &command, std::string &reply)
+{
+  std::vector<std::string> words;
+  for (size_t start = 0, end; start < command.size(); start = end + 1) {
+    end = std::min(command.find(' ', start), command.size());
+    if (end > start)
+      words.push_back(command.substr(start, end - start));
+  }
+  if (!words.empty()) {
+    for (char &character : words[0])
+      character = toupper(static_cast<unsigned char>(character));
+  }
+  if (words.empty() || words.size() > 2 || words[0] != "STATS") {
+    reply = "-ERR unknown command\r\n";
+    return SYSTEM_BAD_COMMAND;
+  }
+
+  MetricsSnapshot snapshot;
+  std::string text;
+  SystemInfoManager::instance()->GetSnapshot(snapshot);
+  FormatMetrics(snapshot, words.size() > 1 ? words[1] : "", text);
+  reply = "+OK\r\n";
+  for (size_t start = 0, end; start < text.size(); start = end + 1) {
+    end = text.find('\n', start);
+    reply.append(text, start, end - start).append("\r\n");
+  }
+  reply.append(".\r\n");
+  return SUCCESS;
+}
+
+/************ StatsWriter *************/
+StatsWriter::StatsWriter(const std::string &name, int interval)
+  : _name(name),
+    _interval(interval)
+{
+}
+
+StatsWriter::~StatsWriter()
+{
+  Stop();
+}
+
+void StatsWriter::Start ()
+{
+  _thread.Start(_interval, [this] { RunOnce(); });
+}
+
+void StatsWriter::Stop ()
+{
+  _thread.Stop();
+}
+
+RC StatsWriter::RunOnce ()
+{
+  MetricsSnapshot snapshot;
+  std::string text;
+  SystemInfoManager::instance()->GetSnapshot(snapshot);
+  FormatMetrics(snapshot, "", text);
+
+  std::string temporary = _name + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+    return SYSTEM_WRITE_ERROR;
+  bool written = WriteAll(fd, text);
+  close(fd);
+  if (!written || rename(temporary.c_str(), _name.c_str())) {
+    unlink(temporary.c_str());
+    return SYSTEM_WRITE_ERROR;
+  }
+  return SUCCESS;
+}
@@ -0,0 +1,87 @@
+#ifndef SYSTEM_FUNCTION
+#define SYSTEM_FUNCTION
+
+/* ----- Include libries or files ----- */
+#include <chrono>
+#include <string>
+#include "../../util/emailError.h"
+#include "../../util/periodic.h"
+#include "../../util/util.h"
+#include "../../manager/sim/sim.h"
+
+/* ----- Define macros ----- */
+enum {
+  SYSTEM_BAD_COMMAND = 1001,
+  SYSTEM_WRITE_ERROR,
+};
+
+#define STATS_INTERVAL 10                       // Seconds between two writes of the stats file
+const char STATS_FILE_NAME[] = "stats.txt";     // Under DATAPATH unless given otherwise
+
+/* ----- Define structs ----- */
+/**
+ * This function will put the metrics into text, one "name value" line each,
+ * by name. A histogram gives name.count, .mean, .p50, .p90, .p99, .p999 and
+ * .max lines, in its unit; two counters x.hits and x.misses give a line
+ * x.hit_rate as well, the fraction of the lookups that hit.
+ * @param  const MetricsSnapshot given as the metrics.
+ *         const string given as the prefix of the names to keep, empty for all.
+ *         string stores the text.
+ */
+void FormatMetrics (const MetricsSnapshot &snapshot, const std::string &prefix, std::string &text);
+
+/**
+ * This function will answer a command of the admin connection:
+ *   STATS [prefix]   the metrics, of the names starting with prefix if given
+ * The reply is "+OK" and the lines of FormatMetrics(), ending with a line
+ * holding ".", every line ending with a CRLF, as a POP3 multi-line reply.
+ * @param  const string given as the command line, without its CRLF.
+ *         string stores the reply.
+ * @return SUCCESS if answered.
+ *         SYSTEM_BAD_COMMAND otherwise, the reply is a "-ERR" line then.
+ */
+RC HandleAdminCommand (const std::string &command, std::string &reply);
+
+/**
+ * StatsWriter
+ * This class runs a background thread that writes all metrics to the stats
+ * file every few seconds, in the form of FormatMetrics(). The file is written
+ * under a temporary name and put in place with rename(), so a reader never
+ * sees half of it.
+ *
+ * Contained Public Functions:
+ *   void Start ()
+ *   void Stop  ()
+ *   RC   RunOnce ()
+ */
+class StatsWriter
+{
+public:
+  explicit StatsWriter(const std::string &name = std::string(DATAPATH) + STATS_FILE_NAME,
+                       int interval = STATS_INTERVAL);
+  ~StatsWriter();
+
+  /**
+   * This function will start the background thread.
+   */
+  void Start ();
+
+  /**
+   * This function will stop the background thread and wait for it.
+   */
+  void Stop  ();
+
+  /**
+   * This function will write the stats file once, in the calling thread.
+   * @return SUCCESS if the file is in place.
+   *         SYSTEM_WRITE_ERROR otherwise.
+   */
+  RC RunOnce ();
+
+private:
+  std::string _name;
+  std::chrono::seconds _interval;
+  PeriodicThread _thread;
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * unit_test_system.cpp
+ *
+ * This file provides unit test for system.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include "unit_test_system.h"
+using namespace std;
+
+static void FillMetrics ()
+{
+  SystemInfoManager *sim = SystemInfoManager::instance();
+  sim->GetCounter("test.cache.hits")->Add(3);
+  sim->GetCounter("test.cache.misses")->Add(1);
+  sim->GetGauge("test.connections")->Set(7);
+  Histogram *latency = sim->GetHistogram("test.command");
+  for (uint64_t value = 1; value <= 100; ++value)
+    latency->Record(value);
+  sim->GetCounter("other.calls")->Add();
+}
+
+static RC TestFormat ()
+{
+  MetricsSnapshot snapshot;
+  string text;
+  SystemInfoManager::instance()->GetSnapshot(snapshot);
+  FormatMetrics(snapshot, "test.", text);
+  string expected =
+    "test.cache.hit_rate 0.7500\n"
+    "test.cache.hits 3\n"
+    "test.cache.misses 1\n"
+    "test.command.count 100\n"
+    "test.command.max 100\n"
+    "test.command.mean 50\n"
+    "test.command.p50 51\n"   // 50 and 51 share a bucket
+    "test.command.p90 91\n"
+    "test.command.p99 99\n"
+    "test.command.p999 100\n"
+    "test.connections 7\n";
+  return text == expected ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestAdminCommand ()
+{
+  string reply;
+  if (HandleAdminCommand("stats test.cache.h", reply) ||
+      reply != "+OK\r\ntest.cache.hit_rate 0.7500\r\ntest.cache.hits 3\r\n.\r\n")
+    return STANDARD_ERROR;
+  if (HandleAdminCommand("STATS", reply) || reply.find("other.calls 1\r\n") == string::npos)
+    return STANDARD_ERROR;
+  if (HandleAdminCommand("RESET", reply) != SYSTEM_BAD_COMMAND || reply.compare(0, 4, "-ERR") ||
+      HandleAdminCommand("STATS a b", reply) != SYSTEM_BAD_COMMAND || HandleAdminCommand("", reply) != SYSTEM_BAD_COMMAND)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// The file is there from the first run on, and follows the metrics
+static RC TestStatsFile ()
+{
+  unlink(TEST_STATS);
+  StatsWriter writer(TEST_STATS, 1);
+  writer.Start();
+  this_thread::sleep_for(chrono::milliseconds(100));
+  SystemInfoManager::instance()->GetCounter("other.calls")->Add();
+  this_thread::sleep_for(chrono::milliseconds(1200));
+  writer.Stop();
+
+  ifstream file(TEST_STATS);
+  stringstream text;
+  text << file.rdbuf();
+  unlink(TEST_STATS);
+  return text.str().find("other.calls 2\n") != string::npos &&
+         text.str().find("\ntest.cache.hit_rate 0.7500\n") != string::npos &&
+         access((string(TEST_STATS) + ".tmp").c_str(), F_OK) ? SUCCESS : STANDARD_ERROR;
+}
+
+int main ()
+{
+  RC rc = SUCCESS, result;
+  FillMetrics();
+
+  result = TestFormat();
+  cout << "TestFormat: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestAdminCommand();
+  cout << "TestAdminCommand: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestStatsFile();
+  cout << "TestStatsFile: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  return (rc);
+}
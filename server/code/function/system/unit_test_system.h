@@ -0,0 +1,18 @@
+/*
+ * unit_test_system.h
+ *
+ * This file provides unit test for system.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "system.h"
+
+const char TEST_STATS[] = "unit_test_system.stats";
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * edc.cpp
+ *
+ * This file provides the Email Data Cache: messages kept in memory in front
+ * of the Email Data Manager.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <functional>
+#include "edc.h"
+
+/************ Helper Functions *************/
+static uint64_t Mix (uint64_t value)
+{
+  value += 0x9E3779B97F4A7C15ull;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+  return value ^ (value >> 31);
+}
+
+// Same form as the paths the mailboxes keep
+static std::string MailboxPath (const std::string &path)
+{
+  if (!path.empty() && path.back() == '/')
+    return path;
+  return path + '/';
+}
+
+size_t CacheKeyHash::operator() (const CacheKey &key) const
+{
+  return Mix(std::hash<std::string>()(key.mailbox) ^ Mix(key.key * 4 + key.part));
+}
+
+/************ FrequencySketch *************/
+static const uint64_t SKETCH_SEEDS[4] = {
+  0xC3A5C85C97CB3127ull, 0xB492B66FBE98F273ull, 0x9AE16A3B2F90404Full, 0xCBF29CE484222325ull,
+};
+
+FrequencySketch::FrequencySketch(size_t width)
+  : _width(1),
+    _additions(0)
+{
+  while (_width < width)
+    _width <<= 1;
+  _counters.assign(4 * _width, 0);
+  _sampleSize = 10 * _width;
+}
+
+void FrequencySketch::Increment (uint64_t hash)
+{
+  for (int row = 0; row < 4; ++row) {
+    uint8_t &counter = _counters[Slot(hash, row)];
+    if (counter < CACHE_MAX_FREQUENCY)
+      ++counter;
+  }
+
+  // Halving keeps the ratios and lets new popularity catch up with the old
+  if (++_additions >= _sampleSize) {
+    for (uint8_t &counter : _counters)
+      counter >>= 1;
+    _additions /= 2;
+  }
+}
+
+uint32_t FrequencySketch::Estimate (uint64_t hash) const
+{
+  uint32_t estimate = CACHE_MAX_FREQUENCY;
+  for (int row = 0; row < 4; ++row)
+    estimate = std::min<uint32_t>(estimate, _counters[Slot(hash, row)]);
+  return estimate;
+}
+
+size_t FrequencySketch::Slot (uint64_t hash, int row) const
+{
+  return row * _width + (Mix(hash ^ SKETCH_SEEDS[row]) & (_width - 1));
+}
+
+/************ MessageCache *************/
+MessageCache::MessageCache(size_t capacity)
+{
+  for (Shard &shard : _shards) {
+    shard.bytes[CACHE_WINDOW] = shard.bytes[CACHE_PROBATION] = shard.bytes[CACHE_PROTECTED] = 0;
+    shard.stats = {};
+  }
+  SetCapacity(capacity);
+}
+
+bool MessageCache::Get (const CacheKey &key, std::shared_ptr<const std::string> &value)
+{
+  uint64_t hash = CacheKeyHash()(key);
+  Shard &shard = GetShard(hash);
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  shard.sketch->Increment(hash);
+  auto found = shard.entries.find(key);
+  if (found == shard.entries.end()) {
+    ++shard.stats.misses;
+    GetMetrics<CacheMetrics>().misses.Add();
+    return false;
+  }
+  ++shard.stats.hits;
+  GetMetrics<CacheMetrics>().hits.Add();
+
+  // Used again: out of probation into protected
+  std::list<Entry>::iterator entry = found->second;
+  value = entry->value;
+  MoveTo(shard, entry, entry->region == CACHE_WINDOW ? CACHE_WINDOW : CACHE_PROTECTED);
+  Balance(shard);
+  return true;
+}
+
+void MessageCache::Put (const CacheKey &key, std::shared_ptr<const std::string> value)
+{
+  uint64_t hash = CacheKeyHash()(key);
+  Shard &shard = GetShard(hash);
+  size_t charge = value->size() + CACHE_ENTRY_OVERHEAD;
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  shard.sketch->Increment(hash);
+  auto found = shard.entries.find(key);
+  if (found != shard.entries.end())
+    Remove(shard, found->second, false);
+  if (charge > shard.capacity)
+    return;
+
+  shard.lists[CACHE_WINDOW].push_front(Entry{key, hash, std::move(value), charge, CACHE_WINDOW});
+  shard.bytes[CACHE_WINDOW] += charge;
+  shard.entries[key] = shard.lists[CACHE_WINDOW].begin();
+  ++shard.stats.insertions;
+  Balance(shard);
+}
+
+void MessageCache::Erase (const CacheKey &key)
+{
+  uint64_t hash = CacheKeyHash()(key);
+  Shard &shard = GetShard(hash);
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  auto found = shard.entries.find(key);
+  if (found != shard.entries.end())
+    Remove(shard, found->second, false);
+}
+
+void MessageCache::Clear ()
+{
+  for (Shard &shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    for (int region = CACHE_WINDOW; region <= CACHE_PROTECTED; ++region) {
+      shard.lists[region].clear();
+      shard.bytes[region] = 0;
+    }
+    shard.entries.clear();
+  }
+}
+
+void MessageCache::SetCapacity (size_t bytes)
+{
+  for (Shard &shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    shard.capacity = bytes / CACHE_SHARDS;
+    size_t width = std::max<size_t>(shard.capacity / CACHE_AVERAGE_SIZE, CACHE_SKETCH_MIN_WIDTH);
+    shard.sketch.reset(new FrequencySketch(width));
+    Balance(shard);
+  }
+}
+
+void MessageCache::GetStats (CacheStats &stats)
+{
+  stats = {};
+  for (Shard &shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    stats.hits       += shard.stats.hits;
+    stats.misses     += shard.stats.misses;
+    stats.insertions += shard.stats.insertions;
+    stats.evictions  += shard.stats.evictions;
+    stats.rejections += shard.stats.rejections;
+    stats.bytes      += shard.bytes[CACHE_WINDOW] + shard.bytes[CACHE_PROBATION] + shard.bytes[CACHE_PROTECTED];
+    stats.entries    += shard.entries.size();
+  }
+}
+
+// Private helper functions
+void MessageCache::MoveTo (Shard &shard, std::list<Entry>::iterator entry, Region region)
+{
+  shard.bytes[entry->region] -= entry->charge;
+  shard.bytes[region]        += entry->charge;
+  shard.lists[region].splice(shard.lists[region].begin(), shard.lists[entry->region], entry);
+  entry->region = region;
+}
+
+void MessageCache::Remove (Shard &shard, std::list<Entry>::iterator entry, bool evicted)
+{
+  if (evicted)
+    ++shard.stats.evictions;
+  shard.bytes[entry->region] -= entry->charge;
+  shard.entries.erase(entry->key);
+  shard.lists[entry->region].erase(entry);
+}
+
+void MessageCache::Balance (Shard &shard)
+{
+  size_t window    = shard.capacity * CACHE_WINDOW_RATIO;
+  size_t main      = shard.capacity - window;
+  size_t protect   = main * CACHE_PROTECTED_RATIO;
+  std::list<Entry> *lists = shard.lists;
+
+  // Protected entries not used for the longest get one more chance in probation
+  while (shard.bytes[CACHE_PROTECTED] > protect)
+    MoveTo(shard, std::prev(lists[CACHE_PROTECTED].end()), CACHE_PROBATION);
+
+  // What the window lets go competes with the next victim of the main part
+  while (shard.bytes[CACHE_WINDOW] > window) {
+    std::list<Entry>::iterator candidate = std::prev(lists[CACHE_WINDOW].end());
+    MoveTo(shard, candidate, CACHE_PROBATION);
+    while (shard.bytes[CACHE_PROBATION] + shard.bytes[CACHE_PROTECTED] > main) {
+      std::list<Entry>::iterator victim = std::prev(lists[CACHE_PROBATION].end());
+      if (victim == candidate) {
+        if (lists[CACHE_PROTECTED].empty()) {
+          Remove(shard, candidate, true);
+          break;
+        }
+        victim = std::prev(lists[CACHE_PROTECTED].end());
+      }
+      if (shard.sketch->Estimate(candidate->hash) > shard.sketch->Estimate(victim->hash)) {
+        Remove(shard, victim, true);
+      } else {
+        ++shard.stats.rejections;
+        Remove(shard, candidate, false);
+        break;
+      }
+    }
+  }
+
+  // After the capacity shrank
+  while (shard.bytes[CACHE_PROBATION] + shard.bytes[CACHE_PROTECTED] > main) {
+    Region region = lists[CACHE_PROBATION].empty() ? CACHE_PROTECTED : CACHE_PROBATION;
+    Remove(shard, std::prev(lists[region].end()), true);
+  }
+}
+
+/************ EmailDataCache *************/
+EmailDataCache* EmailDataCache::instance ()
+{
+  static EmailDataCache *edc = new EmailDataCache();
+  return edc;
+}
+
+RC EmailDataCache::Deliver (std::string_view message, const std::vector<std::string> &paths,
+                            std::vector<uint64_t> &keys)
+{
+  RC rc = EmailDataManager::instance()->Deliver(message, paths, keys);
+  if (rc)
+    return rc;
+
+  // A message for several mailboxes would be charged in full for each of
+  // them, however few read it soon: it is left to the first read
+  if (paths.size() != 1)
+    return SUCCESS;
+  _cache.Put(CacheKey{MailboxPath(paths[0]), keys[0], CACHE_MESSAGE},
+             std::shared_ptr<const std::string>(new std::string(message)));
+  return SUCCESS;
+}
+
+RC EmailDataCache::Deliver (const std::vector<std::string_view> &messages, const std::string &path,
+                            std::vector<uint64_t> &keys)
+{
+  RC rc = EmailDataManager::instance()->Deliver(messages, path, keys);
+  if (rc)
+    return rc;
+  for (size_t i = 0; i < messages.size(); ++i)
+    _cache.Put(CacheKey{MailboxPath(path), keys[i], CACHE_MESSAGE},
+               std::shared_ptr<const std::string>(new std::string(messages[i])));
+  return SUCCESS;
+}
+
+RC EmailDataCache::Read (const std::shared_ptr<Mailbox> &mailbox, uint64_t key,
+                         std::shared_ptr<const std::string> &message)
+{
+  Index index;
+  RC rc = mailbox->Lookup(key, index);
+  if (rc)
+    return rc;
+
+  CacheKey cacheKey{mailbox->GetPath(), key, CACHE_MESSAGE};
+  if (_cache.Get(cacheKey, message))
+    return SUCCESS;
+
+  std::string read;
+  if ((rc = mailbox->Read(key, read)))
+    return rc;
+  message.reset(new std::string(std::move(read)));
+  _cache.Put(cacheKey, message);
+  return SUCCESS;
+}
+
+RC EmailDataCache::ReadHeader (const std::shared_ptr<Mailbox> &mailbox, uint64_t key,
+                               std::shared_ptr<const std::string> &header)
+{
+  Index index;
+  RC rc = mailbox->Lookup(key, index);
+  if (rc)
+    return rc;
+
+  CacheKey cacheKey{mailbox->GetPath(), key, CACHE_HEADER};
+  if (_cache.Get(cacheKey, header))
+    return SUCCESS;
+
+  std::shared_ptr<const std::string> message;
+  if ((rc = Read(mailbox, key, message)))
+    return rc;
+  size_t end = message->find("\r\n\r\n");
+  header.reset(new std::string(end == std::string::npos ? *message : message->substr(0, end + 4)));
+  _cache.Put(cacheKey, header);
+  return SUCCESS;
+}
+
+RC EmailDataCache::Delete (const std::shared_ptr<Mailbox> &mailbox, uint64_t key)
+{
+  RC rc = mailbox->Delete(key);
+  _cache.Erase(CacheKey{mailbox->GetPath(), key, CACHE_MESSAGE});
+  _cache.Erase(CacheKey{mailbox->GetPath(), key, CACHE_HEADER});
+  return rc;
+}
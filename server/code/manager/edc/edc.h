@@ -0,0 +1,291 @@
+#ifndef EMAIL_DATA_CACHE
+#define EMAIL_DATA_CACHE
+
+/* ----- Include libries or files ----- */
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/metrics.h"
+#include "../../util/util.h"
+#include "../edm/edm.h"
+
+/* ----- Define macros ----- */
+#define CACHE_CAPACITY      (256 * 1024 * 1024)  // Bytes the cache may take by default
+#define CACHE_SHARDS        16                   // Independent parts, each with a lock of its own
+#define CACHE_WINDOW_RATIO  0.1                  // Part of a shard new entries start in
+#define CACHE_PROTECTED_RATIO 0.8                // Part of the rest kept for entries used again
+#define CACHE_ENTRY_OVERHEAD 128                 // Bytes charged for an entry besides its value
+#define CACHE_AVERAGE_SIZE  (4 * 1024)           // Entry size the frequency sketch is sized for
+#define CACHE_MAX_FREQUENCY 15                   // Counters of the sketch stop here
+#define CACHE_SKETCH_MIN_WIDTH 1024              // Counters in a row of the sketch at least
+
+/* ----- Define structs ----- */
+enum CachePart {
+  CACHE_MESSAGE = 0,      // The whole message
+  CACHE_HEADER,           // The header only, up to the empty line
+};
+
+struct CacheKey {
+  std::string mailbox;    // Path of the mailbox
+  uint64_t    key;        // Key of the message in the mailbox
+  uint32_t    part;       // CachePart
+
+  bool operator== (const CacheKey &other) const
+  {
+    return key == other.key && part == other.part && mailbox == other.mailbox;
+  }
+};
+
+struct CacheKeyHash {
+  size_t operator() (const CacheKey &key) const;
+};
+
+struct CacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t insertions;    // Entries put into the cache
+  uint64_t evictions;     // Entries dropped to stay within the budget
+  uint64_t rejections;    // New entries the admission policy did not let in
+  uint64_t bytes;         // Charged now, values and overhead
+  uint64_t entries;
+};
+
+// Reported by the System Info Manager as edc.cache.*, of every cache together
+struct CacheMetrics {
+  Counter hits;
+  Counter misses;
+};
+
+/**
+ * FrequencySketch
+ * This class estimates how often a key has been asked for lately: a
+ * count-min sketch of four rows of small counters. All counters are halved
+ * once enough keys have been counted, so old popularity fades.
+ *
+ * Contained Public Functions:
+ *   void     Increment (uint64_t hash)
+ *   uint32_t Estimate  (uint64_t hash)
+ */
+class FrequencySketch
+{
+public:
+  explicit FrequencySketch(size_t width);
+
+  /**
+   * This function will count one more request of a key.
+   * @param uint64_t given as the hash of the key.
+   */
+  void Increment (uint64_t hash);
+
+  /**
+   * This function will estimate the requests of a key.
+   * @param  uint64_t given as the hash of the key.
+   * @return uint32_t as the estimate, at most CACHE_MAX_FREQUENCY.
+   */
+  uint32_t Estimate (uint64_t hash) const;
+
+private:
+  std::vector<uint8_t> _counters;   // Four rows of _width counters
+  size_t _width;                    // A power of two
+  size_t _additions;                // Since the last halving
+  size_t _sampleSize;               // Additions between two halvings
+
+  size_t Slot (uint64_t hash, int row) const;
+};
+
+/**
+ * MessageCache
+ * This class keeps values in memory within a budget of bytes. The keys are
+ * spread over CACHE_SHARDS shards, each with its own lock and an equal part
+ * of the budget, so threads asking for different messages rarely wait for
+ * each other.
+ *
+ * Every shard follows W-TinyLFU: a new entry goes into a small LRU window;
+ * what falls out of the window only enters the main part if the frequency
+ * sketch says it is asked for more often than the entry it would push out.
+ * The main part is a segmented LRU: entries start in probation and move to
+ * protected when used again. A scan reading every message once therefore
+ * passes through the window without pushing out the messages read often.
+ *
+ * Values are handed out as shared_ptr, a reader keeps its value even if the
+ * entry is evicted meanwhile.
+ *
+ * Contained Public Functions:
+ *   bool Get   (const CacheKey &key, std::shared_ptr<const std::string> &value)
+ *   void Put   (const CacheKey &key, std::shared_ptr<const std::string> value)
+ *   void Erase (const CacheKey &key)
+ *   void Clear ()
+ *   void SetCapacity (size_t bytes)
+ *   void GetStats (CacheStats &stats)
+ */
+class MessageCache
+{
+public:
+  explicit MessageCache(size_t capacity = CACHE_CAPACITY);
+
+  MessageCache(const MessageCache &) = delete;
+  MessageCache &operator=(const MessageCache &) = delete;
+
+  /**
+   * This function will look a value up.
+   * @param  const CacheKey given as the key.
+   *         shared_ptr stores the value if found.
+   * @return true if the value is in the cache.
+   */
+  bool Get (const CacheKey &key, std::shared_ptr<const std::string> &value);
+
+  /**
+   * This function will put a value into the cache, replacing the one there.
+   * A value larger than a shard is not kept.
+   * @param const CacheKey given as the key.
+   *        shared_ptr given as the value.
+   */
+  void Put (const CacheKey &key, std::shared_ptr<const std::string> value);
+
+  /**
+   * This function will drop a value from the cache, if it is there.
+   * @param const CacheKey given as the key.
+   */
+  void Erase (const CacheKey &key);
+
+  /**
+   * This function will drop every value. The counters stay.
+   */
+  void Clear ();
+
+  /**
+   * This function will change the budget, evicting what no longer fits.
+   * @param size_t given as the number of bytes.
+   */
+  void SetCapacity (size_t bytes);
+
+  /**
+   * This function will add up the counters of all shards.
+   * @param CacheStats stores the counters.
+   */
+  void GetStats (CacheStats &stats);
+
+private:
+  enum Region { CACHE_WINDOW, CACHE_PROBATION, CACHE_PROTECTED };
+
+  struct Entry {
+    CacheKey key;
+    uint64_t hash;
+    std::shared_ptr<const std::string> value;
+    size_t   charge;      // Value and overhead
+    Region   region;
+  };
+
+  struct Shard {
+    std::mutex lock;      // Guards the members below
+    std::list<Entry> lists[3];                  // By Region, most recently used first
+    size_t bytes[3];                            // Charged to each Region
+    size_t capacity;
+    std::unordered_map<CacheKey, std::list<Entry>::iterator, CacheKeyHash> entries;
+    std::unique_ptr<FrequencySketch> sketch;
+    CacheStats stats;
+  };
+
+  Shard _shards[CACHE_SHARDS];
+
+  // Private helper functions
+  Shard &GetShard (uint64_t hash) { return _shards[(hash >> 32) % CACHE_SHARDS]; }
+
+  /**
+   * This function will move an entry to the front of a Region.
+   */
+  void MoveTo (Shard &shard, std::list<Entry>::iterator entry, Region region);
+
+  /**
+   * This function will drop an entry.
+   */
+  void Remove (Shard &shard, std::list<Entry>::iterator entry, bool evicted);
+
+  /**
+   * This function will bring a shard back within its capacity: the window
+   * hands its oldest entries to the main part, which lets them in or not.
+   */
+  void Balance (Shard &shard);
+};
+
+/**
+ * EmailDataCache
+ * This class puts a MessageCache in front of the EmailDataManager. A message
+ * delivered to one mailbox goes into the cache as it is stored, so the first
+ * RETR of new mail needs no disk read, and every read fills it. The message is always
+ * looked up in the mailbox first, so a message deleted without the cache
+ * knowing is never served.
+ *
+ * Contained Public Functions:
+ *   EmailDataCache* instance ()
+ *   RC Deliver    (std::string_view message, const std::vector<std::string> &paths, std::vector<uint64_t> &keys)
+ *   RC Deliver    (const std::vector<std::string_view> &messages, const std::string &path, std::vector<uint64_t> &keys)
+ *   RC Read       (const std::shared_ptr<Mailbox> &mailbox, uint64_t key, std::shared_ptr<const std::string> &message)
+ *   RC ReadHeader (const std::shared_ptr<Mailbox> &mailbox, uint64_t key, std::shared_ptr<const std::string> &header)
+ *   RC Delete     (const std::shared_ptr<Mailbox> &mailbox, uint64_t key)
+ *   MessageCache &GetCache ()
+ */
+class EmailDataCache
+{
+public:
+  /**
+   * This function will initialize an instance for EmailDataCache.
+   * @return pointer of EmailDataCache.
+   */
+  static EmailDataCache* instance();
+
+  /**
+   * This function will store a message with EmailDataManager::Deliver() and
+   * keep it in the cache if it is for one mailbox. A message for several
+   * is not kept: the cache would charge its whole size once for each.
+   * @return same as EmailDataManager::Deliver().
+   */
+  RC Deliver (std::string_view message, const std::vector<std::string> &paths, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will store several messages for one mailbox with one
+   * update of its directory file and keep them in the cache.
+   * @return same as EmailDataManager::Deliver() of several messages.
+   */
+  RC Deliver (const std::vector<std::string_view> &messages, const std::string &path, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will give a whole message, from the cache if it is there.
+   * @param  shared_ptr given as the mailbox.
+   *         uint64_t given as the key.
+   *         shared_ptr stores the message.
+   * @return same as Mailbox::Read().
+   */
+  RC Read (const std::shared_ptr<Mailbox> &mailbox, uint64_t key, std::shared_ptr<const std::string> &message);
+
+  /**
+   * This function will give the header of a message, up to and with the
+   * empty line, or the whole message if it has none.
+   * @return same as Read().
+   */
+  RC ReadHeader (const std::shared_ptr<Mailbox> &mailbox, uint64_t key, std::shared_ptr<const std::string> &header);
+
+  /**
+   * This function will delete a message from the mailbox and the cache.
+   * @return same as Mailbox::Delete().
+   */
+  RC Delete (const std::shared_ptr<Mailbox> &mailbox, uint64_t key);
+
+  MessageCache &GetCache () { return _cache; }
+
+protected:
+  EmailDataCache() {};      // Constructor
+  ~EmailDataCache() {};     // Destructor
+
+private:
+  MessageCache _cache;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * prefetcher.cpp
+ *
+ * This file provides the background prefetch of a mailbox after its user
+ * logged in.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <fcntl.h>
+#include "prefetcher.h"
+
+/************ Prefetcher *************/
+Prefetcher::Prefetcher(size_t messages)
+  : _messages(messages),
+    _uim(NULL),
+    _stats()
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+  if (_uim)
+    _uim->SetLoginCallback(NULL);
+  Stop();
+}
+
+void Prefetcher::Start ()
+{
+  // Woken by every request, otherwise only to close the mailboxes held
+  _thread.Start(std::chrono::seconds(PREFETCH_HOLD_TIME), [this] { RunOnce(); });
+}
+
+void Prefetcher::Stop ()
+{
+  _thread.Stop();
+  std::lock_guard<std::mutex> lock(_lock);
+  _held.clear();
+}
+
+void Prefetcher::Attach (UserInfoManager &uim)
+{
+  _uim = &uim;
+  _uim->SetLoginCallback([this] (const UserInfo &userInfo) { Request(UserInfoManager::GetMailboxPath(userInfo)); });
+}
+
+void Prefetcher::Request (const std::string &path)
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (_queued.count(path))
+      return;
+    if (_queue.size() >= PREFETCH_QUEUE_SIZE) {
+      ++_stats.dropped;
+      return;
+    }
+    _queue.push_back(path);
+    _queued.insert(path);
+    ++_stats.requests;
+  }
+  _thread.Wake();
+}
+
+RC Prefetcher::RunOnce ()
+{
+  RC result = SUCCESS;
+  std::unique_lock<std::mutex> lock(_lock);
+  Release();
+  while (!_queue.empty() && !_thread.IsStopping()) {
+    std::string path = _queue.front();
+    _queue.pop_front();
+    _queued.erase(path);
+
+    lock.unlock();
+    RC rc = Prefetch(path);
+    lock.lock();
+    if (rc && result == SUCCESS)
+      result = rc;
+  }
+  return result;
+}
+
+void Prefetcher::GetStats (PrefetchStats &stats)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  stats = _stats;
+}
+
+// Private helper functions
+RC Prefetcher::Prefetch (const std::string &path)
+{
+  // Opening maps the summary, the first message read loads the directory file
+  std::shared_ptr<Mailbox> mailbox;
+  RC rc = EmailDataManager::instance()->OpenMailbox(path, mailbox);
+  if (rc)
+    return rc;
+
+  // Clients read the newest messages first
+  std::vector<SummaryEntry> entries;
+  mailbox->ListSummary(entries);
+  size_t first = entries.size() > _messages ? entries.size() - _messages : 0;
+  uint64_t filled = 0, advised = 0;
+  for (size_t i = entries.size(); i-- > first;) {
+    std::shared_ptr<Segment> segment;
+    off_t offset;
+    size_t length;
+    RC located = mailbox->Locate(entries[i].key, segment, offset, length);
+    if (located == SUCCESS) {
+      posix_fadvise(segment->GetFd(), offset, length, POSIX_FADV_WILLNEED);
+      ++advised;
+      continue;
+    }
+    // Only what the maildrop reads through the cache is worth a copy there
+    std::shared_ptr<const std::string> message;
+    if (located == EDM_COMPRESSED && entries[i].length <= PREFETCH_FILL_SIZE &&
+        EmailDataCache::instance()->Read(mailbox, entries[i].key, message) == SUCCESS)
+      ++filled;
+  }
+
+  std::lock_guard<std::mutex> lock(_lock);
+  ++_stats.mailboxes;
+  _stats.filled  += filled;
+  _stats.advised += advised;
+  _held.emplace_back(Clock::now(), std::move(mailbox));
+  if (_held.size() > PREFETCH_HOLD_MAX)
+    _held.pop_front();
+  return SUCCESS;
+}
+
+void Prefetcher::Release ()
+{
+  Clock::time_point expired = Clock::now() - std::chrono::seconds(PREFETCH_HOLD_TIME);
+  while (!_held.empty() && _held.front().first <= expired)
+    _held.pop_front();
+}
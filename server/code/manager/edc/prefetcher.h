@@ -0,0 +1,121 @@
+#ifndef EDC_PREFETCHER
+#define EDC_PREFETCHER
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <set>
+#include "../../util/periodic.h"
+#include "../uim/uim.h"
+#include "edc.h"
+
+/* ----- Define macros ----- */
+#define PREFETCH_MESSAGES   16                  // Newest messages of a mailbox made warm
+#define PREFETCH_FILL_SIZE  (256 * 1024)        // Larger compressed messages are left to the first read
+#define PREFETCH_QUEUE_SIZE 1024                // Requests waiting at most, more are dropped
+#define PREFETCH_HOLD_TIME  30                  // Seconds a prefetched mailbox is kept open
+#define PREFETCH_HOLD_MAX   256                 // Mailboxes kept open at most
+
+struct PrefetchStats {
+  uint64_t requests;      // Taken by Request()
+  uint64_t dropped;       // Not taken, the queue was full
+  uint64_t mailboxes;     // Opened and made warm
+  uint64_t filled;        // Compressed messages read into the EmailDataCache
+  uint64_t advised;       // Messages the kernel was asked to read ahead
+};
+
+/**
+ * Prefetcher
+ * This class makes a mailbox warm right after its user logged in, before
+ * the POP3 client asks for anything: a background thread opens the mailbox,
+ * mapping its summary (STAT, LIST and UIDL), and locates its
+ * PREFETCH_MESSAGES newest messages, which loads its directory file. A
+ * message POP3 sends with sendfile() stays in its segment, the kernel is
+ * told to read its pages ahead with posix_fadvise(POSIX_FADV_WILLNEED). A
+ * compressed one is read through the EmailDataCache, so it is decompressed
+ * into the cache if it is no longer than PREFETCH_FILL_SIZE.
+ *
+ * A prefetched mailbox is kept open for PREFETCH_HOLD_TIME seconds, so the
+ * session opening it finds it loaded. Request() never blocks; Attach() has
+ * every successful UserInfoManager::Login() call it.
+ *
+ * Contained Public Functions:
+ *   void Start   ()
+ *   void Stop    ()
+ *   void Attach  (UserInfoManager &uim)
+ *   void Request (const std::string &path)
+ *   RC   RunOnce ()
+ *   void GetStats (PrefetchStats &stats)
+ */
+class Prefetcher
+{
+public:
+  explicit Prefetcher(size_t messages = PREFETCH_MESSAGES);
+  ~Prefetcher();
+
+  /**
+   * This function will start the background thread.
+   */
+  void Start ();
+
+  /**
+   * This function will stop the background thread and wait for it.
+   */
+  void Stop  ();
+
+  /**
+   * This function will ask for the mailbox of every user logged in by the
+   * UIM to be made warm, until the Prefetcher is destroyed.
+   * @param UserInfoManager given as the UIM.
+   */
+  void Attach (UserInfoManager &uim);
+
+  /**
+   * This function will ask for a mailbox to be made warm.
+   * @param const string given as the directory of the mailbox.
+   */
+  void Request (const std::string &path);
+
+  /**
+   * This function will make every requested mailbox warm, in the calling
+   * thread.
+   * @return SUCCESS if all of them have been opened.
+   *         pre-defined error number of the first mailbox that failed.
+   */
+  RC RunOnce ();
+
+  /**
+   * This function will give the counters.
+   * @param PrefetchStats stores the counters.
+   */
+  void GetStats (PrefetchStats &stats);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  size_t _messages;
+  UserInfoManager *_uim;              // Calling Request() at every login, NULL if none
+  PeriodicThread _thread;
+  std::mutex _lock;                   // Guards the members below
+  std::deque<std::string> _queue;     // Mailboxes requested, oldest first
+  std::set<std::string> _queued;      // The same, to take a mailbox only once
+  std::deque<std::pair<Clock::time_point, std::shared_ptr<Mailbox>>> _held; // Kept open, oldest first
+  PrefetchStats _stats;
+
+  // Private helper functions
+  /**
+   * This function will make one mailbox warm.
+   * @return same as EmailDataManager::OpenMailbox().
+   */
+  RC Prefetch (const std::string &path);
+
+  /**
+   * This function will close the mailboxes held for long enough, with the
+   * lock held.
+   */
+  void Release ();
+};
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * unit_test_edc.cpp
+ *
+ * This file provides unit test for edc.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+#include <thread>
+#include "unit_test_edc.h"
+using namespace std;
+
+static void RemoveMailbox ()
+{
+  if (system((string("rm -rf ") + TEST_MAILBOX + " " + TEST_OTHER + " " + TEST_SHARED).c_str())) {}
+}
+
+static shared_ptr<const string> Value (uint64_t key)
+{
+  return shared_ptr<const string>(new string(TEST_VALUE_SIZE, 'a' + key % 26));
+}
+
+static CacheKey Key (uint64_t key)
+{
+  return CacheKey{"mailbox/", key, CACHE_MESSAGE};
+}
+
+static RC TestGetPut ()
+{
+  MessageCache cache(TEST_CAPACITY);
+  shared_ptr<const string> value;
+  if (cache.Get(Key(1), value))
+    return STANDARD_ERROR;
+
+  cache.Put(Key(1), Value(1));
+  if (!cache.Get(Key(1), value) || *value != *Value(1) ||
+      cache.Get(CacheKey{"mailbox/", 1, CACHE_HEADER}, value) || cache.Get(CacheKey{"other/", 1, CACHE_MESSAGE}, value))
+    return STANDARD_ERROR;
+
+  // A reader keeps its value after the entry is gone
+  cache.Erase(Key(1));
+  CacheStats stats;
+  cache.GetStats(stats);
+  if (cache.Get(Key(1), value) || *value != *Value(1) || stats.hits != 1 || stats.misses != 3 ||
+      stats.insertions != 1 || stats.entries != 0 || stats.bytes != 0)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// However much is put in, the cache stays within its budget
+static RC TestBudget ()
+{
+  MessageCache cache(TEST_CAPACITY);
+  for (uint64_t key = 0; key < 4096; ++key)
+    cache.Put(Key(key), Value(key));
+
+  CacheStats stats;
+  cache.GetStats(stats);
+  if (stats.bytes > TEST_CAPACITY || stats.entries < TEST_CAPACITY / (TEST_VALUE_SIZE + CACHE_ENTRY_OVERHEAD) / 2 ||
+      stats.evictions + stats.rejections + stats.entries != 4096)
+    return STANDARD_ERROR;
+
+  // Too large for a shard, never kept
+  cache.Put(Key(0), shared_ptr<const string>(new string(TEST_CAPACITY, 'x')));
+  shared_ptr<const string> value;
+  if (cache.Get(Key(0), value))
+    return STANDARD_ERROR;
+
+  cache.SetCapacity(TEST_CAPACITY / 4);
+  cache.GetStats(stats);
+  return stats.bytes <= TEST_CAPACITY / 4 ? SUCCESS : STANDARD_ERROR;
+}
+
+// Messages read often survive a scan reading many others once
+static RC TestScanResistance ()
+{
+  MessageCache cache(TEST_CAPACITY);
+  shared_ptr<const string> value;
+  const uint64_t hot = 256;
+  for (int round = 0; round < 4; ++round) {
+    for (uint64_t key = 0; key < hot; ++key) {
+      if (!cache.Get(Key(key), value))
+        cache.Put(Key(key), Value(key));
+    }
+  }
+  for (uint64_t key = 100000; key < 110000; ++key) {
+    if (!cache.Get(Key(key), value))
+      cache.Put(Key(key), Value(key));
+  }
+
+  uint64_t hits = 0;
+  for (uint64_t key = 0; key < hot; ++key)
+    hits += cache.Get(Key(key), value);
+  CacheStats stats;
+  cache.GetStats(stats);
+  return hits >= hot * 3 / 4 && stats.rejections > 0 ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestConcurrent ()
+{
+  MessageCache cache(TEST_CAPACITY);
+  vector<thread> threads;
+  vector<RC> results(TEST_THREADS, SUCCESS);
+  for (int i = 0; i < TEST_THREADS; ++i) {
+    threads.emplace_back([&cache, &results, i] {
+      shared_ptr<const string> value;
+      for (uint64_t n = 0; n < 20000; ++n) {
+        uint64_t key = (n * 7 + i) % 512;
+        if (cache.Get(Key(key), value)) {
+          if (*value != *Value(key))
+            results[i] = STANDARD_ERROR;
+        } else {
+          cache.Put(Key(key), Value(key));
+        }
+        if (n % 1000 == 0)
+          cache.Erase(Key(key));
+      }
+    });
+  }
+  for (thread &worker : threads)
+    worker.join();
+
+  CacheStats stats;
+  cache.GetStats(stats);
+  for (RC result : results) {
+    if (result)
+      return result;
+  }
+  return stats.bytes <= TEST_CAPACITY && stats.hits + stats.misses == TEST_THREADS * 20000 ? SUCCESS : STANDARD_ERROR;
+}
+
+// Delivered mail is read from memory, deleted mail is never served
+static RC TestEmailDataCache ()
+{
+  RemoveMailbox();
+  EmailDataCache *edc = EmailDataCache::instance();
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys;
+  string message = "Subject: cached\r\n\r\nbody\r\n";
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) ||
+      edc->Deliver(message, {TEST_MAILBOX}, keys))
+    return STANDARD_ERROR;
+
+  CacheStats before, after;
+  shared_ptr<const string> read, header;
+  edc->GetCache().GetStats(before);
+  if (edc->Read(mailbox, keys[0], read) || *read != message ||
+      edc->ReadHeader(mailbox, keys[0], header) || *header != "Subject: cached\r\n\r\n")
+    return STANDARD_ERROR;
+  edc->GetCache().GetStats(after);
+  if (after.hits != before.hits + 2)
+    return STANDARD_ERROR;
+
+  // A message not in the cache is read from the mailbox and kept
+  uint64_t key;
+  if (mailbox->Append("Subject: stored\r\n\r\n", key) || edc->Read(mailbox, key, read) ||
+      *read != "Subject: stored\r\n\r\n" || edc->Read(mailbox, key, read))
+    return STANDARD_ERROR;
+
+  if (edc->Delete(mailbox, keys[0]) || edc->Read(mailbox, keys[0], read) != EDM_NO_SUCH_MESSAGE ||
+      mailbox->Delete(key) || edc->Read(mailbox, key, read) != EDM_NO_SUCH_MESSAGE)
+    return STANDARD_ERROR;
+
+  // A message for several mailboxes is stored once and not charged for each
+  edc->GetCache().GetStats(before);
+  if (edc->Deliver(message, {TEST_MAILBOX, TEST_OTHER}, keys))
+    return STANDARD_ERROR;
+  edc->GetCache().GetStats(after);
+  if (after.insertions != before.insertions || after.bytes != before.bytes)
+    return STANDARD_ERROR;
+  return edc->Read(mailbox, keys[0], read) == SUCCESS && *read == message ? SUCCESS : STANDARD_ERROR;
+}
+
+// After a login the newest messages are warm before the first RETR
+static RC TestPrefetch ()
+{
+  RemoveMailbox();
+  EmailDataManager *edm = EmailDataManager::instance();
+  EmailDataCache *edc = EmailDataCache::instance();
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys(20);
+  // Every fourth is stored compressed, the others too small for it
+  RC rc = edm->OpenMailbox(TEST_MAILBOX, mailbox);
+  for (size_t i = 0; i < keys.size() && rc == SUCCESS; ++i)
+    rc = mailbox->Append(string(i % 4 ? 100 : 4 * COMPRESS_MIN_SIZE, 'a' + i), keys[i]);
+  if (rc)
+    return rc;
+  edc->GetCache().Clear();
+
+  Prefetcher prefetcher;
+  prefetcher.Request(TEST_MAILBOX);
+  prefetcher.Request(TEST_MAILBOX);
+  PrefetchStats stats;
+  if (prefetcher.RunOnce())
+    return STANDARD_ERROR;
+  prefetcher.GetStats(stats);
+  if (stats.requests != 1 || stats.mailboxes != 1 || stats.filled != 4 || stats.advised != 12)
+    return STANDARD_ERROR;
+
+  // A new compressed one is served from memory, one sent with sendfile() is not there
+  CacheStats before, after;
+  shared_ptr<const string> message;
+  edc->GetCache().GetStats(before);
+  if (edc->Read(mailbox, keys[16], message) || edc->Read(mailbox, keys[19], message))
+    return STANDARD_ERROR;
+  edc->GetCache().GetStats(after);
+  if (after.hits != before.hits + 1 || after.misses != before.misses + 1)
+    return STANDARD_ERROR;
+
+  // The same from the background thread
+  prefetcher.Start();
+  prefetcher.Request(TEST_MAILBOX);
+  for (int wait = 0; wait < 500 && stats.mailboxes < 2; ++wait) {
+    this_thread::sleep_for(chrono::milliseconds(10));
+    prefetcher.GetStats(stats);
+  }
+  prefetcher.Stop();
+  return stats.mailboxes == 2 ? SUCCESS : STANDARD_ERROR;
+}
+
+// A login through the UIM asks for the mailbox of the user, a failed one does not
+static RC TestLoginPrefetch ()
+{
+  if (system((string("rm -rf ") + DATAPATH + TEST_DOMAIN).c_str())) {}
+  UserInfoManager *uim = UserInfoManager::instance();
+  UserInfo userInfo = {};
+  strncpy(userInfo.username, "alice", USERNAME_MAX_LANGTH - 1);
+  strncpy(userInfo.domainName, TEST_DOMAIN, DOMAIN_NAME_MAX_LENGTH - 1);
+  strncpy(userInfo.password, "secret", PASSWORD_MAX_LENGTH - 1);
+  UserInfo wrong = userInfo;
+  strncpy(wrong.password, "wrong", PASSWORD_MAX_LENGTH - 1);
+  if (uim->CreateUser(userInfo))
+    return STANDARD_ERROR;
+
+  RC rc = SUCCESS;
+  PrefetchStats stats;
+  {
+    Prefetcher prefetcher;
+    prefetcher.Attach(*uim);
+    if (uim->Login(wrong) == SUCCESS || uim->Login(userInfo) || prefetcher.RunOnce())
+      rc = STANDARD_ERROR;
+    prefetcher.GetStats(stats);
+  }
+  // Detached once destroyed
+  struct stat status;
+  if (rc || stats.requests != 1 || stats.mailboxes != 1 || uim->Login(userInfo) ||
+      stat(UserInfoManager::GetMailboxPath(userInfo).c_str(), &status))
+    rc = STANDARD_ERROR;
+  if (system((string("rm -rf ") + DATAPATH + TEST_DOMAIN).c_str())) {}
+  return rc;
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  EmailDataManager::instance()->SetSharedPath(TEST_SHARED);
+
+  result = TestGetPut();
+  cout << "TestGetPut: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestBudget();
+  cout << "TestBudget: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestScanResistance();
+  cout << "TestScanResistance: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestConcurrent();
+  cout << "TestConcurrent: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestEmailDataCache();
+  cout << "TestEmailDataCache: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestPrefetch();
+  cout << "TestPrefetch: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestLoginPrefetch();
+  cout << "TestLoginPrefetch: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  RemoveMailbox();
+  return (rc);
+}
@@ -0,0 +1,26 @@
+/*
+ * unit_test_edc.h
+ *
+ * This file provides unit test for edc.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "edc.h"
+#include "prefetcher.h"
+
+const char TEST_MAILBOX[] = "unit_test_edc.data/";
+const char TEST_OTHER[]   = "unit_test_edc.other/";
+const char TEST_SHARED[]  = "unit_test_edc.shared/";
+const char TEST_DOMAIN[]  = "edc.test";                 // Its users are under DATAPATH, made again by every test
+
+#define TEST_CAPACITY    (CACHE_SHARDS * 64 * 1024)   // 64 KiB a shard
+#define TEST_VALUE_SIZE  1024
+#define TEST_THREADS     4
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * codec.cpp
+ *
+ * This file provides the block compression of the EDM records.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "codec.h"
+
+/************ Helper Functions *************/
+// The last bytes are always literals, so a match never reads past the end
+#define CODEC_LAST_LITERALS 5
+#define CODEC_MATCH_LIMIT   12
+
+static uint32_t Read32 (const char *bytes)
+{
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static uint32_t Hash (uint32_t value)
+{
+  return (value * 2654435761u) >> (32 - CODEC_HASH_BITS);
+}
+
+/**
+ * Writes a length above 14 as the 255-bytes after the token.
+ * @return false if the target is too small.
+ */
+static bool WriteLength (size_t length, char *&out, const char *end)
+{
+  for (; length >= 255; length -= 255) {
+    if (out >= end)
+      return false;
+    *out++ = static_cast<char>(255);
+  }
+  if (out >= end)
+    return false;
+  *out++ = static_cast<char>(length);
+  return true;
+}
+
+static bool ReadLength (size_t &length, const unsigned char *&in, const unsigned char *end)
+{
+  unsigned char byte;
+  do {
+    if (in >= end)
+      return false;
+    byte    = *in++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+/**
+ * Writes one sequence: the literals from anchor, then a match if matchLength.
+ * @return false if the target is too small.
+ */
+static bool WriteSequence (const char *anchor, size_t literals, size_t offset, size_t matchLength,
+                           char *&out, const char *end)
+{
+  if (out >= end)
+    return false;
+  char *token = out++;
+  size_t extra = matchLength ? matchLength - CODEC_MIN_MATCH : 0;
+  *token = static_cast<char>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(extra, 15));
+
+  if (literals >= 15 && !WriteLength(literals - 15, out, end))
+    return false;
+  if (static_cast<size_t>(end - out) < literals)
+    return false;
+  memcpy(out, anchor, literals);
+  out += literals;
+
+  if (!matchLength)
+    return true;
+  if (end - out < 2)
+    return false;
+  *out++ = static_cast<char>(offset & 0xFF);
+  *out++ = static_cast<char>(offset >> 8);
+  return extra < 15 || WriteLength(extra - 15, out, end);
+}
+
+/************ Codec *************/
+size_t CompressBound (size_t length)
+{
+  return length + length / 255 + 16;
+}
+
+size_t Compress (const char *source, size_t length, char *target, size_t capacity)
+{
+  const char *in     = source;
+  const char *anchor = source;
+  const char *end    = source + length;
+  char       *out    = target;
+  const char *outEnd = target + capacity;
+
+  if (length >= CODEC_MATCH_LIMIT) {
+    static thread_local std::vector<uint32_t> table;
+    table.assign(1u << CODEC_HASH_BITS, 0);
+    const char *limit = end - CODEC_MATCH_LIMIT;
+
+    ++in;
+    while (in < limit) {
+      uint32_t value = Read32(in);
+      uint32_t &slot = table[Hash(value)];
+      const char *candidate = source + slot;
+      slot = in - source;
+
+      if (candidate >= in || in - candidate > CODEC_MAX_OFFSET || Read32(candidate) != value) {
+        ++in;
+        continue;
+      }
+
+      // Extend the match forward, and backward over the pending literals
+      const char *matchEnd = in + CODEC_MIN_MATCH;
+      const char *scan     = candidate + CODEC_MIN_MATCH;
+      while (matchEnd < end - CODEC_LAST_LITERALS && *matchEnd == *scan) {
+        ++matchEnd;
+        ++scan;
+      }
+      while (in > anchor && candidate > source && in[-1] == candidate[-1]) {
+        --in;
+        --candidate;
+      }
+
+      if (!WriteSequence(anchor, in - anchor, in - candidate, matchEnd - in, out, outEnd))
+        return 0;
+      in = anchor = matchEnd;
+      if (in < limit)
+        table[Hash(Read32(in - 2))] = in - 2 - source;
+    }
+  }
+
+  // The rest goes out as literals
+  if (!WriteSequence(anchor, end - anchor, 0, 0, out, outEnd))
+    return 0;
+  return out - target;
+}
+
+bool Decompress (const char *source, size_t length, char *target, size_t rawLength)
+{
+  const unsigned char *in    = reinterpret_cast<const unsigned char *>(source);
+  const unsigned char *inEnd = in + length;
+  char       *out    = target;
+  const char *outEnd = target + rawLength;
+
+  while (in < inEnd) {
+    unsigned char token = *in++;
+
+    size_t literals = token >> 4;
+    if (literals == 15 && !ReadLength(literals, in, inEnd))
+      return false;
+    if (static_cast<size_t>(inEnd - in) < literals || static_cast<size_t>(outEnd - out) < literals)
+      return false;
+    memcpy(out, in, literals);
+    in  += literals;
+    out += literals;
+
+    // The last sequence has no match
+    if (in == inEnd)
+      break;
+
+    if (inEnd - in < 2)
+      return false;
+    size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    size_t matchLength = token & 0x0F;
+    if (matchLength == 15 && !ReadLength(matchLength, in, inEnd))
+      return false;
+    matchLength += CODEC_MIN_MATCH;
+
+    if (offset == 0 || offset > static_cast<size_t>(out - target) ||
+        static_cast<size_t>(outEnd - out) < matchLength)
+      return false;
+    // An overlapping match repeats what it produces, copied byte by byte
+    const char *match = out - offset;
+    if (offset >= matchLength) {
+      memcpy(out, match, matchLength);
+      out += matchLength;
+    } else {
+      for (size_t i = 0; i < matchLength; ++i)
+        *out++ = *match++;
+    }
+  }
+  return out == outEnd;
+}
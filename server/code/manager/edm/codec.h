@@ -0,0 +1,53 @@
+#ifndef EDM_CODEC
+#define EDM_CODEC
+
+/* ----- Include libries or files ----- */
+#include <cstddef>
+
+/* ----- Define macros ----- */
+#define CODEC_HASH_BITS   12    // Entries of the match table: 1 << CODEC_HASH_BITS
+#define CODEC_MIN_MATCH   4     // Shortest match worth a sequence
+#define CODEC_MAX_OFFSET  65535 // Farthest a match can look back
+
+/**
+ * Codec functions
+ * These functions compress and decompress one block with a byte-oriented LZ77
+ * code in the layout of LZ4 blocks: sequences of a token (literal length and
+ * match length, 4 bits each), the literals, a 2-byte offset and the extra
+ * length bytes. The compressor keeps one hash table of recent positions and
+ * never looks back, so it runs at disk speed; the decompressor only copies.
+ *
+ * Contained Public Functions:
+ *   size_t CompressBound (size_t length)
+ *   size_t Compress      (const char *source, size_t length, char *target, size_t capacity)
+ *   bool   Decompress    (const char *source, size_t length, char *target, size_t rawLength)
+ */
+
+/**
+ * This function will give the largest size Compress() can produce.
+ * @param  size_t given as the length of the input.
+ * @return size_t as the number of bytes the target needs.
+ */
+size_t CompressBound (size_t length);
+
+/**
+ * This function will compress one block.
+ * @param  const char * given as the input.
+ *         size_t given as the length of the input.
+ *         char * given as where the compressed block goes.
+ *         size_t given as the room there.
+ * @return size_t as the length of the compressed block, 0 if it does not fit.
+ */
+size_t Compress   (const char *source, size_t length, char *target, size_t capacity);
+
+/**
+ * This function will decompress one block made by Compress().
+ * @param  const char * given as the compressed block.
+ *         size_t given as its length.
+ *         char * given as where the output goes.
+ *         size_t given as the length the output must have.
+ * @return true if the block is well-formed and gives exactly rawLength bytes.
+ */
+bool   Decompress (const char *source, size_t length, char *target, size_t rawLength);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * compactor.cpp
+ *
+ * This file provides the background compaction of the EDM segments.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include "compactor.h"
+
+/************ Compactor *************/
+Compactor::Compactor(uint64_t rate, int interval)
+  : _rate(rate),
+    _interval(std::chrono::seconds(interval)),
+    _copied(0),
+    _reclaimed(0)
+{
+}
+
+Compactor::~Compactor()
+{
+  Stop();
+}
+
+void Compactor::Start ()
+{
+  _thread.Start(_interval, [this] { RunOnce(); });
+}
+
+void Compactor::Stop ()
+{
+  _thread.Stop();
+}
+
+RC Compactor::RunOnce ()
+{
+  RC result = SUCCESS;
+  std::vector<std::string> paths;
+  EmailDataManager::instance()->TakeSparse(paths);
+
+  for (const std::string &path : paths) {
+    std::shared_ptr<Mailbox> mailbox;
+    RC rc = EmailDataManager::instance()->OpenMailbox(path, mailbox);
+
+    uint64_t reclaimed = 0;
+    _start  = Clock::now();
+    _copied = 0;
+    if (rc == SUCCESS)
+      rc = mailbox->Compact([this](size_t bytes) { return Throttle(bytes); }, reclaimed);
+    _reclaimed += reclaimed;
+    if (rc && result == SUCCESS)
+      result = rc;
+  }
+  return result;
+}
+
+bool Compactor::Throttle (size_t bytes)
+{
+  _copied += bytes;
+
+  // Sleep until the bytes copied since the start fit the rate
+  Clock::time_point due = _start + std::chrono::duration_cast<Clock::duration>(
+                                     std::chrono::duration<double>(static_cast<double>(_copied) / _rate));
+  return _thread.WaitUntil(due);
+}
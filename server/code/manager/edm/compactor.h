@@ -0,0 +1,71 @@
+#ifndef EDM_COMPACTOR
+#define EDM_COMPACTOR
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <chrono>
+#include "../../util/periodic.h"
+#include "edm.h"
+
+/* ----- Define macros ----- */
+#define COMPACT_RATE      (8 * 1024 * 1024)   // Bytes per second copied by default
+#define COMPACT_INTERVAL  10                  // Seconds between two looks for sparse mailboxes
+
+/**
+ * Compactor
+ * This class runs a background thread that compacts the mailboxes reported
+ * sparse by the EmailDataManager. The bytes it copies are limited to a rate,
+ * so compaction never takes the disk from the deliveries; Stop() interrupts it
+ * between two records.
+ *
+ * Contained Public Functions:
+ *   void Start ()
+ *   void Stop  ()
+ *   RC   RunOnce ()
+ *   uint64_t GetReclaimedSize ()
+ */
+class Compactor
+{
+public:
+  Compactor(uint64_t rate = COMPACT_RATE, int interval = COMPACT_INTERVAL);
+  ~Compactor();
+
+  /**
+   * This function will start the background thread.
+   */
+  void Start ();
+
+  /**
+   * This function will stop the background thread and wait for it.
+   */
+  void Stop  ();
+
+  /**
+   * This function will compact every mailbox reported sparse since the last
+   * run, in the calling thread.
+   * @return SUCCESS if all of them have been compacted.
+   *         pre-defined error number of the first mailbox that failed.
+   */
+  RC RunOnce ();
+
+  uint64_t GetReclaimedSize () const { return _reclaimed; };
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  uint64_t _rate;
+  Clock::duration _interval;
+  PeriodicThread _thread;
+  Clock::time_point _start;           // Start of the current rate window
+  uint64_t _copied;                   // Bytes copied in the window
+  std::atomic<uint64_t> _reclaimed;   // Bytes freed on the disk
+
+  /**
+   * This function will wait as long as the rate asks for after copying.
+   * @param  size_t given as the number of bytes just copied.
+   * @return true to go on, false if the compactor is stopping.
+   */
+  bool Throttle (size_t bytes);
+};
+
+#endif
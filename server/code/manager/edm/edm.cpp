@@ -0,0 +1,1403 @@
+/*
+ * edm.cpp
+ *
+ * This file provides the Email Data Manager: the directory file and the
+ * content storage files of every mailbox.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "codec.h"
+#include "edm.h"
+
+/************ Helper Functions *************/
+static uint32_t GetArrival ()
+{
+  return static_cast<uint32_t>(time(NULL));
+}
+
+static bool WriteAll (int fd, const void *data, size_t length, uint64_t offset)
+{
+  const char *bytes = static_cast<const char *>(data);
+  while (length) {
+    ssize_t written = pwrite(fd, bytes, length, offset);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes  += written;
+    length -= written;
+    offset += written;
+  }
+  return true;
+}
+
+static bool ReadAll (int fd, void *data, size_t length, uint64_t offset)
+{
+  char *bytes = static_cast<char *>(data);
+  while (length) {
+    ssize_t got = pread(fd, bytes, length, offset);
+    if (got == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (got == 0)
+      return false;
+    bytes  += got;
+    length -= got;
+    offset += got;
+  }
+  return true;
+}
+
+static uint64_t RecordSize (const Index &index)
+{
+  return sizeof(RecordHeader) + index.storedLength;
+}
+
+static void SyncDirectory (const std::string &path)
+{
+  int directoryId = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directoryId != -1) {
+    fsync(directoryId);
+    close(directoryId);
+  }
+}
+
+// Entries with bytes in the segments of their own mailbox
+static bool IsLocal (const Index &index)
+{
+  return !(index.flags & INDEX_SHARED);
+}
+
+/**
+ * Gives the summary entry of a directory entry. The UID mixes the key, never
+ * reused in a mailbox, with the content hash.
+ */
+static SummaryEntry Summarize (const Index &index)
+{
+  ContentHash uid;
+  uid.Update(&index.key, sizeof(index.key));
+  uid.Update(&index.hash, sizeof(index.hash));
+
+  SummaryEntry entry;
+  entry.key    = index.key;
+  entry.length = index.length;
+  entry.flags  = index.flags & INDEX_DELETED ? SUMMARY_DELETED : 0;
+  entry.uid    = uid.GetValue();
+  return entry;
+}
+
+static std::vector<SummaryEntry> Summarize (const std::vector<Index> &indexes)
+{
+  std::vector<SummaryEntry> entries;
+  entries.reserve(indexes.size());
+  for (const Index &index : indexes)
+    entries.push_back(Summarize(index));
+  return entries;
+}
+
+/**
+ * Compresses a message if that is worth it.
+ * @return the bytes to store, in compressed or the message itself.
+ */
+static std::string_view Prepare (std::string_view message, bool compress, std::string &compressed, uint32_t &flags)
+{
+  flags = 0;
+  if (!compress || message.size() < COMPRESS_MIN_SIZE)
+    return message;
+
+  compressed.resize(CompressBound(message.size()));
+  size_t size = Compress(message.data(), message.size(), compressed.data(),
+                         message.size() - message.size() / COMPRESS_MIN_SAVING);
+  if (!size)
+    return message;
+  flags = INDEX_COMPRESSED;
+  return std::string_view(compressed.data(), size);
+}
+
+/************ Mailbox *************/
+Mailbox::Mailbox(const std::string &path, uint64_t segmentSize, bool compress, std::shared_ptr<Mailbox> shared)
+  : _path(path),
+    _directoryId(-1),
+    _segmentSize(segmentSize),
+    _compress(compress),
+    _shared(std::move(shared)),
+    _active(0),
+    _nextKey(1),
+    _generation(0),
+    _nextStage(0),
+    _loaded(false),
+    _reported(false)
+{
+  if (_path.empty() || _path.back() != '/')
+    _path += '/';
+}
+
+Mailbox::~Mailbox()
+{
+  if (_directoryId != -1)
+    close(_directoryId);
+}
+
+RC Mailbox::Open ()
+{
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  if (mkdir(_path.c_str(), 0700) && errno != EEXIST)
+    return EDM_OPEN_ERROR;
+
+  std::string name = _path + DIRECTORY_FILE_NAME + DF_EXTENSION;
+  _directoryId = open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (_directoryId == -1)
+    return EDM_OPEN_ERROR;
+
+  size_t number;
+  RC rc = OpenDirectory(number);
+  if (rc)
+    return rc;
+
+  // A summary of this very directory file is trusted as it is, the entries
+  // are only read once a message is used; any other is made again
+  bool current;
+  if ((rc = _summary.Open(_path + SUMMARY_FILE_NAME + SUMMARY_EXTENSION, _generation, number, current)))
+    return rc;
+  if (current) {
+    _nextKey = std::max(_nextKey, _summary.GetLastKey() + 1);
+    return SUCCESS;
+  }
+  if ((rc = LoadDirectory()))
+    return rc;
+  return _summary.Rebuild(Summarize(_indexes), _generation);
+}
+
+RC Mailbox::Load ()
+{
+  if (_loaded)
+    return SUCCESS;
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  return _loaded ? SUCCESS : LoadDirectory();
+}
+
+RC Mailbox::Append (std::string_view message, uint64_t &key)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  if (message.size() > UINT32_MAX)
+    return EDM_TOO_LARGE;
+
+  // Compressed before taking the lock, readers do not wait for it
+  std::string compressed;
+  Index index = {};
+  std::string_view stored = Prepare(message, _compress, compressed, index.flags);
+  index.length = message.size();
+  ContentHash hash;
+  hash.Update(message.data(), message.size());
+  index.hash = hash.GetValue();
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  rc = AppendRecord(stored, index);
+  if (rc == SUCCESS)
+    key = index.key;
+  return rc;
+}
+
+RC Mailbox::Append (const std::vector<std::string_view> &messages, std::vector<uint64_t> &keys)
+{
+  keys.clear();
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::vector<std::string> compressed(messages.size());
+  std::vector<std::string_view> stored(messages.size());
+  std::vector<Index> indexes(messages.size(), Index{});
+  for (size_t i = 0; i < messages.size(); ++i) {
+    if (messages[i].size() > UINT32_MAX)
+      return EDM_TOO_LARGE;
+    stored[i] = Prepare(messages[i], _compress, compressed[i], indexes[i].flags);
+    indexes[i].length = messages[i].size();
+    ContentHash hash;
+    hash.Update(messages[i].data(), messages[i].size());
+    indexes[i].hash = hash.GetValue();
+  }
+
+  // The records first, every segment written to synced once
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  std::vector<uint32_t> written;
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    indexes[i].key = _nextKey + i;
+    if ((rc = WriteRecord(stored[i], indexes[i])))
+      return rc;
+    if (written.empty() || written.back() != indexes[i].fileNr)
+      written.push_back(indexes[i].fileNr);
+  }
+  for (uint32_t fileNr : written) {
+    if (WriteAheadLog::instance()->IsOpen() && _segments[fileNr]->Sync())
+      return EDM_WRITE_ERROR;
+  }
+
+  // Then all the entries in one record of the log
+  std::vector<size_t> slots;
+  for (const Index &index : indexes) {
+    _indexes.push_back(index);
+    slots.push_back(_indexes.size() - 1);
+  }
+  if (WriteIndexes(slots)) {
+    _indexes.resize(_indexes.size() - indexes.size());
+    return EDM_WRITE_ERROR;
+  }
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    _slots[indexes[i].key] = slots[i];
+    UpdateLiveBytes(indexes[i], true);
+    keys.push_back(indexes[i].key);
+  }
+  _nextKey += indexes.size();
+  return SUCCESS;
+}
+
+RC Mailbox::AppendShared (const Index &shared, uint64_t &key)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  Index index = {};
+  index.key    = _nextKey;
+  index.flags  = INDEX_SHARED | (shared.flags & INDEX_COMPRESSED);
+  index.offset = shared.key;
+  index.length = shared.length;
+  index.storedLength = shared.storedLength;
+  index.hash   = shared.hash;
+  index.arrival = GetArrival();
+
+  _indexes.push_back(index);
+  if (WriteIndex(_indexes.size() - 1)) {
+    _indexes.pop_back();
+    return EDM_WRITE_ERROR;
+  }
+  _slots[index.key] = _indexes.size() - 1;
+  key = _nextKey++;
+  return SUCCESS;
+}
+
+RC Mailbox::Share (std::string_view message, uint64_t hash, uint32_t refs, Index &index)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  if (message.size() > UINT32_MAX)
+    return EDM_TOO_LARGE;
+
+  std::string compressed;
+  uint32_t flags;
+  std::string_view stored = Prepare(message, _compress, compressed, flags);
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  // An identical message already stored only gets the references
+  auto found = _hashes.find(hash);
+  if (found != _hashes.end()) {
+    Index &same = _indexes[found->second];
+    std::string content;
+    if (same.length == message.size() && ReadRecord(same, content) == SUCCESS && content == message) {
+      same.refs += refs;
+      if (WriteIndex(found->second)) {
+        same.refs -= refs;
+        return EDM_WRITE_ERROR;
+      }
+      index = same;
+      return SUCCESS;
+    }
+  }
+
+  index = {};
+  index.flags  = flags;
+  index.length = message.size();
+  index.hash   = hash;
+  index.refs   = refs;
+  rc = AppendRecord(stored, index);
+  if (rc == SUCCESS && found == _hashes.end())
+    _hashes[hash] = _slots[index.key];
+  return rc;
+}
+
+RC Mailbox::Release (uint64_t key)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  auto found = _slots.find(key);
+  if (found == _slots.end())
+    return EDM_NO_SUCH_MESSAGE;
+
+  size_t slot  = found->second;
+  Index &index = _indexes[slot];
+  if (index.refs > 1) {
+    --index.refs;
+    if (WriteIndex(slot)) {
+      ++index.refs;
+      return EDM_WRITE_ERROR;
+    }
+    return SUCCESS;
+  }
+
+  // The last reference, the record is dead now
+  index.refs   = 0;
+  index.flags |= INDEX_DELETED;
+  if (WriteIndex(slot)) {
+    index.refs   = 1;
+    index.flags &= ~INDEX_DELETED;
+    return EDM_WRITE_ERROR;
+  }
+  _slots.erase(found);
+  auto hashed = _hashes.find(index.hash);
+  if (hashed != _hashes.end() && hashed->second == slot)
+    _hashes.erase(hashed);
+  UpdateLiveBytes(index, false);
+  return SUCCESS;
+}
+
+RC Mailbox::Release (const std::vector<uint64_t> &keys)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  // References dropped from each entry, by position
+  std::map<size_t, uint32_t> drops;
+  for (uint64_t key : keys) {
+    auto found = _slots.find(key);
+    if (found == _slots.end())
+      continue;
+    uint32_t &dropped = drops[found->second];
+    if (dropped < std::max(_indexes[found->second].refs, 1u))
+      ++dropped;
+  }
+
+  std::vector<size_t> slots;
+  std::vector<Index> before;
+  for (const auto &drop : drops) {
+    Index &index = _indexes[drop.first];
+    slots.push_back(drop.first);
+    before.push_back(index);
+    index.refs -= std::min(index.refs, drop.second);
+    if (!index.refs)
+      index.flags |= INDEX_DELETED;
+  }
+  if (WriteIndexes(slots)) {
+    for (size_t i = 0; i < slots.size(); ++i)
+      _indexes[slots[i]] = before[i];
+    return EDM_WRITE_ERROR;
+  }
+
+  // The records without a reference left are dead now
+  for (size_t slot : slots) {
+    const Index &index = _indexes[slot];
+    if (!(index.flags & INDEX_DELETED))
+      continue;
+    _slots.erase(index.key);
+    auto hashed = _hashes.find(index.hash);
+    if (hashed != _hashes.end() && hashed->second == slot)
+      _hashes.erase(hashed);
+    UpdateLiveBytes(index, false);
+  }
+  return SUCCESS;
+}
+
+RC Mailbox::Stage (std::shared_ptr<Segment> &segment)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  uint64_t stage;
+  {
+    std::unique_lock<std::shared_mutex> lock(_lock);
+    stage = _nextStage++;
+  }
+  segment.reset(new Segment(_path + std::to_string(stage) + STAGE_EXTENSION));
+  rc = segment->Open(true);
+  if (rc)
+    segment.reset();
+  return rc;
+}
+
+RC Mailbox::Adopt (const std::shared_ptr<Segment> &segment, uint32_t length, uint64_t hash, uint32_t refs, Index &index)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  // The key is only known now, the header is the last part of the record written
+  uint32_t fileNr = _segments.size();
+  if (segment->Seal(_nextKey, length) || segment->Sync() || segment->Rename(GetFileName(fileNr)))
+    return EDM_WRITE_ERROR;
+  // The new name must be on the disk before an entry points to it
+  SyncDirectory(_path);
+
+  index = {};
+  index.key    = _nextKey;
+  index.fileNr = fileNr;
+  index.offset = sizeof(RecordHeader);
+  index.length = length;
+  index.storedLength = length;
+  index.hash   = hash;
+  index.refs   = refs;
+  index.arrival = GetArrival();
+  _segments.push_back(segment);
+  _liveBytes.push_back(0);
+
+  _indexes.push_back(index);
+  if (WriteIndex(_indexes.size() - 1)) {
+    _indexes.pop_back();
+    _segments.back().reset();
+    unlink(segment->GetName().c_str());
+    return EDM_WRITE_ERROR;
+  }
+  _slots[index.key] = _indexes.size() - 1;
+  if (refs)
+    _hashes.emplace(hash, _indexes.size() - 1);
+  UpdateLiveBytes(index, true);
+  ++_nextKey;
+  return SUCCESS;
+}
+
+RC Mailbox::Read (uint64_t key, std::string &message)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::shared_lock<std::shared_mutex> lock(_lock);
+
+  auto found = _slots.find(key);
+  if (found == _slots.end())
+    return EDM_NO_SUCH_MESSAGE;
+  const Index &index = _indexes[found->second];
+  if (IsLocal(index))
+    return ReadRecord(index, message);
+
+  uint64_t shared = index.offset;
+  lock.unlock();
+  return _shared->Read(shared, message);
+}
+
+RC Mailbox::Lookup (uint64_t key, Index &index)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::shared_lock<std::shared_mutex> lock(_lock);
+
+  auto found = _slots.find(key);
+  if (found == _slots.end())
+    return EDM_NO_SUCH_MESSAGE;
+  index = _indexes[found->second];
+  return SUCCESS;
+}
+
+RC Mailbox::Locate (uint64_t key, std::shared_ptr<Segment> &segment, off_t &offset, size_t &length)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::shared_lock<std::shared_mutex> lock(_lock);
+
+  auto found = _slots.find(key);
+  if (found == _slots.end())
+    return EDM_NO_SUCH_MESSAGE;
+  const Index &index = _indexes[found->second];
+  if (index.flags & INDEX_COMPRESSED)
+    return EDM_COMPRESSED;
+  if (!IsLocal(index)) {
+    uint64_t shared = index.offset;
+    lock.unlock();
+    return _shared->Locate(shared, segment, offset, length);
+  }
+  segment = _segments[index.fileNr];
+  offset  = index.offset;
+  length  = index.length;
+  return SUCCESS;
+}
+
+RC Mailbox::Delete (uint64_t key)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+
+  auto found = _slots.find(key);
+  if (found == _slots.end())
+    return EDM_NO_SUCH_MESSAGE;
+
+  size_t slot = found->second;
+  _indexes[slot].flags |= INDEX_DELETED;
+  if (WriteIndex(slot)) {
+    _indexes[slot].flags &= ~INDEX_DELETED;
+    return EDM_WRITE_ERROR;
+  }
+  _slots.erase(found);
+  if (IsLocal(_indexes[slot])) {
+    UpdateLiveBytes(_indexes[slot], false);
+    return SUCCESS;
+  }
+
+  // The entry is gone either way; a reference not dropped only keeps the record longer
+  uint64_t shared = _indexes[slot].offset;
+  lock.unlock();
+  _shared->Release(shared);
+  return SUCCESS;
+}
+
+RC Mailbox::Delete (const std::vector<uint64_t> &keys, size_t &deleted)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  deleted = 0;
+
+  // A key given twice finds its entry marked already
+  std::vector<size_t> slots;
+  for (uint64_t key : keys) {
+    auto found = _slots.find(key);
+    if (found == _slots.end() || (_indexes[found->second].flags & INDEX_DELETED))
+      continue;
+    _indexes[found->second].flags |= INDEX_DELETED;
+    slots.push_back(found->second);
+  }
+  std::sort(slots.begin(), slots.end());
+  if (WriteIndexes(slots)) {
+    for (size_t slot : slots)
+      _indexes[slot].flags &= ~INDEX_DELETED;
+    return EDM_WRITE_ERROR;
+  }
+
+  std::vector<uint64_t> shared;
+  for (size_t slot : slots) {
+    _slots.erase(_indexes[slot].key);
+    if (IsLocal(_indexes[slot]))
+      UpdateLiveBytes(_indexes[slot], false);
+    else
+      shared.push_back(_indexes[slot].offset);
+  }
+  deleted = slots.size();
+  lock.unlock();
+
+  // As for one message, a reference not dropped only keeps the record longer
+  if (!shared.empty())
+    _shared->Release(shared);
+  return SUCCESS;
+}
+
+RC Mailbox::Compact (const std::function<bool(size_t)> &throttle, uint64_t &reclaimed)
+{
+  RC rc = Load();
+  if (rc)
+    return rc;
+
+  std::lock_guard<std::mutex> compacting(_compactLock);
+  reclaimed = 0;
+
+  // What to move is decided up front; deliveries go on into the active segment
+  struct Move {
+    size_t   slot;
+    Index    from;
+    uint32_t fileNr;
+    uint64_t offset;
+  };
+  std::vector<Move> moves;
+  std::vector<uint32_t> victims;
+  std::vector<std::shared_ptr<Segment>> sources;
+  {
+    std::unique_lock<std::shared_mutex> lock(_lock);
+    for (uint32_t fileNr = 0; fileNr < _segments.size(); ++fileNr) {
+      if (IsSparse(fileNr))
+        victims.push_back(fileNr);
+    }
+    if (victims.empty()) {
+      _reported = false;
+      return SUCCESS;
+    }
+    for (size_t slot = 0; slot < _indexes.size(); ++slot) {
+      const Index &index = _indexes[slot];
+      if (!(index.flags & INDEX_DELETED) && IsLocal(index) &&
+          std::count(victims.begin(), victims.end(), index.fileNr))
+        moves.push_back(Move{slot, index, 0, 0});
+    }
+    sources = _segments;
+  }
+
+  // Copy the live records into new segments, nobody else writes to those
+  rc = SUCCESS;
+  bool gaveUp = false;
+  std::vector<uint32_t> outputs;
+  std::string message;
+  for (Move &move : moves) {
+    uint64_t size = outputs.empty() ? 0 : sources[outputs.back()]->GetSize();
+    if (outputs.empty() || (size && size + RecordSize(move.from) > _segmentSize)) {
+      std::unique_lock<std::shared_mutex> lock(_lock);
+      if ((rc = OpenSegment(_segments.size(), true)))
+        break;
+      outputs.push_back(_segments.size() - 1);
+      sources = _segments;
+    }
+    move.fileNr = outputs.back();
+
+    // Records are copied as they are stored, compressed or not
+    uint32_t flags = move.from.flags & INDEX_COMPRESSED ? RECORD_COMPRESSED : 0;
+    if ((rc = sources[move.from.fileNr]->Read(move.from.key, move.from.offset, move.from.storedLength, message)) ||
+        (rc = sources[move.fileNr]->Append(move.from.key, message, move.from.length, flags, move.offset)))
+      break;
+    if (!throttle(RecordSize(move.from))) {
+      gaveUp = true;
+      break;
+    }
+  }
+  for (uint32_t fileNr : outputs) {
+    if (rc == SUCCESS && !gaveUp)
+      rc = sources[fileNr]->Sync();
+  }
+
+  std::unique_lock<std::shared_mutex> lock(_lock);
+  if (rc || gaveUp) {
+    // The copies are dead records nobody points to
+    for (uint32_t fileNr : outputs) {
+      unlink(_segments[fileNr]->GetName().c_str());
+      _segments[fileNr].reset();
+    }
+    // Taken off the sparse list already, the next run has to see it again
+    if (_onSparse)
+      _onSparse(_path);
+    return rc;
+  }
+
+  // Entries deleted meanwhile stay where they were and go with the segment
+  std::vector<Index> indexes = _indexes;
+  for (const Move &move : moves) {
+    Index &index = indexes[move.slot];
+    if (index.flags & INDEX_DELETED)
+      continue;
+    index.fileNr = move.fileNr;
+    index.offset = move.offset;
+  }
+  if ((rc = RewriteDirectory(indexes))) {
+    if (_onSparse)
+      _onSparse(_path);
+    return rc;
+  }
+
+  // The new directory is in place, the victims can go
+  _liveBytes.resize(_segments.size(), 0);
+  for (uint32_t fileNr : victims) {
+    reclaimed += _segments[fileNr]->GetSize();
+    unlink(_segments[fileNr]->GetName().c_str());
+    _segments[fileNr].reset();
+    _liveBytes[fileNr] = 0;
+  }
+  for (const Index &index : _indexes) {
+    if (IsLocal(index) && std::count(outputs.begin(), outputs.end(), index.fileNr))
+      _liveBytes[index.fileNr] += RecordSize(index);
+  }
+  _reported = false;
+  return SUCCESS;
+}
+
+bool Mailbox::IsSparse ()
+{
+  if (Load())
+    return false;
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  for (uint32_t fileNr = 0; fileNr < _segments.size(); ++fileNr) {
+    if (IsSparse(fileNr))
+      return true;
+  }
+  return false;
+}
+
+void Mailbox::ListMessages (std::vector<Index> &indexes)
+{
+  indexes.clear();
+  if (Load())
+    return;
+  std::shared_lock<std::shared_mutex> lock(_lock);
+
+  // Keys grow with the position in the directory file
+  indexes.reserve(_slots.size());
+  for (const Index &index : _indexes) {
+    if (!(index.flags & INDEX_DELETED))
+      indexes.push_back(index);
+  }
+}
+
+void Mailbox::ListSummary (std::vector<SummaryEntry> &entries)
+{
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  _summary.List(entries);
+}
+
+void Mailbox::GetTotals (uint64_t &number, uint64_t &octets)
+{
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  number = _summary.GetNumber();
+  octets = _summary.GetOctets();
+}
+
+size_t Mailbox::GetMessageNumber ()
+{
+  if (Load())
+    return 0;
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  return _slots.size();
+}
+
+uint64_t Mailbox::GetNextKey ()
+{
+  std::shared_lock<std::shared_mutex> lock(_lock);
+  return _nextKey;
+}
+
+/************ Mailbox Helper Functions *************/
+RC Mailbox::OpenDirectory (size_t &number)
+{
+  struct stat status;
+  if (fstat(_directoryId, &status))
+    return EDM_OPEN_ERROR;
+
+  // A new directory file is on the disk before any entry is logged for it
+  DirectoryHeader header = {};
+  number = 0;
+  if (status.st_size == 0) {
+    header.magic   = DIRECTORY_MAGIC;
+    header.version = DIRECTORY_VERSION;
+    header.nextKey = _nextKey;
+    if (!WriteAll(_directoryId, &header, sizeof(header), 0) || fdatasync(_directoryId))
+      return EDM_WRITE_ERROR;
+    SyncDirectory(_path);
+    return SUCCESS;
+  }
+
+  if (static_cast<size_t>(status.st_size) < sizeof(header) || !ReadAll(_directoryId, &header, sizeof(header), 0) ||
+      header.magic != DIRECTORY_MAGIC || header.version != DIRECTORY_VERSION)
+    return EDM_CORRUPTED;
+  _nextKey    = std::max<uint64_t>(header.nextKey, 1);
+  _generation = header.generation;
+
+  // A torn entry at the end is dropped, the next append overwrites it
+  number = (status.st_size - sizeof(header)) / sizeof(Index);
+  return SUCCESS;
+}
+
+RC Mailbox::LoadDirectory ()
+{
+  struct stat status;
+  if (fstat(_directoryId, &status))
+    return EDM_OPEN_ERROR;
+  size_t number = (status.st_size - sizeof(DirectoryHeader)) / sizeof(Index);
+  _indexes.resize(number);
+  if (number && !ReadAll(_directoryId, _indexes.data(), number * sizeof(Index), sizeof(DirectoryHeader)))
+    return EDM_READ_ERROR;
+
+  for (size_t slot = 0; slot < number; ++slot) {
+    const Index &index = _indexes[slot];
+    if (slot && index.key <= _indexes[slot - 1].key)
+      return EDM_CORRUPTED;
+    if (!IsLocal(index) && !_shared)
+      return EDM_CORRUPTED;
+    _nextKey = std::max(_nextKey, index.key + 1);
+  }
+  BuildSlots();
+
+  // Open the segments the entries point to, the last one takes new messages
+  RC rc;
+  for (const Index &index : _indexes) {
+    if (!IsLocal(index))
+      continue;
+    if (index.fileNr >= _segments.size()) {
+      _segments.resize(index.fileNr + 1);
+      _liveBytes.resize(index.fileNr + 1, 0);
+    }
+    if (!_segments[index.fileNr]) {
+      _segments[index.fileNr].reset(new Segment(GetFileName(index.fileNr)));
+      if ((rc = _segments[index.fileNr]->Open(false)))
+        return rc;
+    }
+    if (!(index.flags & INDEX_DELETED))
+      _liveBytes[index.fileNr] += RecordSize(index);
+  }
+  if (_segments.empty()) {
+    if ((rc = OpenSegment(0, true)))
+      return rc;
+  }
+  _active = _segments.size() - 1;
+
+  // Left sparse before a restart
+  for (uint32_t fileNr = 0; fileNr < _segments.size() && _onSparse && !_reported; ++fileNr) {
+    if (IsSparse(fileNr)) {
+      _reported = true;
+      _onSparse(_path);
+    }
+  }
+
+  RemoveOrphans();
+  _loaded = true;
+  return SUCCESS;
+}
+
+
+RC Mailbox::WriteIndex (size_t slot)
+{
+  return WriteIndexes(std::vector<size_t>(1, slot));
+}
+
+RC Mailbox::WriteIndexes (const std::vector<size_t> &slots)
+{
+  if (slots.empty())
+    return SUCCESS;
+
+  std::vector<DirectoryRedo> redos(slots.size());
+  for (size_t i = 0; i < slots.size(); ++i) {
+    redos[i].generation = _generation;
+    redos[i].position   = sizeof(DirectoryHeader) + slots[i] * sizeof(Index);
+    redos[i].index      = _indexes[slots[i]];
+  }
+  RC rc = WriteAheadLog::instance()->Write(
+    WAL_OWNER_EDM, _path + DIRECTORY_FILE_NAME + DF_EXTENSION,
+    std::string_view(reinterpret_cast<const char *>(redos.data()), redos.size() * sizeof(DirectoryRedo)),
+    [this, &redos] () -> RC {
+      // Neighbouring entries go in one write
+      std::vector<Index> run;
+      for (size_t start = 0, end; start < redos.size(); start = end) {
+        run.assign(1, redos[start].index);
+        for (end = start + 1; end < redos.size() && redos[end].position == redos[end - 1].position + sizeof(Index);
+             ++end)
+          run.push_back(redos[end].index);
+        if (!WriteAll(_directoryId, run.data(), run.size() * sizeof(Index), redos[start].position))
+          return EDM_WRITE_ERROR;
+      }
+      return SUCCESS;
+    });
+
+  // A summary that falls behind is made again by the next Open()
+  if (rc == SUCCESS) {
+    for (size_t slot : slots)
+      _summary.Set(slot, Summarize(_indexes[slot]));
+  }
+  return rc;
+}
+
+RC Mailbox::RewriteDirectory (std::vector<Index> &indexes)
+{
+  indexes.erase(std::remove_if(indexes.begin(), indexes.end(),
+                               [](const Index &index) { return index.flags & INDEX_DELETED; }),
+                indexes.end());
+
+  std::string name      = _path + DIRECTORY_FILE_NAME + DF_EXTENSION;
+  std::string temporary = name + ".tmp";
+  int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return EDM_OPEN_ERROR;
+
+  DirectoryHeader header = {};
+  header.magic      = DIRECTORY_MAGIC;
+  header.version    = DIRECTORY_VERSION;
+  header.nextKey    = _nextKey;
+  header.generation = _generation + 1;
+  if (!WriteAll(fd, &header, sizeof(header), 0) ||
+      (!indexes.empty() && !WriteAll(fd, indexes.data(), indexes.size() * sizeof(Index), sizeof(header))) ||
+      fdatasync(fd) || rename(temporary.c_str(), name.c_str())) {
+    close(fd);
+    unlink(temporary.c_str());
+    return EDM_WRITE_ERROR;
+  }
+
+  // The rename is only durable once the directory holding it is synced
+  SyncDirectory(_path);
+
+  close(_directoryId);
+  _directoryId = fd;
+  ++_generation;
+  _indexes.swap(indexes);
+  BuildSlots();
+  _summary.Rebuild(Summarize(_indexes), _generation);
+  return SUCCESS;
+}
+
+RC Mailbox::AppendRecord (std::string_view stored, Index &index)
+{
+  // The record first: an entry must never point past the end of a segment,
+  // and a logged entry must not outlive its record in a crash
+  index.key = _nextKey;
+  RC rc = WriteRecord(stored, index);
+  if (rc)
+    return rc;
+  if (WriteAheadLog::instance()->IsOpen() && _segments[index.fileNr]->Sync())
+    return EDM_WRITE_ERROR;
+
+  _indexes.push_back(index);
+  if (WriteIndex(_indexes.size() - 1)) {
+    _indexes.pop_back();
+    return EDM_WRITE_ERROR;
+  }
+
+  _slots[index.key] = _indexes.size() - 1;
+  UpdateLiveBytes(index, true);
+  ++_nextKey;
+  return SUCCESS;
+}
+
+RC Mailbox::WriteRecord (std::string_view stored, Index &index)
+{
+  // Roll over unless the segment is empty, a large message gets one of its own
+  uint64_t record = sizeof(RecordHeader) + stored.size();
+  uint64_t size   = _segments[_active]->GetSize();
+  if (size && size + record > _segmentSize) {
+    RC rc = OpenSegment(_segments.size(), true);
+    if (rc)
+      return rc;
+    _active = _segments.size() - 1;
+  }
+
+  index.fileNr = _active;
+  index.storedLength = stored.size();
+  index.arrival = GetArrival();
+  if (_segments[_active]->Append(index.key, stored, index.length,
+                                 index.flags & INDEX_COMPRESSED ? RECORD_COMPRESSED : 0, index.offset))
+    return EDM_WRITE_ERROR;
+  return SUCCESS;
+}
+
+RC Mailbox::ReadRecord (const Index &index, std::string &message)
+{
+  if (!(index.flags & INDEX_COMPRESSED))
+    return _segments[index.fileNr]->Read(index.key, index.offset, index.storedLength, message);
+
+  std::string stored;
+  RC rc = _segments[index.fileNr]->Read(index.key, index.offset, index.storedLength, stored);
+  if (rc)
+    return rc;
+  message.resize(index.length);
+  if (!Decompress(stored.data(), stored.size(), message.data(), index.length)) {
+    message.clear();
+    return EDM_CORRUPTED;
+  }
+  return SUCCESS;
+}
+
+void Mailbox::BuildSlots ()
+{
+  _slots.clear();
+  _hashes.clear();
+  _slots.reserve(_indexes.size());
+  for (size_t slot = 0; slot < _indexes.size(); ++slot) {
+    const Index &index = _indexes[slot];
+    if (index.flags & INDEX_DELETED)
+      continue;
+    _slots[index.key] = slot;
+    if (index.refs)
+      _hashes.emplace(index.hash, slot);
+  }
+}
+
+RC Mailbox::OpenSegment (uint32_t fileNr, bool create)
+{
+  std::shared_ptr<Segment> segment(new Segment(GetFileName(fileNr)));
+  RC rc = segment->Open(create);
+  if (rc)
+    return rc;
+  // Entries are logged for its records next, the file must not be lost in a crash
+  if (create)
+    SyncDirectory(_path);
+  if (fileNr >= _segments.size()) {
+    _segments.resize(fileNr + 1);
+    _liveBytes.resize(fileNr + 1, 0);
+  }
+  _segments[fileNr] = std::move(segment);
+  return SUCCESS;
+}
+
+void Mailbox::RemoveOrphans ()
+{
+  DIR *directory = opendir(_path.c_str());
+  if (!directory)
+    return;
+
+  std::string extension = DATA_EXTENSION;
+  std::string stage     = STAGE_EXTENSION;
+  struct dirent *entry;
+  while ((entry = readdir(directory))) {
+    std::string name = entry->d_name;
+    // Messages that were streaming in when the server stopped
+    if (name.size() > stage.size() && !name.compare(name.size() - stage.size(), stage.size(), stage)) {
+      unlink((_path + name).c_str());
+      continue;
+    }
+    if (name.size() <= extension.size() || name.compare(name.size() - extension.size(), extension.size(), extension))
+      continue;
+    char *end;
+    unsigned long fileNr = strtoul(name.c_str(), &end, 10);
+    if (end != name.c_str() + name.size() - extension.size())
+      continue;
+    if (fileNr >= _segments.size() || !_segments[fileNr])
+      unlink((_path + name).c_str());
+  }
+  closedir(directory);
+  unlink((_path + DIRECTORY_FILE_NAME + DF_EXTENSION + ".tmp").c_str());
+}
+
+bool Mailbox::IsSparse (uint32_t fileNr) const
+{
+  if (fileNr == _active || !_segments[fileNr] || _segments[fileNr]->GetSize() == 0)
+    return false;
+  return _liveBytes[fileNr] < _segments[fileNr]->GetSize() * COMPACT_LIVE_RATIO;
+}
+
+void Mailbox::UpdateLiveBytes (const Index &index, bool live)
+{
+  if (live) {
+    _liveBytes[index.fileNr] += RecordSize(index);
+    return;
+  }
+  _liveBytes[index.fileNr] -= RecordSize(index);
+  if (!_reported && _onSparse && IsSparse(index.fileNr)) {
+    _reported = true;
+    _onSparse(_path);
+  }
+}
+
+std::string Mailbox::GetFileName (uint32_t fileNr) const
+{
+  return _path + std::to_string(fileNr) + DATA_EXTENSION;
+}
+
+/************ EmailDataManager *************/
+/**
+ * Replays the DirectoryRedo entries of one record. An entry whose record did
+ * not make it to the disk is written as deleted, the message was never
+ * acknowledged. The summary of the mailbox goes, to be made again from the
+ * repaired directory file by the next Open().
+ */
+static RC RedoIndex (const std::string &path, std::string_view payload)
+{
+  if (payload.empty() || payload.size() % sizeof(DirectoryRedo))
+    return EDM_CORRUPTED;
+
+  // Nothing to do for a mailbox removed since
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd == -1)
+    return errno == ENOENT ? SUCCESS : EDM_OPEN_ERROR;
+  DirectoryHeader header;
+  if (!ReadAll(fd, &header, sizeof(header), 0) || header.magic != DIRECTORY_MAGIC) {
+    close(fd);
+    return SUCCESS;
+  }
+
+  bool written = true, redone = false;
+  std::string directory = path.substr(0, path.rfind('/') + 1);
+  for (size_t offset = 0; written && offset < payload.size(); offset += sizeof(DirectoryRedo)) {
+    DirectoryRedo redo;
+    memcpy(&redo, payload.data() + offset, sizeof(redo));
+    if (header.generation != redo.generation)
+      continue;
+    Index &index = redo.index;
+    if (IsLocal(index) && !(index.flags & INDEX_DELETED)) {
+      Segment segment(directory + std::to_string(index.fileNr) + DATA_EXTENSION);
+      std::string stored;
+      if (segment.Open(false) || segment.Read(index.key, index.offset, index.storedLength, stored))
+        index.flags |= INDEX_DELETED;
+    }
+    written = WriteAll(fd, &index, sizeof(index), redo.position);
+    redone  = true;
+  }
+  close(fd);
+  if (redone)
+    unlink((directory + SUMMARY_FILE_NAME + SUMMARY_EXTENSION).c_str());
+  return written ? SUCCESS : EDM_WRITE_ERROR;
+}
+
+EmailDataManager* EmailDataManager::instance ()
+{
+  static EmailDataManager *edm = new EmailDataManager();
+  return edm;
+}
+
+EmailDataManager::EmailDataManager()
+  : _segmentSize(SEGMENT_SIZE),
+    _compress(true),
+    _sharedPath(std::string(DATAPATH) + SHARED_STORE_NAME)
+{
+  WriteAheadLog::instance()->SetHandler(WAL_OWNER_EDM, RedoIndex);
+}
+
+RC EmailDataManager::OpenMailbox (const std::string &path, std::shared_ptr<Mailbox> &mailbox)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return OpenLocked(path, mailbox);
+}
+
+RC EmailDataManager::Deliver (std::string_view message, const std::vector<std::string> &paths, std::vector<uint64_t> &keys)
+{
+  keys.clear();
+  if (paths.empty())
+    return SUCCESS;
+
+  std::vector<std::shared_ptr<Mailbox>> mailboxes;
+  std::shared_ptr<Mailbox> shared;
+  RC rc = OpenRecipients(paths, mailboxes, shared);
+  if (rc)
+    return rc;
+
+  // A single recipient gains nothing from the shared store
+  if (!shared) {
+    keys.resize(1);
+    return mailboxes[0]->Append(message, keys[0]);
+  }
+
+  ContentHash hash;
+  hash.Update(message.data(), message.size());
+  Index index;
+  if ((rc = shared->Share(message, hash.GetValue(), paths.size(), index)))
+    return rc;
+  return Spread(shared, index, mailboxes, keys);
+}
+
+RC EmailDataManager::Deliver (const std::vector<std::string_view> &messages, const std::string &path,
+                              std::vector<uint64_t> &keys)
+{
+  keys.clear();
+  std::shared_ptr<Mailbox> mailbox;
+  RC rc = OpenMailbox(path, mailbox);
+  if (rc)
+    return rc;
+  return mailbox->Append(messages, keys);
+}
+
+void EmailDataManager::OpenStream (const std::vector<std::string> &paths, std::unique_ptr<MessageStream> &stream)
+{
+  stream.reset(new MessageStream(paths));
+}
+
+void EmailDataManager::SetSharedPath (const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _sharedPath = path;
+}
+
+void EmailDataManager::SetSegmentSize (uint64_t bytes)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _segmentSize = bytes;
+}
+
+void EmailDataManager::SetCompression (bool compress)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _compress = compress;
+}
+
+void EmailDataManager::TakeSparse (std::vector<std::string> &paths)
+{
+  std::lock_guard<std::mutex> lock(_sparseLock);
+  paths.assign(_sparse.begin(), _sparse.end());
+  _sparse.clear();
+}
+
+// Private helper functions
+RC EmailDataManager::OpenLocked (const std::string &name, std::shared_ptr<Mailbox> &mailbox)
+{
+  // Same form as the paths given to the sparse callback
+  std::string path = name;
+  if (path.empty() || path.back() != '/')
+    path += '/';
+  std::string sharedPath = _sharedPath;
+  if (sharedPath.empty() || sharedPath.back() != '/')
+    sharedPath += '/';
+
+  mailbox = _mailboxes[path].lock();
+  if (mailbox)
+    return SUCCESS;
+
+  // Every mailbox may point into the shared store, it is opened first
+  std::shared_ptr<Mailbox> shared;
+  if (path != sharedPath) {
+    RC rc = OpenLocked(sharedPath, shared);
+    if (rc)
+      return rc;
+  }
+
+  // Forget the mailboxes closed since, the map only keeps the open ones
+  for (auto entry = _mailboxes.begin(); entry != _mailboxes.end();) {
+    if (entry->second.expired() && entry->first != path)
+      entry = _mailboxes.erase(entry);
+    else
+      ++entry;
+  }
+
+  std::shared_ptr<Mailbox> opened(new Mailbox(path, _segmentSize, _compress, shared));
+  opened->SetSparseCallback([this](const std::string &sparse) {
+    std::lock_guard<std::mutex> sparseLock(_sparseLock);
+    _sparse.insert(sparse);
+  });
+  RC rc = opened->Open();
+  if (rc) {
+    _mailboxes.erase(path);
+    return rc;
+  }
+  _mailboxes[path] = opened;
+  mailbox = std::move(opened);
+  return SUCCESS;
+}
+
+RC EmailDataManager::OpenRecipients (const std::vector<std::string> &paths,
+                                     std::vector<std::shared_ptr<Mailbox>> &mailboxes,
+                                     std::shared_ptr<Mailbox> &shared)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  mailboxes.resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    RC rc = OpenLocked(paths[i], mailboxes[i]);
+    if (rc)
+      return rc;
+  }
+  shared.reset();
+  if (paths.size() > 1)
+    return OpenLocked(_sharedPath, shared);
+  return SUCCESS;
+}
+
+RC EmailDataManager::Spread (const std::shared_ptr<Mailbox> &shared, const Index &index,
+                             const std::vector<std::shared_ptr<Mailbox>> &mailboxes, std::vector<uint64_t> &keys)
+{
+  keys.clear();
+  for (size_t i = 0; i < mailboxes.size(); ++i) {
+    uint64_t key;
+    RC rc = mailboxes[i]->AppendShared(index, key);
+    if (rc) {
+      // Take back what has been delivered, and the references never used
+      for (size_t j = 0; j < i; ++j)
+        mailboxes[j]->Delete(keys[j]);
+      for (size_t j = i; j < mailboxes.size(); ++j)
+        shared->Release(index.key);
+      keys.clear();
+      return rc;
+    }
+    keys.push_back(key);
+  }
+  return SUCCESS;
+}
+
+/************ MessageStream *************/
+MessageStream::MessageStream(const std::vector<std::string> &paths)
+  : _paths(paths),
+    _length(0),
+    _committed(false)
+{
+  _buffer.reserve(STREAM_CHUNK_SIZE);
+}
+
+MessageStream::~MessageStream()
+{
+  // A staging file given up on, Adopt() renamed the others
+  if (_staging && !_committed)
+    unlink(_staging->GetName().c_str());
+}
+
+RC MessageStream::Write (std::string_view data)
+{
+  if (_length + data.size() > UINT32_MAX)
+    return EDM_TOO_LARGE;
+  _hash.Update(data.data(), data.size());
+  _buffer.append(data);
+  _length += data.size();
+  return SUCCESS;
+}
+
+RC MessageStream::Flush ()
+{
+  return WriteChunks(_buffer.size() - _buffer.size() % STREAM_CHUNK_SIZE);
+}
+
+RC MessageStream::Commit (std::vector<uint64_t> &keys)
+{
+  keys.clear();
+  if (_paths.empty())
+    return SUCCESS;
+
+  // Small enough to have stayed in memory: stored like any other message
+  if (!_staging)
+    return EmailDataManager::instance()->Deliver(_buffer, _paths, keys);
+
+  RC rc = WriteChunks(_buffer.size());
+  if (rc || (rc = _staging->Sync()))
+    return rc;
+
+  Index index;
+  uint32_t refs = _mailboxes.size() > 1 ? _mailboxes.size() : 0;
+  rc = _target->Adopt(_staging, _length, _hash.GetValue(), refs, index);
+  _committed = rc == SUCCESS;
+  if (rc)
+    return rc;
+  if (_target == _mailboxes[0]) {
+    keys.push_back(index.key);
+    return SUCCESS;
+  }
+  return EmailDataManager::instance()->Spread(_target, index, _mailboxes, keys);
+}
+
+// Private helper functions
+RC MessageStream::WriteChunks (size_t bytes)
+{
+  if (!bytes)
+    return SUCCESS;
+
+  RC rc;
+  if (!_staging) {
+    if (_paths.empty())
+      return SUCCESS;
+    std::shared_ptr<Mailbox> shared;
+    if ((rc = EmailDataManager::instance()->OpenRecipients(_paths, _mailboxes, shared)))
+      return rc;
+    _target = shared ? shared : _mailboxes[0];
+    if ((rc = _target->Stage(_staging)))
+      return rc;
+  }
+
+  if ((rc = _staging->Write(std::string_view(_buffer.data(), bytes))))
+    return rc;
+  _buffer.erase(0, bytes);
+  return SUCCESS;
+}
@@ -0,0 +1,705 @@
+#ifndef EMAIL_DATA_MANAGER
+#define EMAIL_DATA_MANAGER
+
+/* ----- Include libries or files ----- */
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+#include "segment.h"
+#include "summary.h"
+
+/* ----- Define macros ----- */
+enum {
+  EDM_OPEN_ERROR = 601,
+  EDM_READ_ERROR,
+  EDM_WRITE_ERROR,
+  EDM_NO_SUCH_MESSAGE,
+  EDM_CORRUPTED,
+  EDM_COMPRESSED,
+  EDM_TOO_LARGE,
+};
+
+#define DIRECTORY_MAGIC    0x4D444645    // "EFDM" in the .df header
+#define DIRECTORY_VERSION  4             // 1 was the 16-bit layout of the design doc, 3 had no hash
+#define INDEX_DELETED      0x1           // Index flag: the message has been deleted
+#define INDEX_COMPRESSED   0x2           // Index flag: the message is stored compressed
+#define INDEX_SHARED       0x4           // Index flag: the message is a record of the shared store
+#define COMPRESS_MIN_SIZE  1024          // Smaller messages are always stored as they are
+#define COMPRESS_MIN_SAVING 8            // Compressed only if it saves 1/8 of the message
+#define COMPACT_LIVE_RATIO 0.5           // Segments with less live data than this are compacted
+#define STREAM_CHUNK_SIZE  (64 * 1024)   // Bytes a MessageStream writes at once
+const char DIRECTORY_FILE_NAME[] = "directory";
+const char SHARED_STORE_NAME[]   = "shared/";   // Under DATAPATH unless set otherwise
+const char STAGE_EXTENSION[]     = ".stage";    // Segment of a message still streaming in
+
+/* ----- Define structs ----- */
+/**
+ * Index
+ * One entry of the directory file. Keys are given in increasing order and
+ * never reused, so a mailbox is not limited to 65,536 messages.
+ *
+ * An entry with INDEX_SHARED holds no bytes of its own: offset is the key of
+ * the record in the shared store, and fileNr is not used. Entries of the
+ * shared store count in refs the mailbox entries pointing to them.
+ */
+struct Index {
+  uint64_t key;          // Unique key of the message in the mailbox
+  uint32_t fileNr;       // Segment holding the message
+  uint32_t flags;        // INDEX_DELETED, INDEX_COMPRESSED, INDEX_SHARED
+  uint64_t offset;       // Position of the message in the segment, after its RecordHeader
+  uint32_t length;       // Length of the message, what POP3 LIST reports
+  uint32_t storedLength; // Bytes it takes in the segment
+  uint64_t hash;         // ContentHash of the message, 0 in entries older than the summary
+  uint32_t refs;         // Mailbox entries pointing here, shared store only
+  uint32_t arrival;      // Seconds since the epoch it was stored at, 0 in entries older than the field
+};
+static_assert(sizeof(Index) == 48, "Index is stored as it is in the .df file");
+
+struct DirectoryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t nextKey;       // Keys below are taken, even when their entries are gone
+  uint64_t generation;    // One more with every rewrite of the file
+  uint64_t reserved;
+};
+static_assert(sizeof(DirectoryHeader) == 32, "DirectoryHeader is stored as it is in the .df file");
+
+/**
+ * DirectoryRedo
+ * The payload of a WAL record of the EDM is one or more of these, each an
+ * entry written to a directory file. A record of an older generation is not replayed, the rewrite that
+ * came after it is on the disk already.
+ */
+struct DirectoryRedo {
+  uint64_t generation;    // Generation of the directory file the entry was written to
+  uint64_t position;      // Offset of the entry in the file
+  Index    index;
+};
+
+/**
+ * Mailbox
+ * This class stores the messages of one mailbox: a directory file (.df) of
+ * Index entries and the segments holding the messages. New messages are
+ * appended to the last segment; a new one is started once the next record
+ * would take it past the segment size, so a segment holds many small messages
+ * or one large one.
+ *
+ * Messages of COMPRESS_MIN_SIZE or more are compressed (codec.cpp) unless that
+ * saves too little, as for attachments that are compressed already. The entry
+ * keeps both lengths, so sizes are reported without reading anything.
+ *
+ * The directory file is loaded into memory the first time a message is used
+ * and a hash table maps every key to its entry, so finding a message costs
+ * one probe and reading it one positioned read. New entries are appended to
+ * the directory file, a deletion rewrites its entry in place.
+ *
+ * A message for several local recipients is stored once, in the shared
+ * store: a Mailbox like the others whose entries count references (see
+ * EmailDataManager::Deliver()). The entries of the recipients point to it
+ * and reading goes through to it; deleting one drops a reference, and the
+ * record is only deleted, and left to compaction, with the last reference.
+ *
+ * Deleted messages leave dead records behind. Compact() copies the live
+ * records of sparse segments into new ones and swaps the directory file for a
+ * rewritten one with rename(), so a crash leaves either the old or the new
+ * directory, never a mix. The old segments are unlinked afterwards.
+ *
+ * With the WriteAheadLog open, every entry written to the directory file is
+ * logged first, and a new record is synced before its entry, so a crash
+ * between the two is repaired at the next start (EmailDataManager sets the
+ * handler). The entries of a bulk deletion share one log record, so
+ * deleting many messages costs one sync. Rewrites of the directory file are
+ * atomic by themselves.
+ *
+ * Next to the directory file, a Summary keeps the totals and a dense array
+ * of key, length and UID for POP3: the entries written to the directory file
+ * are written to it as well, so STAT and LIST never walk the directory. Open()
+ * only reads the header of the directory file: a summary made from the same
+ * generation with as many entries, whose entries match its checksum, is
+ * trusted, and STAT, LIST and UIDL of a mailbox nobody reads from never load
+ * the directory. A summary that does
+ * not match is made again from the directory, and WAL recovery removes the
+ * summary of every directory file it repairs.
+ *
+ * Several threads may use one Mailbox: reads share a lock, changes take it
+ * alone. Compact() only takes it to start and to swap.
+ *
+ * Contained Public Functions:
+ *   RC Append (std::string_view message, uint64_t &key)
+ *   RC Append (const std::vector<std::string_view> &messages, std::vector<uint64_t> &keys)
+ *   RC AppendShared (const Index &shared, uint64_t &key)
+ *   RC Share   (std::string_view message, uint64_t hash, uint32_t refs, Index &index)
+ *   RC Release (uint64_t key)
+ *   RC Release (const std::vector<uint64_t> &keys)
+ *   RC Stage   (std::shared_ptr<Segment> &segment)
+ *   RC Adopt   (const std::shared_ptr<Segment> &segment, uint32_t length, uint64_t hash, uint32_t refs, Index &index)
+ *   RC Read   (uint64_t key, std::string &message)
+ *   RC Lookup (uint64_t key, Index &index)
+ *   RC Locate (uint64_t key, std::shared_ptr<Segment> &segment, off_t &offset, size_t &length)
+ *   RC Delete (uint64_t key)
+ *   RC Delete (const std::vector<uint64_t> &keys, size_t &deleted)
+ *   RC Compact (const std::function<bool(size_t)> &throttle, uint64_t &reclaimed)
+ *   bool IsSparse ()
+ *   void ListMessages (std::vector<Index> &indexes)
+ *   void ListSummary  (std::vector<SummaryEntry> &entries)
+ *   void GetTotals    (uint64_t &number, uint64_t &octets)
+ *   size_t GetMessageNumber ()
+ *   uint64_t GetNextKey ()
+ */
+class Mailbox
+{
+public:
+  Mailbox(const std::string &path, uint64_t segmentSize = SEGMENT_SIZE, bool compress = true,
+          std::shared_ptr<Mailbox> shared = NULL);
+  ~Mailbox();
+
+  Mailbox(const Mailbox &) = delete;
+  Mailbox &operator=(const Mailbox &) = delete;
+
+  /**
+   * This function will create the directory of the mailbox if needed and read
+   * the header of its directory file, loading the entries only if the
+   * summary has to be made again.
+   * @return SUCCESS if the mailbox is ready.
+   *         EDM_OPEN_ERROR if a file cannot be created or opened.
+   *         EDM_CORRUPTED if the directory file is not one of ours.
+   */
+  RC Open ();
+
+  /**
+   * This function will store a new message.
+   * @param  string_view given as the message.
+   *         uint64_t stores the key given to the message.
+   * @return SUCCESS if the message and its entry have been written.
+   *         EDM_TOO_LARGE if it is 4 GiB or more.
+   *         EDM_OPEN_ERROR or EDM_WRITE_ERROR otherwise.
+   */
+  RC Append (std::string_view message, uint64_t &key);
+
+  /**
+   * This function will store several new messages: their records are synced
+   * once a segment and their entries written as one record of the
+   * WriteAheadLog.
+   * @param  const vector given as the messages.
+   *         vector stores the keys given to them, in the same order.
+   * @return same as Append(), none of them is stored on an error.
+   */
+  RC Append (const std::vector<std::string_view> &messages, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will add an entry pointing to a record of the shared store,
+   * which must have a reference taken for it already.
+   * @param  const Index given as the entry of the record in the shared store.
+   *         uint64_t stores the key given to the message.
+   * @return SUCCESS if the entry has been written.
+   *         EDM_WRITE_ERROR otherwise.
+   */
+  RC AppendShared (const Index &shared, uint64_t &key);
+
+  /**
+   * This function will take references to a message in the shared store,
+   * storing it unless an identical message is there already.
+   * @param  string_view given as the message.
+   *         uint64_t given as its ContentHash.
+   *         uint32_t given as the number of references to take.
+   *         Index stores the entry of the record.
+   * @return same as Append().
+   */
+  RC Share   (std::string_view message, uint64_t hash, uint32_t refs, Index &index);
+
+  /**
+   * This function will drop one reference to a record of the shared store and
+   * delete the record with the last one.
+   * @param  uint64_t given as the key of the record.
+   * @return same as Delete().
+   */
+  RC Release (uint64_t key);
+
+  /**
+   * This function will drop one reference for every key given, a key given
+   * twice dropping two, with one write of the directory entries.
+   * @param  const vector given as the keys of the records.
+   * @return SUCCESS if every reference there was has been dropped.
+   *         EDM_WRITE_ERROR otherwise, none is dropped then.
+   */
+  RC Release (const std::vector<uint64_t> &keys);
+
+  /**
+   * This function will create the segment a message is streamed into. It is
+   * not part of the mailbox until Adopt(), and its file is removed at the
+   * next Open() if that never happens.
+   * @param  shared_ptr stores the segment, empty and open.
+   * @return SUCCESS if the segment has been created.
+   *         EDM_OPEN_ERROR otherwise.
+   */
+  RC Stage   (std::shared_ptr<Segment> &segment);
+
+  /**
+   * This function will make the message streamed into a segment from Stage()
+   * a message of the mailbox. Its bytes must be on the disk already; only the
+   * header is written with the lock held, and the segment is renamed and the
+   * directory synced before the entry is logged.
+   * @param  shared_ptr given as the segment.
+   *         uint32_t given as the length of the message.
+   *         uint64_t given as its ContentHash.
+   *         uint32_t given as the references to take, 0 outside the shared store.
+   *         Index stores the entry of the message.
+   * @return SUCCESS if the message and its entry have been written.
+   *         EDM_WRITE_ERROR otherwise.
+   */
+  RC Adopt   (const std::shared_ptr<Segment> &segment, uint32_t length, uint64_t hash, uint32_t refs, Index &index);
+
+  /**
+   * This function will read a whole message.
+   * @param  uint64_t given as the key.
+   *         string stores the message.
+   * @return SUCCESS if the message has been read.
+   *         EDM_NO_SUCH_MESSAGE if no message has this key.
+   *         EDM_CORRUPTED if its record fails the checksum.
+   *         EDM_READ_ERROR otherwise.
+   */
+  RC Read   (uint64_t key, std::string &message);
+
+  /**
+   * This function will give the directory entry of a message.
+   * @param  uint64_t given as the key.
+   *         Index stores the entry.
+   * @return SUCCESS if the message exists.
+   *         EDM_NO_SUCH_MESSAGE otherwise.
+   */
+  RC Lookup (uint64_t key, Index &index);
+
+  /**
+   * This function will name the file range holding a message, so it can be
+   * sent without copying. Holding the segment keeps its file open, even after
+   * compaction has unlinked it.
+   * @param  uint64_t given as the key.
+   *         shared_ptr stores the segment, GetFd() gives its file descriptor.
+   *         off_t stores the offset of the message.
+   *         size_t stores the length of the message.
+   * @return SUCCESS if the message exists.
+   *         EDM_COMPRESSED if it is stored compressed, use Read() then.
+   *         EDM_NO_SUCH_MESSAGE otherwise.
+   */
+  RC Locate (uint64_t key, std::shared_ptr<Segment> &segment, off_t &offset, size_t &length);
+
+  /**
+   * This function will delete a message. Its record stays in the segment.
+   * @param  uint64_t given as the key.
+   * @return SUCCESS if the entry has been marked deleted.
+   *         EDM_NO_SUCH_MESSAGE if no message has this key.
+   *         EDM_WRITE_ERROR otherwise.
+   */
+  RC Delete (uint64_t key);
+
+  /**
+   * This function will delete many messages at once: their entries are
+   * written together, as one record of the WriteAheadLog synced once, and the
+   * references they hold in the shared store are dropped the same way. Keys
+   * of no message are skipped.
+   * @param  const vector given as the keys.
+   *         size_t stores the number of messages deleted.
+   * @return SUCCESS if the entries have been marked deleted.
+   *         EDM_WRITE_ERROR otherwise, none is deleted then.
+   */
+  RC Delete (const std::vector<uint64_t> &keys, size_t &deleted);
+
+  /**
+   * This function will rewrite the sparse segments. Records are copied without
+   * holding the lock, throttle() is called after each one and may sleep to
+   * limit the disk bandwidth taken from the deliveries.
+   * A mailbox not compacted whole, given up or failed, is reported sparse
+   * again for the next Compactor run.
+   * @param  function given as the throttle, returns false to give up.
+   *         uint64_t stores the number of bytes freed on the disk.
+   * @return SUCCESS if the sparse segments are gone or the throttle gave up.
+   *         pre-defined error number of the file operations otherwise.
+   */
+  RC Compact (const std::function<bool(size_t)> &throttle, uint64_t &reclaimed);
+
+  /**
+   * This function will tell if a segment has less than COMPACT_LIVE_RATIO of
+   * its bytes in live records.
+   * @return true if Compact() has something to do.
+   */
+  bool IsSparse ();
+
+  /**
+   * This function will set what is called when a deletion leaves a segment
+   * sparse, or the directory is loaded with one left sparse before a
+   * restart. Called with the lock held, so it must not use the Mailbox.
+   * @param function given as the callback, given the path of the mailbox.
+   */
+  void SetSparseCallback (std::function<void(const std::string &)> callback) { _onSparse = std::move(callback); };
+
+  /**
+   * This function will give the entries of the messages not deleted, by key.
+   * @param vector stores the entries.
+   */
+  void ListMessages (std::vector<Index> &indexes);
+
+  /**
+   * This function will give what POP3 LIST and UIDL report of the messages
+   * not deleted, by key: one pass over the summary.
+   * @param vector stores the entries.
+   */
+  void ListSummary (std::vector<SummaryEntry> &entries);
+
+  /**
+   * This function will give what POP3 STAT reports, without a walk.
+   * @param uint64_t stores the number of messages not deleted.
+   *        uint64_t stores their total length.
+   */
+  void GetTotals (uint64_t &number, uint64_t &octets);
+
+  /**
+   * This function will count the messages not deleted.
+   * @return size_t as the number of messages.
+   */
+  size_t GetMessageNumber ();
+
+  /**
+   * This function will give the key the next message will get. Every key
+   * below has been given, keys of deleted messages included.
+   * @return uint64_t as the key.
+   */
+  uint64_t GetNextKey ();
+
+  const std::string &GetPath () const { return _path; }
+
+private:
+  std::string _path;                          // Directory of the mailbox, ends with '/'
+  std::mutex _compactLock;                    // One Compact() at a time
+  std::shared_mutex _lock;                    // Guards the members below
+  int _directoryId;                           // Directory file
+  uint64_t _segmentSize;                      // Size at which a new segment is started
+  bool _compress;                             // Compress new messages
+  std::shared_ptr<Mailbox> _shared;           // Shared store, NULL in the shared store itself
+  std::vector<std::shared_ptr<Segment>> _segments; // By file number, NULL once unlinked
+  std::vector<uint64_t> _liveBytes;           // Bytes of live records, by file number
+  uint32_t _active;                           // Segment taking new messages
+  std::vector<Index> _indexes;                // Entries in directory file order
+  std::unordered_map<uint64_t, size_t> _slots; // Key to position in _indexes, deleted ones left out
+  std::unordered_map<uint64_t, size_t> _hashes; // Content hash to position, shared store only
+  uint64_t _nextKey;
+  uint64_t _generation;                       // Of the directory file, see DirectoryHeader
+  uint64_t _nextStage;                        // Number of the next file made by Stage()
+  std::atomic<bool> _loaded;                  // The entries and segments below are in memory
+  Summary _summary;                           // Follows _indexes, see Summary
+  bool _reported;                             // _onSparse called since the last Compact()
+  std::function<void(const std::string &)> _onSparse;
+
+  // Private helper functions
+  /**
+   * This function will read the header of the directory file, writing one
+   * into a new file.
+   * @param  size_t stores the number of entries of the file.
+   * @return same as Open().
+   */
+  RC OpenDirectory (size_t &number);
+
+  /**
+   * This function will read the directory file into _indexes and _slots and
+   * open the segments, with the lock held.
+   * @return same as Open().
+   */
+  RC LoadDirectory ();
+
+  /**
+   * This function will load the directory the first time it is needed.
+   * @return same as Open().
+   */
+  RC Load ();
+
+  /**
+   * This function will write one entry of the directory file, through the
+   * WriteAheadLog when it is open.
+   * @param size_t given as the position of the entry.
+   * @return SUCCESS if written, EDM_WRITE_ERROR otherwise.
+   */
+  RC WriteIndex (size_t slot);
+
+  /**
+   * This function will write several entries of the directory file, as one
+   * record of the WriteAheadLog when it is open.
+   * @param const vector given as the positions of the entries, increasing.
+   * @return SUCCESS if written, EDM_WRITE_ERROR otherwise.
+   */
+  RC WriteIndexes (const std::vector<size_t> &slots);
+
+  /**
+   * This function will write the whole directory file again, without the
+   * deleted entries, and put it in place of the old one.
+   * @param  vector given as the entries to keep.
+   * @return SUCCESS if the new directory file is in place.
+   *         EDM_OPEN_ERROR or EDM_WRITE_ERROR otherwise.
+   */
+  RC RewriteDirectory (std::vector<Index> &indexes);
+
+  /**
+   * This function will open a segment and put it into _segments.
+   * @param  uint32_t given as the file number.
+   *         bool given as true for a new segment, emptied if the file exists;
+   *         the directory is synced so the file outlives a crash.
+   * @return SUCCESS if it is open, EDM_OPEN_ERROR otherwise.
+   */
+  RC OpenSegment (uint32_t fileNr, bool create);
+
+  /**
+   * This function will remove the segment files no entry points to, left by a
+   * crash in the middle of Compact().
+   */
+  void RemoveOrphans ();
+
+  /**
+   * This function will write a message to the active segment and add its
+   * entry, with the lock held.
+   * @param  string_view given as the message.
+   *         Index given as the entry, key and place are filled in.
+   * @return same as Append().
+   */
+  RC AppendRecord (std::string_view message, Index &index);
+
+  /**
+   * This function will write the record of a message to the active segment,
+   * rolling over if it is full, without syncing it, with the lock held.
+   * @param  string_view given as the message, as stored.
+   *         Index given as the entry with its key, the place is filled in.
+   * @return SUCCESS if written, EDM_OPEN_ERROR or EDM_WRITE_ERROR otherwise.
+   */
+  RC WriteRecord (std::string_view stored, Index &index);
+
+  /**
+   * This function will read the record of an entry of this mailbox.
+   * @return same as Read().
+   */
+  RC ReadRecord (const Index &index, std::string &message);
+
+  void BuildSlots ();
+  bool IsSparse (uint32_t fileNr) const;
+  void UpdateLiveBytes (const Index &index, bool live);
+
+  std::string GetFileName (uint32_t fileNr) const;
+};
+
+/**
+ * MessageStream
+ * This class takes one message in pieces, as they come off the wire, so a
+ * large message is stored without ever being in memory whole. Write() only
+ * copies a piece into the chunk buffer and hashes it; once IsFull(), Flush()
+ * writes the whole chunks to a segment of their own (Mailbox::Stage()). The
+ * memory taken is one chunk and one piece, whatever the message size.
+ *
+ * Nothing is visible before Commit(): it writes what is left, syncs, and only
+ * then adds the entries. A stream dropped without Commit() removes its file.
+ * A message that fits into one chunk never touches a staging file, Commit()
+ * hands it to EmailDataManager::Deliver() like any other.
+ *
+ * Write() never blocks. Flush() and Commit() do, and the mailboxes are only
+ * opened by them, so a caller that keeps the disk off its thread only has to
+ * move those two.
+ *
+ * Contained Public Functions:
+ *   RC   Write  (std::string_view data)
+ *   bool IsFull ()
+ *   RC   Flush  ()
+ *   RC   Commit (std::vector<uint64_t> &keys)
+ */
+class MessageStream
+{
+public:
+  explicit MessageStream(const std::vector<std::string> &paths);
+  ~MessageStream();
+
+  MessageStream(const MessageStream &) = delete;
+  MessageStream &operator=(const MessageStream &) = delete;
+
+  /**
+   * This function will add the next piece of the message.
+   * @param  string_view given as the piece.
+   * @return SUCCESS if it has been taken.
+   *         EDM_TOO_LARGE if the message would reach 4 GiB.
+   */
+  RC Write (std::string_view data);
+
+  /**
+   * This function will tell if a whole chunk waits for Flush().
+   * @return true if Flush() should be called before more Write().
+   */
+  bool IsFull () const { return _buffer.size() >= STREAM_CHUNK_SIZE; };
+
+  /**
+   * This function will write the whole chunks buffered.
+   * @return SUCCESS if they are written.
+   *         pre-defined error number of the mailbox or the segment otherwise.
+   */
+  RC Flush ();
+
+  /**
+   * This function will store the message for every mailbox given.
+   * @param  vector stores the key of the message in each mailbox.
+   * @return same as EmailDataManager::Deliver().
+   */
+  RC Commit (std::vector<uint64_t> &keys);
+
+private:
+  std::vector<std::string> _paths;
+  std::vector<std::shared_ptr<Mailbox>> _mailboxes; // Opened by the first Flush()
+  std::shared_ptr<Mailbox> _target;           // Where the record goes, the shared store for several
+  std::shared_ptr<Segment> _staging;          // NULL until the first chunk is written
+  std::string _buffer;                        // Bytes not written yet
+  ContentHash _hash;
+  uint64_t _length;                           // Bytes given to Write()
+  bool _committed;                            // The staging file belongs to a mailbox now
+
+  // Private helper functions
+  RC WriteChunks (size_t bytes);
+};
+
+/**
+ * EmailDataManager
+ * This class hands out the mailboxes. A mailbox opened by several sessions at
+ * once is one shared Mailbox object, so they see each other's changes and
+ * share its lock.
+ *
+ * Contained Public Functions:
+ *   EmailDataManager* instance ()
+ *   RC OpenMailbox (const std::string &path, std::shared_ptr<Mailbox> &mailbox)
+ *   RC Deliver (std::string_view message, const std::vector<std::string> &paths, std::vector<uint64_t> &keys)
+ *   RC Deliver (const std::vector<std::string_view> &messages, const std::string &path, std::vector<uint64_t> &keys)
+ *   void OpenStream (const std::vector<std::string> &paths, std::unique_ptr<MessageStream> &stream)
+ *   void SetSharedPath (const std::string &path)
+ *   void SetSegmentSize (uint64_t bytes)
+ *   void SetCompression (bool compress)
+ *   void TakeSparse (std::vector<std::string> &paths)
+ */
+class EmailDataManager
+{
+public:
+  /**
+   * This function will initialize an instance for EmailDataManager.
+   * @return pointer of EmailDataManager.
+   */
+  static EmailDataManager* instance();
+
+  /**
+   * This function will open a mailbox, creating it if it does not exist. The
+   * mailbox is closed once the last pointer to it is gone.
+   * @param  const string given as the directory of the mailbox.
+   *         shared_ptr stores the mailbox.
+   * @return SUCCESS if the mailbox is open.
+   *         pre-defined error number returned by Mailbox::Open() otherwise.
+   */
+  RC OpenMailbox (const std::string &path, std::shared_ptr<Mailbox> &mailbox);
+
+  /**
+   * This function will store one message for several mailboxes. For more than
+   * one, the message is hashed and stored once in the shared store, and every
+   * mailbox gets an entry pointing to it: one write instead of one for each.
+   * @param  string_view given as the message.
+   *         const vector given as the directories of the mailboxes.
+   *         vector stores the key of the message in each of them.
+   * @return SUCCESS if every mailbox has the message.
+   *         pre-defined error number otherwise, no mailbox has it then.
+   */
+  RC Deliver (std::string_view message, const std::vector<std::string> &paths, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will store several messages for one mailbox with one
+   * update of its directory file, see Mailbox::Append().
+   * @param  const vector given as the messages.
+   *         const string given as the directory of the mailbox.
+   *         vector stores the keys of the messages, in the same order.
+   * @return SUCCESS if the mailbox has all of them.
+   *         pre-defined error number otherwise, it has none of them then.
+   */
+  RC Deliver (const std::vector<std::string_view> &messages, const std::string &path, std::vector<uint64_t> &keys);
+
+  /**
+   * This function will start a message to be given in pieces. Opens nothing
+   * yet, so it never blocks.
+   * @param const vector given as the directories of the mailboxes.
+   *        unique_ptr stores the stream.
+   */
+  void OpenStream (const std::vector<std::string> &paths, std::unique_ptr<MessageStream> &stream);
+
+  /**
+   * This function will set the directory of the shared store, for the
+   * mailboxes opened from now on.
+   * @param const string given as the directory.
+   */
+  void SetSharedPath (const std::string &path);
+
+  /**
+   * This function will set the size at which the mailboxes opened from now on
+   * start a new segment.
+   * @param uint64_t given as the number of bytes.
+   */
+  void SetSegmentSize (uint64_t bytes);
+
+  /**
+   * This function will choose if the mailboxes opened from now on compress
+   * the messages. On by default.
+   * @param bool given as true to compress.
+   */
+  void SetCompression (bool compress);
+
+  /**
+   * This function will give the mailboxes that have sparse segments since the
+   * last call, for the Compactor.
+   * @param vector stores the paths of the mailboxes.
+   */
+  void TakeSparse (std::vector<std::string> &paths);
+
+protected:
+  EmailDataManager();       // Constructor
+  ~EmailDataManager() {};   // Destructor
+
+private:
+  std::mutex _lock;                                       // Guards the members below
+  uint64_t _segmentSize;
+  bool _compress;
+  std::string _sharedPath;                                // Directory of the shared store
+  std::map<std::string, std::weak_ptr<Mailbox>> _mailboxes; // Open mailboxes by path
+  std::mutex _sparseLock;                                 // Guards _sparse, taken under a Mailbox lock
+  std::set<std::string> _sparse;                          // Mailboxes waiting for the Compactor
+
+  friend class MessageStream;
+
+  // Private helper functions
+  RC OpenLocked (const std::string &path, std::shared_ptr<Mailbox> &mailbox);
+
+  /**
+   * This function will open the mailboxes of a delivery, and the shared store
+   * if there is more than one.
+   * @param  const vector given as the directories of the mailboxes.
+   *         vector stores the mailboxes.
+   *         shared_ptr stores the shared store, NULL for one mailbox.
+   * @return SUCCESS if all are open, same as OpenMailbox() otherwise.
+   */
+  RC OpenRecipients (const std::vector<std::string> &paths, std::vector<std::shared_ptr<Mailbox>> &mailboxes,
+                     std::shared_ptr<Mailbox> &shared);
+
+  /**
+   * This function will give every mailbox an entry pointing to a record of the
+   * shared store that has one reference for each of them. On failure the
+   * entries made are deleted and the references not used dropped.
+   * @return SUCCESS if every mailbox has its entry.
+   *         EDM_WRITE_ERROR otherwise.
+   */
+  RC Spread (const std::shared_ptr<Mailbox> &shared, const Index &index,
+             const std::vector<std::shared_ptr<Mailbox>> &mailboxes, std::vector<uint64_t> &keys);
+};
+
+#endif
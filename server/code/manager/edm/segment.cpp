@@ -0,0 +1,238 @@
+/*
+ * segment.cpp
+ *
+ * This file provides the append-only content storage files of the Email Data
+ * Manager and the hash finding identical messages.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "edm.h"
+#include "segment.h"
+
+/************ ContentHash *************/
+void ContentHash::Mix (uint64_t word)
+{
+  _state ^= word * 0x87C37B91114253D5ull;
+  _state  = (_state << 31 | _state >> 33) * 0x4CF5AD432745937Full;
+}
+
+void ContentHash::Update (const void *data, size_t length)
+{
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  _length += length;
+
+  // Finish the word left over by the last piece
+  while (_tailLength && length) {
+    _tail[_tailLength++] = *bytes++;
+    --length;
+    if (_tailLength == sizeof(_tail)) {
+      uint64_t word;
+      memcpy(&word, _tail, sizeof(word));
+      Mix(word);
+      _tailLength = 0;
+    }
+  }
+  for (; length >= 8; bytes += 8, length -= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    Mix(word);
+  }
+  memcpy(_tail + _tailLength, bytes, length);
+  _tailLength += length;
+}
+
+uint64_t ContentHash::GetValue () const
+{
+  uint64_t word = 0;
+  memcpy(&word, _tail, _tailLength);
+  uint64_t hash = _state ^ (word * 0x87C37B91114253D5ull) ^ _length;
+  // Final avalanche, every input bit reaches every output bit
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDull;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/************ Helper Functions *************/
+// The stored bytes come first, so a streamed record is checksummed as it is written
+static uint32_t RecordChecksum (const RecordHeader &header, uint32_t storedCrc)
+{
+  // Everything after the checksum field
+  const char *fields = reinterpret_cast<const char *>(&header.key);
+  return Crc32c(fields, reinterpret_cast<const char *>(&header + 1) - fields, storedCrc);
+}
+
+/************ Segment *************/
+Segment::Segment(const std::string &name)
+  : _name(name),
+    _fd(-1),
+    _size(0),
+    _crc(0)
+{
+}
+
+Segment::~Segment()
+{
+  if (_fd != -1)
+    close(_fd);
+}
+
+RC Segment::Open (bool create)
+{
+  _fd = open(_name.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0600);
+  if (_fd == -1)
+    return EDM_OPEN_ERROR;
+
+  // Appending goes on after whatever is there, even a torn record
+  struct stat status;
+  if (fstat(_fd, &status))
+    return EDM_OPEN_ERROR;
+  _size = status.st_size;
+  return SUCCESS;
+}
+
+RC Segment::Append (uint64_t key, std::string_view stored, uint32_t length, uint32_t flags, uint64_t &offset)
+{
+  RecordHeader header = {};
+  header.magic        = RECORD_MAGIC;
+  header.key          = key;
+  header.length       = length;
+  header.storedLength = stored.size();
+  header.flags        = flags;
+  header.checksum     = RecordChecksum(header, Crc32c(stored.data(), stored.size()));
+
+  // Header and message go out with one write at the end of the file
+  struct iovec parts[2];
+  parts[0].iov_base = &header;
+  parts[0].iov_len  = sizeof(header);
+  parts[1].iov_base = const_cast<char *>(stored.data());
+  parts[1].iov_len  = stored.size();
+
+  uint64_t position = _size;
+  size_t   left     = sizeof(header) + stored.size();
+  int      first    = 0;
+  while (left) {
+    ssize_t written = pwritev(_fd, parts + first, 2 - first, position);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return EDM_WRITE_ERROR;
+    }
+    position += written;
+    left     -= written;
+    for (; first < 2 && static_cast<size_t>(written) >= parts[first].iov_len; ++first)
+      written -= parts[first].iov_len;
+    if (first < 2) {
+      parts[first].iov_base = static_cast<char *>(parts[first].iov_base) + written;
+      parts[first].iov_len -= written;
+    }
+  }
+
+  offset = _size + sizeof(header);
+  _size  = position;
+  return SUCCESS;
+}
+
+RC Segment::Read (uint64_t key, uint64_t offset, uint32_t storedLength, std::string &stored)
+{
+  if (offset < sizeof(RecordHeader))
+    return EDM_CORRUPTED;
+
+  // The header and the stored bytes with one read
+  RecordHeader header;
+  stored.resize(storedLength);
+  struct iovec parts[2];
+  parts[0].iov_base = &header;
+  parts[0].iov_len  = sizeof(header);
+  parts[1].iov_base = stored.data();
+  parts[1].iov_len  = storedLength;
+
+  uint64_t position = offset - sizeof(RecordHeader);
+  ssize_t  bytes;
+  while ((bytes = preadv(_fd, parts, 2, position)) == -1 && errno == EINTR) {}
+  if (bytes == -1) {
+    stored.clear();
+    return EDM_READ_ERROR;
+  }
+  // A short read continues with the rest of the stored bytes, the header is in
+  if (static_cast<size_t>(bytes) >= sizeof(header)) {
+    size_t got = bytes - sizeof(header);
+    while (got < storedLength) {
+      ssize_t more = pread(_fd, stored.data() + got, storedLength - got, offset + got);
+      if (more == -1 && errno == EINTR)
+        continue;
+      if (more <= 0)
+        break;
+      got += more;
+    }
+    bytes = sizeof(header) + got;
+  }
+
+  if (static_cast<size_t>(bytes) != sizeof(header) + storedLength || header.magic != RECORD_MAGIC ||
+      header.key != key || header.storedLength != storedLength ||
+      header.checksum != RecordChecksum(header, Crc32c(stored.data(), storedLength))) {
+    stored.clear();
+    return EDM_CORRUPTED;
+  }
+  return SUCCESS;
+}
+
+RC Segment::Write (std::string_view bytes)
+{
+  // Room for the header Seal() writes
+  if (_size == 0)
+    _size = sizeof(RecordHeader);
+
+  const char *data = bytes.data();
+  size_t left = bytes.size();
+  while (left) {
+    ssize_t written = pwrite(_fd, data, left, _size);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return EDM_WRITE_ERROR;
+    }
+    data  += written;
+    left  -= written;
+    _size += written;
+  }
+  _crc = Crc32c(bytes.data(), bytes.size(), _crc);
+  return SUCCESS;
+}
+
+RC Segment::Seal (uint64_t key, uint32_t length)
+{
+  RecordHeader header = {};
+  header.magic        = RECORD_MAGIC;
+  header.key          = key;
+  header.length       = length;
+  header.storedLength = _size - sizeof(header);
+  header.checksum     = RecordChecksum(header, _crc);
+  if (pwrite(_fd, &header, sizeof(header), 0) != sizeof(header))
+    return EDM_WRITE_ERROR;
+  return SUCCESS;
+}
+
+RC Segment::Rename (const std::string &name)
+{
+  if (rename(_name.c_str(), name.c_str()))
+    return EDM_WRITE_ERROR;
+  _name = name;
+  return SUCCESS;
+}
+
+RC Segment::Sync ()
+{
+  return fdatasync(_fd) ? EDM_WRITE_ERROR : SUCCESS;
+}
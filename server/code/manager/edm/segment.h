@@ -0,0 +1,180 @@
+#ifndef EDM_SEGMENT
+#define EDM_SEGMENT
+
+/* ----- Include libries or files ----- */
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "../../util/util.h"
+#include "../../basic/wal/wal.h"
+
+/* ----- Define macros ----- */
+#define SEGMENT_SIZE  (64 * 1024 * 1024)   // Default size at which a new segment is started
+#define RECORD_MAGIC  0x52434445           // "EDCR" at the start of every record
+#define RECORD_COMPRESSED 0x1              // Record flag: the message is stored compressed
+
+/* ----- Define structs ----- */
+/**
+ * RecordHeader
+ * Written in front of every message in a segment. The checksum covers the
+ * rest of the header and the stored bytes, so a torn or damaged record is
+ * found without the directory file.
+ */
+struct RecordHeader {
+  uint32_t magic;         // RECORD_MAGIC
+  uint32_t checksum;      // CRC-32C of the stored bytes, then of the fields below
+  uint64_t key;           // Key of the message, as in its Index
+  uint32_t length;        // Length of the message
+  uint32_t storedLength;  // Bytes following the header, less than length if compressed
+  uint32_t flags;         // RECORD_COMPRESSED
+  uint32_t reserved;
+};
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader is stored as it is in the segments");
+
+/**
+ * ContentHash
+ * This class computes the 64-bit hash that finds identical messages. Bytes
+ * can be given in pieces of any size, as they come off the wire. Equal hashes
+ * are only a hint, the messages are compared before one is shared.
+ *
+ * Contained Public Functions:
+ *   void     Update   (const void *data, size_t length)
+ *   uint64_t GetValue ()
+ */
+class ContentHash
+{
+public:
+  ContentHash() : _state(0x9E3779B97F4A7C15ull), _length(0), _tailLength(0) {};
+
+  /**
+   * This function will add bytes to the hash.
+   * @param  const void * given as the start of the bytes.
+   *         size_t given as the number of bytes.
+   */
+  void Update (const void *data, size_t length);
+
+  /**
+   * This function will give the hash of all bytes added so far.
+   * @return uint64_t as the hash.
+   */
+  uint64_t GetValue () const;
+
+private:
+  uint64_t _state;
+  uint64_t _length;       // Bytes added
+  unsigned char _tail[8]; // Bytes not making a whole word yet
+  size_t   _tailLength;
+
+  void Mix (uint64_t word);
+};
+
+/**
+ * Segment
+ * This class is one content storage file. Messages are only ever appended,
+ * each as a RecordHeader followed by the stored bytes, so writing is
+ * sequential and a message is read back with one positioned read of its
+ * record. Whether the stored bytes are compressed is up to the caller.
+ *
+ * A message streamed in (see MessageStream) gets a new segment of its own:
+ * Write() puts its bytes behind the room for the header as they come, Seal()
+ * writes the header once the key is known and Rename() gives the file its
+ * place among the segments of the mailbox.
+ *
+ * Contained Public Functions:
+ *   RC Open   (bool create)
+ *   RC Append (uint64_t key, std::string_view stored, uint32_t length, uint32_t flags, uint64_t &offset)
+ *   RC Read   (uint64_t key, uint64_t offset, uint32_t storedLength, std::string &stored)
+ *   RC Write  (std::string_view bytes)
+ *   RC Seal   (uint64_t key, uint32_t length)
+ *   RC Rename (const std::string &name)
+ *   RC Sync   ()
+ *   int      GetFd   ()
+ *   uint64_t GetSize ()
+ */
+class Segment
+{
+public:
+  explicit Segment(const std::string &name);
+  ~Segment();
+
+  Segment(const Segment &) = delete;
+  Segment &operator=(const Segment &) = delete;
+
+  /**
+   * This function will open the file of the segment.
+   * @param  bool given as true for a new segment: the file is created, or
+   *         emptied if a crash left one behind.
+   * @return SUCCESS if the file is open.
+   *         EDM_OPEN_ERROR otherwise.
+   */
+  RC Open (bool create);
+
+  /**
+   * This function will write one record at the end of the segment.
+   * @param  uint64_t given as the key of the message.
+   *         string_view given as the bytes to store.
+   *         uint32_t given as the length of the message they hold.
+   *         uint32_t given as the record flags.
+   *         uint64_t stores the offset of the stored bytes, after the header.
+   * @return SUCCESS if the whole record has been written.
+   *         EDM_WRITE_ERROR otherwise.
+   */
+  RC Append (uint64_t key, std::string_view stored, uint32_t length, uint32_t flags, uint64_t &offset);
+
+  /**
+   * This function will read the stored bytes of one record and check it.
+   * @param  uint64_t given as the key of the message.
+   *         uint64_t given as the offset of the stored bytes, after the header.
+   *         uint32_t given as the number of stored bytes.
+   *         string stores the stored bytes.
+   * @return SUCCESS if the record has been read.
+   *         EDM_CORRUPTED if the header or the checksum does not match.
+   *         EDM_READ_ERROR otherwise.
+   */
+  RC Read (uint64_t key, uint64_t offset, uint32_t storedLength, std::string &stored);
+
+  /**
+   * This function will add the next bytes of the one record of a streamed
+   * segment. Nothing else may be appended to the segment.
+   * @param  string_view given as the bytes.
+   * @return SUCCESS if they have been written.
+   *         EDM_WRITE_ERROR otherwise.
+   */
+  RC Write (std::string_view bytes);
+
+  /**
+   * This function will write the header of a streamed record, with the
+   * checksum of every byte given to Write().
+   * @param  uint64_t given as the key of the message.
+   *         uint32_t given as the length of the message.
+   * @return SUCCESS if the header has been written.
+   *         EDM_WRITE_ERROR otherwise.
+   */
+  RC Seal (uint64_t key, uint32_t length);
+
+  /**
+   * This function will move the file of the segment.
+   * @param  const string given as the new file name, with the path.
+   * @return SUCCESS if moved, EDM_WRITE_ERROR otherwise.
+   */
+  RC Rename (const std::string &name);
+
+  /**
+   * This function will wait until the records written are on the disk.
+   * @return SUCCESS if synced, EDM_WRITE_ERROR otherwise.
+   */
+  RC Sync ();
+
+  int      GetFd   () const { return _fd; }
+  const std::string &GetName () const { return _name; }
+  uint64_t GetSize () const { return _size; }
+
+private:
+  std::string _name;    // File name, with the path
+  int _fd;
+  uint64_t _size;       // Where the next record goes
+  uint32_t _crc;        // CRC-32C of the bytes given to Write()
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * summary.cpp
+ *
+ * This file provides the summary file of every mailbox, what POP3 STAT, LIST
+ * and UIDL read.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "edm.h"
+#include "summary.h"
+
+/************ Helper Functions *************/
+// The share of one entry in the checksum, which is the XOR of all of them
+static uint64_t Hash (size_t slot, const SummaryEntry &entry)
+{
+  uint64_t value = slot;
+  for (uint64_t word : {entry.key, static_cast<uint64_t>(entry.length) << 32 | entry.flags, entry.uid}) {
+    value = (value ^ word) * 0x9E3779B97F4A7C15ULL;
+    value ^= value >> 29;
+  }
+  return value;
+}
+
+/************ Summary *************/
+Summary::Summary()
+  : _fd(-1),
+    _header(NULL),
+    _entries(NULL),
+    _capacity(0)
+{
+}
+
+Summary::~Summary()
+{
+  Unmap();
+  if (_fd != -1)
+    close(_fd);
+}
+
+RC Summary::Open (const std::string &name, uint64_t generation, uint64_t entries, bool &current)
+{
+  current = false;
+  _fd = open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (_fd == -1)
+    return EDM_OPEN_ERROR;
+
+  struct stat status;
+  if (fstat(_fd, &status))
+    return EDM_OPEN_ERROR;
+  size_t size = status.st_size;
+  if (size < sizeof(SummaryHeader))
+    return SUCCESS;
+  size_t capacity = (size - sizeof(SummaryHeader)) / sizeof(SummaryEntry);
+  RC rc = Map(capacity);
+  if (rc)
+    return rc;
+
+  // Left behind by a crash or by an older directory file otherwise
+  if (_header->magic != SUMMARY_MAGIC || _header->version != SUMMARY_VERSION ||
+      _header->generation != generation || _header->entries != entries || capacity < entries)
+    return SUCCESS;
+
+  // The pages of the mapping reach the disk in any order, an entry page may be older than the header
+  uint64_t checksum = 0, number = 0, octets = 0;
+  for (size_t slot = 0; slot < entries; ++slot) {
+    checksum ^= Hash(slot, _entries[slot]);
+    if (!(_entries[slot].flags & SUMMARY_DELETED)) {
+      ++number;
+      octets += _entries[slot].length;
+    }
+  }
+  current = _header->checksum == checksum && _header->number == number && _header->octets == octets;
+  return SUCCESS;
+}
+
+RC Summary::Set (size_t slot, const SummaryEntry &entry)
+{
+  if (!_header || slot > _header->entries)
+    return EDM_WRITE_ERROR;
+  if (slot >= _capacity) {
+    RC rc = Map(std::max<size_t>(SUMMARY_MIN_CAPACITY, _capacity * 2));
+    if (rc)
+      return rc;
+  }
+
+  if (slot < _header->entries) {
+    _header->checksum ^= Hash(slot, _entries[slot]);
+    if (!(_entries[slot].flags & SUMMARY_DELETED)) {
+      --_header->number;
+      _header->octets -= _entries[slot].length;
+    }
+  }
+  _entries[slot] = entry;
+  _header->checksum ^= Hash(slot, entry);
+  if (!(entry.flags & SUMMARY_DELETED)) {
+    ++_header->number;
+    _header->octets += entry.length;
+  }
+  if (slot == _header->entries)
+    ++_header->entries;
+  return SUCCESS;
+}
+
+RC Summary::Rebuild (const std::vector<SummaryEntry> &entries, uint64_t generation)
+{
+  if (!_header || _capacity < entries.size()) {
+    RC rc = Map(std::max<size_t>(SUMMARY_MIN_CAPACITY, entries.size() * 2));
+    if (rc)
+      return rc;
+  }
+
+  memset(_header, 0, sizeof(SummaryHeader));
+  _header->magic      = SUMMARY_MAGIC;
+  _header->version    = SUMMARY_VERSION;
+  _header->generation = generation;
+  for (const SummaryEntry &entry : entries)
+    Set(_header->entries, entry);
+  return SUCCESS;
+}
+
+void Summary::List (std::vector<SummaryEntry> &entries) const
+{
+  entries.clear();
+  if (!_header)
+    return;
+  entries.reserve(_header->number);
+  for (const SummaryEntry *entry = _entries; entry != _entries + _header->entries; ++entry) {
+    if (!(entry->flags & SUMMARY_DELETED))
+      entries.push_back(*entry);
+  }
+}
+
+// Private helper functions
+RC Summary::Map (size_t capacity)
+{
+  Unmap();
+  size_t size = sizeof(SummaryHeader) + capacity * sizeof(SummaryEntry);
+  struct stat status;
+  if (fstat(_fd, &status) || (static_cast<size_t>(status.st_size) != size && ftruncate(_fd, size)))
+    return EDM_WRITE_ERROR;
+
+  void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (mapping == MAP_FAILED)
+    return EDM_WRITE_ERROR;
+  _header   = static_cast<SummaryHeader *>(mapping);
+  _entries  = reinterpret_cast<SummaryEntry *>(_header + 1);
+  _capacity = capacity;
+  return SUCCESS;
+}
+
+void Summary::Unmap ()
+{
+  if (!_header)
+    return;
+  munmap(_header, sizeof(SummaryHeader) + _capacity * sizeof(SummaryEntry));
+  _header   = NULL;
+  _entries  = NULL;
+  _capacity = 0;
+}
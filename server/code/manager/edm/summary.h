@@ -0,0 +1,135 @@
+#ifndef EDM_SUMMARY
+#define EDM_SUMMARY
+
+/* ----- Include libries or files ----- */
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../../util/util.h"
+
+/* ----- Define macros ----- */
+#define SUMMARY_MAGIC    0x4D555345    // "ESUM" in the summary header
+#define SUMMARY_VERSION  2
+#define SUMMARY_DELETED  0x1           // Entry flag: the message has been deleted
+#define SUMMARY_MIN_CAPACITY 64        // Entries the file has room for at least
+const char SUMMARY_FILE_NAME[] = "summary";
+const char SUMMARY_EXTENSION[] = ".sum";
+
+/* ----- Define structs ----- */
+struct SummaryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t number;        // Messages not deleted
+  uint64_t octets;        // Their total length
+  uint64_t entries;       // Entries in use, one for every entry of the directory file
+  uint64_t generation;    // Of the directory file it was made from
+  uint64_t checksum;      // Of the entries in use and their positions
+};
+static_assert(sizeof(SummaryHeader) == 48, "SummaryHeader is stored as it is in the .sum file");
+
+/**
+ * SummaryEntry
+ * What POP3 STAT, LIST and UIDL need of one message, nothing more, so a
+ * listing walks 24 bytes a message instead of a whole directory entry.
+ */
+struct SummaryEntry {
+  uint64_t key;           // Key of the message, as in its Index
+  uint32_t length;        // Length of the message, what LIST reports
+  uint32_t flags;         // SUMMARY_DELETED
+  uint64_t uid;           // Hash UIDL reports, never the same for two messages of a mailbox
+};
+static_assert(sizeof(SummaryEntry) == 24, "SummaryEntry is stored as it is in the .sum file");
+
+/**
+ * Summary
+ * This class keeps the summary file of a mailbox: the number and the total
+ * length of its messages and one SummaryEntry for every entry of its
+ * directory file, at the same position. The file is mapped into memory, so
+ * the totals are read without a walk and a listing is one sequential pass
+ * over a dense array. Every change of the directory file changes one entry
+ * and the totals in place.
+ *
+ * The directory file stays the record of the mailbox. The summary is not
+ * synced; Open() only trusts one made from the same generation of the
+ * directory file with as many entries whose entries still add up to the
+ * checksum and the totals of the header. That catches what a crash of the
+ * server leaves behind and an entry page older than the header after a
+ * power loss, when a deletion changed neither the generation nor the
+ * count. WAL recovery removes the summary of a directory file it repairs.
+ *
+ * Contained Public Functions:
+ *   RC   Open    (const std::string &name, uint64_t generation, uint64_t entries, bool &current)
+ *   RC   Set     (size_t slot, const SummaryEntry &entry)
+ *   RC   Rebuild (const std::vector<SummaryEntry> &entries, uint64_t generation)
+ *   void List    (std::vector<SummaryEntry> &entries)
+ *   uint64_t GetNumber ()
+ *   uint64_t GetOctets ()
+ *   uint64_t GetLastKey ()
+ */
+class Summary
+{
+public:
+  Summary();
+  ~Summary();
+
+  Summary(const Summary &) = delete;
+  Summary &operator=(const Summary &) = delete;
+
+  /**
+   * This function will map the summary file, creating it if needed, and
+   * check it against the header of the directory file: the header has to
+   * match and the entries have to add up to its checksum and totals.
+   * @param  const string given as the file name, with the path.
+   *         uint64_t given as the generation of the directory file.
+   *         uint64_t given as the number of entries of the directory file.
+   *         bool stores whether the summary is of that directory file; if
+   *         not, it must be given the entries with Rebuild().
+   * @return SUCCESS if opened.
+   *         EDM_OPEN_ERROR or EDM_WRITE_ERROR otherwise.
+   */
+  RC Open (const std::string &name, uint64_t generation, uint64_t entries, bool &current);
+
+  /**
+   * This function will write one entry, the next one after the last adds it.
+   * @param  size_t given as the position of the entry in the directory file.
+   *         const SummaryEntry given as the entry.
+   * @return SUCCESS if written, EDM_WRITE_ERROR if the file cannot grow.
+   */
+  RC Set (size_t slot, const SummaryEntry &entry);
+
+  /**
+   * This function will write all entries again, after the directory file has
+   * been rewritten.
+   * @param  const vector given as the entries of the new directory file.
+   *         uint64_t given as its generation.
+   * @return SUCCESS if written, EDM_WRITE_ERROR otherwise.
+   */
+  RC Rebuild (const std::vector<SummaryEntry> &entries, uint64_t generation);
+
+  /**
+   * This function will give the entries of the messages not deleted, by key.
+   * @param vector stores the entries.
+   */
+  void List (std::vector<SummaryEntry> &entries) const;
+
+  uint64_t GetNumber () const { return _header ? _header->number : 0; }
+  uint64_t GetOctets () const { return _header ? _header->octets : 0; }
+  uint64_t GetLastKey () const { return _header && _header->entries ? _entries[_header->entries - 1].key : 0; }
+
+private:
+  int _fd;
+  SummaryHeader *_header;   // Start of the mapping, NULL before Open()
+  SummaryEntry *_entries;   // Right behind the header
+  size_t _capacity;         // Entries the mapping has room for
+
+  // Private helper functions
+  /**
+   * This function will size the file for a number of entries and map it.
+   * @return SUCCESS if mapped, EDM_WRITE_ERROR otherwise.
+   */
+  RC Map (size_t capacity);
+  void Unmap ();
+};
+
+#endif
@@ -0,0 +1,831 @@
+/*
+ * unit_test_edm.cpp
+ *
+ * This file provides unit test for edm.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "unit_test_edm.h"
+using namespace std;
+
+static void RemoveMailbox ()
+{
+  if (system((string("rm -rf ") + TEST_MAILBOX + " " + TEST_SHARED + " " + TEST_LOG).c_str())) {}
+}
+
+static RC TestAppendRead ()
+{
+  RemoveMailbox();
+  shared_ptr<Mailbox> mailbox;
+  RC rc = EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox);
+  if (rc)
+    return rc;
+
+  uint64_t first, second;
+  string message;
+  if (mailbox->Append("Subject: one\r\n\r\nfirst\r\n", first) ||
+      mailbox->Append("Subject: two\r\n\r\nsecond\r\n", second) ||
+      mailbox->Read(second, message) || message != "Subject: two\r\n\r\nsecond\r\n")
+    return STANDARD_ERROR;
+
+  // Opening again gives the same object
+  shared_ptr<Mailbox> again;
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, again) || again != mailbox)
+    return STANDARD_ERROR;
+
+  // One probe gives the file range for sendfile()
+  shared_ptr<Segment> segment;
+  off_t offset;
+  size_t length;
+  char buffer[32] = {};
+  if (mailbox->Locate(first, segment, offset, length) || length != 23 ||
+      pread(segment->GetFd(), buffer, length, offset) != 23 || string(buffer) != "Subject: one\r\n\r\nfirst\r\n")
+    return STANDARD_ERROR;
+
+  if (mailbox->Delete(first) || mailbox->Delete(first) != EDM_NO_SUCH_MESSAGE ||
+      mailbox->Read(first, message) != EDM_NO_SUCH_MESSAGE || mailbox->GetMessageNumber() != 1)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+static RC TestReopen ()
+{
+  RemoveMailbox();
+  vector<uint64_t> keys(3);
+  {
+    shared_ptr<Mailbox> mailbox;
+    if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+      return STANDARD_ERROR;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (mailbox->Append("message " + to_string(i), keys[i]))
+        return STANDARD_ERROR;
+    }
+    if (mailbox->Delete(keys[1]))
+      return STANDARD_ERROR;
+  }
+
+  // The last pointer is gone, the mailbox is loaded from the files again
+  shared_ptr<Mailbox> mailbox;
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+    return STANDARD_ERROR;
+
+  vector<Index> indexes;
+  mailbox->ListMessages(indexes);
+  string message;
+  uint64_t key;
+  if (indexes.size() != 2 || indexes[0].key != keys[0] || indexes[1].key != keys[2] ||
+      mailbox->Read(keys[2], message) || message != "message 2")
+    return STANDARD_ERROR;
+
+  // Keys are never reused, even the one of the deleted message
+  if (mailbox->Append("message 3", key) || key != keys[2] + 1)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+static RC TestManyMessages ()
+{
+  RemoveMailbox();
+  shared_ptr<Mailbox> mailbox;
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+    return STANDARD_ERROR;
+
+  // More than a 16-bit key could name
+  const uint64_t number = 70000;
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < number; ++i) {
+    if (mailbox->Append(to_string(i), key))
+      return STANDARD_ERROR;
+  }
+
+  Index index;
+  string message;
+  if (key != number || mailbox->Lookup(key, index) || index.length != 5 ||
+      mailbox->Read(66000, message) || message != "65999")
+    return STANDARD_ERROR;
+  mailbox.reset();
+
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) ||
+      mailbox->GetMessageNumber() != number || mailbox->Read(number, message) || message != "69999")
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+static RC TestSegments ()
+{
+  RemoveMailbox();
+  Mailbox mailbox(TEST_MAILBOX, 4096, false);
+  if (mailbox.Open())
+    return STANDARD_ERROR;
+
+  // Four records of 992 + header bytes fill a segment, a large message gets its own
+  string small(992, 's'), large(10000, 'l'), message;
+  vector<uint64_t> keys(7);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (mailbox.Append(i == 5 ? large : small, keys[i]))
+      return STANDARD_ERROR;
+  }
+  vector<uint32_t> fileNrs;
+  Index index;
+  for (uint64_t key : keys) {
+    if (mailbox.Lookup(key, index))
+      return STANDARD_ERROR;
+    fileNrs.push_back(index.fileNr);
+  }
+  if (fileNrs != vector<uint32_t>({0, 0, 0, 0, 1, 2, 3}) ||
+      mailbox.Read(keys[5], message) || message != large)
+    return STANDARD_ERROR;
+
+  // A damaged record fails its checksum instead of being returned
+  shared_ptr<Segment> segment;
+  off_t offset;
+  size_t length;
+  if (mailbox.Locate(keys[4], segment, offset, length) || pwrite(segment->GetFd(), "x", 1, offset + 10) != 1 ||
+      mailbox.Read(keys[4], message) != EDM_CORRUPTED || mailbox.Read(keys[3], message) || message != small)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+/**
+ * Fills segments of 4096 bytes with uncompressed records of 1024 bytes (four
+ * per segment) and deletes the given keys.
+ */
+static RC FillMailbox (shared_ptr<Mailbox> &mailbox, size_t number, const vector<uint64_t> &deletes)
+{
+  RemoveMailbox();
+  EmailDataManager::instance()->SetSegmentSize(4096);
+  EmailDataManager::instance()->SetCompression(false);
+  RC rc = EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox);
+  EmailDataManager::instance()->SetSegmentSize(SEGMENT_SIZE);
+  EmailDataManager::instance()->SetCompression(true);
+  if (rc)
+    return rc;
+
+  string message(992, '\0');
+  uint64_t key;
+  for (size_t i = 1; i <= number; ++i) {
+    message.replace(0, 8, to_string(10000000 + i));
+    if ((rc = mailbox->Append(message, key)))
+      return rc;
+  }
+  for (uint64_t deleted : deletes) {
+    if ((rc = mailbox->Delete(deleted)))
+      return rc;
+  }
+  return SUCCESS;
+}
+
+static RC TestCompaction ()
+{
+  // Segment 0 keeps one of four records and is sparse, segment 1 keeps two and is not
+  shared_ptr<Mailbox> mailbox;
+  if (FillMailbox(mailbox, 12, {1, 2, 3, 5, 6}))
+    return STANDARD_ERROR;
+
+  // Left sparse before a restart: reported once the directory is loaded, not at open
+  vector<string> sparse;
+  mailbox.reset();
+  EmailDataManager::instance()->TakeSparse(sparse);
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+    return STANDARD_ERROR;
+  EmailDataManager::instance()->TakeSparse(sparse);
+  if (!sparse.empty() || !mailbox->IsSparse())
+    return STANDARD_ERROR;
+
+  // A message being sent keeps its old segment readable
+  shared_ptr<Segment> pinned;
+  off_t offset;
+  size_t length;
+  if (mailbox->Locate(4, pinned, offset, length))
+    return STANDARD_ERROR;
+
+  Compactor compactor;
+  if (compactor.RunOnce() || compactor.GetReclaimedSize() != 4096 || mailbox->IsSparse() ||
+      access((string(TEST_MAILBOX) + "0.data").c_str(), F_OK) == 0)
+    return STANDARD_ERROR;
+
+  Index index;
+  string message;
+  char buffer[8];
+  uint64_t number, octets;
+  vector<SummaryEntry> entries;
+  mailbox->GetTotals(number, octets);
+  mailbox->ListSummary(entries);
+  if (number != 7 || entries.size() != 7 || entries[0].key != 4 || entries[6].key != 12)
+    return STANDARD_ERROR;
+  if (mailbox->Lookup(4, index) || index.fileNr != 3 || mailbox->Read(4, message) ||
+      message.compare(0, 8, "10000004") || pread(pinned->GetFd(), buffer, 8, offset) != 8 ||
+      string(buffer, 8) != "10000004")
+    return STANDARD_ERROR;
+  pinned.reset();
+
+  // The rewritten directory and the new segment survive a reopen, keys are not reused
+  mailbox.reset();
+  uint64_t key;
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) || mailbox->GetMessageNumber() != 7 ||
+      mailbox->Read(4, message) || message.compare(0, 8, "10000004") ||
+      mailbox->Read(12, message) || message.compare(0, 8, "10000012") ||
+      mailbox->Append("new", key) || key != 13)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// A compaction given up leaves the mailbox for the next run
+static RC TestCompactRetry ()
+{
+  shared_ptr<Mailbox> mailbox;
+  vector<string> sparse;
+  if (FillMailbox(mailbox, 12, {1, 2, 3, 5, 6}))
+    return STANDARD_ERROR;
+  EmailDataManager::instance()->TakeSparse(sparse);
+  uint64_t reclaimed;
+  if (sparse.size() != 1 || mailbox->Compact([](size_t) { return false; }, reclaimed) || reclaimed ||
+      !mailbox->IsSparse())
+    return STANDARD_ERROR;
+
+  Compactor compactor;
+  string message;
+  return (compactor.RunOnce() == SUCCESS && compactor.GetReclaimedSize() == 4096 && !mailbox->IsSparse() &&
+          !mailbox->Read(4, message) && !message.compare(0, 8, "10000004")) ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestCompactRate ()
+{
+  // One live record left in each of two segments: 2048 bytes at 8192 per second
+  shared_ptr<Mailbox> mailbox;
+  if (FillMailbox(mailbox, 12, {1, 2, 3, 5, 6, 7}))
+    return STANDARD_ERROR;
+
+  Compactor compactor(8192, 1);
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  compactor.Start();
+  for (int i = 0; i < 500 && compactor.GetReclaimedSize() == 0; ++i)
+    usleep(10000);
+  chrono::steady_clock::duration elapsed = chrono::steady_clock::now() - start;
+  compactor.Stop();
+
+  string message;
+  if (compactor.GetReclaimedSize() != 8192 || elapsed < chrono::milliseconds(200) ||
+      mailbox->Read(8, message) || message.compare(0, 8, "10000008"))
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+static RC TestCodec ()
+{
+  // Text, runs that overlap their own copy, random bytes and tiny inputs
+  string text;
+  for (int i = 0; i < 400; ++i)
+    text += "<p>Line " + to_string(i % 37) + " of the HTML body</p>\r\n";
+  string random(5000, '\0');
+  srand(7);
+  for (char &byte : random)
+    byte = static_cast<char>(rand());
+  vector<string> inputs = {text, string(3000, 'a'), "abcabcabcabcabcabcabcabcabcabc", random, "", "x", "abcdefghijkl"};
+
+  for (const string &input : inputs) {
+    string compressed(CompressBound(input.size()), '\0');
+    size_t size = Compress(input.data(), input.size(), compressed.data(), compressed.size());
+    string output(input.size(), '\0');
+    if (size == 0 || !Decompress(compressed.data(), size, output.data(), output.size()) || output != input)
+      return STANDARD_ERROR;
+    // A damaged block is refused, not overrun
+    if (size > 1 && Decompress(compressed.data(), size - 1, output.data(), output.size()))
+      return STANDARD_ERROR;
+  }
+
+  // Only a fraction of the text is stored, and nothing is forced into a small target
+  string compressed(CompressBound(text.size()), '\0');
+  if (Compress(text.data(), text.size(), compressed.data(), compressed.size()) > text.size() / 4 ||
+      Compress(random.data(), random.size(), compressed.data(), random.size() / 2) != 0)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+static RC TestCompression ()
+{
+  RemoveMailbox();
+  shared_ptr<Mailbox> mailbox;
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+    return STANDARD_ERROR;
+
+  string html = "Content-Type: text/html\r\n\r\n";
+  for (int i = 0; i < 500; ++i)
+    html += "<tr><td>Row " + to_string(i) + "</td><td class=\"cell\">value</td></tr>\r\n";
+  string random(4000, '\0');
+  for (char &byte : random)
+    byte = static_cast<char>(rand());
+
+  uint64_t htmlKey, smallKey, randomKey;
+  if (mailbox->Append(html, htmlKey) || mailbox->Append("Subject: hi\r\n\r\nshort\r\n", smallKey) ||
+      mailbox->Append(random, randomKey))
+    return STANDARD_ERROR;
+
+  // Both lengths in the entry; small and incompressible messages are stored as they are
+  Index index;
+  if (mailbox->Lookup(htmlKey, index) || !(index.flags & INDEX_COMPRESSED) ||
+      index.length != html.size() || index.storedLength > html.size() / 4)
+    return STANDARD_ERROR;
+  if (mailbox->Lookup(smallKey, index) || (index.flags & INDEX_COMPRESSED) || index.storedLength != index.length ||
+      mailbox->Lookup(randomKey, index) || (index.flags & INDEX_COMPRESSED))
+    return STANDARD_ERROR;
+
+  // Only the records stored as they are can be sent with sendfile()
+  shared_ptr<Segment> segment;
+  off_t offset;
+  size_t length;
+  string message;
+  if (mailbox->Locate(htmlKey, segment, offset, length) != EDM_COMPRESSED ||
+      mailbox->Locate(randomKey, segment, offset, length) || length != random.size() ||
+      mailbox->Read(htmlKey, message) || message != html ||
+      mailbox->Read(randomKey, message) || message != random)
+    return STANDARD_ERROR;
+
+  // Still read back after a reopen
+  mailbox.reset();
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) ||
+      mailbox->Read(htmlKey, message) || message != html)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+static RC TestSharedStorage ()
+{
+  RemoveMailbox();
+  if (mkdir(TEST_MAILBOX, 0700))
+    return STANDARD_ERROR;
+  EmailDataManager *edm = EmailDataManager::instance();
+  edm->SetSegmentSize(4096);
+  edm->SetCompression(false);
+
+  // Eight messages for three mailboxes, four records to a shared segment
+  vector<string> paths = {string(TEST_MAILBOX) + "a", string(TEST_MAILBOX) + "b", string(TEST_MAILBOX) + "c"};
+  vector<vector<uint64_t>> keys(8);
+  string message(992, '\0');
+  RC rc = SUCCESS;
+  for (size_t i = 0; i < 8 && !rc; ++i) {
+    message.replace(0, 8, to_string(10000000 + i));
+    rc = edm->Deliver(message, paths, keys[i]);
+  }
+  // The same message again is not stored again
+  vector<uint64_t> again;
+  message.replace(0, 8, to_string(10000000));
+  if (!rc)
+    rc = edm->Deliver(message, {paths[0], paths[1]}, again);
+  edm->SetSegmentSize(SEGMENT_SIZE);
+  edm->SetCompression(true);
+  if (rc || again.size() != 2)
+    return STANDARD_ERROR;
+
+  shared_ptr<Mailbox> shared;
+  vector<shared_ptr<Mailbox>> mailboxes(3);
+  vector<Index> indexes;
+  if (edm->OpenMailbox(TEST_SHARED, shared))
+    return STANDARD_ERROR;
+  shared->ListMessages(indexes);
+  if (indexes.size() != 8 || indexes[0].refs != 5 || indexes[7].refs != 3)
+    return STANDARD_ERROR;
+  for (size_t i = 0; i < 3; ++i) {
+    if (edm->OpenMailbox(paths[i], mailboxes[i]) || mailboxes[i]->GetMessageNumber() != (i < 2 ? 9 : 8) ||
+        mailboxes[i]->Read(keys[7][i], message) || message.compare(0, 8, "10000007"))
+      return STANDARD_ERROR;
+  }
+
+  // Deleting drops references, the records stay until the last one is gone
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 2; ++j) {
+      if (mailboxes[j]->Delete(keys[i][j]))
+        return STANDARD_ERROR;
+    }
+  }
+  if (mailboxes[0]->Delete(again[0]) || mailboxes[1]->Delete(again[1]) || shared->IsSparse() ||
+      mailboxes[2]->Read(keys[0][2], message) || message.compare(0, 8, "10000000"))
+    return STANDARD_ERROR;
+  for (size_t i = 0; i < 4; ++i) {
+    if (mailboxes[2]->Delete(keys[i][2]))
+      return STANDARD_ERROR;
+  }
+  if (!shared->IsSparse())
+    return STANDARD_ERROR;
+
+  Compactor compactor;
+  if (compactor.RunOnce() || compactor.GetReclaimedSize() != 4096 || shared->GetMessageNumber() != 4)
+    return STANDARD_ERROR;
+
+  // The entries still find the moved records, also after a reopen
+  shared.reset();
+  mailboxes.assign(3, NULL);
+  if (edm->OpenMailbox(paths[1], mailboxes[1]) || mailboxes[1]->GetMessageNumber() != 4 ||
+      mailboxes[1]->Read(keys[5][1], message) || message.compare(0, 8, "10000005") ||
+      mailboxes[1]->Read(keys[0][1], message) != EDM_NO_SUCH_MESSAGE)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Count the files of a directory ending with the extension
+static size_t CountFiles (const string &path, const string &extension)
+{
+  size_t number = 0;
+  DIR *directory = opendir(path.c_str());
+  struct dirent *entry;
+  while (directory && (entry = readdir(directory))) {
+    string name = entry->d_name;
+    if (name.size() > extension.size() && !name.compare(name.size() - extension.size(), extension.size(), extension))
+      ++number;
+  }
+  if (directory)
+    closedir(directory);
+  return number;
+}
+
+// Stream a message in pieces as SMTP DATA gives them
+static RC StreamMessage (MessageStream &stream, const string &message)
+{
+  RC rc;
+  for (size_t offset = 0; offset < message.size(); offset += BUFFER_PIECE_SIZE) {
+    if ((rc = stream.Write(string_view(message).substr(offset, BUFFER_PIECE_SIZE))))
+      return rc;
+    if (stream.IsFull() && (rc = stream.Flush()))
+      return rc;
+  }
+  return SUCCESS;
+}
+
+static RC TestStream ()
+{
+  RemoveMailbox();
+  if (mkdir(TEST_MAILBOX, 0700))
+    return STANDARD_ERROR;
+  EmailDataManager *edm = EmailDataManager::instance();
+  string one = string(TEST_MAILBOX) + "one/";
+  vector<string> paths = {one, string(TEST_MAILBOX) + "two/", string(TEST_MAILBOX) + "three/"};
+
+  // A small message stays in memory and is stored like any other
+  unique_ptr<MessageStream> stream;
+  vector<uint64_t> keys;
+  string message;
+  edm->OpenStream({one}, stream);
+  if (StreamMessage(*stream, "Subject: small\r\n\r\nbody\r\n") || stream->Commit(keys) || keys.size() != 1)
+    return STANDARD_ERROR;
+
+  // A large one goes to a staging file in chunks, invisible until the commit
+  string large;
+  while (large.size() < 20 * STREAM_CHUNK_SIZE + 123)
+    large += "line " + to_string(large.size()) + "\r\n";
+  shared_ptr<Mailbox> mailbox;
+  edm->OpenStream({one}, stream);
+  if (StreamMessage(*stream, large) || edm->OpenMailbox(one, mailbox) ||
+      CountFiles(one, STAGE_EXTENSION) != 1 || mailbox->GetMessageNumber() != 1 || stream->Commit(keys))
+    return STANDARD_ERROR;
+  stream.reset();
+
+  shared_ptr<Segment> segment;
+  off_t offset;
+  size_t length;
+  if (CountFiles(one, STAGE_EXTENSION) != 0 || mailbox->GetMessageNumber() != 2 ||
+      mailbox->Read(keys[0], message) || message != large ||
+      mailbox->Locate(keys[0], segment, offset, length) || length != large.size())
+    return STANDARD_ERROR;
+  segment.reset();
+
+  // For several mailboxes it goes to the shared store
+  edm->OpenStream(paths, stream);
+  if (StreamMessage(*stream, large) || stream->Commit(keys) || keys.size() != 3)
+    return STANDARD_ERROR;
+  stream.reset();
+
+  // Given up half way: nothing stored, no file left
+  edm->OpenStream({one}, stream);
+  if (StreamMessage(*stream, large))
+    return STANDARD_ERROR;
+  stream.reset();
+  if (CountFiles(one, STAGE_EXTENSION) != 0 || mailbox->GetMessageNumber() != 3)
+    return STANDARD_ERROR;
+
+  // The records pass their checksums after a reopen
+  mailbox.reset();
+  shared_ptr<Mailbox> shared;
+  vector<Index> indexes;
+  if (edm->OpenMailbox(paths[2], mailbox) || mailbox->Read(keys[2], message) || message != large ||
+      edm->OpenMailbox(TEST_SHARED, shared))
+    return STANDARD_ERROR;
+  shared->ListMessages(indexes);
+  return indexes.size() == 1 && indexes[0].refs == 3 ? SUCCESS : STANDARD_ERROR;
+}
+
+// Entries lost in a crash come back from the log, unless their record did not make it
+static RC TestRecovery ()
+{
+  RemoveMailbox();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  EmailDataManager *edm = EmailDataManager::instance();
+  if (wal->Open(TEST_LOG) || wal->Recover())
+    return STANDARD_ERROR;
+
+  shared_ptr<Mailbox> mailbox;
+  uint64_t first, second, third;
+  Index index;
+  if (edm->OpenMailbox(TEST_MAILBOX, mailbox) || mailbox->Append("first", first) ||
+      mailbox->Append("second", second) || mailbox->Append("third", third) ||
+      mailbox->Delete(second) || mailbox->Lookup(third, index))
+    return STANDARD_ERROR;
+  mailbox.reset();
+
+  // The entries never reached the directory file and the last record is torn
+  string segment = string(TEST_MAILBOX) + "0.data";
+  int fd = open(segment.c_str(), O_WRONLY);
+  bool torn = fd != -1 && pwrite(fd, "X", 1, index.offset) == 1;
+  if (fd != -1)
+    close(fd);
+  if (!torn || truncate((string(TEST_MAILBOX) + "directory.df").c_str(), sizeof(DirectoryHeader)))
+    return STANDARD_ERROR;
+
+  // The repaired mailbox has its summary made again
+  wal->Close();
+  string message;
+  if (wal->Open(TEST_LOG) || wal->Recover() ||
+      !access((string(TEST_MAILBOX) + SUMMARY_FILE_NAME + SUMMARY_EXTENSION).c_str(), F_OK))
+    return STANDARD_ERROR;
+  RC rc = edm->OpenMailbox(TEST_MAILBOX, mailbox) ||
+          mailbox->GetMessageNumber() != 1 || mailbox->Read(first, message) || message != "first" ||
+          mailbox->Read(second, message) != EDM_NO_SUCH_MESSAGE ||
+          mailbox->Read(third, message) != EDM_NO_SUCH_MESSAGE ? STANDARD_ERROR : SUCCESS;
+  wal->Close();
+  return rc;
+}
+
+// STAT and LIST come from the summary, which survives a restart and a damaged file
+static RC CheckSummary (const shared_ptr<Mailbox> &mailbox, const vector<uint64_t> &keys)
+{
+  uint64_t number, octets, expected = 0;
+  vector<SummaryEntry> entries;
+  mailbox->GetTotals(number, octets);
+  mailbox->ListSummary(entries);
+  if (number != keys.size() || entries.size() != keys.size())
+    return STANDARD_ERROR;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (entries[i].key != keys[i] || (i && entries[i].uid == entries[i - 1].uid))
+      return STANDARD_ERROR;
+    expected += entries[i].length;
+  }
+  return octets == expected ? SUCCESS : STANDARD_ERROR;
+}
+
+// Many new messages are one record of the log, and come back after a restart
+static RC TestAppendMany ()
+{
+  RemoveMailbox();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  EmailDataManager *edm = EmailDataManager::instance();
+  if (wal->Open(TEST_LOG) || wal->Recover())
+    return STANDARD_ERROR;
+
+  vector<string> messages;
+  vector<string_view> views;
+  for (size_t i = 0; i < 10; ++i)
+    messages.push_back("message " + to_string(i) + (i % 3 ? "" : string(2 * COMPRESS_MIN_SIZE, 'x')));
+  views.assign(messages.begin(), messages.end());
+
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys;
+  uint64_t size = wal->GetSize();
+  string path = string(TEST_MAILBOX) + DIRECTORY_FILE_NAME + DF_EXTENSION;
+  if (edm->Deliver(views, TEST_MAILBOX, keys) || keys.size() != messages.size() ||
+      wal->GetSize() - size != sizeof(WalRecordHeader) + path.size() + keys.size() * sizeof(DirectoryRedo) ||
+      edm->OpenMailbox(TEST_MAILBOX, mailbox) || CheckSummary(mailbox, keys))
+    return STANDARD_ERROR;
+  mailbox.reset();
+  wal->Close();
+
+  string message;
+  if (edm->OpenMailbox(TEST_MAILBOX, mailbox) || CheckSummary(mailbox, keys))
+    return STANDARD_ERROR;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (mailbox->Read(keys[i], message) || message != messages[i])
+      return STANDARD_ERROR;
+  }
+  uint64_t key;
+  return mailbox->Append("next", key) == SUCCESS && key == keys.back() + 1 ? SUCCESS : STANDARD_ERROR;
+}
+
+// Many deletions are one record of the log, replayed after a crash like the others
+static RC TestDeleteMany ()
+{
+  RemoveMailbox();
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  EmailDataManager *edm = EmailDataManager::instance();
+  if (wal->Open(TEST_LOG) || wal->Recover())
+    return STANDARD_ERROR;
+
+  shared_ptr<Mailbox> mailbox;
+  vector<uint64_t> keys(40), doomed, kept;
+  if (edm->OpenMailbox(TEST_MAILBOX, mailbox))
+    return STANDARD_ERROR;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (mailbox->Append("message " + to_string(i), keys[i]))
+      return STANDARD_ERROR;
+    (i % 4 ? doomed : kept).push_back(keys[i]);
+  }
+  vector<uint64_t> given(doomed);
+  given.push_back(doomed[3]);
+  given.push_back(keys.back() + 100);
+
+  size_t deleted;
+  uint64_t size = wal->GetSize();
+  string path = string(TEST_MAILBOX) + DIRECTORY_FILE_NAME + DF_EXTENSION;
+  if (mailbox->Delete(given, deleted) || deleted != doomed.size() ||
+      wal->GetSize() - size != sizeof(WalRecordHeader) + path.size() + doomed.size() * sizeof(DirectoryRedo) ||
+      CheckSummary(mailbox, kept) || mailbox->Delete(doomed, deleted) || deleted)
+    return STANDARD_ERROR;
+  mailbox.reset();
+
+  // The entries never reached the directory file
+  if (truncate(path.c_str(), sizeof(DirectoryHeader)))
+    return STANDARD_ERROR;
+  wal->Close();
+  string message;
+  RC rc = wal->Open(TEST_LOG) || wal->Recover() || edm->OpenMailbox(TEST_MAILBOX, mailbox) ||
+          CheckSummary(mailbox, kept) || mailbox->Read(doomed[0], message) != EDM_NO_SUCH_MESSAGE ||
+          mailbox->Read(kept[1], message) || message != "message 4" ? STANDARD_ERROR : SUCCESS;
+  wal->Close();
+  return rc;
+}
+
+static RC TestSummary ()
+{
+  RemoveMailbox();
+  vector<uint64_t> keys;
+  {
+    shared_ptr<Mailbox> mailbox;
+    if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+      return STANDARD_ERROR;
+    // More than the first file size holds, so it has to grow
+    for (size_t i = 0; i < 200; ++i) {
+      uint64_t key;
+      if (mailbox->Append("message " + string(i, 'x'), key))
+        return STANDARD_ERROR;
+      if (i % 3 == 0) {
+        if (mailbox->Delete(key))
+          return STANDARD_ERROR;
+      } else {
+        keys.push_back(key);
+      }
+    }
+    if (CheckSummary(mailbox, keys))
+      return STANDARD_ERROR;
+  }
+
+  shared_ptr<Mailbox> mailbox;
+  if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) || CheckSummary(mailbox, keys))
+    return STANDARD_ERROR;
+  mailbox.reset();
+
+  // A summary of another generation of the directory file is made again
+  string summary = string(TEST_MAILBOX) + SUMMARY_FILE_NAME + SUMMARY_EXTENSION;
+  uint64_t generation = 7;
+  int fd = open(summary.c_str(), O_WRONLY);
+  bool damaged = fd != -1 && pwrite(fd, &generation, sizeof(generation), offsetof(SummaryHeader, generation)) ==
+                 sizeof(generation);
+  if (fd != -1)
+    close(fd);
+  if (!damaged || EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) || CheckSummary(mailbox, keys))
+    return STANDARD_ERROR;
+  mailbox.reset();
+
+  if (truncate(summary.c_str(), 0) || EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) ||
+      CheckSummary(mailbox, keys))
+    return STANDARD_ERROR;
+  mailbox.reset();
+
+  // A matching summary is trusted: the directory file is only read for a message
+  uint64_t key = 0;
+  fd = open((string(TEST_MAILBOX) + DIRECTORY_FILE_NAME + DF_EXTENSION).c_str(), O_WRONLY);
+  damaged = fd != -1 && pwrite(fd, &key, sizeof(key), sizeof(DirectoryHeader) + sizeof(Index)) == sizeof(key);
+  if (fd != -1)
+    close(fd);
+  string message;
+  if (!damaged || EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox) || CheckSummary(mailbox, keys) ||
+      mailbox->GetNextKey() != 201)
+    return STANDARD_ERROR;
+  return mailbox->Read(keys[0], message) == EDM_CORRUPTED ? SUCCESS : STANDARD_ERROR;
+}
+
+// A power loss can keep the header of the summary and lose an entry page written with it
+static RC TestStaleSummary ()
+{
+  RemoveMailbox();
+  vector<uint64_t> keys(3);
+  string summary = string(TEST_MAILBOX) + SUMMARY_FILE_NAME + SUMMARY_EXTENSION;
+  vector<SummaryEntry> stale(keys.size());
+  {
+    shared_ptr<Mailbox> mailbox;
+    if (EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+      return STANDARD_ERROR;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (mailbox->Append("message " + to_string(i), keys[i]))
+        return STANDARD_ERROR;
+    }
+    int fd = open(summary.c_str(), O_RDONLY);
+    size_t size = stale.size() * sizeof(SummaryEntry);
+    bool saved = fd != -1 && pread(fd, stale.data(), size, sizeof(SummaryHeader)) == static_cast<ssize_t>(size);
+    if (fd != -1)
+      close(fd);
+    // A deletion changes neither the generation nor the number of entries
+    if (!saved || mailbox->Delete(keys[1]))
+      return STANDARD_ERROR;
+  }
+
+  // The entries as they were before the deletion, under the header written after it
+  int fd = open(summary.c_str(), O_WRONLY);
+  size_t size = stale.size() * sizeof(SummaryEntry);
+  bool damaged = fd != -1 && pwrite(fd, stale.data(), size, sizeof(SummaryHeader)) == static_cast<ssize_t>(size);
+  if (fd != -1)
+    close(fd);
+  shared_ptr<Mailbox> mailbox;
+  if (!damaged || EmailDataManager::instance()->OpenMailbox(TEST_MAILBOX, mailbox))
+    return STANDARD_ERROR;
+  return CheckSummary(mailbox, {keys[0], keys[2]});
+}
+
+int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  EmailDataManager::instance()->SetSharedPath(TEST_SHARED);
+
+  result = TestAppendRead();
+  cout << "TestAppendRead: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestReopen();
+  cout << "TestReopen: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestManyMessages();
+  cout << "TestManyMessages: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestSegments();
+  cout << "TestSegments: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestCodec();
+  cout << "TestCodec: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestCompression();
+  cout << "TestCompression: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestCompaction();
+  cout << "TestCompaction: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestCompactRetry();
+  cout << "TestCompactRetry: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestCompactRate();
+  cout << "TestCompactRate: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestSharedStorage();
+  cout << "TestSharedStorage: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestStream();
+  cout << "TestStream: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestRecovery();
+  cout << "TestRecovery: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestSummary();
+  cout << "TestSummary: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestStaleSummary();
+  cout << "TestStaleSummary: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestAppendMany();
+  cout << "TestAppendMany: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestDeleteMany();
+  cout << "TestDeleteMany: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  RemoveMailbox();
+  return (rc);
+}
@@ -0,0 +1,24 @@
+/*
+ * unit_test_edm.h
+ *
+ * This file provides unit test for edm.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "codec.h"
+#include "compactor.h"
+#include "edm.h"
+
+const char TEST_MAILBOX[] = "unit_test_edm.data/";
+const char TEST_SHARED[]  = "unit_test_edm.shared/";
+const char TEST_LOG[]     = "unit_test_edm.wal/";
+
+#define BUFFER_PIECE_SIZE 16381   // Pieces of SMTP DATA, as DataSocket::GetData() gives them
+
+#endif
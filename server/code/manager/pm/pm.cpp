@@ -0,0 +1,701 @@
+/*
+ * pm.cpp
+ *
+ * This file provides the Protocol Manager that runs the server side of the
+ * SMTP and POP3 sessions.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <strings.h>
+#include "../../basic/socket/scan.h"
+#include "../sim/sim.h"
+#include "pm.h"
+
+/************ Helper Functions *************/
+namespace {
+
+// Split "VERB argument" and compare the verb case-insensitively
+bool IsCommand (std::string_view line, const char *verb, std::string_view &argument)
+{
+  size_t length = strlen(verb);
+  if (line.size() < length || strncasecmp(line.data(), verb, length) != 0)
+    return false;
+  if (line.size() > length && line[length] != ' ')
+    return false;
+  argument = line.size() > length ? line.substr(length + 1) : std::string_view();
+  return true;
+}
+
+// Take the path out of "FROM:<path>" or "TO:<path>"
+bool ParsePath (std::string_view argument, const char *prefix, std::string &path)
+{
+  size_t length = strlen(prefix);
+  if (argument.size() < length || strncasecmp(argument.data(), prefix, length) != 0)
+    return false;
+  argument.remove_prefix(length);
+  while (!argument.empty() && argument.front() == ' ')
+    argument.remove_prefix(1);
+
+  size_t close = argument.find('>');
+  if (argument.empty() || argument.front() != '<' || close == std::string_view::npos)
+    return false;
+  path = std::string(argument.substr(1, close - 1));
+  return true;
+}
+
+// The reply to a DATA block the store has taken, or not
+const char *GetDataReply (RC rc)
+{
+  if (rc == SUCCESS)
+    return "250 OK\r\n";
+  if (rc == PM_RECIPIENT_REFUSED)
+    return "554 Transaction failed: no such user here\r\n";
+  return "451 Requested action aborted: local error in processing\r\n";
+}
+
+/**
+ * Cut a message after its header and the given number of body lines. The
+ * scan state lives in the struct, so the message can be fed in pieces.
+ */
+struct TopCutter {
+  size_t bodyLines;     // Body lines still to keep
+  bool   inBody;        // The empty line after the header has been passed
+  bool   lastWasCRLF;   // The previous line ended right before this piece
+  size_t length;        // Bytes kept so far
+  bool   done;
+
+  explicit TopCutter(size_t lines)
+    : bodyLines(lines), inBody(false), lastWasCRLF(true), length(0), done(false) {};
+
+  // Feed the next piece, which must start where the previous one ended
+  void Feed (const char *data, size_t size)
+  {
+    size_t offset = 0;
+    while (!done && offset < size) {
+      if (inBody && bodyLines == 0) {
+        done = true;
+        return;
+      }
+      size_t found = FindCRLF(data + offset, size - offset);
+      if (found == size - offset) {
+        // Keep the tail unless a CRLF may straddle the end of the piece
+        size_t keep = data[size - 1] == '\r' ? size - offset - 1 : size - offset;
+        length += keep;
+        // Only the '\r' left: the next piece starts right after the last CRLF
+        if (keep > 0)
+          lastWasCRLF = false;
+        return;
+      }
+      bool emptyLine = found == 0 && lastWasCRLF;
+      length += found + CRLF_LENGTH;
+      offset += found + CRLF_LENGTH;
+      lastWasCRLF = true;
+      if (inBody)
+        --bodyLines;
+      else if (emptyLine)
+        inBody = true;
+    }
+    if (inBody && bodyLines == 0)
+      done = true;
+  }
+};
+
+// Find where TOP cuts a message in a storage file, with small positioned reads of its head
+RC FindTopLength (int fileId, off_t offset, size_t length, size_t bodyLines, size_t &cut)
+{
+  TopCutter cutter(bodyLines);
+  char buffer[TOP_READ_SIZE];
+  size_t scanned = 0;
+  while (!cutter.done && scanned < length) {
+    size_t size = std::min(sizeof(buffer), length - scanned);
+    ssize_t got = pread(fileId, buffer, size, offset + scanned);
+    if (got <= 0)
+      return STANDARD_ERROR;
+    cutter.Feed(buffer, got);
+    if (!cutter.done && (cutter.length == scanned || static_cast<size_t>(got) < size))
+      return STANDARD_ERROR;
+    scanned = cutter.length;
+  }
+  cut = std::min(length, cutter.length);
+  return SUCCESS;
+}
+
+bool ParseNumber (std::string_view argument, size_t &number)
+{
+  if (argument.empty())
+    return false;
+  number = 0;
+  for (char c : argument) {
+    if (!isdigit(static_cast<unsigned char>(c)))
+      return false;
+    number = number * 10 + (c - '0');
+  }
+  return true;
+}
+
+/**
+ * The latency histograms of the commands of a protocol, found once: every
+ * known verb has its own, "<protocol>.<verb>.latency_us", any other verb
+ * shares "<protocol>.other.latency_us", so clients cannot make up metrics.
+ */
+struct CommandHistograms {
+  std::vector<const char *> verbs;
+  std::vector<Histogram *> histograms;  // One a verb, the shared one last
+
+  CommandHistograms(const std::string &protocol, std::vector<const char *> known)
+    : verbs(std::move(known))
+  {
+    for (const char *verb : verbs) {
+      std::string name = protocol + '.' + verb + ".latency_us";
+      for (char &c : name)
+        c = tolower(static_cast<unsigned char>(c));
+      histograms.push_back(SystemInfoManager::instance()->GetHistogram(name));
+    }
+    histograms.push_back(SystemInfoManager::instance()->GetHistogram(protocol + ".other.latency_us"));
+  }
+
+  Histogram *Find (std::string_view line) const
+  {
+    std::string_view argument;
+    for (size_t i = 0; i < verbs.size(); ++i)
+      if (IsCommand(line, verbs[i], argument))
+        return histograms[i];
+    return histograms.back();
+  }
+};
+
+const CommandHistograms &SmtpHistograms ()
+{
+  static CommandHistograms histograms("smtp", {"HELO", "EHLO", "MAIL", "RCPT", "DATA", "RSET", "NOOP", "QUIT",
+                                               "VRFY"});
+  return histograms;
+}
+
+const CommandHistograms &Pop3Histograms ()
+{
+  static CommandHistograms histograms("pop3", {"USER", "PASS", "STAT", "LIST", "RETR", "DELE", "NOOP", "RSET",
+                                               "QUIT", "TOP", "UIDL"});
+  return histograms;
+}
+
+}
+
+void DotStuff (std::string_view message, std::string &stuffed)
+{
+  stuffed.clear();
+  stuffed.reserve(message.size() + CRLF_LENGTH);
+
+  size_t offset = 0;
+  while (offset < message.size()) {
+    if (message[offset] == '.')
+      stuffed += '.';
+    size_t found = FindCRLF(message.data() + offset, message.size() - offset);
+    size_t end = found == message.size() - offset ? message.size() : offset + found + CRLF_LENGTH;
+    stuffed.append(message.data() + offset, end - offset);
+    offset = end;
+  }
+  if (stuffed.size() < CRLF_LENGTH || stuffed.compare(stuffed.size() - CRLF_LENGTH, CRLF_LENGTH, CRLF) != 0)
+    stuffed += CRLF;
+}
+
+/************ Maildrop *************/
+uint64_t Maildrop::GetTotalSize ()
+{
+  uint64_t octets = 0;
+  for (size_t i = 0; i < GetMessageNumber(); ++i)
+    octets += GetMessageSize(i);
+  return octets;
+}
+
+/************ ProtocolSession *************/
+ProtocolSession::ProtocolSession(DataSocket &socket)
+  : _socket(socket),
+    _closed(false),
+    _deferWork(false)
+{
+}
+
+RC ProtocolSession::Process ()
+{
+  RC rc = SUCCESS;
+  size_t handled = 0;
+
+  // Handle every complete command already received, replies only get queued
+  while (!_closed && !_done) {
+    if (handled++ == PROCESS_BATCH_SIZE) {
+      // The kernel wakes the reactor again for input it still holds itself
+      if (_socket.GetBufferedSize() > 0)
+        rc = PM_INPUT_PENDING;
+      break;
+    }
+    if (ExpectData()) {
+      std::string_view data;
+      bool complete;
+      if ((rc = _socket.GetData(data, complete)))
+        break;
+      if ((rc = HandleData(data, complete)))
+        break;
+      continue;
+    }
+
+    std::string_view line;
+    rc = _socket.GetLine(line);
+    if (rc == SOCKET_LINE_TOO_LONG) {
+      Reply("500 Line too long\r\n");
+      _closed = true;
+      break;
+    }
+    if (rc)
+      break;
+    // Up to the replies being queued, a deferred storage call is not waited for
+    LatencyTimer timer(GetCommandHistogram(line));
+    if ((rc = HandleLine(line)))
+      break;
+  }
+
+  // One gathered send for the whole batch of replies
+  RC flushRc = Flush();
+  if (_done && (flushRc == SUCCESS || flushRc == PM_OUTPUT_PENDING))
+    return PM_WORK_PENDING;
+  if (flushRc != SUCCESS)
+    return flushRc;
+  if (_closed || rc == SOCKET_CLOSED)
+    return PM_SESSION_CLOSED;
+  if (rc == SOCKET_WOULD_BLOCK)
+    return SUCCESS;
+  return rc;
+}
+
+RC ProtocolSession::Flush ()
+{
+  RC rc = _socket.Flush();
+  if (rc == SOCKET_WOULD_BLOCK)
+    return PM_OUTPUT_PENDING;
+  if (rc)
+    return rc;
+  return _closed ? PM_SESSION_CLOSED : SUCCESS;
+}
+
+std::function<RC()> ProtocolSession::TakeWork ()
+{
+  std::function<RC()> work;
+  work.swap(_work);
+  return work;
+}
+
+void ProtocolSession::CompleteWork (RC rc)
+{
+  std::function<void(RC)> done;
+  done.swap(_done);
+  if (done)
+    done(rc);
+}
+
+RC ProtocolSession::Defer (std::function<RC()> work, std::function<void(RC)> done)
+{
+  if (!_deferWork) {
+    done(work());
+    return SUCCESS;
+  }
+  _work = std::move(work);
+  _done = std::move(done);
+  return PM_WORK_PENDING;
+}
+
+/************ SmtpSession *************/
+SmtpSession::SmtpSession(DataSocket &socket, MailStore &store, const std::string &hostname)
+  : ProtocolSession(socket),
+    _store(store),
+    _hostname(hostname),
+    _state(SMTP_INIT),
+    _dataSize(0),
+    _dataError(NULL)
+{
+}
+
+RC SmtpSession::Greet ()
+{
+  Reply("220 " + _hostname + " ESMTP ready\r\n");
+  return Flush();
+}
+
+Histogram *SmtpSession::GetCommandHistogram (std::string_view line) const
+{
+  return SmtpHistograms().Find(line);
+}
+
+RC SmtpSession::HandleLine (std::string_view line)
+{
+  std::string_view argument;
+
+  if (IsCommand(line, "EHLO", argument)) {
+    ResetTransaction();
+    _state = SMTP_READY;
+    Reply("250-" + _hostname + "\r\n"
+          "250-PIPELINING\r\n"
+          "250-8BITMIME\r\n"
+          "250 SIZE " + std::to_string(SMTP_MAX_MESSAGE_SIZE) + "\r\n");
+  } else if (IsCommand(line, "HELO", argument)) {
+    ResetTransaction();
+    _state = SMTP_READY;
+    Reply("250 " + _hostname + "\r\n");
+  } else if (IsCommand(line, "MAIL", argument)) {
+    if (_state != SMTP_READY) {
+      Reply("503 Bad sequence of commands\r\n");
+    } else if (!ParsePath(argument, "FROM:", _envelope.from)) {
+      Reply("501 Syntax: MAIL FROM:<address>\r\n");
+    } else {
+      _state = SMTP_MAIL;
+      Reply("250 OK\r\n");
+    }
+  } else if (IsCommand(line, "RCPT", argument)) {
+    std::string recipient;
+    if (_state != SMTP_MAIL && _state != SMTP_RCPT) {
+      Reply("503 Bad sequence of commands\r\n");
+    } else if (!ParsePath(argument, "TO:", recipient) || recipient.empty()) {
+      Reply("501 Syntax: RCPT TO:<address>\r\n");
+    } else if (_envelope.recipients.size() >= SMTP_MAX_RECIPIENTS) {
+      Reply("452 Too many recipients\r\n");
+    } else if (_store.ChecksRecipients()) {
+      return Defer([this, recipient] { return _store.CheckRecipient(recipient); },
+                   [this, recipient] (RC rc) {
+                     if (rc == SUCCESS) {
+                       _envelope.recipients.push_back(recipient);
+                       _state = SMTP_RCPT;
+                       Reply("250 OK\r\n");
+                     } else {
+                       Reply(rc == PM_RECIPIENT_REFUSED ? "550 No such user here\r\n"
+                                                        : "451 Requested action aborted: local error in processing\r\n");
+                     }
+                   });
+    } else {
+      _envelope.recipients.push_back(std::move(recipient));
+      _state = SMTP_RCPT;
+      Reply("250 OK\r\n");
+    }
+  } else if (IsCommand(line, "DATA", argument)) {
+    // With pipelining every RCPT may have failed, DATA must fail as well
+    if (_state != SMTP_RCPT) {
+      Reply(_state == SMTP_MAIL ? "554 No valid recipients\r\n" : "503 Bad sequence of commands\r\n");
+    } else {
+      _state = SMTP_DATA;
+      Reply("354 End data with <CR><LF>.<CR><LF>\r\n");
+    }
+  } else if (IsCommand(line, "RSET", argument)) {
+    ResetTransaction();
+    Reply("250 OK\r\n");
+  } else if (IsCommand(line, "NOOP", argument)) {
+    Reply("250 OK\r\n");
+  } else if (IsCommand(line, "QUIT", argument)) {
+    Reply("221 " + _hostname + " closing connection\r\n");
+    _closed = true;
+  } else {
+    Reply("502 Command not implemented\r\n");
+  }
+
+  return SUCCESS;
+}
+
+RC SmtpSession::HandleData (std::string_view data, bool complete)
+{
+  // The whole block in one piece: a delivery made now reads it from the
+  // receive block. One left to a worker gets a copy, the block goes back to
+  // the pool if the connection closes while the worker has it
+  if (complete && _dataSize == 0 && !_dataError) {
+    if (data.size() > SMTP_MAX_MESSAGE_SIZE) {
+      Reply("552 Message size exceeds fixed maximum\r\n");
+      ResetTransaction();
+      return SUCCESS;
+    }
+    if (IsWorkDeferred()) {
+      if (_socket.Charge(data.size())) {
+        Reply("452 Insufficient system storage\r\n");
+        ResetTransaction();
+        return SUCCESS;
+      }
+      _message.assign(data);
+      data = _message;
+    }
+    return Defer([this, data] { return _store.Deliver(_envelope, data); },
+                 [this] (RC rc) {
+                   Reply(GetDataReply(rc));
+                   ResetTransaction();
+                 });
+  }
+
+  // A larger block is streamed to the store, or collected within the
+  // budgets, or dropped to its end
+  if (!_dataError) {
+    _dataSize += data.size();
+    if (_dataSize > SMTP_MAX_MESSAGE_SIZE)
+      _dataError = "552 Message size exceeds fixed maximum\r\n";
+    else if (!_stream && _message.empty() && _store.OpenStream(_envelope, _stream))
+      _dataError = "451 Requested action aborted: local error in processing\r\n";
+    else if (_stream && _stream->Write(data))
+      _dataError = "451 Requested action aborted: local error in processing\r\n";
+    else if (!_stream && _socket.Charge(data.size()))
+      _dataError = "452 Insufficient system storage\r\n";
+    else if (!_stream)
+      _message.append(data);
+    if (_dataError)
+      _stream.reset();
+  }
+  if (!complete) {
+    // A whole chunk is written before the next piece is read
+    if (_stream && _stream->IsFull()) {
+      return Defer([this] { return _stream->Flush(); },
+                   [this] (RC rc) {
+                     if (rc) {
+                       _dataError = GetDataReply(rc);
+                       _stream.reset();
+                     }
+                   });
+    }
+    return SUCCESS;
+  }
+
+  if (_dataError) {
+    Reply(_dataError);
+    ResetTransaction();
+    return SUCCESS;
+  }
+  std::function<RC()> deliver = [this] { return _store.Deliver(_envelope, _message); };
+  if (_stream)
+    deliver = [this] { return _stream->Commit(); };
+  return Defer(deliver,
+               [this] (RC rc) {
+                 Reply(GetDataReply(rc));
+                 ResetTransaction();
+               });
+}
+
+void SmtpSession::ResetTransaction ()
+{
+  _envelope.from.clear();
+  _envelope.recipients.clear();
+  _socket.Discharge(_message.size());
+  std::string().swap(_message);
+  _stream.reset();
+  _dataSize  = 0;
+  _dataError = NULL;
+  if (_state != SMTP_INIT)
+    _state = SMTP_READY;
+}
+
+/************ Pop3Session *************/
+Pop3Session::Pop3Session(DataSocket &socket, MailStore &store, const std::string &hostname)
+  : ProtocolSession(socket),
+    _store(store),
+    _hostname(hostname),
+    _state(POP3_AUTHORIZATION),
+    _number(0),
+    _octets(0)
+{
+}
+
+RC Pop3Session::Greet ()
+{
+  Reply("+OK " + _hostname + " POP3 ready\r\n");
+  return Flush();
+}
+
+Histogram *Pop3Session::GetCommandHistogram (std::string_view line) const
+{
+  return Pop3Histograms().Find(line);
+}
+
+RC Pop3Session::HandleLine (std::string_view line)
+{
+  std::string_view argument;
+
+  if (IsCommand(line, "QUIT", argument)) {
+    // Entering the UPDATE state: remove every message marked by DELE at once
+    if (_state == POP3_TRANSACTION) {
+      std::vector<size_t> indexes;
+      for (size_t i = 0; i < _deleted.size(); ++i) {
+        if (_deleted[i])
+          indexes.push_back(i);
+      }
+      if (!indexes.empty()) {
+        return Defer([this, indexes] { return _maildrop->DeleteMessages(indexes); },
+                     [this] (RC rc) {
+                       Reply(rc ? "-ERR some deleted messages not removed\r\n"
+                                : "+OK " + _hostname + " POP3 server signing off\r\n");
+                       _closed = true;
+                     });
+      }
+    }
+    Reply("+OK " + _hostname + " POP3 server signing off\r\n");
+    _closed = true;
+    return SUCCESS;
+  }
+
+  if (IsCommand(line, "NOOP", argument)) {
+    Reply(_state == POP3_TRANSACTION ? "+OK\r\n" : "-ERR not logged in\r\n");
+    return SUCCESS;
+  }
+
+  if (_state == POP3_AUTHORIZATION) {
+    if (IsCommand(line, "USER", argument) && !argument.empty()) {
+      _account = std::string(argument);
+      Reply("+OK\r\n");
+    } else if (IsCommand(line, "PASS", argument)) {
+      if (_account.empty()) {
+        Reply("-ERR USER first\r\n");
+      } else {
+        return Defer([this, password = std::string(argument)] {
+                       return _store.OpenMaildrop(_account, password, _maildrop);
+                     },
+                     [this] (RC rc) {
+                       if (rc || !_maildrop) {
+                         _account.clear();
+                         _maildrop.reset();
+                         Reply("-ERR invalid user or password\r\n");
+                       } else {
+                         _state = POP3_TRANSACTION;
+                         ResetMarks();
+                         Reply("+OK maildrop ready\r\n");
+                       }
+                     });
+      }
+    } else {
+      Reply("-ERR command not valid in this state\r\n");
+    }
+    return SUCCESS;
+  }
+
+  size_t index;
+  if (IsCommand(line, "STAT", argument)) {
+    Reply("+OK " + std::to_string(_number) + " " + std::to_string(_octets) + "\r\n");
+  } else if (IsCommand(line, "LIST", argument) || IsCommand(line, "UIDL", argument)) {
+    bool uidl = toupper(static_cast<unsigned char>(line[0])) == 'U';
+    if (!argument.empty()) {
+      if (ParseMessageNumber(argument, index)) {
+        Reply("-ERR no such message\r\n");
+      } else {
+        Reply("+OK " + std::to_string(index + 1) + " " +
+              (uidl ? _maildrop->GetUid(index) : std::to_string(_maildrop->GetMessageSize(index))) + "\r\n");
+      }
+    } else {
+      // The whole scan listing goes out as one reply
+      std::string listing = "+OK\r\n";
+      for (size_t i = 0; i < _deleted.size(); ++i) {
+        if (_deleted[i])
+          continue;
+        listing += std::to_string(i + 1);
+        listing += ' ';
+        listing += uidl ? _maildrop->GetUid(i) : std::to_string(_maildrop->GetMessageSize(i));
+        listing += "\r\n";
+      }
+      listing += ".\r\n";
+      Reply(std::move(listing));
+    }
+  } else if (IsCommand(line, "RETR", argument)) {
+    if (ParseMessageNumber(argument, index)) {
+      Reply("-ERR no such message\r\n");
+    } else {
+      return QueueContent(index, SIZE_MAX, "+OK " + std::to_string(_maildrop->GetMessageSize(index)) + " octets\r\n");
+    }
+  } else if (IsCommand(line, "TOP", argument)) {
+    size_t space = argument.find(' ');
+    size_t lines;
+    if (space == std::string_view::npos || !ParseNumber(argument.substr(space + 1), lines)) {
+      Reply("-ERR syntax: TOP msg n\r\n");
+    } else if (ParseMessageNumber(argument.substr(0, space), index)) {
+      Reply("-ERR no such message\r\n");
+    } else {
+      return QueueContent(index, lines, "+OK\r\n");
+    }
+  } else if (IsCommand(line, "DELE", argument)) {
+    if (ParseMessageNumber(argument, index)) {
+      Reply("-ERR no such message\r\n");
+    } else {
+      _deleted[index] = true;
+      --_number;
+      _octets -= _maildrop->GetMessageSize(index);
+      Reply("+OK message deleted\r\n");
+    }
+  } else if (IsCommand(line, "RSET", argument)) {
+    ResetMarks();
+    Reply("+OK\r\n");
+  } else {
+    Reply("-ERR command not implemented\r\n");
+  }
+
+  return SUCCESS;
+}
+
+RC Pop3Session::QueueContent (size_t index, size_t bodyLines, std::string status)
+{
+  int fileId;
+  off_t offset;
+  size_t length;
+
+  if (_maildrop->LocateMessage(index, fileId, offset, length) == SUCCESS) {
+    // RETR sends the storage file as it is, nothing to read first
+    if (bodyLines == SIZE_MAX) {
+      QueueRange(std::move(status), fileId, offset, length);
+      return SUCCESS;
+    }
+    std::shared_ptr<size_t> cut = std::make_shared<size_t>(length);
+    return Defer([fileId, offset, length, bodyLines, cut] {
+                   return FindTopLength(fileId, offset, length, bodyLines, *cut);
+                 },
+                 [this, fileId, offset, cut, status] (RC rc) {
+                   if (rc)
+                     Reply("-ERR unable to read message\r\n");
+                   else
+                     QueueRange(status, fileId, offset, *cut);
+                 });
+  }
+
+  std::shared_ptr<std::string> message = std::make_shared<std::string>();
+  return Defer([this, index, message] { return _maildrop->ReadMessage(index, *message); },
+               [this, bodyLines, message, status] (RC rc) {
+                 if (rc) {
+                   Reply("-ERR unable to read message\r\n");
+                   return;
+                 }
+                 if (bodyLines != SIZE_MAX) {
+                   TopCutter cutter(bodyLines);
+                   cutter.Feed(message->data(), message->size());
+                   message->resize(std::min(message->size(), cutter.length));
+                 }
+                 Reply(status);
+                 Reply(std::move(*message));
+                 Reply(".\r\n");
+               });
+}
+
+void Pop3Session::QueueRange (std::string status, int fileId, off_t offset, size_t length)
+{
+  Reply(std::move(status));
+  if (_socket.QueueFile(fileId, offset, length)) {
+    // The status line is already queued, the reply cannot be fixed up
+    _closed = true;
+    return;
+  }
+  Reply(".\r\n");
+}
+
+RC Pop3Session::ParseMessageNumber (std::string_view argument, size_t &index)
+{
+  size_t number;
+  if (!ParseNumber(argument, number) || number == 0 || number > _deleted.size() || _deleted[number - 1])
+    return PM_NO_SUCH_MESSAGE;
+  index = number - 1;
+  return SUCCESS;
+}
+
+void Pop3Session::ResetMarks ()
+{
+  _number = _maildrop->GetMessageNumber();
+  _octets = _maildrop->GetTotalSize();
+  _deleted.assign(_number, false);
+}
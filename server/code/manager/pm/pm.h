@@ -0,0 +1,361 @@
+#ifndef PROTOCOL_MANAGER
+#define PROTOCOL_MANAGER
+
+/* ----- Include libries or files ----- */
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../../basic/socket/socket.h"
+#include "../../util/emailError.h"
+#include "../../util/util.h"
+
+class Histogram;
+
+/* ----- Define macros ----- */
+enum {
+  PM_OUTPUT_PENDING = 501,
+  PM_SESSION_CLOSED,
+  PM_AUTH_FAILED,
+  PM_NO_SUCH_MESSAGE,
+  PM_DELIVERY_FAILED,
+  PM_INPUT_PENDING,
+  PM_WORK_PENDING,
+  PM_RECIPIENT_REFUSED,     // For a MailStore: the recipient does not exist, never try again
+};
+
+#define SMTP_MAX_RECIPIENTS  100
+#define SMTP_MAX_MESSAGE_SIZE (50 * 1024 * 1024)
+#define TOP_READ_SIZE        4096
+#define PROCESS_BATCH_SIZE   64     // Commands handled by one Process() call
+
+/* ----- Define structs ----- */
+struct Envelope {
+  std::string from;                     // Reverse-path, without the brackets
+  std::vector<std::string> recipients;  // Forward-paths, without the brackets
+};
+
+/**
+ * Maildrop
+ * This interface gives a POP3 session the messages of one mailbox. Message
+ * indexes are ZERO based, POP3 message numbers are index + 1.
+ *
+ * Messages are kept the way they came in through SMTP DATA: dot-stuffed and
+ * ending with a CRLF. That is also what POP3 sends, so a message can go from
+ * storage to the socket unchanged. When LocateMessage() can name the file
+ * range holding it, RETR and TOP send it with sendfile(); otherwise they fall
+ * back to ReadMessage(). The file descriptor stays owned by the Maildrop.
+ *
+ * The session asks for the totals once, when the maildrop is opened, and
+ * keeps them up to date through DELE and RSET; a store keeping a summary
+ * (see the EDM) should answer GetTotalSize() without a walk.
+ */
+class Maildrop
+{
+public:
+  virtual ~Maildrop() {};
+  virtual size_t GetMessageNumber () = 0;
+  virtual size_t GetMessageSize   (size_t index) = 0;
+  virtual uint64_t GetTotalSize   ();
+  virtual std::string GetUid      (size_t index) = 0;
+  virtual RC ReadMessage    (size_t index, std::string &message) = 0;
+  virtual RC DeleteMessages (const std::vector<size_t> &indexes) = 0;
+  virtual RC LocateMessage  (size_t, int &, off_t &, size_t &) { return PM_NO_SUCH_MESSAGE; };
+};
+
+/**
+ * DeliveryStream
+ * This interface takes a DATA block in pieces and writes it to the storage
+ * as it comes, so a large message is never in memory whole. Write() only
+ * copies a piece and must not block; once IsFull(), Flush() writes what has
+ * been buffered. Nothing is delivered before Commit(), a stream destroyed
+ * without it leaves nothing behind.
+ */
+class DeliveryStream
+{
+public:
+  virtual ~DeliveryStream() {};
+  virtual RC   Write  (std::string_view data) = 0;
+  virtual bool IsFull () const = 0;
+  virtual RC   Flush  () = 0;
+  virtual RC   Commit () = 0;
+};
+
+/**
+ * MailStore
+ * This interface connects the protocol sessions to the storage below them.
+ * Deliver() receives a DATA block exactly as it came off the wire: dot-stuffed
+ * and ending with a CRLF. Messages that do not come from SMTP should go
+ * through DotStuff() first.
+ *
+ * A DATA block larger than the receive block goes to OpenStream() instead,
+ * which must not block either. A store without streaming leaves the stream
+ * empty and gets the block collected in memory.
+ *
+ * A store that knows its recipients says so with ChecksRecipients(); every
+ * RCPT then goes through CheckRecipient(), a storage call, and one refused
+ * with PM_RECIPIENT_REFUSED gets a 550. Deliver() and Commit() return
+ * PM_RECIPIENT_REFUSED for a recipient gone since, the client gets a 554;
+ * any other error is a 451 and the client tries again. A message is never
+ * taken with a 250 and then dropped.
+ */
+class MailStore
+{
+public:
+  virtual ~MailStore() {};
+  virtual RC Deliver      (const Envelope &envelope, std::string_view data) = 0;
+  virtual RC OpenMaildrop (const std::string &account, const std::string &password,
+                           std::unique_ptr<Maildrop> &maildrop) = 0;
+  virtual RC OpenStream   (const Envelope &, std::unique_ptr<DeliveryStream> &) { return SUCCESS; };
+  virtual bool ChecksRecipients () const { return false; };
+  virtual RC CheckRecipient (const std::string &) { return SUCCESS; };
+};
+
+/**
+ * This function will put a message into the form it has in SMTP DATA and
+ * POP3 RETR: every line starting with '.' gets one more '.', and the message
+ * ends with a CRLF.
+ * @param  string_view given as the message.
+ *         string stores the dot-stuffed message.
+ */
+void DotStuff (std::string_view message, std::string &stuffed);
+
+/**
+ * ProtocolSession
+ * This class holds what SMTP and POP3 sessions share: it reads every complete
+ * command that is buffered on the socket, queues the replies and writes the
+ * whole batch with one gathered send. A pipelining client therefore costs one
+ * send per batch of commands instead of one per reply. A batch stops after
+ * PROCESS_BATCH_SIZE commands, so one client cannot hold its thread while
+ * other sessions wait.
+ *
+ * The calls into the storage (delivery, opening and updating a maildrop) may
+ * block on the disk. With SetDeferWork(true) the session does not make them
+ * itself: Process() returns PM_WORK_PENDING, the caller runs TakeWork() where
+ * blocking is fine and hands the result back with CompleteWork(). No command
+ * is handled in between, so the replies stay in order.
+ *
+ * Contained Public Functions:
+ *   RC   Greet    ()
+ *   RC   Process  ()
+ *   bool IsClosed ()
+ *   void SetDeferWork (bool defer)
+ *   bool HasWork  ()
+ *   std::function<RC()> TakeWork ()
+ *   void CompleteWork (RC rc)
+ */
+class ProtocolSession
+{
+public:
+  explicit ProtocolSession(DataSocket &socket);
+  virtual ~ProtocolSession() {};
+
+  /**
+   * This function will queue and send the greeting of the protocol.
+   * @return same as Process().
+   */
+  virtual RC Greet () = 0;
+
+  /**
+   * This function will handle every command buffered on the socket, then flush
+   * the queued replies.
+   * @return SUCCESS if all replies are sent and more input is needed.
+   *         PM_INPUT_PENDING if the batch is full and commands are still
+   *         buffered, call again after the other sessions had their turn.
+   *         PM_OUTPUT_PENDING if the socket is full, call again once writable.
+   *         PM_WORK_PENDING if a storage call waits for TakeWork(), call again
+   *         after CompleteWork().
+   *         PM_SESSION_CLOSED if the session is over or the peer has gone.
+   *         pre-defined socket error number otherwise.
+   */
+  RC Process ();
+
+  /**
+   * This function will tell if the session has finished (QUIT or error).
+   * @return true if no more commands will be handled.
+   */
+  bool IsClosed () const { return _closed; };
+
+  /**
+   * This function will choose who makes the storage calls. Off by default:
+   * the session makes them inside Process().
+   * @param bool given as true to hand them to the caller.
+   */
+  void SetDeferWork (bool defer) { _deferWork = defer; };
+
+  /**
+   * This function will tell if a storage call waits to be taken.
+   * @return true if TakeWork() has something to give.
+   */
+  bool HasWork () const { return static_cast<bool>(_work); };
+
+  /**
+   * This function will give the waiting storage call to the caller. It only
+   * uses state the session does not touch until CompleteWork().
+   * @return function that makes the call and returns its result.
+   */
+  std::function<RC()> TakeWork ();
+
+  /**
+   * This function will queue the replies for the result of a storage call.
+   * Call Process() afterwards to send them and go on with the commands.
+   * @param RC given as what the function from TakeWork() returned.
+   */
+  void CompleteWork (RC rc);
+
+protected:
+  DataSocket &_socket;
+  bool _closed;
+
+  /**
+   * This function will make a storage call now, or leave it to the caller if
+   * the work is deferred.
+   * @param function given as the storage call.
+   *        function given as what to do with its result, run on the session.
+   * @return SUCCESS if the call has been made.
+   *         PM_WORK_PENDING if it waits for TakeWork().
+   */
+  RC Defer (std::function<RC()> work, std::function<void(RC)> done);
+
+  /**
+   * This function will tell if the storage calls are left to the caller, to
+   * run after Process() has returned.
+   */
+  bool IsWorkDeferred () const { return _deferWork; };
+
+  /**
+   * This function will queue one reply. Sent by the next Flush().
+   * @param string given as the reply including its CRLF.
+   */
+  void Reply (std::string reply) { _socket.QueueMessage(std::move(reply)); };
+
+  /**
+   * This function will send the queued replies.
+   * @return same as Process().
+   */
+  RC Flush ();
+
+  // Protocol specific parts
+  virtual RC   HandleLine (std::string_view line) = 0;
+  virtual bool ExpectData () const { return false; };
+  virtual RC   HandleData (std::string_view, bool) { return SUCCESS; };
+
+  /**
+   * This function will give the histogram of the System Info Manager timing
+   * a command line.
+   * @return Histogram of its verb, NULL not to time it.
+   */
+  virtual Histogram *GetCommandHistogram (std::string_view) const { return NULL; };
+
+private:
+  bool _deferWork;                   // Set by SetDeferWork()
+  std::function<RC()>     _work;     // Storage call not taken yet
+  std::function<void(RC)> _done;     // Completion of the storage call in flight
+};
+
+/**
+ * SmtpSession
+ * This class runs the server side of one SMTP session (RFC 5321) and supports
+ * command pipelining (RFC 2920).
+ *
+ * A DATA block that fits into the receive block of the socket is delivered
+ * from there. A larger one is streamed to the MailStore piece by piece, the
+ * writes going through Defer() like the other storage calls, so a session
+ * holds one chunk of it at most however large it is. With a store that cannot
+ * stream, it is collected while the connection and global budgets allow it;
+ * otherwise the rest of it is dropped and the client gets a 452, so a flood
+ * of large uploads cannot grow the memory without bound.
+ */
+class SmtpSession : public ProtocolSession
+{
+public:
+  SmtpSession(DataSocket &socket, MailStore &store, const std::string &hostname);
+
+  RC Greet () override;
+
+protected:
+  RC   HandleLine (std::string_view line) override;
+  bool ExpectData () const override { return _state == SMTP_DATA; };
+  RC   HandleData (std::string_view data, bool complete) override;
+  Histogram *GetCommandHistogram (std::string_view line) const override;
+
+private:
+  enum SmtpState { SMTP_INIT, SMTP_READY, SMTP_MAIL, SMTP_RCPT, SMTP_DATA };
+
+  MailStore  &_store;
+  std::string _hostname;
+  SmtpState   _state;
+  Envelope    _envelope;
+  std::string _message;      // DATA block received in pieces, charged to the socket
+  std::unique_ptr<DeliveryStream> _stream;  // DATA block being streamed to the store
+  size_t      _dataSize;     // Bytes of the DATA block received so far
+  const char *_dataError;    // Reply for a DATA block being dropped, NULL if none
+
+  void ResetTransaction ();
+};
+
+/**
+ * Pop3Session
+ * This class runs the server side of one POP3 session (RFC 1939).
+ */
+class Pop3Session : public ProtocolSession
+{
+public:
+  Pop3Session(DataSocket &socket, MailStore &store, const std::string &hostname);
+
+  RC Greet () override;
+
+protected:
+  RC HandleLine (std::string_view line) override;
+  Histogram *GetCommandHistogram (std::string_view line) const override;
+
+private:
+  enum Pop3State { POP3_AUTHORIZATION, POP3_TRANSACTION };
+
+  MailStore  &_store;
+  std::string _hostname;
+  Pop3State   _state;
+  std::string _account;                  // Given by USER
+  std::unique_ptr<Maildrop> _maildrop;   // Opened by PASS
+  std::vector<bool> _deleted;            // Marked by DELE, by message index
+  size_t   _number;                      // Messages not marked, what STAT reports
+  uint64_t _octets;                      // Their total size
+
+  /**
+   * This function will turn a POP3 message number argument into an index.
+   * @param string_view given as the argument.
+   *        size_t stores the message index.
+   * @return SUCCESS if it names an existing, not deleted message.
+   *         PM_NO_SUCH_MESSAGE otherwise.
+   */
+  RC ParseMessageNumber (std::string_view argument, size_t &index);
+
+  /**
+   * This function will take the totals of the maildrop again and unmark all
+   * messages, as after PASS and RSET.
+   */
+  void ResetMarks ();
+
+  /**
+   * This function will queue the status line, the first bytes of a message and
+   * the final ".\r\n", or an -ERR reply if it cannot be read. The message
+   * comes from the storage file when the Maildrop can locate it, from memory
+   * otherwise; reading it, or the head of the file for TOP, goes through
+   * Defer() like the other storage calls.
+   * @param size_t given as the message index.
+   *        size_t given as the number of lines of the body, SIZE_MAX for all.
+   *        string given as the status line, queued only on success.
+   * @return same as Defer().
+   */
+  RC QueueContent (size_t index, size_t bodyLines, std::string status);
+
+  /**
+   * This function will queue the status line, a range of a storage file to
+   * send with sendfile() and the final ".\r\n".
+   */
+  void QueueRange (std::string status, int fileId, off_t offset, size_t length);
+};
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ * unit_test_pm.cpp
+ *
+ * This file provides unit test for pm.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <iostream>
+#include <sys/socket.h>
+#include "unit_test_pm.h"
+using namespace std;
+
+// Read everything the session has sent so far
+static string Drain (DataSocket &client)
+{
+  string reply;
+  while (client.GetMessage(reply) == SUCCESS) {}
+  return reply;
+}
+
+static RC TestSmtpPipelining (MemoryStore &store)
+{
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+
+  if (session.Greet() || Drain(client) != "220 " TEST_HOSTNAME " ESMTP ready\r\n")
+    return STANDARD_ERROR;
+
+  client.PutMessage("EHLO client.example.com\r\n");
+  if (session.Process() || Drain(client).find("250-PIPELINING\r\n") == string::npos)
+    return STANDARD_ERROR;
+
+  // The whole transaction in one packet, the replies come back in order
+  client.PutMessage("MAIL FROM:<a@example.com>\r\n"
+                    "RCPT TO:<user@example.com>\r\n"
+                    "RCPT TO:no-brackets@example.com\r\n"
+                    "RCPT TO:<other@example.com>\r\n"
+                    "DATA\r\n");
+  if (session.Process())
+    return STANDARD_ERROR;
+  if (Drain(client) != "250 OK\r\n250 OK\r\n501 Syntax: RCPT TO:<address>\r\n250 OK\r\n"
+                       "354 End data with <CR><LF>.<CR><LF>\r\n")
+    return STANDARD_ERROR;
+
+  client.PutMessage("Subject: hi\r\n\r\n..dot\r\n.\r\nQUIT\r\n");
+  if (session.Process() != PM_SESSION_CLOSED)
+    return STANDARD_ERROR;
+  if (Drain(client) != "250 OK\r\n221 " TEST_HOSTNAME " closing connection\r\n")
+    return STANDARD_ERROR;
+
+  if (store.envelopes.size() != 1 || store.envelopes[0].recipients.size() != 2)
+    return STANDARD_ERROR;
+  return store.bodies[0] == "Subject: hi\r\n\r\n..dot\r\n" ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestPop3Session (MemoryStore &store)
+{
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  Pop3Session session(server, store, TEST_HOSTNAME);
+  session.Greet();
+  Drain(client);
+
+  client.PutMessage("USER user@example.com\r\nPASS wrong\r\n");
+  if (session.Process() || Drain(client) != "+OK\r\n-ERR invalid user or password\r\n")
+    return STANDARD_ERROR;
+
+  string size = to_string(store.bodies[0].size());
+  client.PutMessage("USER user@example.com\r\nPASS secret\r\nSTAT\r\nLIST\r\nUIDL 1\r\nRETR 1\r\nDELE 1\r\nSTAT\r\n"
+                    "RSET\r\nSTAT\r\nDELE 1\r\n");
+  if (session.Process())
+    return STANDARD_ERROR;
+  string expect = "+OK\r\n+OK maildrop ready\r\n"
+                  "+OK 1 " + size + "\r\n"
+                  "+OK\r\n1 " + size + "\r\n.\r\n"
+                  "+OK 1 uid0\r\n"
+                  "+OK " + size + " octets\r\n" + store.bodies[0] + ".\r\n"
+                  "+OK message deleted\r\n"
+                  "+OK 0 0\r\n"
+                  "+OK\r\n+OK 1 " + size + "\r\n"
+                  "+OK message deleted\r\n";
+  if (Drain(client) != expect)
+    return STANDARD_ERROR;
+
+  client.PutMessage("QUIT\r\n");
+  if (session.Process() != PM_SESSION_CLOSED)
+    return STANDARD_ERROR;
+  return store.lastMaildrop->deleted == vector<size_t>{ 0 } ? SUCCESS : STANDARD_ERROR;
+}
+
+// RETR and TOP give the same bytes from a storage file and from memory
+static RC TestRetrieveTop ()
+{
+  vector<string> messages = {
+    "Subject: first\r\nFrom: a@b.com\r\n\r\nline 1\r\n..line 2\r\nline 3\r\n",
+    "Subject: second\r\n\r\n" + string(3 * TOP_READ_SIZE, 'x') + "\r\nlast\r\n",
+  };
+  FileStore fileStore;
+  fileStore.messages = messages;
+  MemoryStore memoryStore;
+  memoryStore.bodies = messages;
+
+  string replies[2];
+  MailStore *stores[2] = { &fileStore, &memoryStore };
+  for (int i = 0; i < 2; ++i) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+      return STANDARD_ERROR;
+    DataSocket server(pair[0]);
+    DataSocket client(pair[1]);
+    Pop3Session session(server, *stores[i], TEST_HOSTNAME);
+    session.Greet();
+    Drain(client);
+    client.PutMessage("USER user@example.com\r\nPASS secret\r\nRETR 1\r\nTOP 1 1\r\nTOP 1 0\r\nTOP 2 1\r\nRETR 2\r\n");
+    RC rc;
+    while ((rc = session.Process()) == PM_OUTPUT_PENDING)
+      replies[i] += Drain(client);
+    if (rc)
+      return STANDARD_ERROR;
+    replies[i] += Drain(client);
+  }
+  remove("unit_test_pm.data");
+
+  string expect = "+OK\r\n+OK maildrop ready\r\n"
+                  "+OK " + to_string(messages[0].size()) + " octets\r\n" + messages[0] + ".\r\n"
+                  "+OK\r\nSubject: first\r\nFrom: a@b.com\r\n\r\nline 1\r\n.\r\n"
+                  "+OK\r\nSubject: first\r\nFrom: a@b.com\r\n\r\n.\r\n"
+                  "+OK\r\nSubject: second\r\n\r\n" + string(3 * TOP_READ_SIZE, 'x') + "\r\n.\r\n"
+                  "+OK " + to_string(messages[1].size()) + " octets\r\n" + messages[1] + ".\r\n";
+  return (replies[0] == expect && replies[1] == expect) ? SUCCESS : STANDARD_ERROR;
+}
+
+// TOP from a file finds the end of the header when its '\r' ends a read
+static RC TestTopBoundary ()
+{
+  string header = "Subject: boundary\r\nX-Pad: ";
+  header += string(TOP_READ_SIZE - 1 - header.size() - 2, 'p') + "\r\n";
+  FileStore store;
+  store.messages = { header + "\r\nbody 1\r\nbody 2\r\n" };
+
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  Pop3Session session(server, store, TEST_HOSTNAME);
+  session.Greet();
+  Drain(client);
+  client.PutMessage("USER user@example.com\r\nPASS secret\r\nTOP 1 1\r\n");
+  string reply;
+  RC rc;
+  while ((rc = session.Process()) == PM_OUTPUT_PENDING)
+    reply += Drain(client);
+  reply += Drain(client);
+  remove("unit_test_pm.data");
+
+  // The empty line is at offset TOP_READ_SIZE - 1
+  if (rc || header.size() != TOP_READ_SIZE - 1)
+    return STANDARD_ERROR;
+  return reply == "+OK\r\n+OK maildrop ready\r\n+OK\r\n" + header + "\r\nbody 1\r\n.\r\n" ? SUCCESS : STANDARD_ERROR;
+}
+
+// A long pipelined batch is handled in turns of PROCESS_BATCH_SIZE commands
+static RC TestBatchLimit (MemoryStore &store)
+{
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+  session.Greet();
+  Drain(client);
+
+  string batch;
+  for (int i = 0; i < PROCESS_BATCH_SIZE + 10; ++i)
+    batch += "NOOP\r\n";
+  client.PutMessage(batch);
+
+  if (session.Process() != PM_INPUT_PENDING || Drain(client).size() != PROCESS_BATCH_SIZE * 8)
+    return STANDARD_ERROR;
+  if (session.Process() != SUCCESS || Drain(client).size() != 10 * 8)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// With deferred work the caller makes the storage call, the replies stay in order
+static RC TestDeferWork (MemoryStore &store)
+{
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+  session.SetDeferWork(true);
+  session.Greet();
+  Drain(client);
+
+  size_t before = store.envelopes.size();
+  client.PutMessage("EHLO client\r\nMAIL FROM:<a@b.com>\r\nRCPT TO:<c@d.com>\r\nDATA\r\nbody\r\n.\r\nNOOP\r\n");
+  if (session.Process() != PM_WORK_PENDING || !session.HasWork() || store.envelopes.size() != before)
+    return STANDARD_ERROR;
+  string replies = Drain(client);
+  if (replies.rfind("354 ") == string::npos || replies.substr(replies.rfind("354 ")).find("250") != string::npos)
+    return STANDARD_ERROR;
+
+  std::function<RC()> work = session.TakeWork();
+  session.CompleteWork(work());
+  if (session.Process() != SUCCESS || Drain(client) != "250 OK\r\n250 OK\r\n")
+    return STANDARD_ERROR;
+  if (store.envelopes.size() != before + 1)
+    return STANDARD_ERROR;
+
+  // POP3 reads the message, and the head of its file for TOP, the same way
+  FileStore files;
+  files.messages = { "Subject: top\r\n\r\nline 1\r\nline 2\r\n" };
+  MailStore *stores[2] = { &store, &files };
+  for (MailStore *pop3Store : stores) {
+    Pop3Session pop3(server, *pop3Store, TEST_HOSTNAME);
+    pop3.SetDeferWork(true);
+    client.PutMessage("USER user@example.com\r\nPASS secret\r\n");
+    if (pop3.Process() != PM_WORK_PENDING)
+      return STANDARD_ERROR;
+    pop3.CompleteWork(pop3.TakeWork()());
+    client.PutMessage("TOP 1 0\r\nNOOP\r\n");
+    if (pop3.Process() != PM_WORK_PENDING || !pop3.HasWork() || Drain(client) != "+OK\r\n+OK maildrop ready\r\n")
+      return STANDARD_ERROR;
+    pop3.CompleteWork(pop3.TakeWork()());
+    if (pop3.Process() != SUCCESS || Drain(client).find("\r\n\r\n.\r\n+OK\r\n") == string::npos)
+      return STANDARD_ERROR;
+  }
+  remove("unit_test_pm.data");
+  return SUCCESS;
+}
+
+// DATA larger than the receive block is collected, or refused over budget
+static RC TestLargeData ()
+{
+  MemoryStore store;
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+  session.Greet();
+  Drain(client);
+
+  string body;
+  while (body.size() < 3 * BUFFER_BLOCK_SIZE)
+    body += "Subject: large\r\n..line\r\n";
+  string transaction = "MAIL FROM:<a@b.com>\r\nRCPT TO:<c@d.com>\r\nDATA\r\n" + body + ".\r\n";
+
+  client.PutMessage("EHLO client\r\n" + transaction);
+  string replies;
+  RC rc;
+  while ((rc = session.Process()) == SUCCESS && replies.find("250 OK\r\n250 OK\r\n354") == string::npos)
+    replies += Drain(client);
+  while (rc == SUCCESS && store.bodies.empty())
+    rc = session.Process();
+  if (rc || store.bodies.size() != 1 || store.bodies[0] != body)
+    return STANDARD_ERROR;
+  Drain(client);
+
+  // Over the connection budget: dropped to its end, the session goes on
+  server.SetBudget(BUFFER_BLOCK_SIZE);
+  client.PutMessage(transaction + "NOOP\r\n");
+  replies.clear();
+  while ((rc = session.Process()) == SUCCESS && replies.find("452") == string::npos)
+    replies += Drain(client);
+  replies += Drain(client);
+  return (rc == SUCCESS && store.bodies.size() == 1 &&
+          replies.find("452 Insufficient system storage\r\n250 OK\r\n") != string::npos) ? SUCCESS : STANDARD_ERROR;
+}
+
+// DATA larger than the receive block is streamed to a store that can take it
+static RC TestStreamData ()
+{
+  StreamStore store;
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+  session.SetDeferWork(true);
+  session.Greet();
+  Drain(client);
+
+  string body;
+  while (body.size() < 4 * BUFFER_BLOCK_SIZE)
+    body += "Subject: stream\r\n..line\r\n";
+  client.PutMessage("EHLO client\r\nMAIL FROM:<a@b.com>\r\nRCPT TO:<c@d.com>\r\nDATA\r\n" + body + ".\r\nNOOP\r\n");
+
+  // Every chunk write and the commit are storage calls handed to the caller
+  RC rc;
+  size_t works = 0;
+  while ((rc = session.Process()) == SUCCESS || rc == PM_WORK_PENDING) {
+    if (rc == SUCCESS && store.bodies.size() == 1)
+      break;
+    if (rc == PM_WORK_PENDING) {
+      std::function<RC()> work = session.TakeWork();
+      session.CompleteWork(work());
+      ++works;
+    }
+  }
+  string replies = Drain(client);
+  return (rc == SUCCESS && store.bodies.size() == 1 && store.bodies[0] == body && works > 2 &&
+          store.maxBuffered < TEST_CHUNK_SIZE + BUFFER_BLOCK_SIZE &&
+          replies.find("354 End data with <CR><LF>.<CR><LF>\r\n250 OK\r\n250 OK\r\n") != string::npos)
+         ? SUCCESS : STANDARD_ERROR;
+}
+
+// A store that knows its recipients refuses the others at RCPT, and never takes a message it cannot deliver
+static RC TestRecipientCheck ()
+{
+  CheckedStore store;
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair))
+    return STANDARD_ERROR;
+  DataSocket server(pair[0]);
+  DataSocket client(pair[1]);
+  SmtpSession session(server, store, TEST_HOSTNAME);
+  session.SetDeferWork(true);
+  session.Greet();
+  Drain(client);
+
+  client.PutMessage("EHLO client\r\n");
+  session.Process();
+  Drain(client);
+  client.PutMessage("MAIL FROM:<a@b.com>\r\nRCPT TO:<nobody@example.com>\r\nRCPT TO:<user@example.com>\r\n"
+                    "DATA\r\nbody\r\n.\r\n"
+                    "MAIL FROM:<a@b.com>\r\nRCPT TO:<nobody@example.com>\r\nDATA\r\nRSET\r\n"
+                    "MAIL FROM:<a@b.com>\r\nRCPT TO:<user@example.com>\r\nDATA\r\ngone\r\n.\r\nNOOP\r\n");
+  string replies;
+  size_t works = 0;
+  RC rc;
+  while ((rc = session.Process()) == PM_WORK_PENDING) {
+    // Refused once the first message is in
+    store.deliverRc = store.bodies.empty() ? SUCCESS : PM_RECIPIENT_REFUSED;
+    session.CompleteWork(session.TakeWork()());
+    ++works;
+  }
+  replies = Drain(client);
+  return (rc == SUCCESS && works == 6 && store.bodies.size() == 1 &&
+          store.envelopes[0].recipients == vector<string>{ "user@example.com" } &&
+          replies == "250 OK\r\n550 No such user here\r\n250 OK\r\n354 End data with <CR><LF>.<CR><LF>\r\n"
+                     "250 OK\r\n"
+                     "250 OK\r\n550 No such user here\r\n554 No valid recipients\r\n250 OK\r\n"
+                     "250 OK\r\n250 OK\r\n354 End data with <CR><LF>.<CR><LF>\r\n"
+                     "554 Transaction failed: no such user here\r\n250 OK\r\n") ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestDotStuff ()
+{
+  string stuffed;
+  DotStuff(".hidden\r\nline\r\n.\r\nno end", stuffed);
+  return stuffed == "..hidden\r\nline\r\n..\r\nno end\r\n" ? SUCCESS : STANDARD_ERROR;
+}
+
+int main () {
+  MemoryStore store;
+  RC rc = SUCCESS;
+  RC result;
+
+  result = TestSmtpPipelining(store);
+  cout << "TestSmtpPipelining: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestPop3Session(store);
+  cout << "TestPop3Session: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestRetrieveTop();
+  cout << "TestRetrieveTop: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestTopBoundary();
+  cout << "TestTopBoundary: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestBatchLimit(store);
+  cout << "TestBatchLimit: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestDeferWork(store);
+  cout << "TestDeferWork: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestLargeData();
+  cout << "TestLargeData: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestStreamData();
+  cout << "TestStreamData: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestRecipientCheck();
+  cout << "TestRecipientCheck: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestDotStuff();
+  cout << "TestDotStuff: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  return (rc);
+}
@@ -0,0 +1,172 @@
+/*
+ * unit_test_pm.h
+ *
+ * This file provides unit test for pm.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include <cstdio>
+#include <fcntl.h>
+#include "pm.h"
+
+#define TEST_HOSTNAME "mail.example.com"
+
+/* ----- Memory backed MailStore for the sessions under test ----- */
+class MemoryMaildrop : public Maildrop
+{
+public:
+  std::vector<std::string> messages;
+  std::vector<size_t> deleted;
+
+  size_t GetMessageNumber () override { return messages.size(); };
+  size_t GetMessageSize (size_t index) override { return messages[index].size(); };
+  std::string GetUid (size_t index) override { return "uid" + std::to_string(index); };
+  RC ReadMessage (size_t index, std::string &message) override { message = messages[index]; return SUCCESS; };
+  RC DeleteMessages (const std::vector<size_t> &indexes) override { deleted = indexes; return SUCCESS; };
+};
+
+/* ----- Maildrop keeping all messages back to back in one file ----- */
+class FileMaildrop : public MemoryMaildrop
+{
+public:
+  int fileId = -1;
+  std::vector<off_t> offsets;
+
+  RC Write (const char *path)
+  {
+    fileId = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    off_t offset = 0;
+    for (const std::string &message : messages) {
+      if (pwrite(fileId, message.data(), message.size(), offset) != static_cast<ssize_t>(message.size()))
+        return STANDARD_ERROR;
+      offsets.push_back(offset);
+      offset += message.size();
+    }
+    return fileId == -1 ? STANDARD_ERROR : SUCCESS;
+  }
+  ~FileMaildrop() { if (fileId != -1) close(fileId); }
+
+  RC ReadMessage (size_t, std::string &) override { return STANDARD_ERROR; };
+  RC LocateMessage (size_t index, int &file, off_t &offset, size_t &length) override
+  {
+    file   = fileId;
+    offset = offsets[index];
+    length = messages[index].size();
+    return SUCCESS;
+  }
+};
+
+class FileStore : public MailStore
+{
+public:
+  std::vector<std::string> messages;
+  RC Deliver (const Envelope &, std::string_view) override { return SUCCESS; };
+  RC OpenMaildrop (const std::string &, const std::string &, std::unique_ptr<Maildrop> &maildrop) override
+  {
+    FileMaildrop *file = new FileMaildrop();
+    file->messages = messages;
+    maildrop.reset(file);
+    return file->Write("unit_test_pm.data");
+  }
+};
+
+class MemoryStore : public MailStore
+{
+public:
+  std::vector<Envelope> envelopes;
+  std::vector<std::string> bodies;
+  MemoryMaildrop *lastMaildrop = NULL;
+
+  RC Deliver (const Envelope &envelope, std::string_view data) override
+  {
+    envelopes.push_back(envelope);
+    bodies.push_back(std::string(data));
+    return SUCCESS;
+  }
+
+  RC OpenMaildrop (const std::string &account, const std::string &password,
+                   std::unique_ptr<Maildrop> &maildrop) override
+  {
+    if (account != "user@example.com" || password != "secret")
+      return PM_AUTH_FAILED;
+    MemoryMaildrop *memory = new MemoryMaildrop();
+    memory->messages = bodies;
+    lastMaildrop = memory;
+    maildrop.reset(memory);
+    return SUCCESS;
+  }
+};
+
+/* ----- MailStore knowing its recipients, refused at RCPT ----- */
+class CheckedStore : public MemoryStore
+{
+public:
+  RC deliverRc = SUCCESS;
+
+  bool ChecksRecipients () const override { return true; };
+  RC CheckRecipient (const std::string &recipient) override
+  {
+    return recipient == "nobody@example.com" ? PM_RECIPIENT_REFUSED : SUCCESS;
+  }
+  RC Deliver (const Envelope &envelope, std::string_view data) override
+  {
+    return deliverRc ? deliverRc : MemoryStore::Deliver(envelope, data);
+  }
+};
+
+/* ----- MailStore writing DATA blocks in chunks as they stream in ----- */
+#define TEST_CHUNK_SIZE 4096
+
+class ChunkStream : public DeliveryStream
+{
+public:
+  std::string buffer;
+  std::string &written;
+  size_t &maxBuffered;
+  std::vector<std::string> &bodies;
+
+  ChunkStream(std::string &out, size_t &max, std::vector<std::string> &delivered)
+    : written(out), maxBuffered(max), bodies(delivered) {};
+
+  RC Write (std::string_view data) override
+  {
+    buffer.append(data);
+    maxBuffered = std::max(maxBuffered, buffer.size());
+    return SUCCESS;
+  }
+  bool IsFull () const override { return buffer.size() >= TEST_CHUNK_SIZE; };
+  RC Flush () override
+  {
+    written += buffer;
+    buffer.clear();
+    return SUCCESS;
+  }
+  RC Commit () override
+  {
+    Flush();
+    bodies.push_back(written);
+    written.clear();
+    return SUCCESS;
+  }
+};
+
+class StreamStore : public MemoryStore
+{
+public:
+  std::string written;
+  size_t maxBuffered = 0;
+
+  RC OpenStream (const Envelope &, std::unique_ptr<DeliveryStream> &stream) override
+  {
+    stream.reset(new ChunkStream(written, maxBuffered, bodies));
+    return SUCCESS;
+  }
+};
+
+#endif
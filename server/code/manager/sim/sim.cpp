@@ -0,0 +1,116 @@
+/*
+ * sim.cpp
+ *
+ * This file provides the System Info Manager: the registry that finds the
+ * counters, gauges and latency histograms of every layer by name.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#include "../../basic/fileIO/fileio.h"
+#include "../../basic/socket/socket.h"
+#include "../edc/edc.h"
+#include "../uim/uim.h"
+#include "sim.h"
+
+/************ SystemInfoManager *************/
+SystemInfoManager* SystemInfoManager::instance ()
+{
+  static SystemInfoManager *sim = new SystemInfoManager();
+  return sim;
+}
+
+SystemInfoManager::SystemInfoManager()
+{
+  FileMetrics &file = GetMetrics<FileMetrics>();
+  Add("fileio.open.calls",        &file.openCalls);
+  Add("fileio.read.calls",        &file.readCalls);
+  Add("fileio.read.bytes",        &file.readBytes);
+  Add("fileio.write.calls",       &file.writeCalls);
+  Add("fileio.write.bytes",       &file.writeBytes);
+  Add("fileio.write.latency_us",  &file.writeTimes);
+
+  SocketMetrics &socket = GetMetrics<SocketMetrics>();
+  Add("socket.accepts",           &socket.accepts);
+  Add("socket.recv.calls",        &socket.recvCalls);
+  Add("socket.recv.bytes",        &socket.recvBytes);
+  Add("socket.send.calls",        &socket.sendCalls);
+  Add("socket.send.bytes",        &socket.sendBytes);
+
+  UserMetrics &user = GetMetrics<UserMetrics>();
+  Add("uim.lookup.hits",          &user.lookupHits);
+  Add("uim.lookup.misses",        &user.lookupMisses);
+  Add("uim.lookup.latency_us",    &user.lookupTimes);
+  Add("uim.login.failures",       &user.loginFailures);
+
+  CacheMetrics &cache = GetMetrics<CacheMetrics>();
+  Add("edc.cache.hits",           &cache.hits);
+  Add("edc.cache.misses",         &cache.misses);
+}
+
+Counter *SystemInfoManager::GetCounter (const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  Counter *&counter = _counters[name];
+  if (!counter) {
+    _ownCounters.emplace_back(new Counter());
+    counter = _ownCounters.back().get();
+  }
+  return counter;
+}
+
+Gauge *SystemInfoManager::GetGauge (const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  Gauge *&gauge = _gauges[name];
+  if (!gauge) {
+    _ownGauges.emplace_back(new Gauge());
+    gauge = _ownGauges.back().get();
+  }
+  return gauge;
+}
+
+Histogram *SystemInfoManager::GetHistogram (const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  Histogram *&histogram = _histograms[name];
+  if (!histogram) {
+    _ownHistograms.emplace_back(new Histogram());
+    histogram = _ownHistograms.back().get();
+  }
+  return histogram;
+}
+
+void SystemInfoManager::Add (const std::string &name, Counter *counter)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _counters.emplace(name, counter);
+}
+
+void SystemInfoManager::Add (const std::string &name, Gauge *gauge)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _gauges.emplace(name, gauge);
+}
+
+void SystemInfoManager::Add (const std::string &name, Histogram *histogram)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _histograms.emplace(name, histogram);
+}
+
+void SystemInfoManager::GetSnapshot (MetricsSnapshot &snapshot)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  snapshot.counters.clear();
+  snapshot.gauges.clear();
+  snapshot.histograms.clear();
+  for (const auto &counter : _counters)
+    snapshot.counters[counter.first] = counter.second->GetValue();
+  for (const auto &gauge : _gauges)
+    snapshot.gauges[gauge.first] = gauge.second->GetValue();
+  for (const auto &histogram : _histograms)
+    histogram.second->GetSnapshot(snapshot.histograms[histogram.first]);
+}
@@ -0,0 +1,92 @@
+#ifndef SYSTEM_INFO_MANAGER
+#define SYSTEM_INFO_MANAGER
+
+/* ----- Include libries or files ----- */
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../../util/emailError.h"
+#include "../../util/metrics.h"
+#include "../../util/util.h"
+
+/* ----- Define structs ----- */
+/**
+ * MetricsSnapshot
+ * Every metric registered, by name, as read at one time.
+ */
+struct MetricsSnapshot {
+  std::map<std::string, uint64_t> counters;
+  std::map<std::string, int64_t>  gauges;
+  std::map<std::string, HistogramSnapshot> histograms;
+};
+
+/**
+ * SystemInfoManager
+ * This class is the registry of the metrics of every layer, by dotted names,
+ * the layer first, as "socket.accepts". The modules keep their metrics
+ * themselves (util/metrics.h) without knowing the registry: it lists those
+ * of FileIO, the socket, the UIM and the EDC by name when it is made. Other
+ * metrics are registered by name when first asked for, the caller keeping
+ * the pointer: the registry only takes its lock to register and to read,
+ * never while a metric is updated. Metrics are never removed, so the
+ * pointers stay good until the end.
+ *
+ * Contained Public Functions:
+ *   SystemInfoManager* instance ()
+ *   Counter   *GetCounter   (const std::string &name)
+ *   Gauge     *GetGauge     (const std::string &name)
+ *   Histogram *GetHistogram (const std::string &name)
+ *   void Add (const std::string &name, Counter *counter)
+ *   void Add (const std::string &name, Gauge *gauge)
+ *   void Add (const std::string &name, Histogram *histogram)
+ *   void GetSnapshot (MetricsSnapshot &snapshot)
+ */
+class SystemInfoManager
+{
+public:
+  static SystemInfoManager* instance ();
+
+  /**
+   * This function will give the metric of a name, registering one the first
+   * time; a name asked for twice gives the same metric.
+   * @param  const string given as the name.
+   * @return the metric, never NULL.
+   */
+  Counter   *GetCounter   (const std::string &name);
+  Gauge     *GetGauge     (const std::string &name);
+  Histogram *GetHistogram (const std::string &name);
+
+  /**
+   * This function will register a metric kept by its module, which must
+   * live until the end. A name registered already is left as it is.
+   * @param const string given as the name.
+   *        the metric.
+   */
+  void Add (const std::string &name, Counter *counter);
+  void Add (const std::string &name, Gauge *gauge);
+  void Add (const std::string &name, Histogram *histogram);
+
+  /**
+   * This function will read every metric, summing the cells of the threads.
+   * @param MetricsSnapshot stores the values.
+   */
+  void GetSnapshot (MetricsSnapshot &snapshot);
+
+protected:
+  SystemInfoManager();       // Constructor
+  ~SystemInfoManager() {};   // Destructor
+
+private:
+  std::mutex _lock;                     // Guards the maps, not the metrics
+  std::map<std::string, Counter *>   _counters;
+  std::map<std::string, Gauge *>     _gauges;
+  std::map<std::string, Histogram *> _histograms;
+  std::vector<std::unique_ptr<Counter>>   _ownCounters;   // Registered by name, not kept by a module
+  std::vector<std::unique_ptr<Gauge>>     _ownGauges;
+  std::vector<std::unique_ptr<Histogram>> _ownHistograms;
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * unit_test_sim.cpp
+ *
+ * This file provides unit test for sim.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+#include <iostream>
+#include <thread>
+#include "unit_test_sim.h"
+using namespace std;
+
+// Every value is in a bucket at most 1/16 wider than itself, buckets in order
+static RC TestBuckets ()
+{
+  size_t last = 0;
+  for (uint64_t value = 0; value < (uint64_t(1) << 20); value += 1 + value / 64) {
+    size_t bucket = Histogram::GetBucket(value);
+    uint64_t limit = Histogram::GetBucketLimit(bucket);
+    if (bucket < last || bucket >= METRIC_BUCKETS || limit < value || limit - value > value / 16)
+      return STANDARD_ERROR;
+    if (bucket && Histogram::GetBucketLimit(bucket - 1) >= value)
+      return STANDARD_ERROR;
+    last = bucket;
+  }
+  return Histogram::GetBucket(UINT64_MAX) == METRIC_BUCKETS - 1 &&
+         Histogram::GetBucket(uint64_t(1) << METRIC_MAX_BITS) == METRIC_BUCKETS - 1 &&
+         Histogram::GetBucket((uint64_t(1) << METRIC_MAX_BITS) - 1) == METRIC_BUCKETS - 1 ? SUCCESS : STANDARD_ERROR;
+}
+
+// Threads counting at once lose nothing
+static RC TestCounters ()
+{
+  Counter counter;
+  Gauge gauge;
+  Histogram histogram;
+  vector<thread> threads;
+  for (int t = 0; t < TEST_THREADS; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < TEST_ADDS; ++i) {
+        counter.Add();
+        gauge.Add(t % 2 ? 1 : -1);
+        histogram.Record(i % 100);
+      }
+    });
+  }
+  for (thread &worker : threads)
+    worker.join();
+
+  HistogramSnapshot snapshot;
+  histogram.GetSnapshot(snapshot);
+  return counter.GetValue() == uint64_t(TEST_THREADS) * TEST_ADDS && gauge.GetValue() == 0 &&
+         snapshot.count == uint64_t(TEST_THREADS) * TEST_ADDS && snapshot.max == 99 &&
+         snapshot.sum == uint64_t(TEST_THREADS) * (TEST_ADDS / 100) * 4950 ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestPercentiles ()
+{
+  Histogram histogram;
+  HistogramSnapshot snapshot;
+  histogram.GetSnapshot(snapshot);
+  if (snapshot.count || snapshot.GetPercentile(0.5))
+    return STANDARD_ERROR;
+
+  for (uint64_t value = 1; value <= 10000; ++value)
+    histogram.Record(value);
+  histogram.GetSnapshot(snapshot);
+  uint64_t p50 = snapshot.GetPercentile(0.5), p99 = snapshot.GetPercentile(0.99);
+  if (p50 < 5000 || p50 > 5000 + 5000 / 16 || p99 < 9900 || p99 > 9900 + 9900 / 16)
+    return STANDARD_ERROR;
+  // Never past the largest value recorded
+  return snapshot.GetPercentile(1) == 10000 && snapshot.GetPercentile(0) == 1 ? SUCCESS : STANDARD_ERROR;
+}
+
+static RC TestRegistry ()
+{
+  SystemInfoManager *sim = SystemInfoManager::instance();
+  Counter *counter = sim->GetCounter("test.calls");
+  Histogram *histogram = sim->GetHistogram("test.latency");
+  if (sim->GetCounter("test.calls") != counter || sim->GetHistogram("test.latency") != histogram)
+    return STANDARD_ERROR;
+  counter->Add(3);
+  sim->GetGauge("test.level")->Set(-2);
+  {
+    LatencyTimer timer(histogram);
+    this_thread::sleep_for(chrono::milliseconds(2));
+  }
+
+  MetricsSnapshot snapshot;
+  sim->GetSnapshot(snapshot);
+  const HistogramSnapshot &latency = snapshot.histograms["test.latency"];
+  return snapshot.counters["test.calls"] == 3 && snapshot.gauges["test.level"] == -2 && latency.count == 1 &&
+         latency.max >= 2000 ? SUCCESS : STANDARD_ERROR;
+}
+
+// The metrics the basic layer keeps itself are reported by their names
+static RC TestModuleMetrics ()
+{
+  SystemInfoManager *sim = SystemInfoManager::instance();
+  GetMetrics<FileMetrics>().readBytes.Add(5);
+  GetMetrics<SocketMetrics>().accepts.Add();
+  if (sim->GetCounter("fileio.read.bytes") != &GetMetrics<FileMetrics>().readBytes)
+    return STANDARD_ERROR;
+
+  MetricsSnapshot snapshot;
+  sim->GetSnapshot(snapshot);
+  return snapshot.counters["fileio.read.bytes"] == 5 && snapshot.counters["socket.accepts"] == 1 &&
+         snapshot.counters.count("edc.cache.hits") && snapshot.histograms.count("uim.lookup.latency_us") ?
+         SUCCESS : STANDARD_ERROR;
+}
+
+int main ()
+{
+  RC rc = SUCCESS, result;
+
+  result = TestBuckets();
+  cout << "TestBuckets: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestCounters();
+  cout << "TestCounters: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestPercentiles();
+  cout << "TestPercentiles: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestRegistry();
+  cout << "TestRegistry: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestModuleMetrics();
+  cout << "TestModuleMetrics: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  return (rc);
+}
@@ -0,0 +1,21 @@
+/*
+ * unit_test_sim.h
+ *
+ * This file provides unit test for sim.cpp/h.
+ *
+ * Author(s): Yujia Li (liyj070707@gmail.com), Hang Yuan (hyuan211@gmail.com)
+ * Tester(s): -
+ *
+ */
+
+#ifndef UNIT_TEST
+#define UNIT_TEST
+
+#include "../../basic/fileIO/fileio.h"
+#include "../../basic/socket/socket.h"
+#include "sim.h"
+
+#define TEST_THREADS 16           // More than the stripes, so some threads share a cell
+#define TEST_ADDS    100000
+
+#endif
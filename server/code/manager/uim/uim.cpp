@@ -8,15 +8,41 @@
  *
  */
 
+#include <fcntl.h>
+#include <unistd.h>
 #include "uim.h"
 
 UserInfoManager* UserInfoManager::_uim = NULL;
 FileIO* UserInfoManager::_fio = NULL;
 
+/**
+ * Replays one WAL record of the UIM: every extent is written again.
+ */
+static RC RedoExtents (const std::string &path, std::string_view payload)
+{
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    return errno == ENOENT ? SUCCESS : STANDARD_ERROR;
+
+  RC rc = SUCCESS;
+  while (rc == SUCCESS && payload.size() >= sizeof(UserExtent)) {
+    UserExtent extent;
+    memcpy(&extent, payload.data(), sizeof(extent));
+    payload.remove_prefix(sizeof(extent));
+    if (payload.size() < extent.length ||
+        pwrite(fd, payload.data(), extent.length, extent.offset) != static_cast<ssize_t>(extent.length))
+      rc = STANDARD_ERROR;
+    payload.remove_prefix(std::min<size_t>(extent.length, payload.size()));
+  }
+  close(fd);
+  return rc;
+}
+
 UserInfoManager::UserInfoManager()
 {
   // Initialize the internal FileIO instance
   _fio = FileIO::instance();
+  WriteAheadLog::instance()->SetHandler(WAL_OWNER_UIM, RedoExtents);
 }
 
 UserInfoManager* UserInfoManager::instance()
@@ -42,15 +68,19 @@ RC UserInfoManager::CreateUser (const UserInfo &userInfo)
 
   // Add user into the user database
   offset = CheckEmptySpace();
-  if (offset) { // true(not ZERO) means there is availiable space to store
-    _fio->WriteFile(offset, sizeof(UserInfo), &userInfo);
-  } else { // false(ZERO) means need to append the user info
-    _fio->AppendFile(sizeof(UserInfo), &userInfo);
-  }
+  if (!offset) // false(ZERO) means need to append the user info
+    offset = _fio->GetFileSize();
 
-  // Increase the header by ONE
+  // The user and the header increased by ONE change together
+  UserInfoHeader header;
+  header.totalUserNumber = _totalUserNumber + ONE;
+  std::string extents;
+  AddExtent(extents, offset, sizeof(UserInfo), &userInfo);
+  AddExtent(extents, ZERO, sizeof(UserInfoHeader), &header);
+  rc = WriteExtents(extents);
+  if (rc)
+    return STANDARD_ERROR;
   ++_totalUserNumber;
-  SetUserNumber();
 
   return SUCCESS;
 }
@@ -66,23 +96,26 @@ RC UserInfoManager::CloseUser  (const UserInfo &userInfo)
   unsigned offset = ObatinUserOffset(userInfo);
   if (offset) { // true(not ZERO) means found the user
     // Move the following user info towards ahead to cover the one need to be closed
-    unsigned moveBlockSize = sizeof(UserInfoHeader) + (_totalUserNumber - ONE) * sizeof(UserInfo);
-    void* moveBlock = malloc(moveBlockSize);
-    rc = _fio->ReadFile(offset + sizeof(UserInfo), moveBlockSize, moveBlock);
-    if (rc) {
-      free(moveBlock);
-      return STANDARD_ERROR;
-    }
-    rc = _fio->WriteFile(offset, moveBlockSize, moveBlock);
-    if (rc) {
-      free(moveBlock);
-      return STANDARD_ERROR;
+    unsigned usedSpace = sizeof(UserInfoHeader) + _totalUserNumber * sizeof(UserInfo);
+    unsigned moveBlockSize = usedSpace - offset - sizeof(UserInfo);
+    std::string moveBlock(moveBlockSize, '\0');
+    if (moveBlockSize) {
+      rc = _fio->ReadFile(offset + sizeof(UserInfo), moveBlockSize, &moveBlock[0]);
+      if (rc)
+        return STANDARD_ERROR;
     }
-    free(moveBlock);
 
-    // Increase the totalUserNumber in the header
-    ++_totalUserNumber;
-    SetUserNumber();
+    // The shifted users and the decreased header are logged as one change, a
+    // crash half way through the rewrite is repaired at the next start
+    UserInfoHeader header;
+    header.totalUserNumber = _totalUserNumber - ONE;
+    std::string extents;
+    AddExtent(extents, offset, moveBlockSize, moveBlock.data());
+    AddExtent(extents, ZERO, sizeof(UserInfoHeader), &header);
+    rc = WriteExtents(extents);
+    if (rc)
+      return STANDARD_ERROR;
+    --_totalUserNumber;
   } else { // false(ZERO) means the user not found
     return USER_NOT_EXISTS;
   }
@@ -141,8 +174,10 @@ RC UserInfoManager::Login      (const UserInfo &userInfo)
     _fio->ReadFile(offset, sizeof(UserInfo), &compare_userInfo);
 
     // Compare the password field to verify the identity
-    if (strcmp(compare_userInfo.password, userInfo.password) != ZERO)
+    if (strcmp(compare_userInfo.password, userInfo.password) != ZERO) {
+      GetMetrics<UserMetrics>().loginFailures.Add();
       return STANDARD_ERROR;
+    }
 
     // Update the lastLoginTime
     time_t timer;
@@ -155,6 +190,10 @@ RC UserInfoManager::Login      (const UserInfo &userInfo)
     return USER_NOT_EXISTS;
   }
 
+  // STAT, LIST and RETR of the newest messages usually come next
+  if (_onLogin)
+    _onLogin(userInfo);
+
   return SUCCESS;
 }
 
@@ -182,6 +221,16 @@ RC UserInfoManager::Logout     (const UserInfo &userInfo)
   return SUCCESS;
 }
 
+std::string UserInfoManager::GetMailboxPath (const UserInfo &userInfo)
+{
+  std::string username(userInfo.username, strnlen(userInfo.username, USERNAME_MAX_LANGTH));
+  std::string domainName(userInfo.domainName, strnlen(userInfo.domainName, DOMAIN_NAME_MAX_LENGTH));
+  std::string path(strlen(DATAPATH) + domainName.size() + username.size() + 3, '\0');
+  snprintf(&path[0], path.size(), MAILBOX_PATH_FORMAT, DATAPATH, domainName.c_str(), username.c_str());
+  path.pop_back();
+  return path;
+}
+
 /************ Helper Functions *************/
 void UserInfoManager::GetUserNumber ()
 {
@@ -202,15 +251,18 @@ unsigned UserInfoManager::ObatinUserOffset (const UserInfo &userInfo)
 {
   unsigned offset = sizeof(UserInfoHeader);
   UserInfo compare_userInfo;
+  LatencyTimer timer(&GetMetrics<UserMetrics>().lookupTimes);
 
   // Traverse and compare each username with the given userInfo's username
   for (size_t i = ZERO; i < _totalUserNumber; ++i) {
     _fio->ReadFile(offset, sizeof(UserInfo), &compare_userInfo);
     if (strcmp(userInfo.username, compare_userInfo.username) == 0) {
+      GetMetrics<UserMetrics>().lookupHits.Add();
       return offset;
     }
     offset += sizeof(UserInfo);
   }
+  GetMetrics<UserMetrics>().lookupMisses.Add();
   return ZERO;
 }
 
@@ -233,21 +285,25 @@ RC UserInfoManager::SetUserFilePath (const UserInfo &userInfo)
   sprintf(dataPath, USER_FILE_PATH_FORMAT, DATAPATH, userInfo.domainName);
   std::string path = std::string(dataPath);
   free(dataPath);
+  _userFilePath = path;
 
   // Open the file. If the file not exists, create it
   _fio = FileIO::instance();
   if (_fio == NULL)
     return STANDARD_ERROR;
+  // FileIO holds one file at a time, maybe the user file of another domain
+  _fio->CloseFile();
   rc = _fio->OpenFile(path);
   if (rc) { // Means failed to open: no such file. Create it.
-    // Create the domainName folder
+    // Create the domainName folder, there already if only the file is missing
     std::string dir = std::string(DATAPATH) + std::string(userInfo.domainName);
-    rc = _fio->CreateDir(dir);
-    if (rc)
-      return STANDARD_ERROR;
+    _fio->CreateDir(dir);
 
     // Create the user info file
     rc = _fio->CreateFile(path);
+    if (rc)
+      return STANDARD_ERROR;
+    rc = _fio->OpenFile(path);
     if (rc)
       return STANDARD_ERROR;
 
@@ -260,3 +316,28 @@ RC UserInfoManager::SetUserFilePath (const UserInfo &userInfo)
   GetUserNumber();
   return SUCCESS;
 }
+
+RC UserInfoManager::WriteExtents (const std::string &extents)
+{
+  return WriteAheadLog::instance()->Write(WAL_OWNER_UIM, _userFilePath, extents, [this, &extents] {
+    std::string_view rest = extents;
+    while (rest.size() >= sizeof(UserExtent)) {
+      UserExtent extent;
+      memcpy(&extent, rest.data(), sizeof(extent));
+      rest.remove_prefix(sizeof(extent));
+      if (extent.length && _fio->WriteFile(extent.offset, extent.length, rest.data()))
+        return STANDARD_ERROR;
+      rest.remove_prefix(extent.length);
+    }
+    return SUCCESS;
+  });
+}
+
+void UserInfoManager::AddExtent (std::string &extents, size_t offset, size_t length, const void *data)
+{
+  UserExtent extent;
+  extent.offset = offset;
+  extent.length = length;
+  extents.append(reinterpret_cast<const char *>(&extent), sizeof(extent));
+  extents.append(static_cast<const char *>(data), length);
+}
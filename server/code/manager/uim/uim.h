@@ -3,11 +3,15 @@
 
 /* ----- Include libries or files ----- */
 #include <cstring>
+#include <functional>
 #include <stdlib.h>
 #include <string>
+#include <string_view>
 #include <time.h>
 #include "../../util/emailError.h"
 #include "../../basic/fileIO/fileio.h"
+#include "../../basic/wal/wal.h"
+#include "../../util/metrics.h"
 #include "../../util/util.h"
 
 /* ----- Define macros ----- */
@@ -24,12 +28,24 @@ enum {
 #define PASSWORD_MAX_LENGTH       16
 #define USER_FILE_PATH_MAX_LENGTH 40 // DATAPATH(14)+domainName(15)+(10)+extra(1)
 const char USER_FILE_PATH_FORMAT[] = "%s%s/user.data"; // DATAPATH/domainName/user.data
+const char MAILBOX_PATH_FORMAT[]   = "%s%s/%s/";       // DATAPATH/domainName/username/
 
 /* ----- Define structs ----- */
 struct UserInfoHeader {
   unsigned totalUserNumber;
 };
 
+/**
+ * UserExtent
+ * The payload of a WAL record of the UIM is a list of extents, each one of
+ * these followed by its bytes. The extents of one record are replayed
+ * together, so a change spanning several places of the file is atomic.
+ */
+struct UserExtent {
+  uint64_t offset;
+  uint64_t length;
+};
+
 struct UserInfo {
   char username  [USERNAME_MAX_LANGTH];      // Example: user
   char domainName[DOMAIN_NAME_MAX_LENGTH];   // Example: @example.com
@@ -38,9 +54,21 @@ struct UserInfo {
   time_t lastLogoutTime;
 };
 
+// Reported by the System Info Manager as uim.*
+struct UserMetrics {
+  Counter lookupHits;
+  Counter lookupMisses;
+  Counter loginFailures;
+  Histogram lookupTimes;      // Microseconds
+};
+
 /**
  * UserInfoManager
  * This class contains all interfaces that will be used to manage the user info.
+ * Changes writing more than one place of the user file (CreateUser and the
+ * shifting rewrite of CloseUser) go through the WriteAheadLog.
+ * A successful Login calls the login callback, which a POP3 server uses to
+ * make the mailbox warm while the client is still sending its next command.
  *
  * Contained Public Functions:
  *   UserInfoManager* instance ()
@@ -50,6 +78,8 @@ struct UserInfo {
  *   RC UpdateUser (const UserInfo &userInfo)
  *   RC Login      (const UserInfo &userInfo)
  *   RC Logout     (const UserInfo &userInfo)
+ *   void SetLoginCallback (std::function<void(const UserInfo &)> callback)
+ *   std::string GetMailboxPath (const UserInfo &userInfo)
  */
 
 class UserInfoManager
@@ -117,6 +147,20 @@ public:
    */
   RC Logout     (const UserInfo &userInfo);
 
+  /**
+   * This function will set what is called after every successful Login. It
+   * is called in the thread of Login and must not block.
+   * @param function given as the callback, given the user logged in.
+   */
+  void SetLoginCallback (std::function<void(const UserInfo &)> callback) { _onLogin = std::move(callback); };
+
+  /**
+   * This function will give the directory of the mailbox of a user.
+   * @param UserInfo indicates which user.
+   * @return string as the path, DATAPATH/domainName/username/.
+   */
+  static std::string GetMailboxPath (const UserInfo &userInfo);
+
 protected:
   UserInfoManager();      // Constructor
   ~UserInfoManager() {};  // Destructor
@@ -126,6 +170,8 @@ private:
   static FileIO *_fio; // Pointer of FileIO class
 
   unsigned _totalUserNumber;
+  std::string _userFilePath;       // User file of the domain set by SetUserFilePath()
+  std::function<void(const UserInfo &)> _onLogin;
 
   // Private helper functions
   /**
@@ -162,6 +208,19 @@ private:
    */
   RC SetUserFilePath (const UserInfo &userInfo);
 
+  /**
+   * This function will log the extents and write them to the user file.
+   * @param string given as the extents, made with AddExtent().
+   * @return SUCCESS if all extents are written.
+   *         STANDARD_ERROR otherwise.
+   */
+  RC WriteExtents (const std::string &extents);
+
+  /**
+   * This function will add one extent for WriteExtents().
+   */
+  void AddExtent (std::string &extents, size_t offset, size_t length, const void *data);
+
 };
 
 #endif
@@ -7,9 +7,155 @@
  * Tester(s): -
  *
  */
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include "unit_test_uim.h"
+using namespace std;
+
+static UserInfo GetUser (const string &name)
+{
+  UserInfo userInfo = {};
+  strncpy(userInfo.username, name.c_str(), USERNAME_MAX_LANGTH - 1);
+  strncpy(userInfo.domainName, TEST_DOMAIN, DOMAIN_NAME_MAX_LENGTH - 1);
+  strncpy(userInfo.password, "secret", PASSWORD_MAX_LENGTH - 1);
+  return userInfo;
+}
+
+static string GetUserFile ()
+{
+  return string(DATAPATH) + TEST_DOMAIN + "/user.data";
+}
+
+// The domain with the users given, and the log open
+static RC MakeDomain (const vector<string> &names)
+{
+  if (system((string("rm -rf ") + TEST_LOG + " " + DATAPATH + TEST_DOMAIN).c_str())) {}
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  if (wal->Open(TEST_LOG) || wal->Recover())
+    return STANDARD_ERROR;
+  for (const string &name : names) {
+    if (UserInfoManager::instance()->CreateUser(GetUser(name)))
+      return STANDARD_ERROR;
+  }
+  return SUCCESS;
+}
+
+static string ReadUserFile ()
+{
+  ifstream file(GetUserFile(), ios::binary);
+  ostringstream bytes;
+  bytes << file.rdbuf();
+  return bytes.str();
+}
+
+static RC WriteUserFile (const string &bytes)
+{
+  ofstream file(GetUserFile(), ios::binary | ios::trunc);
+  file.write(bytes.data(), bytes.size());
+  return file.good() ? SUCCESS : STANDARD_ERROR;
+}
+
+static unsigned GetUserNumber ()
+{
+  UserInfoHeader header = {};
+  string bytes = ReadUserFile();
+  if (bytes.size() >= sizeof(header))
+    memcpy(&header, bytes.data(), sizeof(header));
+  return header.totalUserNumber;
+}
+
+// Whether every user given is there and nobody else
+static bool HasUsers (const vector<string> &names)
+{
+  for (const string &name : names) {
+    UserInfo userInfo = GetUser(name);
+    if (UserInfoManager::instance()->ReadUser(userInfo))
+      return false;
+  }
+  return GetUserNumber() == names.size();
+}
+
+// The restart after a crash: the log is replayed
+static RC Restart ()
+{
+  WriteAheadLog *wal = WriteAheadLog::instance();
+  wal->Close();
+  return wal->Open(TEST_LOG) || wal->Recover() ? STANDARD_ERROR : SUCCESS;
+}
+
+// A user logged but never written to the user file is there after the restart
+static RC TestRedoCreate ()
+{
+  if (MakeDomain({"bob"}))
+    return STANDARD_ERROR;
+  string before = ReadUserFile();
+  UserInfo alice = GetUser("alice");
+  if (UserInfoManager::instance()->CreateUser(alice) || !HasUsers({"bob", "alice"}))
+    return STANDARD_ERROR;
+
+  // The crash: the record is on the disk, the user file as it was
+  if (WriteUserFile(before) || UserInfoManager::instance()->ReadUser(alice) != USER_NOT_EXISTS ||
+      Restart() || !HasUsers({"bob", "alice"}))
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Closing a user moves the ones after it and the header as one change
+static RC TestRedoClose ()
+{
+  if (MakeDomain({"bob", "carol", "dave"}))
+    return STANDARD_ERROR;
+  string before = ReadUserFile();
+  if (UserInfoManager::instance()->CloseUser(GetUser("bob")) || !HasUsers({"carol", "dave"}))
+    return STANDARD_ERROR;
+
+  // The crash half way through the rewrite: the new header, the old users,
+  // so dave is out of the count and bob is still listed
+  string torn = before;
+  string after = ReadUserFile();
+  torn.replace(0, sizeof(UserInfoHeader), after, 0, sizeof(UserInfoHeader));
+  UserInfo bob = GetUser("bob"), dave = GetUser("dave");
+  if (WriteUserFile(torn) || UserInfoManager::instance()->ReadUser(bob) ||
+      UserInfoManager::instance()->ReadUser(dave) != USER_NOT_EXISTS)
+    return STANDARD_ERROR;
+
+  if (Restart() || !HasUsers({"carol", "dave"}) || UserInfoManager::instance()->ReadUser(bob) != USER_NOT_EXISTS)
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
+
+// Without the log a change is written as before and nothing is replayed
+static RC TestWithoutLog ()
+{
+  if (MakeDomain({"bob"}))
+    return STANDARD_ERROR;
+  WriteAheadLog::instance()->Close();
+  string before = ReadUserFile();
+  if (UserInfoManager::instance()->CreateUser(GetUser("alice")) || !HasUsers({"bob", "alice"}) ||
+      WriteUserFile(before) || Restart() || !HasUsers({"bob"}))
+    return STANDARD_ERROR;
+  return SUCCESS;
+}
 
 int main () {
+  RC rc = SUCCESS;
+  RC result;
+
+  result = TestRedoCreate();
+  cout << "TestRedoCreate: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestRedoClose();
+  cout << "TestRedoClose: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
+
+  result = TestWithoutLog();
+  cout << "TestWithoutLog: " << (result ? "FAIL" : "PASS") << endl;
+  rc |= result;
 
-  return (0);
+  WriteAheadLog::instance()->Close();
+  if (system((string("rm -rf ") + TEST_LOG + " " + DATAPATH + TEST_DOMAIN).c_str())) {}
+  return (rc);
 }
@@ -13,4 +13,7 @@
 
 #include "uim.h"
 
+const char TEST_DOMAIN[] = "uim.test";                  // Its users are under DATAPATH, made again by every test
+const char TEST_LOG[]    = "unit_test_uim.wal/";
+
 #endif
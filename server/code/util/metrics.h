@@ -0,0 +1,259 @@
+/*
+ * metrics.h
+ *
+ * This file provides the counters, gauges and latency histograms every layer
+ * keeps about itself, updated without a lock. The System Info Manager
+ * (manager/sim) finds them by name and reports them.
+ *
+ * Author: Yujia Li(liyj070707@gmail.com), Hang Yuan(hyuan211@gmail.com)
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define METRIC_CACHE_LINE   64              // Bytes of a cache line, what every cell is padded to
+#define METRIC_STRIPES      8               // Cells of a metric, threads share one only past this many
+#define METRIC_SUB_BITS     4               // 16 buckets for every power of two: under 6.25% error
+#define METRIC_MAX_BITS     40              // Values from 2^40 up share the last bucket
+#define METRIC_BUCKETS      ((METRIC_MAX_BITS - METRIC_SUB_BITS + 1) << METRIC_SUB_BITS)
+
+/**
+ * This function will give the metrics of a module: a struct of Counters,
+ * Gauges and Histograms, made the first time it is asked for, so the
+ * constructors of other statics may already count.
+ * @return the metrics, the same every time.
+ */
+template <class Metrics>
+inline Metrics &GetMetrics ()
+{
+  static Metrics metrics;
+  return metrics;
+}
+
+/**
+ * This function will give the cell the calling thread updates: threads get
+ * one each in turn the first time they ask, so up to METRIC_STRIPES threads
+ * never write to the cache line of another.
+ * @return size_t as the cell, below METRIC_STRIPES.
+ */
+inline size_t GetStripe ()
+{
+  static std::atomic<size_t> next(0);
+  thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % METRIC_STRIPES;
+  return stripe;
+}
+
+/**
+ * Counter
+ * This class counts events that only go up, as calls and bytes. Every thread
+ * adds to its own cell with a relaxed atomic add, so counting takes no lock
+ * and two threads never fight for a cache line; the cells are summed when the
+ * value is read.
+ *
+ * Contained Public Functions:
+ *   void Add (uint64_t value = 1)
+ *   uint64_t GetValue ()
+ */
+class Counter
+{
+public:
+  Counter() : _cells() {};
+
+  void Add (uint64_t value = 1) { _cells[GetStripe()].value.fetch_add(value, std::memory_order_relaxed); };
+
+  uint64_t GetValue () const
+  {
+    uint64_t value = 0;
+    for (const Cell &cell : _cells)
+      value += cell.value.load(std::memory_order_relaxed);
+    return value;
+  };
+
+private:
+  struct alignas(METRIC_CACHE_LINE) Cell {
+    std::atomic<uint64_t> value;
+  };
+  Cell _cells[METRIC_STRIPES];
+};
+
+/**
+ * Gauge
+ * This class holds a level that goes up and down, as open connections. It is
+ * one atomic on a cache line of its own; a level changes far less often than
+ * counters count.
+ *
+ * Contained Public Functions:
+ *   void Set (int64_t value)
+ *   void Add (int64_t value)
+ *   int64_t GetValue ()
+ */
+class alignas(METRIC_CACHE_LINE) Gauge
+{
+public:
+  Gauge() : _value(0) {};
+
+  void Set (int64_t value) { _value.store(value, std::memory_order_relaxed); };
+  void Add (int64_t value) { _value.fetch_add(value, std::memory_order_relaxed); };
+  int64_t GetValue () const { return _value.load(std::memory_order_relaxed); };
+
+private:
+  std::atomic<int64_t> _value;
+};
+
+struct HistogramSnapshot;
+
+/**
+ * Histogram
+ * This class records the spread of values, latencies in microseconds mostly,
+ * the way HdrHistogram does: values below 2^(METRIC_SUB_BITS + 1) have a
+ * bucket each, every power of two above is cut into 2^METRIC_SUB_BITS
+ * buckets, so a bucket is never wider than 1/16 of its values however large
+ * they are. Recording finds the bucket with one count of leading zeros and
+ * adds to the cell of the thread, without a lock.
+ *
+ * Contained Public Functions:
+ *   void Record (uint64_t value)
+ *   void GetSnapshot (HistogramSnapshot &snapshot)
+ *   static size_t   GetBucket      (uint64_t value)
+ *   static uint64_t GetBucketLimit (size_t bucket)
+ */
+class Histogram
+{
+public:
+  Histogram() : _cells() {};
+
+  void Record (uint64_t value)
+  {
+    Cell &cell = _cells[GetStripe()];
+    cell.buckets[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+    cell.sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = cell.max.load(std::memory_order_relaxed);
+    while (value > max && !cell.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+  };
+
+  inline void GetSnapshot (HistogramSnapshot &snapshot) const;
+
+  /**
+   * This function will give the bucket of a value.
+   * @return size_t as the bucket, below METRIC_BUCKETS.
+   */
+  static size_t GetBucket (uint64_t value)
+  {
+    if (value < (2u << METRIC_SUB_BITS))
+      return value;
+    if (value >> METRIC_MAX_BITS)
+      return METRIC_BUCKETS - 1;
+    // The highest bits of the value: its power of two and which part of it
+    unsigned shift = 63 - __builtin_clzll(value) - METRIC_SUB_BITS;
+    return (static_cast<size_t>(shift) << METRIC_SUB_BITS) + (value >> shift);
+  };
+
+  /**
+   * This function will give the highest value of a bucket.
+   * @return uint64_t as the value.
+   */
+  static uint64_t GetBucketLimit (size_t bucket)
+  {
+    if (bucket < (2u << METRIC_SUB_BITS))
+      return bucket;
+    unsigned shift = (bucket >> METRIC_SUB_BITS) - 1;
+    uint64_t top   = bucket - (static_cast<uint64_t>(shift) << METRIC_SUB_BITS);
+    return ((top + 1) << shift) - 1;
+  };
+
+private:
+  struct alignas(METRIC_CACHE_LINE) Cell {
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+    std::atomic<uint64_t> buckets[METRIC_BUCKETS];
+  };
+  Cell _cells[METRIC_STRIPES];
+};
+
+/**
+ * HistogramSnapshot
+ * What a Histogram held when it was read, its cells summed.
+ */
+struct HistogramSnapshot {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  std::vector<uint64_t> buckets;        // METRIC_BUCKETS of them, see Histogram
+
+  /**
+   * This function will give the value a fraction of the values are at or
+   * below, as the highest value of its bucket, so never less than it.
+   * @param  double given as the fraction, 0.99 for the 99th percentile.
+   * @return uint64_t as the value, 0 without values.
+   */
+  uint64_t GetPercentile (double fraction) const
+  {
+    if (!count)
+      return 0;
+    // The rank of the value wanted, from 1
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+      seen += buckets[bucket];
+      if (seen >= std::min(rank, count))
+        return std::min(Histogram::GetBucketLimit(bucket), max);
+    }
+    return max;
+  };
+};
+
+inline void Histogram::GetSnapshot (HistogramSnapshot &snapshot) const
+{
+  snapshot.count = snapshot.sum = snapshot.max = 0;
+  snapshot.buckets.assign(METRIC_BUCKETS, 0);
+  for (const Cell &cell : _cells) {
+    snapshot.sum += cell.sum.load(std::memory_order_relaxed);
+    snapshot.max  = std::max(snapshot.max, cell.max.load(std::memory_order_relaxed));
+    for (size_t bucket = 0; bucket < METRIC_BUCKETS; ++bucket)
+      snapshot.buckets[bucket] += cell.buckets[bucket].load(std::memory_order_relaxed);
+  }
+  // Counted from the buckets, so the percentiles always add up
+  for (uint64_t number : snapshot.buckets)
+    snapshot.count += number;
+}
+
+/**
+ * LatencyTimer
+ * This class records into a Histogram the microseconds from its creation to
+ * its end, or to Stop().
+ */
+class LatencyTimer
+{
+public:
+  explicit LatencyTimer(Histogram *histogram)
+    : _histogram(histogram),
+      _start(std::chrono::steady_clock::now())
+  {
+  };
+  ~LatencyTimer() { Stop(); };
+
+  LatencyTimer(const LatencyTimer &) = delete;
+  LatencyTimer &operator=(const LatencyTimer &) = delete;
+
+  void Stop ()
+  {
+    if (!_histogram)
+      return;
+    _histogram->Record(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - _start).count());
+    _histogram = NULL;
+  };
+
+private:
+  Histogram *_histogram;                // NULL once recorded
+  std::chrono::steady_clock::time_point _start;
+};
+
+#endif /* metrics.h */
@@ -0,0 +1,115 @@
+/*
+ * periodic.h
+ *
+ * This file provides the background thread of the modules that do their work
+ * every few seconds: the Compactor, the Prefetcher, the SearchMerger and the
+ * StatsWriter.
+ *
+ * Author: Yujia Li(liyj070707@gmail.com), Hang Yuan(hyuan211@gmail.com)
+ */
+
+#ifndef PERIODIC_H
+#define PERIODIC_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * PeriodicThread
+ * This class runs a piece of work on a thread of its own, at once and then
+ * every interval, or sooner when woken up. Stop() wakes it and waits for the
+ * work in progress; the work may check IsStopping() to give up early, or
+ * sleep with WaitUntil(), which returns at once when the thread stops.
+ *
+ * Contained Public Functions:
+ *   void Start (Clock::duration interval, std::function<void()> work)
+ *   void Stop  ()
+ *   void Wake  ()
+ *   bool WaitUntil  (Clock::time_point due)
+ *   bool IsStopping ()
+ */
+class PeriodicThread
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  PeriodicThread() : _stopping(false), _woken(false) {};
+  ~PeriodicThread() { Stop(); };
+
+  PeriodicThread(const PeriodicThread &) = delete;
+  PeriodicThread &operator=(const PeriodicThread &) = delete;
+
+  /**
+   * This function will start the thread.
+   * @param Clock::duration given as the time between two runs.
+   *        function given as the work.
+   */
+  void Start (Clock::duration interval, std::function<void()> work)
+  {
+    _stopping = false;
+    _woken    = false;
+    _thread = std::thread([this, interval, work = std::move(work)] {
+      std::unique_lock<std::mutex> lock(_lock);
+      while (!_stopping) {
+        _woken = false;
+        lock.unlock();
+        work();
+        lock.lock();
+        _wake.wait_for(lock, interval, [this] { return _stopping || _woken; });
+      }
+    });
+  };
+
+  /**
+   * This function will stop the thread and wait for it.
+   */
+  void Stop ()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _stopping = true;
+    }
+    _wake.notify_all();
+    if (_thread.joinable())
+      _thread.join();
+  };
+
+  /**
+   * This function will run the work again without waiting for the interval.
+   */
+  void Wake ()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _woken = true;
+    }
+    _wake.notify_all();
+  };
+
+  /**
+   * This function will sleep until the given time or until the thread stops.
+   * @param  Clock::time_point given as the time to wake up.
+   * @return true to go on, false if the thread is stopping.
+   */
+  bool WaitUntil (Clock::time_point due)
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    _wake.wait_until(lock, due, [this] { return _stopping.load(); });
+    return !_stopping;
+  };
+
+  bool IsStopping () const { return _stopping; };
+
+private:
+  std::thread _thread;
+  std::mutex _lock;                   // Taken to change the flags below
+  std::condition_variable _wake;
+  std::atomic<bool> _stopping;
+  bool _woken;                        // Wake() since the work last started
+};
+
+#endif /* periodic.h */